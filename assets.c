@@ -0,0 +1,186 @@
+/*
+        Smokey and the bandit attract screen assets on the SD card.
+
+        This program is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        This program is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// With SD_ASSETS the logo maps and the coors can are read from
+// SMOKEY.PAK in the root of the SD card (written by tools/mkassets).
+// Loads only happen while the screen is faded out and the sprites are
+// off, so the last 8 RAM tiles double as the sector buffer and the
+// first ones can hold the tiles of a small picture.
+//
+//   SD_ASSETS 0  flash only, the default
+//   SD_ASSETS 1  SD card first, the flash copies are the fallback
+//   SD_ASSETS 2  SD card only, the flash copies are left out of the
+//                data headers and the pictures stay blank without a card
+//
+// SMOKEY.PAK, little endian:
+//   "SMKY", count, count x u32 offset of each asset
+//   map:   width, height, RLE of the width*height tile numbers
+//   tiles: count, RLE of the count*64 pixels
+// RLE: c<128 is followed by c+1 literal bytes, c>=128 by one byte
+// repeated c-125 times.
+//
+// The ids and the formats must match tools/mkassets.c.
+//
+#define ASSET_SBL_1             0
+#define ASSET_SBL_2             1
+#define ASSET_SABL_1            2
+#define ASSET_SABL_2            3
+#define ASSET_COORS_MAP         4       // RAM tile numbers, see transitionScreen
+#define ASSET_COORS_TILES       5
+#define ASSET_COUNT             6
+
+#if SD_ASSETS == 0
+
+#define InitAssets()
+#define LoadAssetMap(x, y, id, base)    false
+#define LoadAssetTiles(id, first)       false
+#define DrawAssetMap(x, y, id, map)     DrawMap2(x, y, map)
+
+#else
+
+#if SD_ASSETS == 2
+#define sbl_1           NULL
+#define sbl_2           NULL
+#define sabl_1          NULL
+#define sabl_2          NULL
+#define coors_can_map   NULL
+#define coorsCan        font4_tileset
+#define COORSCAN_SIZE   0
+#endif
+
+#define ASSET_BUFFER_TILE       (RAM_TILES_COUNT - 8)
+#define ASSET_BUFFER            (ram_tiles + ASSET_BUFFER_TILE * 64)
+
+extern unsigned char ram_tiles[];
+
+FatFile assetFile;
+bool assetsReady;
+bool assetError;
+u8 assetRun;                    // bytes left in the current RLE run
+bool assetRepeat;
+u8 assetValue;
+
+void InitAssets()
+{
+        assetsReady = InitFat(ASSET_BUFFER) == 0 &&
+                FatMount() == FAT_ERROR_NONE &&
+                FatOpen(&assetFile, "SMOKEY.PAK") == FAT_ERROR_NONE;
+}
+
+static u8 AssetReadByte()
+{
+        long sector;
+
+        if ((assetFile.position & 511) == 0) {
+                sector = FatFileSector(&assetFile);
+                if (sector < 0 || mmc_readsector(sector) != 0) {
+                        assetError = true;
+                        return 0;
+                }
+        }
+        return ASSET_BUFFER[assetFile.position++ & 511];
+}
+
+static u8 AssetUnpackByte()
+{
+        if (assetRun == 0) {
+                assetValue = AssetReadByte();
+                assetRepeat = assetValue >= 128;
+                assetRun = assetRepeat ? assetValue - 125 : assetValue + 1;
+                if (assetRepeat) assetValue = AssetReadByte();
+        }
+        assetRun--;
+        return assetRepeat ? assetValue : AssetReadByte();
+}
+
+//
+// A position inside a sector needs its sector in the buffer first
+//
+
+static bool AssetSeek(u32 position)
+{
+        if (FatSeek(&assetFile, position & ~511UL) != FAT_ERROR_NONE) return false;
+        AssetReadByte();
+        assetFile.position = position;
+        return !assetError;
+}
+
+//
+// Seeks to an asset. The sectors are read again, the sprites may have
+// used the buffer since the last load.
+//
+
+static bool AssetOpen(u8 id)
+{
+        u32 offset = 0;
+        u8 i;
+
+        if (!assetsReady) return false;
+
+        mmc_invalidate();
+        assetError = false;
+        assetRun = 0;
+        if (!AssetSeek(5 + id * 4)) return false;
+        for (i = 0; i < 32; i += 8) offset |= (u32)AssetReadByte() << i;
+        return AssetSeek(offset);
+}
+
+//
+// Draws a map, base is added to the tile numbers like DrawMap2() adds
+// RAM_TILES_COUNT, or 0 when the map uses RAM tiles.
+//
+
+bool LoadAssetMap(u8 x, u8 y, u8 id, u8 base)
+{
+        u8 width, height, dx, dy;
+
+        if (!AssetOpen(id)) return false;
+        width = AssetReadByte();
+        height = AssetReadByte();
+        for (dy = 0; dy < height; dy++) {
+                for (dx = 0; dx < width; dx++) {
+                        vram[(y + dy) * VRAM_TILES_H + x + dx] = AssetUnpackByte() + base;
+                }
+        }
+        return !assetError;
+}
+
+//
+// Loads a tile set into the RAM tiles from first on, the buffer tiles
+// can't be used.
+//
+
+bool LoadAssetTiles(u8 id, u8 first)
+{
+        u8 *dest = ram_tiles + first * 64;
+        u16 size;
+
+        if (!AssetOpen(id)) return false;
+        size = AssetReadByte() * 64;
+        if (first * 64 + size > ASSET_BUFFER_TILE * 64) return false;
+        while (size-- != 0) *dest++ = AssetUnpackByte();
+        return !assetError;
+}
+
+void DrawAssetMap(u8 x, u8 y, u8 id, const char *map)
+{
+        if (LoadAssetMap(x, y, id, RAM_TILES_COUNT)) return;
+        if (map != NULL) DrawMap2(x, y, map);
+}
+
+#endif
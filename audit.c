@@ -0,0 +1,139 @@
+/*
+        Smokey and the bandit operator audit counters.
+
+        This program is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        This program is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// The counters live in RAM and are saved by FlushAudit() at the start
+// of the attract mode, only when something changed. The kernel only
+// writes the EEPROM bytes that differ, so a flush after one game
+// touches a handful of bytes of the block. The block uses the same
+// CRC8 as the high score journal, a bad CRC resets the counters.
+//
+#define AUDIT_EEPROM_ID         (SMOKEY_EEPROM_ID | (0x10 << 8))
+#define AUDIT_HISTOGRAM_BUCKETS 7
+
+// upper bounds of the score histogram buckets, the last one is open
+const u16 auditBuckets[AUDIT_HISTOGRAM_BUCKETS - 1] PROGMEM = {
+        1000, 2000, 5000, 10000, 20000, 50000
+};
+
+struct AuditCounters {
+        u16 coins;
+        u16 starts1P;
+        u16 starts2P;
+        u16 players;            // player games finished
+        u16 stageSum;           // sum of the stages reached, for the average
+        u32 playSeconds;
+        u16 scores[AUDIT_HISTOGRAM_BUCKETS];
+};                              // 28 bytes, data[HS_CRC] holds the CRC
+
+struct EepromBlockStruct auditBlock;
+struct AuditCounters *audit = (struct AuditCounters *)auditBlock.data;
+volatile u8 auditFrames;        // frames of the second being played
+volatile u16 auditSeconds;      // play seconds counted by the vsync
+u16 auditSecondsSaved;          // auditSeconds already in playSeconds
+volatile bool auditPlaying;
+bool auditDirty;
+
+//
+// Counts the play time, post vsync callback. Whole seconds go to
+// auditSeconds, which only the vsync writes, so the main program reads
+// it without disabling interrupts.
+//
+
+void AuditVsync()
+{
+        if (!auditPlaying) return;
+        if (++auditFrames == 60) {
+                auditFrames = 0;
+                auditSeconds++;
+        }
+}
+
+//
+// Play seconds not yet added to playSeconds
+//
+
+u16 AuditUnsavedSeconds()
+{
+        u16 seconds;
+
+        // the vsync may carry between the two bytes, read until it holds
+        do seconds = auditSeconds; while (seconds != auditSeconds);
+        return seconds - auditSecondsSaved;
+}
+
+void InitAudit()
+{
+        if (EepromReadBlock(AUDIT_EEPROM_ID, &auditBlock) != 0 ||
+                HighScoreCrc(&auditBlock) != auditBlock.data[HS_CRC]) {
+                memset(&auditBlock, 0, sizeof(auditBlock));
+        }
+        SetUserPostVsyncCallback(&AuditVsync);
+}
+
+void FlushAudit()
+{
+        u16 seconds = AuditUnsavedSeconds();
+
+        if (seconds != 0) {
+                audit->playSeconds += seconds;
+                auditSecondsSaved += seconds;
+                auditDirty = true;
+        }
+        if (!auditDirty) return;
+
+        auditBlock.id = AUDIT_EEPROM_ID;
+        auditBlock.data[HS_CRC] = HighScoreCrc(&auditBlock);
+        // still dirty when the write queue is full, the next flush retries
+        if (EepromWriteBlock(&auditBlock) != EEPROM_ERROR_BUSY) auditDirty = false;
+}
+
+void AuditCoin()
+{
+        audit->coins++;
+        auditDirty = true;
+}
+
+void AuditGameStart(bool twoPlayer)
+{
+        if (twoPlayer) audit->starts2P++;
+        else audit->starts1P++;
+        auditPlaying = true;
+        auditDirty = true;
+}
+
+//
+// A player has no guys left
+//
+
+void AuditPlayerOver(u8 stage, u32 score)
+{
+        u8 i;
+
+        for (i = 0; i < AUDIT_HISTOGRAM_BUCKETS - 1; i++) {
+                if (score < pgm_read_word(&auditBuckets[i])) break;
+        }
+        audit->scores[i]++;
+        audit->players++;
+        audit->stageSum += stage + 1;
+        auditDirty = true;
+}
+
+void AuditGameOver()
+{
+        auditPlaying = false;
+}
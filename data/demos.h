@@ -0,0 +1,57 @@
+//
+// Attract demo recordings, replayed by demoMode() through playGame().
+// Each one is the stage, then an input log of the kernel recorder: the
+// rand() seed and the joypad runs from the first frame of the turn, see
+// InputRecordStart(). A build with DEMO_RECORD=1 sends the same bytes on
+// the UART for each turn played.
+//
+// These two were made with tools/balance -d 1,3 and -d 5,1, the bot of
+// the host model of the playGame() loop at top speed, and stop after one
+// minute. The model is kept in sync with the game by hand, "make demos"
+// in default/ replays them on the game .elf and checks each one ends as
+// demoEnds[] says.
+//
+
+// stage 1, beers then the dirt road with a jump, 120 bytes
+const unsigned char demoStage1[] PROGMEM = {
+0x00,0x03,0x00,0x84,0x00,0x84,0x01,0x84,0x00,0x84,0x01,0x84,0x00,0x84,0x77,0x86,0x00,0x86,0x4f,0x86,0x00,0x86,0x7f,0x29,0x87,0x00,0x87,0x12,0x86,0x00,0x86,0x7f,
+0x87,0x00,0x87,0x20,0x87,0x00,0x87,0x54,0x86,0x00,0x86,0x14,0x87,0x00,0x87,0x7f,0x69,0x86,0x00,0x86,0x7f,0x7f,0x7f,0x7f,0x19,0x86,0x00,0x86,0x5b,0x87,0x00,0x87,
+0x2a,0x86,0x00,0x86,0x3c,0x87,0x00,0x87,0x7f,0x27,0x86,0x00,0x86,0x27,0x87,0x00,0x87,0x7f,0x7f,0x7f,0x14,0x87,0x00,0x87,0x7f,0x46,0x87,0x00,0x87,0x4e,0x86,0x00,
+0x86,0x7f,0x4e,0x87,0x00,0x87,0x66,0x86,0x00,0x86,0x7f,0x7f,0x76,0x86,0x00,0x86,0x7f,0x5a,0x89,0x00,0x89,0x7f,0x17,0xff};
+
+// stage 5, 210 bytes
+const unsigned char demoStage5[] PROGMEM = {
+0x04,0x01,0x00,0x84,0x00,0x84,0x7f,0x4c,0x86,0x00,0x86,0x11,0x86,0x00,0x86,0x12,0x87,0x00,0x87,0x39,0x86,0x00,0x86,0x0c,0x87,0x00,0x87,0x5d,0x86,0x00,0x86,0x1f,
+0x87,0x00,0x87,0x60,0x86,0x00,0x86,0x50,0x87,0x00,0x87,0x07,0x87,0x00,0x87,0x54,0x86,0x00,0x86,0x30,0x87,0x00,0x87,0x2d,0x87,0x00,0x87,0x68,0x86,0x00,0x86,0x44,
+0x87,0x00,0x87,0x38,0x86,0x00,0x86,0x1b,0x87,0x00,0x87,0x15,0x86,0x00,0x86,0x3e,0x87,0x00,0x87,0x1a,0x86,0x00,0x86,0x3a,0x86,0x00,0x86,0x57,0x86,0x00,0x86,0x24,
+0x87,0x00,0x87,0x15,0x86,0x00,0x86,0x45,0x87,0x00,0x87,0x2f,0x86,0x00,0x86,0x0e,0x87,0x00,0x87,0x55,0x87,0x00,0x87,0x0f,0x86,0x00,0x86,0x2e,0x87,0x00,0x87,0x26,
+0x87,0x00,0x87,0x07,0x86,0x00,0x86,0x2d,0x86,0x00,0x86,0x5f,0x87,0x00,0x87,0x6d,0x87,0x00,0x87,0x29,0x86,0x00,0x86,0x43,0x86,0x00,0x86,0x53,0x86,0x00,0x86,0x7f,
+0x7f,0x7c,0x87,0x00,0x87,0x07,0x87,0x00,0x87,0x0d,0x87,0x00,0x87,0x36,0x86,0x00,0x86,0x7f,0x36,0x86,0x00,0x86,0x36,0x87,0x00,0x87,0x76,0x86,0x00,0x86,0x7f,0x7e,
+0x87,0x00,0x87,0x4e,0x86,0x00,0x86,0x3e,0x87,0x00,0x87,0x7f,0x02,0x89,0x00,0x89,0x31,0xff};
+
+const unsigned char * const demos[] PROGMEM = {
+    demoStage1,
+    demoStage5,
+};
+
+#define DEMO_COUNT 2
+
+#ifndef __AVR__
+// where each turn of demos[] ends in the host model, for tools/uzesim -m:
+// the loop frames, playerScore[0], gameStage[0] and subStage after the
+// last one and the GameEvent of tools/gamerules.h, 0 for the end of the
+// recording. tools/balance -d prints the entry with the recording.
+struct DemoEnd
+{
+    unsigned int frames;
+    unsigned int score;
+    unsigned char stage;
+    unsigned char subStage;
+    unsigned char event;
+};
+
+const struct DemoEnd demoEnds[DEMO_COUNT] = {
+    { 3600, 1090, 0, 3, 0 },
+    { 3600, 1180, 4, 3, 0 },
+};
+#endif
@@ -230,3 +230,17 @@ const struct PatchStruct patches[] PROGMEM = {
     {0,NULL,patch08,0,0}, // car crashes, misses a beer
 };
 
+
+// fx priority, max voices and channels, see SetFxInfoTable().
+// channel 0 is the engine, the title song plays on channels 0 and 1.
+const struct FxInfoStruct fxInfo[] PROGMEM = {
+    {1,0,FX_CHANNEL(1)|FX_CHANNEL(2)}, // synth lead
+    {1,0,FX_CHANNEL(1)|FX_CHANNEL(2)}, // bass
+    {1,0,FX_CHANNEL(1)|FX_CHANNEL(2)}, // UNUSED
+    {1,0,FX_CHANNEL(1)|FX_CHANNEL(2)}, // engine noise
+    {2,1,FX_CHANNEL(2)},               // coin-up, start: keep the song's bass
+    {1,0,FX_CHANNEL(1)|FX_CHANNEL(2)}, // UNUSED
+    {1,1,FX_CHANNEL(1)|FX_CHANNEL(2)}, // beer, retriggered often
+    {1,1,FX_CHANNEL(1)|FX_CHANNEL(2)}, // turn, retriggered often
+    {3,1,FX_CHANNEL(1)|FX_CHANNEL(2)}, // crash, never stolen by the others
+};
@@ -148,6 +148,8 @@ const char sabl_blank[] PROGMEM ={
 1,1
 ,0x0};
 
+// with SD_ASSETS=2 the maps only come from the SD card, see assets.c
+#if SD_ASSETS != 2
 #define SABL_1_WIDTH 9
 #define SABL_1_HEIGHT 18
 const char sabl_1[] PROGMEM ={
@@ -169,3 +171,4 @@ const char sabl_2[] PROGMEM ={
 ,0x0,0x0,0x1,0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x2,0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x0
 ,0x3,0x4,0x5,0x6,0x0,0x0,0x0,0x7,0x0,0x8,0x9,0xa,0xb,0x0,0x0,0x0,0xc,0xd,0xe,0xf
 ,0x10,0x11,0x0,0x0,0x0};
+#endif
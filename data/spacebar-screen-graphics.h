@@ -103,6 +103,8 @@ const char sbl_blank[] PROGMEM ={
 1,1
 ,0x0};
 
+// with SD_ASSETS=2 the maps only come from the SD card, see assets.c
+#if SD_ASSETS != 2
 #define SBL_1_WIDTH 9
 #define SBL_1_HEIGHT 20
 const char sbl_1[] PROGMEM ={
@@ -125,5 +127,6 @@ const char sbl_2[] PROGMEM ={
 ,0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x1,0x2,0x3,0x4,0x5,0x6,0x0,0x0,0x0,0x7,0x8
 ,0x9,0xa,0xb,0xc,0x0,0x0,0x0,0xd,0xe,0xf,0x10,0x11,0x12,0x0,0x0,0x0,0x0,0x13,0x14,0x15
 ,0x16,0x17,0x0,0x0,0x0,0x18,0x19,0x1a,0x1b,0x1c,0x1d,0x0};
+#endif
 
 
@@ -1,3 +1,5 @@
+// with SD_ASSETS=2 the can only comes from the SD card, see assets.c
+#if SD_ASSETS != 2
 #define COORSCAN_SIZE 16
 const char coorsCan[] PROGMEM={
  0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0		 //tile:0
@@ -17,11 +19,14 @@ const char coorsCan[] PROGMEM={
 , 0x6e, 0x6e, 0x6e, 0x6e, 0x9, 0xad, 0x9, 0xad, 0x2e, 0x6e, 0x6e, 0x9, 0xad, 0xad, 0x9, 0x9, 0x6e, 0x6e, 0x6e, 0x9, 0xad, 0xad, 0xad, 0xad, 0x6e, 0x6e, 0x6e, 0x9, 0xad, 0xad, 0x9, 0x9, 0x6e, 0x6e, 0x6e, 0x9, 0xad, 0x9, 0xad, 0xad, 0x6e, 0x6e, 0x9, 0xad, 0xad, 0xad, 0x9, 0xad, 0x9, 0x9, 0x9, 0x9, 0x9, 0x9, 0xad, 0xad, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x9, 0x9		 //tile:14
 , 0xad, 0xad, 0x16, 0xad, 0xad, 0x9, 0x0, 0x0, 0x9, 0xad, 0xad, 0xad, 0x52, 0x9, 0x0, 0x0, 0xad, 0xad, 0xad, 0xad, 0x9, 0x0, 0x0, 0x0, 0xad, 0xad, 0xad, 0xad, 0x9, 0x0, 0x0, 0x0, 0x16, 0xad, 0xad, 0x9, 0x9, 0x0, 0x0, 0x0, 0xad, 0xad, 0x52, 0x9, 0x0, 0x0, 0x0, 0x0, 0xad, 0x52, 0x9, 0x0, 0x0, 0x0, 0x0, 0x0, 0x9, 0x9, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0		 //tile:15
 };
+#endif
 
 #include "font4.inc"
 
+#if SD_ASSETS != 2
 #define COORS_CAN_MAP_WIDTH 5
 #define COORS_CAN_MAP_HEIGHT 3
 const char coors_can_map[] PROGMEM ={
 5,3
 ,0x1,0x2,0x3,0x4,0x5,0x6,0x7,0x8,0x9,0xa,0xb,0xc,0xd,0xe,0xf};
+#endif
@@ -23,132 +23,331 @@
 */
 
 #define SMOKEY_EEPROM_ID     (23)
-#define MAX_HIGH_SCORES 4
+#define MAX_HIGH_SCORES 10
 
-struct EepromBlockStruct eeprom;
+//
+// The table is saved as a journal: each save goes to the next of
+// HS_JOURNAL_BLOCKS records with a sequence number and a CRC8, and the
+// newest valid record wins on boot. A power cut while saving only
+// loses the record being written, and each record is rewritten only
+// once every HS_JOURNAL_BLOCKS saves.
+//
+// A record is two EEPROM blocks, each with the sequence number, half
+// of the table and the CRC8 of both halves, so a record with one half
+// from an older save is rejected.
+//
+#define HS_JOURNAL_BLOCKS    3
+#define HS_JOURNAL_ID(n)     (SMOKEY_EEPROM_ID | (((n) + 1) << 8))
+#define HS_SEQ               0      // data[] offset of the sequence number
+#define HS_TABLE             1      // data[] offset of the table
+#define HS_CRC               29     // data[] offset of the CRC8
+#define HS_HALF_BYTES        (HS_CRC - HS_TABLE)
 
 //
-// Set the N'th highest score
+// The table is bit packed, LSB first: a 4 bit entry count, then for
+// each entry three 5 bit initials (0=space, 1-26=A-Z) and a score. The
+// first score is stored as is, the others as the distance to the score
+// above them, each as a 4 bit width (15 means 24) followed by that many
+// bits. An entry takes at most 43 bits, so 10 entries always fit in the
+// 448 bits of the two halves.
 //
+#define HS_TABLE_BYTES       (2 * HS_HALF_BYTES)
+#define HS_TABLE_BITS        (HS_TABLE_BYTES * 8)
+#define HS_COUNT_BITS        4
+#define HS_INITIAL_BITS      5
+#define HS_WIDTH_BITS        4
+#define HS_WIDTH_MAX         15     // width code for a full 24 bit value
+#define HS_MAX_SCORE         0xffffffUL
+
+#if HS_COUNT_BITS + MAX_HIGH_SCORES * (3 * HS_INITIAL_BITS + HS_WIDTH_BITS + 24) > HS_TABLE_BITS
+        #error MAX_HIGH_SCORES entries do not fit in the high score table
+#endif
 
-void SetHighScore(u8 number, char i1, char i2, char i3, u32 score)
+u8 hsTable[HS_TABLE_BYTES];
+u8 hsSeq;
+u8 journalSlot;
+bool hsUnsaved;         // the EEPROM write queue had no room for the record
+
+//
+// CRC8 of the block id, sequence number and table
+//
+
+u8 HighScoreCrc(struct EepromBlockStruct *block)
 {
-        // calculate the offset byte we're starting at
-        u8 offset = (number * 6);
-        
-        // set the initials
-        eeprom.data[offset + 0] = i1;
-        eeprom.data[offset + 1] = i2;
-        eeprom.data[offset + 2] = i3;
-        
-        // set the score
-        eeprom.data[offset + 3] = (char)((score &0xff0000) >> 16);
-        eeprom.data[offset + 4] = (char)((score &0xff00) >>  8);
-        eeprom.data[offset + 5] = (char)((score &0xff));
+        u8 *p = (u8 *)block;
+        u8 crc = 0;
+
+        for (u8 i = 0; i < 2 + HS_CRC; i++) crc = _crc8_ccitt_update(crc, p[i]);
+        return crc;
+}
+
+// CRC8 of a record, both halves
+u8 HsRecordCrc(struct EepromBlockStruct *lo, struct EepromBlockStruct *hi)
+{
+        u8 *p = (u8 *)hi;
+        u8 crc = HighScoreCrc(lo);
+
+        for (u8 i = 0; i < 2 + HS_CRC; i++) crc = _crc8_ccitt_update(crc, p[i]);
+        return crc;
+}
+
+//
+// Bit access to a packed table
+//
+
+u32 HsReadBits(const u8 *table, u16 *pos, u8 count)
+{
+        u32 value = 0;
+
+        for (u8 i = 0; i < count; i++, (*pos)++) {
+                if (table[*pos >> 3] & (1 << (*pos & 7))) value |= (1UL << i);
+        }
+        return value;
+}
+
+bool HsWriteBits(u8 *table, u16 *pos, u8 count, u32 value)
+{
+        if (*pos + count > HS_TABLE_BITS) return false;
+
+        for (u8 i = 0; i < count; i++, (*pos)++) {
+                if (value & (1UL << i)) table[*pos >> 3] |= (1 << (*pos & 7));
+                else table[*pos >> 3] &= ~(1 << (*pos & 7));
+        }
+        return true;
+}
+
+//
+// Read the entry at *pos, prev is the score of the entry above it
+// (0 for the first entry, scores in the table are never 0)
+//
+
+u32 HsReadEntry(const u8 *table, u16 *pos, u32 prev, char *initials)
+{
+        u8 width;
+        u32 value;
+
+        for (u8 i = 0; i < 3; i++) {
+                u8 c = HsReadBits(table, pos, HS_INITIAL_BITS);
+                initials[i] = (c >= 1 && c <= 26) ? ('A' - 1 + c) : ' ';
+        }
+        width = HsReadBits(table, pos, HS_WIDTH_BITS);
+        value = HsReadBits(table, pos, (width == HS_WIDTH_MAX) ? 24 : width);
+        return (prev == 0) ? value : prev - value;
+}
+
+//
+// Append an entry at *pos, returns false if it does not fit
+//
+
+bool HsWriteEntry(u8 *table, u16 *pos, u32 prev, const char *initials, u32 score)
+{
+        u32 value = (prev == 0) ? score : prev - score;
+        u8 width = 0;
+
+        while (width < HS_WIDTH_MAX && (value >> width) != 0) width++;
+
+        for (u8 i = 0; i < 3; i++) {
+                char c = initials[i];
+                if (!HsWriteBits(table, pos, HS_INITIAL_BITS, (c >= 'A' && c <= 'Z') ? (c - 'A' + 1) : 0)) return false;
+        }
+        return HsWriteBits(table, pos, HS_WIDTH_BITS, width) &&
+                HsWriteBits(table, pos, (width == HS_WIDTH_MAX) ? 24 : width, value);
+}
+
+//
+// Write the table with the score inserted to out in one pass, shifting
+// the entries below it down. Returns false if it does not make it into
+// the table, hsTable is not changed.
+//
+
+bool HsPack(u8 *out, char i1, char i2, char i3, u32 score)
+{
+        char newInitials[3] = { i1, i2, i3 };
+        char initials[3];
+        u16 inPos = 0, outPos = HS_COUNT_BITS;
+        u32 inPrev = 0, outPrev = 0;
+        u8 count, kept = 0;
+        bool inserted = false;
+
+        if (score == 0) return false;
+        if (score > HS_MAX_SCORE) score = HS_MAX_SCORE;
+
+        memset(out, 0, HS_TABLE_BYTES);
+        count = HsReadBits(hsTable, &inPos, HS_COUNT_BITS);
+
+        for (u8 i = 0; i <= count && kept < MAX_HIGH_SCORES; i++) {
+                u32 entry = 0;
+
+                if (i < count) entry = inPrev = HsReadEntry(hsTable, &inPos, inPrev, initials);
+
+                if (!inserted && (i == count || score > entry)) {
+                        if (!HsWriteEntry(out, &outPos, outPrev, newInitials, score)) break;
+                        outPrev = score;
+                        inserted = true;
+                        kept++;
+                        if (kept == MAX_HIGH_SCORES) break;
+                }
+                if (i < count) {
+                        if (!HsWriteEntry(out, &outPos, outPrev, initials, entry)) break;
+                        outPrev = entry;
+                        kept++;
+                }
+        }
+
+        if (!inserted) return false;
+
+        outPos = 0;
+        HsWriteBits(out, &outPos, HS_COUNT_BITS, kept);
+        return true;
+}
+
+bool HsInsert(char i1, char i2, char i3, u32 score)
+{
+        u8 out[HS_TABLE_BYTES];
+
+        if (!HsPack(out, i1, i2, i3, score)) return false;
+        memcpy(hsTable, out, HS_TABLE_BYTES);
+        return true;
 }
 
 // 
-// Get the N'th highest score
+// Get the N'th highest score, 0 if the table has fewer entries
 //
 
 void GetHighScore(u8 number, char *i1, char *i2, char *i3, u32 *score)
 {
-        // calculate the offset byte we're starting at
-        u8 offset = (number * 6);
-        
-        // get the initials
-        *i1 = eeprom.data[offset + 0];
-        *i2 = eeprom.data[offset + 1];
-        *i3 = eeprom.data[offset + 2];
-        
-        // get the score
-        *score = (u32)(((u32)eeprom.data[offset + 3] << 16) | ((u32)eeprom.data[offset + 4] << 8) | ((u32)eeprom.data[offset + 5]));
+        char initials[3] = { ' ', ' ', ' ' };
+        u16 pos = 0;
+        u32 prev = 0;
+        u8 count = HsReadBits(hsTable, &pos, HS_COUNT_BITS);
+
+        *score = 0;
+        for (u8 i = 0; i <= number && i < count; i++) {
+                prev = HsReadEntry(hsTable, &pos, prev, initials);
+                if (i == number) *score = prev;
+        }
+        if (*score == 0) initials[0] = initials[1] = initials[2] = ' ';
+
+        *i1 = initials[0];
+        *i2 = initials[1];
+        *i3 = initials[2];
 }
 
 //
-// Initialize high scores. Read them from eeprom, if the eeprom is 
-// not formatted then we set them to zero. 
+// Initialize high scores. Read the newest valid journal record, if
+// there is none the table starts empty, or from the tables of earlier
+// versions: the one block journal records, then the old single block
+// table.
 void InitHighScores()
 {
-// This is commented out because it should never be the case that the 
-// eeprom is not formatted.
-//        // make sure we're formatted
-//        if(!isEepromFormatted()) {
-//			FormatEeprom();
-//			SetHighScore(0, ' ', ' ', ' ', 0);
-//			SetHighScore(1, ' ', ' ', ' ', 0);
-//			SetHighScore(2, ' ', ' ', ' ', 0);
-//			SetHighScore(3, ' ', ' ', ' ', 0);
-//		}
-                
-        eeprom.id = SMOKEY_EEPROM_ID;
-                
-        // now read in the struct
-        EepromReadBlock(SMOKEY_EEPROM_ID, &eeprom);
+        struct EepromBlockStruct lo, hi;
+        bool found = false, halves = false;
+
+        memset(hsTable, 0, sizeof(hsTable));
+        hsSeq = 0;
+        journalSlot = HS_JOURNAL_BLOCKS - 1;
+
+        for (u8 n = 0; n < HS_JOURNAL_BLOCKS; n++) {
+                if (EepromReadBlock(HS_JOURNAL_ID(n + HS_JOURNAL_BLOCKS), &hi) != 0) continue;
+                halves = true;
+                if (EepromReadBlock(HS_JOURNAL_ID(n), &lo) != 0) continue;
+                if (lo.data[HS_SEQ] != hi.data[HS_SEQ]) continue;
+                if (HsRecordCrc(&lo, &hi) != lo.data[HS_CRC] || hi.data[HS_CRC] != lo.data[HS_CRC]) continue;
+
+                // sequence numbers wrap, newer means ahead by less than 128
+                if (!found || (s8)(lo.data[HS_SEQ] - hsSeq) > 0) {
+                        memcpy(hsTable, &lo.data[HS_TABLE], HS_HALF_BYTES);
+                        memcpy(hsTable + HS_HALF_BYTES, &hi.data[HS_TABLE], HS_HALF_BYTES);
+                        hsSeq = lo.data[HS_SEQ];
+                        journalSlot = n;
+                        found = true;
+                }
+        }
+        if (found || halves) return;
+
+        // one block records: the same packed table in the first half
+        for (u8 n = 0; n < HS_JOURNAL_BLOCKS; n++) {
+                if (EepromReadBlock(HS_JOURNAL_ID(n), &lo) != 0) continue;
+                if (HighScoreCrc(&lo) != lo.data[HS_CRC]) continue;
+
+                if (!found || (s8)(lo.data[HS_SEQ] - hsSeq) > 0) {
+                        memcpy(hsTable, &lo.data[HS_TABLE], HS_HALF_BYTES);
+                        hsSeq = lo.data[HS_SEQ];
+                        journalSlot = n;
+                        found = true;
+                }
+        }
+        if (found) return;
+
+        // old table: 4 entries of 3 initials and a 24 bit score
+        if (EepromReadBlock(SMOKEY_EEPROM_ID, &lo) == 0) {
+                for (u8 i = 0; i < 4; i++) {
+                        u8 *e = &lo.data[i * 6];
+                        HsInsert(e[0], e[1], e[2], ((u32)e[3] << 16) | ((u32)e[4] << 8) | e[5]);
+                }
+        }
 }
 
 void WriteHighScores()
 {
-        // set the identifer bytes to be sure
-        eeprom.id = SMOKEY_EEPROM_ID;
-        
-        // write it out!
-        EepromWriteBlock(&eeprom);
+        struct EepromBlockStruct lo, hi;
+
+        // next record of the journal, a retry rewrites the same one
+        if (!hsUnsaved) {
+                journalSlot = (journalSlot + 1) % HS_JOURNAL_BLOCKS;
+                hsSeq++;
+        }
+        lo.id = HS_JOURNAL_ID(journalSlot);
+        hi.id = HS_JOURNAL_ID(journalSlot + HS_JOURNAL_BLOCKS);
+        lo.data[HS_SEQ] = hi.data[HS_SEQ] = hsSeq;
+        memcpy(&lo.data[HS_TABLE], hsTable, HS_HALF_BYTES);
+        memcpy(&hi.data[HS_TABLE], hsTable + HS_HALF_BYTES, HS_HALF_BYTES);
+        lo.data[HS_CRC] = hi.data[HS_CRC] = HsRecordCrc(&lo, &hi);
+
+        // write it out! A half already queued is replaced on a retry
+        hsUnsaved = EepromWriteBlock(&lo) == EEPROM_ERROR_BUSY ||
+                EepromWriteBlock(&hi) == EEPROM_ERROR_BUSY;
 }
 
-bool IsHighScore(u32 newScore)
+//
+// Retry a save the write queue had no room for
+//
+
+void FlushHighScores()
 {
-	// compare new score to the lowest high score, if it is greater 
-	// then this is a new high score. 
-	char i;
-	u32 score;
-    GetHighScore(3, &i, &i, &i, &score);
-    
-    if (newScore > score) return true;
-    else return false;
+        if (hsUnsaved) WriteHighScores();
 }
 
+//
+// Rank the score would get, 1 is the best. One pass over the table.
+//
+
 u8 GetScoreRank(u32 score)
 {
-        char i;
-        
-        u32 score1, score2, score3, score4;
-        GetHighScore(0, &i, &i, &i, &score1);
-        GetHighScore(1, &i, &i, &i, &score2);
-        GetHighScore(2, &i, &i, &i, &score3);
-        GetHighScore(3, &i, &i, &i, &score4);
-        
+        char initials[3];
+        u16 pos = 0;
+        u32 prev = 0;
+        u8 count = HsReadBits(hsTable, &pos, HS_COUNT_BITS);
+        u8 rank;
 
-        if(score <= score4)
-                return 5; // nope
-        if(score <= score3)
-                return 4;
-        if(score <= score2)
-                return 3;
-        if(score <= score1)
-                return 2;
-        
-        // the only way we get down here is if we beat score 1!
-        return 1;
+        for (rank = 1; rank <= count; rank++) {
+                prev = HsReadEntry(hsTable, &pos, prev, initials);
+                if (score > prev) break;
+        }
+        return rank;
 }
 
-void NewHighScore(char i1, char i2, char i3, u32 score)
+bool IsHighScore(u32 newScore)
 {
-        u8 rank = GetScoreRank(score);
-        
-        // shift the old scores down
-        for(u8 i = MAX_HIGH_SCORES; i > rank; i--)
-        {
-                char oi1, oi2, oi3;
-                u32 oscore;
-                GetHighScore(i - 2, &oi1, &oi2, &oi3, &oscore);
-                SetHighScore(i - 1, oi1, oi2, oi3, oscore);
-        }
-        
-        // set the new score
-        SetHighScore(rank - 1, i1, i2, i3, score);
-        
-        // and write it out
-        WriteHighScores();
+        u8 out[HS_TABLE_BYTES];
+
+        // a dry run of the insert NewHighScore() will do, the initials
+        // do not change the size of an entry
+        return HsPack(out, 'A', 'A', 'A', newScore);
 }
 
+void NewHighScore(char i1, char i2, char i3, u32 score)
+{
+        // insert it, shifting the lower scores down, and write it out
+        if (HsInsert(i1, i2, i3, score)) WriteHighScores();
+}
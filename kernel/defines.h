@@ -174,6 +174,32 @@
 		#endif
 	#endif
 
+	/*
+	 * Activates the UART transmit buffer. UartWrite() never waits, the
+	 * buffer is sent at 115200 bauds, one byte per hsync at most, in
+	 * the cycles the receive buffer would use, so the two cannot be
+	 * used together.
+	 * Not supported with video mode 2.
+	 *
+	 * 0 = no
+	 * 1 = yes
+	 */
+	#ifndef UART_TX_BUFFER
+		#define UART_TX_BUFFER 0
+	#elif UART_TX_BUFFER == 1 && UART_RX_BUFFER == 1
+		#error UART_TX_BUFFER cannot be used with UART_RX_BUFFER or MIDI_IN
+	#endif
+
+	/*
+	 * Size of the UART transmit buffer, a power of 2 up to 256. The
+	 * buffer is aligned on its size.
+	 */
+	#ifndef UART_TX_BUFFER_SIZE
+		#define UART_TX_BUFFER_SIZE 64
+	#elif (UART_TX_BUFFER_SIZE & (UART_TX_BUFFER_SIZE-1)) != 0 || UART_TX_BUFFER_SIZE > 256
+		#error Invalid size for UART_TX_BUFFER_SIZE: must be a power of 2 up to 256.
+	#endif
+
 	/*
 	 * Screen center adjustment for mode 1 only.
 	 * Useful if your game field absolutely needs a non-even width.
@@ -282,6 +308,118 @@
 	#ifndef CONTROLLERS_VSYNC_READ
 		#define CONTROLLERS_VSYNC_READ 1
 	#endif
+
+	/*
+	 * Per frame CPU accounting of the vsync stages, see struct KernelFrameStats
+	 * 0 = disabled (default)
+	 * 1 = Timestamp each vsync stage with TIMER1 (~150 cycles per stage)
+	 */
+	#ifndef KERNEL_FRAME_STATS
+		#define KERNEL_FRAME_STATS 0
+	#endif
+
+	/*
+	 * Paint the free RAM above the static variables with STACK_CANARY
+	 * before main(), see GetStackHighWater().
+	 * 0 = disabled (default)
+	 * 1 = Paint the stack (~5 cycles per byte at reset)
+	 */
+	#ifndef STACK_PAINT
+		#define STACK_PAINT 0
+	#endif
+
+	#ifndef STACK_CANARY
+		#define STACK_CANARY 0xc5
+	#endif
+
+	/*
+	 * Idle jobs run by WaitVsync() in the time left before the next vsync,
+	 * see AddIdleJob(). Max 8.
+	 * 0 = disabled (default)
+	 * n = number of job slots
+	 */
+	#ifndef IDLE_JOBS
+		#define IDLE_JOBS 0
+	#endif
+	#if IDLE_JOBS > 8
+		#error IDLE_JOBS is more than 8, the jobs run this frame are bits of an unsigned char
+	#endif
+
+	/*
+	 * Safety margin in cycles kept before the deadline of the idle jobs
+	 */
+	#ifndef IDLE_JOBS_MARGIN
+		#define IDLE_JOBS_MARGIN 2000
+	#endif
+
+	/*
+	 * Queue EepromWriteBlock() and write the EEPROM one byte per vsync
+	 * instead of stalling the program 3.4ms per byte. Size it for the
+	 * blocks a program writes in a row: with the queue full,
+	 * EepromWriteBlock() writes nothing and returns EEPROM_ERROR_BUSY.
+	 * Smokey and the bandit needs 3, the two blocks of a high score
+	 * record and the audit block.
+	 * 0 = disabled, blocks are written immediately (default)
+	 * n = number of blocks that can be pending (35 bytes of RAM each)
+	 */
+	#ifndef EEPROM_WRITE_QUEUE
+		#define EEPROM_WRITE_QUEUE 0
+	#endif
+
+	/*
+	 * Keep a directory of the EEPROM blocks in RAM (65 bytes), built at boot,
+	 * so EepromReadBlock()/EepromWriteBlock() do not scan all block headers.
+	 * 0 = disabled (default)
+	 * 1 = enabled
+	 */
+	#ifndef EEPROM_BLOCK_DIRECTORY
+		#define EEPROM_BLOCK_DIRECTORY 0
+	#endif
+
+	/*
+	 * Joypad input recorder, see InputRecordStart() and InputReplayStart().
+	 * The vsync logs ReadJoypad(0/1) each frame or replays a log instead
+	 * of the joypads.
+	 * 0 = disabled (default)
+	 * 1 = enabled
+	 */
+	#ifndef INPUT_RECORDER
+		#define INPUT_RECORDER 0
+	#endif
+
+	/*
+	 * Size of the RAM log of InputRecordStart(), 0 = replay only
+	 */
+	#ifndef INPUT_LOG_SIZE
+		#define INPUT_LOG_SIZE 256
+	#elif INPUT_LOG_SIZE > 0 && INPUT_LOG_SIZE < 8
+		#error Invalid size for INPUT_LOG_SIZE: must be 0 or at least 8.
+	#endif
+
+	/*
+	 * Send the input log on the UART while it is recorded, from WaitVsync().
+	 * Needs UART_TX_BUFFER=1.
+	 * 0 = disabled (default)
+	 * 1 = enabled
+	 */
+	#ifndef INPUT_RECORDER_UART
+		#define INPUT_RECORDER_UART 0
+	#elif INPUT_RECORDER_UART == 1 && (UART_TX_BUFFER != 1 || INPUT_RECORDER != 1 || INPUT_LOG_SIZE == 0)
+		#error INPUT_RECORDER_UART needs UART_TX_BUFFER=1, INPUT_RECORDER=1 and INPUT_LOG_SIZE>0
+	#endif
+
+	/*
+	 * FAT driver (fat.c) cache of the cluster chains: FAT_CACHE_LINES
+	 * runs of FAT_CACHE_ENTRIES consecutive FAT entries (power of 2),
+	 * 4 bytes each, evicted LRU. A FAT sector is read once every
+	 * FAT_CACHE_ENTRIES clusters of a sequential read.
+	 */
+	#ifndef FAT_CACHE_LINES
+		#define FAT_CACHE_LINES 2
+	#endif
+	#ifndef FAT_CACHE_ENTRIES
+		#define FAT_CACHE_ENTRIES 16
+	#endif
 	
 	/*
 	 * Kernel Internal settings, do not modify
@@ -360,6 +498,9 @@
 	#define PC_TREMOLO_RATE	10
 	#define PATCH_END		0xff
 
+	//FxInfoStruct channel mask
+	#define FX_CHANNEL(c)	(1<<(c))
+
 
 	#if MIXER_CHAN4_TYPE == 0
 		#define WAVE_CHANNELS 3
@@ -389,6 +530,19 @@
 	#define SYNC_PHASE_POST_EQ	2
 	#define SYNC_PHASE_HSYNC	3
 
+	#define FRAME_CYCLES ((unsigned long)(SYNC_PRE_EQ_PULSES+SYNC_EQ_PULSES+SYNC_POST_EQ_PULSES)*(HDRIVE_CL_TWICE+1)+(unsigned long)SYNC_HSYNC_PULSES*(HDRIVE_CL+1))
+
+	//KernelFrameStats stages, in vsync order
+	#define FS_PRE_CALLBACK		0
+	#define FS_CONTROLLERS		1
+	#define FS_FADING			2
+	#define FS_SPRITES			3	//whole VideoModeVsync() if the mode does not mark FS_FADING
+	#define FS_MUSIC			4
+	#define FS_MIXER			5
+	#define FS_POST_CALLBACK	6
+	#define FS_VSYNC			7	//sum of the above
+	#define FS_STAGES			8
+
 	#define SYNC_PIN PB0
 	#define SYNC_PORT PORTB
 	#define DATA_PORT PORTC
@@ -416,6 +570,14 @@
 	#define EEPROM_ERROR_FULL 0x2
 	#define EEPROM_ERROR_BLOCK_NOT_FOUND 0x3
 	#define EEPROM_ERROR_NOT_FORMATTED 0x4
+	#define EEPROM_ERROR_BUSY 0x5
+
+	#define IDLE_JOBS_ERROR_FULL 0x1
+
+	//GetInputRecorderState()
+	#define INPUT_IDLE 0
+	#define INPUT_RECORDING 1
+	#define INPUT_REPLAYING 2
 
 
 	#if VIDEO_MODE == 1 
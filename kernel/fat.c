@@ -21,12 +21,15 @@
 #include <stdbool.h>
 #include <avr/io.h>
 #include <stdlib.h>
+#include <string.h>
 #include <avr/pgmspace.h>
 #include <uzebox.h>
 #include <mmc.h>
 #include <fat.h>
 #include <avr/interrupt.h>
 
+#define FAT_EOC 0x0ffffff8	//clusters from here on end a chain
+
 long dirTableSector;
 long sectorsPerCluster;
 long maxRootDirectoryEntries;
@@ -34,34 +37,101 @@ long bytesPerSector;
 
 uint8_t *fatBuffer;
 
+unsigned char fatType;			//16 or 32, 0=not mounted
+unsigned char clusterShift;		//log2(sectorsPerCluster)
+unsigned long fatStartSector;
+unsigned long dataStartSector;
+unsigned long rootDirCluster;	//FAT32 only
+
+/*
+ * Cache of the FAT: each line holds the next cluster of FAT_CACHE_ENTRIES
+ * consecutive clusters, lines are evicted least recently used first.
+ */
+struct FatCacheLine{
+	unsigned long first;		//first cluster of the run, 0xffffffff=empty
+	unsigned char age;
+	unsigned long next[FAT_CACHE_ENTRIES];
+};
+
+struct FatCacheLine fatCache[FAT_CACHE_LINES];
+
 uint8_t InitFat(uint8_t *buffer){
 	fatBuffer=buffer;
+	fatType=0;
 	return mmc_init(buffer);
 }
 
-void LoadRootDirectory(){
+static unsigned long ClusterToSector(unsigned long cluster){
+	return dataStartSector+((cluster-2)<<clusterShift);
+}
 
-	//read MBR
-	mmc_readsector(0);
+static unsigned long EntryCluster(DirectoryTableEntry *entry){
+	unsigned long cluster=entry->firstCluster;
+	if(fatType==32) cluster|=((unsigned long)entry->eaIndex<<16);
+	return cluster;
+}
 
-	//read boot record
-	long bootRecordSector= ((MBR*)fatBuffer)->partition1.startSector;
-	mmc_readsector(bootRecordSector);
+/*
+ * Reads the partition. Works with FAT16 and FAT32, with or without a
+ * partition table. The first root directory sector is left in the
+ * buffer for LoadFiles().
+ */
+uint8_t FatMount(void){
+	BootRecord *br=(BootRecord*)fatBuffer;
+	unsigned long bootRecordSector=0,totalSectors,clusters;
+	unsigned char i;
 
-	int reservedSectors=((BootRecord*)fatBuffer)->reservedSectors;
-	int sectorsPerFat=((BootRecord*)fatBuffer)->sectorsPerFat;
-	maxRootDirectoryEntries=((BootRecord*)fatBuffer)->maxRootDirectoryEntries;
-	bytesPerSector=((BootRecord*)fatBuffer)->bytesPerSector;
-	sectorsPerCluster=((BootRecord*)fatBuffer)->sectorsPerCluster;
+	fatType=0;
+	for(i=0;i<FAT_CACHE_LINES;i++){
+		fatCache[i].first=0xffffffff;
+		fatCache[i].age=255;
+	}
 
-	//get directory table
-	dirTableSector=bootRecordSector + reservedSectors + (sectorsPerFat * 2); 
-	mmc_readsector(dirTableSector);
+	//read MBR, unless sector 0 is already the boot record
+	if(mmc_readsector(0)!=0) return FAT_ERROR_IO;
+	if(!((br->jmp[0]==0xeb || br->jmp[0]==0xe9) && br->bytesPerSector==512)){
+		bootRecordSector=((MBR*)fatBuffer)->partition1.startSector;
+		if(mmc_readsector(bootRecordSector)!=0) return FAT_ERROR_IO;
+	}
+	if(br->bytesPerSector!=512 || br->sectorsPerCluster==0 || br->fatCopies==0) return FAT_ERROR_NO_FAT;
 
+	maxRootDirectoryEntries=br->maxRootDirectoryEntries;
+	bytesPerSector=br->bytesPerSector;
+	sectorsPerCluster=br->sectorsPerCluster;
+	for(clusterShift=0;(1L<<clusterShift)<sectorsPerCluster;clusterShift++);
+
+	fatStartSector=bootRecordSector+br->reservedSectors;
+	totalSectors=(br->totalSectorsLegacy!=0)?br->totalSectorsLegacy:br->totalSectors;
+
+	if(br->sectorsPerFat!=0){
+		dirTableSector=fatStartSector+((unsigned long)br->sectorsPerFat*br->fatCopies);
+		dataStartSector=dirTableSector+((maxRootDirectoryEntries*32)/512);
+		rootDirCluster=0;
+		fatType=16;
+	}else{
+		dataStartSector=fatStartSector+(((BootRecord32*)fatBuffer)->sectorsPerFat32*br->fatCopies);
+		rootDirCluster=((BootRecord32*)fatBuffer)->rootDirectoryCluster;
+		dirTableSector=ClusterToSector(rootDirCluster);
+		fatType=32;
+	}
+
+	//FAT12 volumes are not supported
+	clusters=(totalSectors-(dataStartSector-bootRecordSector))>>clusterShift;
+	if(clusters<4085){
+		fatType=0;
+		return FAT_ERROR_NO_FAT;
+	}
+
+	if(mmc_readsector(dirTableSector)!=0) return FAT_ERROR_IO;
+	return FAT_ERROR_NONE;
+}
+
+void LoadRootDirectory(){
+	FatMount();
 }
 
 long GetFileSector(DirectoryTableEntry *file){
-	return dirTableSector+((maxRootDirectoryEntries * 32)/bytesPerSector)+((file->firstCluster-2)*sectorsPerCluster);
+	return ClusterToSector(EntryCluster(file));
 }
 
 unsigned char LoadFiles(File *files){
@@ -101,3 +171,218 @@ unsigned char LoadFiles(File *files){
 	}
 	return fileCount;
 }
+
+
+/*
+ * Returns the cluster that follows in the chain, FAT_EOC or above at the
+ * end. Reading the FAT overwrites the sector buffer.
+ */
+unsigned long FatNextCluster(unsigned long cluster){
+	struct FatCacheLine *line,*lru=&fatCache[0];
+	unsigned long first=cluster&~((unsigned long)FAT_CACHE_ENTRIES-1),next;
+	unsigned char i,entryShift=(fatType==32)?7:8;
+	unsigned int offset;
+
+	for(i=0;i<FAT_CACHE_LINES;i++){
+		if(fatCache[i].age<255) fatCache[i].age++;
+	}
+
+	for(i=0;i<FAT_CACHE_LINES;i++){
+		line=&fatCache[i];
+		if(line->first==first){
+			line->age=0;
+			return line->next[cluster-first];
+		}
+		if(line->age>lru->age) lru=line;
+	}
+
+	//load the run from its FAT sector, runs never cross sectors
+	if(mmc_readsector(fatStartSector+(first>>entryShift))!=0) return FAT_EOC;
+
+	offset=first&((1<<entryShift)-1);
+	for(i=0;i<FAT_CACHE_ENTRIES;i++){
+		if(fatType==32){
+			next=((unsigned long*)fatBuffer)[offset+i]&0x0fffffff;
+		}else{
+			next=((unsigned int*)fatBuffer)[offset+i];
+			if(next>=0xfff8) next=FAT_EOC;
+		}
+		lru->next[i]=next;
+	}
+	lru->first=first;
+	lru->age=0;
+	return lru->next[cluster-first];
+}
+
+static void FatOpenCluster(FatFile *file,unsigned long cluster,unsigned long size){
+	file->firstCluster=cluster;
+	file->cluster=cluster;
+	file->clusterIndex=0;
+	file->fileSize=size;
+	file->position=0;
+}
+
+static void FatOpenRoot(FatFile *file){
+	if(fatType==32){
+		FatOpenCluster(file,rootDirCluster,0xffffffff);
+	}else{
+		FatOpenCluster(file,0,maxRootDirectoryEntries*32);
+	}
+}
+
+/*
+ * Returns the sector holding the current position of the file, following
+ * the cluster chain from the last position (or from the start when going
+ * backwards). Returns -1 at the end of the file.
+ */
+long FatFileSector(FatFile *file){
+	unsigned long index;
+
+	if(file->position>=file->fileSize) return -1;
+	if(file->firstCluster==0) return dirTableSector+(file->position>>9);
+
+	index=file->position>>(9+clusterShift);
+	if(index<file->clusterIndex){
+		file->cluster=file->firstCluster;
+		file->clusterIndex=0;
+	}
+	while(file->clusterIndex<index){
+		file->cluster=FatNextCluster(file->cluster);
+		if(file->cluster<2 || file->cluster>=FAT_EOC){
+			file->cluster=file->firstCluster;
+			file->clusterIndex=0;
+			return -1;
+		}
+		file->clusterIndex++;
+	}
+	return ClusterToSector(file->cluster)+((file->position>>9)&(sectorsPerCluster-1));
+}
+
+uint8_t FatSeek(FatFile *file,unsigned long position){
+	if(position>file->fileSize) return FAT_ERROR_EOF;
+	file->position=position;
+	return FAT_ERROR_NONE;
+}
+
+/*
+ * Copies up to count bytes from the file, returns the number of bytes read.
+ * Each data sector is read once, even with reads smaller than a sector.
+ */
+unsigned int FatRead(FatFile *file,uint8_t *dest,unsigned int count){
+	unsigned int done=0,offset,len;
+	long sector;
+
+	while(done<count){
+		sector=FatFileSector(file);
+		if(sector<0 || mmc_readsector(sector)!=0) break;
+
+		offset=file->position&511;
+		len=512-offset;
+		if(len>count-done) len=count-done;
+		if(len>file->fileSize-file->position) len=file->fileSize-file->position;
+
+		memcpy(dest+done,fatBuffer+offset,len);
+		done+=len;
+		file->position+=len;
+	}
+	return done;
+}
+
+/*
+ * Overwrites up to count bytes of the file from its position, returns the
+ * number of bytes written. The file keeps its size and clusters, the FAT
+ * and the directory are not changed: create the file large enough on the
+ * PC. Sectors only partly written are read first.
+ */
+unsigned int FatWrite(FatFile *file,const uint8_t *src,unsigned int count){
+	unsigned int done=0,offset,len;
+	long sector;
+
+	while(done<count){
+		sector=FatFileSector(file);
+		if(sector<0) break;
+
+		offset=file->position&511;
+		len=512-offset;
+		if(len>count-done) len=count-done;
+		if(len>file->fileSize-file->position) len=file->fileSize-file->position;
+		if(len<512 && mmc_readsector(sector)!=0) break;
+
+		memcpy(fatBuffer+offset,src+done,len);
+		if(mmc_writesector(sector)!=0) break;
+		done+=len;
+		file->position+=len;
+	}
+	return done;
+}
+
+/*
+ * Returns the next entry of a directory, skipping deleted entries, long
+ * file names and the volume label.
+ */
+uint8_t FatReadDir(FatFile *dir,DirectoryTableEntry *entry){
+	DirectoryTableEntry *e;
+	long sector;
+
+	while((sector=FatFileSector(dir))>=0){
+		if(mmc_readsector(sector)!=0) return FAT_ERROR_IO;
+
+		e=(DirectoryTableEntry*)(fatBuffer+(dir->position&511));
+		if(e->filename[0]==0) break;	//end of directory
+		dir->position+=32;
+
+		if(e->filename[0]==0xe5 || (e->fileAttributes&FAT_ATTR_VOLUME)) continue;
+		memcpy(entry,e,sizeof(DirectoryTableEntry));
+		return FAT_ERROR_NONE;
+	}
+	return FAT_ERROR_NOT_FOUND;
+}
+
+/*
+ * Opens a file or directory from a path like "DATA/LEVEL1.MAP", in 8.3
+ * names, not case sensitive. An empty path opens the root directory.
+ */
+uint8_t FatOpen(FatFile *file,const char *path){
+	DirectoryTableEntry entry;
+	unsigned char name[11];
+	unsigned char i,limit,c,err;
+	unsigned long cluster;
+
+	if(fatType==0) return FAT_ERROR_NO_FAT;
+
+	FatOpenRoot(file);
+	while(*path!=0){
+		if(*path=='/'){
+			path++;
+			continue;
+		}
+
+		//space padded 8.3 name of the next path component
+		memset(name,' ',11);
+		for(i=0,limit=8;*path!=0 && *path!='/';path++){
+			c=*path;
+			if(c=='.' && i>0 && name[0]!='.'){
+				i=8;
+				limit=11;
+				continue;
+			}
+			if(c>='a' && c<='z') c-=('a'-'A');
+			if(i<limit) name[i++]=c;
+		}
+
+		do{
+			err=FatReadDir(file,&entry);
+			if(err!=FAT_ERROR_NONE) return err;
+		}while(memcmp(entry.filename,name,11)!=0);
+
+		cluster=EntryCluster(&entry);
+		if(entry.fileAttributes&FAT_ATTR_DIRECTORY){
+			if(cluster==0) FatOpenRoot(file);	//".." of a first level directory
+			else FatOpenCluster(file,cluster,0xffffffff);
+		}else{
+			if(*path!=0) return FAT_ERROR_NOT_FOUND;
+			FatOpenCluster(file,cluster,entry.fileSize);
+		}
+	}
+	return FAT_ERROR_NONE;
+}
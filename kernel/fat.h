@@ -40,7 +40,7 @@
 		unsigned int creationTime;
 		unsigned int creationDate;
 		unsigned int lastAccessDate;
-		unsigned int eaIndex;
+		unsigned int eaIndex;		//FAT32: high word of firstCluster
 		unsigned int lastModifiedTime;
 		unsigned int lastModifiedDate;
 		unsigned int firstCluster;
@@ -96,6 +96,28 @@
 
 	} BootRecord;
 
+	//FAT32 boot record, same as BootRecord up to totalSectors
+	typedef struct {
+		unsigned char jmp[3];
+		unsigned char oemName[8];
+		unsigned int bytesPerSector;
+		unsigned char sectorsPerCluster;
+		unsigned int reservedSectors;
+		unsigned char fatCopies;
+		unsigned int maxRootDirectoryEntries;	//0
+		unsigned int totalSectorsLegacy;
+		unsigned char mediaDescriptor;
+		unsigned int sectorsPerFat;				//0
+		unsigned int sectorPerTrack;
+		unsigned int numbersOfHeads;
+		unsigned long hiddenSectors;
+		unsigned long totalSectors;
+		unsigned long sectorsPerFat32;
+		unsigned int flags;
+		unsigned int version;
+		unsigned long rootDirectoryCluster;
+	} BootRecord32;
+
 /*
 	union SectorData {
 		unsigned char buffer[512];
@@ -112,6 +134,21 @@
 		unsigned long fileSize;	
 	} File;
 
+	//an open file or directory, see FatOpen()
+	typedef struct{
+		unsigned long firstCluster;	//0=FAT16 root directory
+		unsigned long fileSize;		//0xffffffff for directories
+		unsigned long position;		//byte offset of the next read
+		unsigned long cluster;		//cluster holding position
+		unsigned long clusterIndex;	//index of that cluster in the chain
+	} FatFile;
+
+	#define FAT_ERROR_NONE		0
+	#define FAT_ERROR_IO		1
+	#define FAT_ERROR_NO_FAT	2	//no FAT16/FAT32 partition
+	#define FAT_ERROR_NOT_FOUND	3
+	#define FAT_ERROR_EOF		4	//position past the end or broken chain
+
 	/*
 	 * Functions
 	 */
@@ -120,4 +157,13 @@
 	unsigned char LoadFiles(File *destFiles);
 	uint8_t InitFat(unsigned char *buffer);
 
+	uint8_t FatMount(void);
+	uint8_t FatOpen(FatFile *file,const char *path);
+	uint8_t FatReadDir(FatFile *dir,DirectoryTableEntry *entry);
+	uint8_t FatSeek(FatFile *file,unsigned long position);
+	long FatFileSector(FatFile *file);
+	unsigned int FatRead(FatFile *file,uint8_t *dest,unsigned int count);
+	unsigned int FatWrite(FatFile *file,const uint8_t *src,unsigned int count);
+	unsigned long FatNextCluster(unsigned long cluster);
+
 #endif
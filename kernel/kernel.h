@@ -84,6 +84,7 @@
 
 	typedef void (*PatchCommand)(unsigned char channel, char value);
 	typedef void (*VsyncCallBackFunc)(void);
+	typedef bool (*IdleJobFunc)(void);
 
 	struct TrackStruct
 	{
@@ -111,6 +112,10 @@
 		bool patchEnvelopeHold;
 		const char *patchCommandStreamPos;
 
+		unsigned int slidePitch;		//8:8 note while sliding, see SetVoicePitchTarget()
+		unsigned char slideTarget;
+		unsigned char slideRate;		//1/16 semitone per frame, 0=not sliding
+
 	};
 
 
@@ -128,6 +133,9 @@
 	extern unsigned char uart_rx_buf_start;
 	extern unsigned char uart_rx_buf_end;
 	extern unsigned char uart_rx_buf[];
+	extern volatile unsigned char uart_tx_buf_start;
+	extern volatile unsigned char uart_tx_buf_end;
+	extern unsigned char uart_tx_buf[];
 
 	struct  PatchStruct{   
    		unsigned char type;
@@ -137,6 +145,30 @@
 		unsigned int loopEnd;   		       
 	}; 
 
+	//optional per patch fx allocation info, see SetFxInfoTable()
+	struct FxInfoStruct{
+		unsigned char priority;		//1=lowest, fx only steal voices of same or lower priority
+		unsigned char voices;		//max simultaneous instances, 0=unlimited
+		unsigned char channels;		//mask of allowed channels, see FX_CHANNEL()
+	};
+
+	//per frame CPU usage, filled when KERNEL_FRAME_STATS==1
+	struct KernelFrameStats{
+		unsigned int cycles[FS_STAGES];	//cycles used by each vsync stage in the last frame
+		unsigned int peak[FS_STAGES];	//max since ResetFrameStats()
+		unsigned long game;				//cycles left for the program and the rendering in the last frame
+		unsigned int frames;
+	};
+
+	extern unsigned long GetFrameCycles(void);
+	extern unsigned long GetLineStartCycles(unsigned char line);
+	extern void NewIdleJobsFrame(void);
+	extern void ProcessEepromQueue(void);
+	extern void EepromBuildDirectory(void);
+	extern void FrameStatsBegin(void);
+	extern void FrameStatsMark(unsigned char stage);
+	extern void FrameStatsEnd(void);
+
 	extern void SetColorBurstOffset(unsigned char offset);
 	void ProcessMouseMovement(void);
 	void ProcessFading();
@@ -22,6 +22,11 @@
 #pragma once
 
 extern uint8_t mmc_readsector(uint32_t lba);
+extern uint8_t mmc_writesector(uint32_t lba);
+extern void mmc_invalidate(void);
+extern uint8_t mmc_stream_open(uint32_t lba);
+extern uint16_t mmc_stream_read(uint8_t *buf, uint16_t count);
+extern void mmc_stream_close(void);
 extern uint8_t mmc_init(uint8_t *buffer);
 extern void mmc_send_command(uint8_t command, uint16_t px, uint16_t py);
 extern uint8_t mmc_datatoken(void);
@@ -26,6 +26,9 @@
 #define CMD_RESET 0
 #define CMD_INIT 1
 #define CMD_READBLOCK 17
+#define CMD_WRITEBLOCK 24
+#define CMD_STOPTRANSMISSION 12
+#define CMD_READMULTIBLOCK 18
 
 
 .global spi_byte
@@ -35,11 +38,17 @@
 .global mmc_send_command
 .global mmc_init
 .global mmc_readsector
+.global mmc_writesector
+.global mmc_invalidate
+.global mmc_stream_open
+.global mmc_stream_read
+.global mmc_stream_close
 
 
 .section .bss
 	sector_buffer_ptr:	.word 1  ;pointer to sector buffer (at least 512 bytes)
 	last_sector:		.space 4 ;used for caching
+	stream_left:		.word 1  ;bytes left in the current block of a stream
 
 .section .text
 
@@ -246,6 +255,22 @@ mmcinit_cmd1_done:
 
 	clr r24   
     ret
+
+;
+; void mmc_invalidate(void)
+;------------------------
+; Forgets the sector held in the buffer, for callers that reuse the
+; buffer between reads.
+;
+; C callable
+.section .text.mmc_invalidate
+mmc_invalidate:
+	ser r24
+	sts last_sector+0,r24
+	sts last_sector+1,r24
+	sts last_sector+2,r24
+	sts last_sector+3,r24
+	ret
   
 ;
 ; mmc_readsector
@@ -324,3 +349,267 @@ mmc_readsector_end:
     clr r24
     ret
 
+
+;
+; uint8_t mmc_writesector(uint32_t lba)
+;------------------------
+; Writes the sector buffer to the specified sector (CMD24) and waits
+; until the card has programmed it. The buffer then holds that sector
+; for mmc_readsector(). Do not call while a stream is open.
+;
+; C callable
+; r25:r24:r23:r22 = LBA sector (32 bit)
+; return: 0 on success, 0xff on error
+.section .text.mmc_writesector
+mmc_writesector:
+	sts last_sector+0,r22
+	sts last_sector+1,r23
+	sts last_sector+2,r24
+	sts last_sector+3,r25
+
+	;byte address, same as mmc_readsector
+	clr r20
+	mov r21,r22
+	mov r22,r23
+	mov r23,r24
+	clc
+	rol r21
+	rol r22
+	rol r23
+
+	ldi r24,CMD_WRITEBLOCK
+	rcall mmc_send_command
+
+	;R1 response within 8 bytes, 0 = accepted
+	ldi r30,9
+mmc_writesector_r1:
+	dec r30
+	breq mmc_writesector_error
+	rcall spibyte_ff
+	sbrc r24,7
+	rjmp mmc_writesector_r1
+	tst r24
+	brne mmc_writesector_error
+
+	rcall spibyte_ff		;one byte gap before the token
+	ldi r24,0xfe
+	rcall spi_byte
+
+	lds XH,sector_buffer_ptr+0
+	lds XL,sector_buffer_ptr+1
+
+	ldi r30,lo8(512)
+	ldi r31,hi8(512)
+mmc_writesector_loop:
+	ld r24,X+
+	rcall spi_byte
+	sbiw r30,1
+	brne mmc_writesector_loop
+
+	;dummy checksum
+	rcall spibyte_ff
+	rcall spibyte_ff
+
+	;data response xxx00101 = accepted
+	rcall spibyte_ff
+	andi r24,0x1f
+	cpi r24,0x05
+	brne mmc_writesector_error
+
+	;the card holds MISO low while busy, up to ~250ms
+	ldi r18,4
+	ser r30
+	ser r31
+mmc_writesector_busy:
+	rcall spibyte_ff
+	cpi r24,0
+	brne mmc_writesector_done
+	sbiw r30,1
+	brne mmc_writesector_busy
+	dec r18
+	brne mmc_writesector_busy
+
+mmc_writesector_error:
+	rcall mmc_clock_and_release
+	rcall mmc_invalidate
+	ldi r24,0xff
+	ret
+
+mmc_writesector_done:
+	rcall mmc_clock_and_release
+	clr r24
+	ret
+
+
+;
+; uint8_t mmc_stream_open(uint32_t lba)
+;------------------------
+; Starts a multiple block read (CMD18) at the specified sector. The card
+; keeps sending the following sectors until mmc_stream_close(), without
+; a command and access time per sector. The card stays selected, do not
+; call mmc_readsector() while a stream is open. "make mmcbench" in tools/
+; times both paths on a model of the card.
+;
+; C callable
+; r25:r24:r23:r22 = LBA sector (32 bit)
+; return: 0 on success, 0xff on error
+.section .text.mmc_stream_open
+mmc_stream_open:
+
+	;byte address, same as mmc_readsector
+	clr r20
+	mov r21,r22
+	mov r22,r23
+	mov r23,r24
+	clc
+	rol r21
+	rol r22
+	rol r23
+
+	ldi r24,CMD_READMULTIBLOCK
+	rcall mmc_send_command
+
+	rcall mmc_datatoken
+	cpi r24,0xfe
+	breq mmc_stream_open_gotdata
+
+	;error!
+	rcall mmc_clock_and_release
+	ldi r24,0xff
+	ret
+
+mmc_stream_open_gotdata:
+	ldi r24,lo8(512)
+	ldi r25,hi8(512)
+	sts stream_left+0,r24
+	sts stream_left+1,r25
+	clr r24
+	ret
+
+
+;
+; uint16_t mmc_stream_read(uint8_t *buf, uint16_t count)
+;------------------------
+; Reads the next count bytes of an open stream, any size, crossing
+; sectors as needed. The transfer loop does not poll SPIF: at SPI
+; clock/2 a byte takes 16 cycles, so SPDR is read a fixed 17 cycles
+; after it is written (22 cycles per byte instead of ~33 for spi_byte).
+;
+; C callable
+; r25:r24 = destination buffer
+; r23:r22 = byte count
+; return: bytes read, less than count on error
+.section .text.mmc_stream_read
+mmc_stream_read:
+	movw XL,r24
+	movw r20,r22		;keep count for the return value
+	ldi r25,0xff
+
+mmc_stream_read_block:
+	cp r22,r1
+	cpc r23,r1
+	breq mmc_stream_read_end
+
+	;end of a sector: skip its CRC and wait for the next one
+	lds r30,stream_left+0
+	lds r31,stream_left+1
+	cp r30,r1
+	cpc r31,r1
+	brne mmc_stream_read_chunk
+
+	rcall spibyte_ff
+	rcall spibyte_ff
+	rcall mmc_datatoken
+	cpi r24,0xfe
+	brne mmc_stream_read_end
+	ldi r30,lo8(512)
+	ldi r31,hi8(512)
+
+mmc_stream_read_chunk:
+	;chunk=min(count,left)
+	movw r18,r30
+	cp r22,r18
+	cpc r23,r19
+	brsh .+2
+	movw r18,r22
+
+	sub r30,r18
+	sbc r31,r19
+	sts stream_left+0,r30
+	sts stream_left+1,r31
+	sub r22,r18
+	sbc r23,r19
+
+mmc_stream_read_loop:
+	out _SFR_IO_ADDR(SPDR),r25	;1  start the transfer
+	subi r18,1					;1
+	sbci r19,0					;1
+	nop							;14 wait for the 16 cycles transfer,
+	nop							;   nop, in and st leave SREG alone
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	nop
+	in r24,_SFR_IO_ADDR(SPDR)	;1
+	st X+,r24					;2
+	brne mmc_stream_read_loop	;2
+
+	;SPIF is still set, clear it for spi_byte by reading SPSR then SPDR
+	in r24,_SFR_IO_ADDR(SPSR)
+	in r24,_SFR_IO_ADDR(SPDR)
+	rjmp mmc_stream_read_block
+
+mmc_stream_read_end:
+	;bytes read = count - bytes not read
+	sub r20,r22
+	sbc r21,r23
+	movw r24,r20
+	ret
+
+
+;
+; void mmc_stream_close(void)
+;------------------------
+; Stops the multiple block read (CMD12) and releases the card.
+;
+; C callable
+.section .text.mmc_stream_close
+mmc_stream_close:
+	ldi r24,CMD_STOPTRANSMISSION
+	ldi r23,0x00
+	ldi r22,0x00
+	ldi r21,0x00
+	ldi r20,0x00
+	rcall mmc_send_command		;also skips the stuff byte
+
+	;wait for the R1 response (bit 7 clear)...
+	ser r30
+mmc_stream_close_r1:
+	dec r30
+	breq mmc_stream_close_release
+	rcall spibyte_ff
+	sbrc r24,7
+	rjmp mmc_stream_close_r1
+
+	;...then for the end of the busy state
+	ser r30
+	ser r31
+mmc_stream_close_busy:
+	sbiw r30,1
+	breq mmc_stream_close_release
+	rcall spibyte_ff
+	cpi r24,0xff
+	brne mmc_stream_close_busy
+
+mmc_stream_close_release:
+	sts stream_left+0,r1
+	sts stream_left+1,r1
+	rjmp mmc_clock_and_release
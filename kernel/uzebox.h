@@ -91,6 +91,7 @@
 	extern unsigned char GetMouseY();
 	extern unsigned int GetActionButton();
 	extern unsigned char DetectControllers();
+	extern u8 ReadPowerSwitch();
 	void ReadControllers(); //use only if CONTROLLERS_READ_MASTER=1
 
 
@@ -108,12 +109,25 @@
 	extern void FormatEeprom(void);
 	extern void FormatEeprom2(u16 *ids, u8 count);
 
+	/*
+	 * EEPROM write queue, EEPROM_WRITE_QUEUE must be >0.
+	 * EepromWriteBlock() returns at once and the block is written one
+	 * byte per vsync. When the queue is full it returns EEPROM_ERROR_BUSY
+	 * and writes nothing. WaitVsync() flushes the queue when the power
+	 * switch is pressed.
+	 */
+	extern bool EepromWritePending(void);
+	extern void EepromFlush(void);
+
 	/*
 	 * Sound Engine functions
 	 */	
 	extern void SetMasterVolume(unsigned char vol);		//global player volume
 	extern void TriggerNote(unsigned char channel,unsigned char patch,unsigned char note,unsigned char volume);
 	extern void TriggerFx(unsigned char patch,unsigned char volume, bool retrig); //uses a simple voice stealing algorithm
+	extern void SetVoicePitchTarget(unsigned char channel,unsigned char note,unsigned char slideRate); //glide without retriggering the patch
+	extern void SetVoiceVolume(unsigned char channel,unsigned char volume); //note volume without retriggering the patch
+	extern void SetFxInfoTable(const struct FxInfoStruct *fxInfoParam); //per patch priority/polyphony/channels, NULL=defaults
 	extern void StopSong();
 	extern void StartSong(const char *midiSong);
 	extern void ResumeSong();
@@ -129,12 +143,72 @@
 	extern unsigned char UartUnreadCount();
 	extern unsigned char UartReadChar();
 
+	/*
+	 * UART TX buffer, UART_TX_BUFFER must be 1.
+	 * UartWrite() returns the number of bytes that fit in the buffer, the
+	 * others are counted in uartTxDropped and the call in uartTxOverruns.
+	 */
+	extern void UartInitTxBuffer();
+	extern unsigned char UartWrite(const void *buf,unsigned char count);
+	extern bool UartWriteChar(unsigned char data);
+	extern unsigned char UartTxFree();
+	extern unsigned int uartTxDropped;
+	extern unsigned int uartTxOverruns;
+
 	/*
 	 * Misc functions
 	 */
 	extern void WaitUs(unsigned int microseconds);
 	extern void SoftReset(void);
 
+	/*
+	 * Frame stats, KERNEL_FRAME_STATS must be 1.
+	 * Read frameStats after WaitVsync(), it is updated in the vsync interrupt,
+	 * or copy it whole with GetFrameStats() at any time.
+	 */
+	extern struct KernelFrameStats frameStats;
+	extern void GetFrameStats(struct KernelFrameStats *stats);
+	extern void ResetFrameStats(void);
+	extern void DumpFrameStats(void);	//one text line over the UART at 115200 bauds
+
+	/*
+	 * Stack high water mark, STACK_PAINT must be 1.
+	 * Both scan the painted RAM, ~5 cycles per free byte.
+	 */
+	extern unsigned int GetStackHighWater(void);	//deepest stack use in bytes since reset
+	extern unsigned int GetStackFree(void);		//painted bytes never reached by the stack
+
+	/*
+	 * Idle jobs, IDLE_JOBS must be >0.
+	 * A job runs at most once per frame inside WaitVsync(), only if its
+	 * cycles estimate fits before the next vsync. It returns true to be
+	 * called again on later frames, false when its work is done.
+	 */
+	extern char AddIdleJob(IdleJobFunc job,unsigned int cycles);
+	extern void RemoveIdleJob(IdleJobFunc job);
+	extern void RunIdleJobs(void);
+
+	/*
+	 * Joypad input recorder, INPUT_RECORDER must be 1.
+	 * InputRecordStart() seeds rand() and logs ReadJoypad(0/1) from the
+	 * next vsync in inputLog (INPUT_LOG_SIZE bytes), recording stops when
+	 * it is full. InputReplayStart() seeds rand() from a log and feeds it
+	 * to ReadJoypad() until its end. Start both just after WaitVsync() so
+	 * the same frames of the game see the same buttons. To keep a log on
+	 * the SD card, FatWrite() it in a file created with enough room.
+	 */
+	extern void InputRecordStart(unsigned int seed);
+	extern unsigned int InputRecordStop(void);	//returns the log size
+	extern void InputReplayStart(const u8 *log,bool inFlash);
+	extern void InputReplayStop(void);
+	extern u8 GetInputRecorderState(void);
+	extern unsigned int ReadPhysicalJoypad(unsigned char joypadNo);	//the joypads during a replay
+	extern char InputLogSaveEeprom(unsigned int firstId);	//blocks firstId, firstId+1...
+	extern char InputLogLoadEeprom(unsigned int firstId);
+	extern void InputLogSend(void);
+	extern u8 inputLog[];
+	extern unsigned int inputLogSize;
+
 	extern void SetUserPreVsyncCallback(VsyncCallBackFunc);
 	extern void SetUserPostVsyncCallback(VsyncCallBackFunc);
 
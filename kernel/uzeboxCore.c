@@ -21,6 +21,7 @@
 #include <stdbool.h>
 #include <avr/io.h>
 #include <stdlib.h>
+#include <string.h>
 #include <avr/pgmspace.h>
 #include <avr/interrupt.h>
 #include <avr/wdt.h>
@@ -36,6 +37,9 @@ extern void InitializeVideoMode();
 
 
 void ReadButtons();
+#if INPUT_RECORDER == 1
+	void InputRecorderFrame(void);
+#endif
 
 
 extern unsigned char sync_phase;
@@ -63,6 +67,11 @@ extern unsigned char sound_enabled;
 u8 joypadsConnectionStatus;
 bool snesMouseEnabled=false;
 
+#if EEPROM_BLOCK_DIRECTORY == 1
+	unsigned char eepromDirectory[64];	//hash of each block id, 0=free block
+	bool eepromFormatted;
+#endif
+
 const u8 eeprom_format_table[] PROGMEM ={(u8)EEPROM_SIGNATURE,		//(u16)
 								   (u8)(EEPROM_SIGNATURE>>8),	//
 								   EEPROM_HEADER_VER,			//(u8)				
@@ -118,6 +127,9 @@ void SetRenderingParameters(u8 firstScanlineToRender, u8 scanlinesToRender){
 void Initialize(void){
 	int i;
 
+	#if EEPROM_BLOCK_DIRECTORY == 1
+		EepromBuildDirectory();
+	#endif
 	if(!isEepromFormatted()) FormatEeprom();
 
 	cli();
@@ -153,6 +165,10 @@ void Initialize(void){
 		UBRR0L=56; //31250 bauds (.5% error)
 	#endif
 
+	#if UART_TX_BUFFER == 1
+		UartInitTxBuffer();
+	#endif
+
 	
 	//stop timers
 	TCCR1B=0;
@@ -290,6 +306,10 @@ void ReadButtons(){
 		SoftReset();
 	}
 
+	#if INPUT_RECORDER == 1
+		InputRecorderFrame();
+	#endif
+
 }
 
 void ReadControllers(){
@@ -583,7 +603,10 @@ void FormatEeprom(void) {
 	  WriteEeprom(i,(u8)EEPROM_FREE_BLOCK);
 	  WriteEeprom(i+1,(u8)(EEPROM_FREE_BLOCK>>8));
    }
-   
+
+   #if EEPROM_BLOCK_DIRECTORY == 1
+	  EepromBuildDirectory();
+   #endif
 }
 
 // Format eeprom, saving data specified in ids
@@ -610,13 +633,21 @@ void FormatEeprom2(u16 *ids, u8 count) {
 		 WriteEeprom(i*EEPROM_BLOCK_SIZE+1,(u8)(EEPROM_FREE_BLOCK>>8));
 	  }
    }
+
+   #if EEPROM_BLOCK_DIRECTORY == 1
+	  EepromBuildDirectory();
+   #endif
 }
 	
 //returns true if the EEPROM has been setup to work with the kernel.
 bool isEepromFormatted(){
-	unsigned id;
-	id=ReadEeprom(0)+(ReadEeprom(1)<<8);
-	return (id==EEPROM_SIGNATURE);
+	#if EEPROM_BLOCK_DIRECTORY == 1
+		return eepromFormatted;
+	#else
+		unsigned id;
+		id=ReadEeprom(0)+(ReadEeprom(1)<<8);
+		return (id==EEPROM_SIGNATURE);
+	#endif
 }
 
 /*
@@ -628,38 +659,211 @@ u8 ReadPowerSwitch(){
 	return !((PIND&((1<<PD3)+(1<<PD2)))==((1<<PD3)+(1<<PD2)));
 }
 
+/*
+ * EEPROM write queue. The vsync interrupt writes one byte per frame
+ * (a write takes 3.4ms), skipping bytes that are already up to date.
+ * An EE_READY interrupt is not used since it would add jitter to the
+ * video interrupt. The main program sets eepromQueueLock while it reads
+ * the EEPROM so the vsync does not change EEAR under its feet.
+ */
+#if EEPROM_WRITE_QUEUE > 0
+
+	struct EepromQueueStruct{
+		unsigned int addr;		//destination, 0=free entry
+		unsigned char pos;		//next byte to write
+		struct EepromBlockStruct block;
+	};
+
+	struct EepromQueueStruct eepromQueue[EEPROM_WRITE_QUEUE];
+	volatile unsigned char eepromQueueLock;
+
+	#define EepromLock() eepromQueueLock++
+	#define EepromUnlock() eepromQueueLock--
+
+	//writes the next byte that differs, returns false when the entry is done
+	static bool EepromQueueWriteNext(struct EepromQueueStruct *q){
+		unsigned char *src=(unsigned char *)&q->block;
+		unsigned char c;
+
+		while(q->pos<EEPROM_BLOCK_SIZE){
+			c=src[q->pos];
+			if(ReadEeprom(q->addr+q->pos)!=c){
+				WriteEeprom(q->addr+q->pos,c);
+				q->pos++;
+				return true;
+			}
+			q->pos++;
+		}
+		q->addr=0;
+		return false;
+	}
+
+	//called in the vsync interrupt
+	void ProcessEepromQueue(void){
+		if(eepromQueueLock || (EECR&(1<<EEPE))) return;
+
+		for(unsigned char i=0;i<EEPROM_WRITE_QUEUE;i++){
+			if(eepromQueue[i].addr!=0 && EepromQueueWriteNext(&eepromQueue[i])) return;
+		}
+	}
+
+	//true while some queued block is not completely written
+	bool EepromWritePending(void){
+		for(unsigned char i=0;i<EEPROM_WRITE_QUEUE;i++){
+			if(eepromQueue[i].addr!=0) return true;
+		}
+		return ((EECR&(1<<EEPE))!=0);
+	}
+
+	//writes all pending blocks now
+	void EepromFlush(void){
+		EepromLock();
+		for(unsigned char i=0;i<EEPROM_WRITE_QUEUE;i++){
+			if(eepromQueue[i].addr!=0){
+				while(EepromQueueWriteNext(&eepromQueue[i]));
+			}
+		}
+		EepromUnlock();
+	}
+
+	static struct EepromQueueStruct* EepromQueueFind(unsigned int id){
+		for(unsigned char i=0;i<EEPROM_WRITE_QUEUE;i++){
+			if(eepromQueue[i].addr!=0 && eepromQueue[i].block.id==id) return &eepromQueue[i];
+		}
+		return NULL;
+	}
+
+	static bool EepromQueueHasAddr(unsigned int addr){
+		for(unsigned char i=0;i<EEPROM_WRITE_QUEUE;i++){
+			if(eepromQueue[i].addr==addr) return true;
+		}
+		return false;
+	}
+
+	//the pending entry of the block id, else a free one, NULL when full
+	static struct EepromQueueStruct* EepromQueueEntry(unsigned int id){
+		struct EepromQueueStruct *q=EepromQueueFind(id);
+
+		if(q!=NULL) return q;
+		for(unsigned char i=0;i<EEPROM_WRITE_QUEUE;i++){
+			if(eepromQueue[i].addr==0) return &eepromQueue[i];
+		}
+		return NULL;
+	}
+
+#else
+	#define EepromLock()
+	#define EepromUnlock()
+#endif
+
+static unsigned int EepromBlockId(unsigned char block){
+	return ReadEeprom(block*EEPROM_BLOCK_SIZE)+(ReadEeprom((block*EEPROM_BLOCK_SIZE)+1)<<8);
+}
+
+/*
+ * EEPROM block directory: one hash byte per block, built at boot by
+ * EepromBuildDirectory() and updated by EepromWriteBlock(), so finding
+ * a block is a RAM scan plus one header read instead of reading the
+ * 64 headers.
+ */
+#if EEPROM_BLOCK_DIRECTORY == 1
+
+	static unsigned char EepromDirHash(unsigned int id){
+		unsigned char h;
+		if(id==EEPROM_FREE_BLOCK) return 0;
+		h=(id&0xff)^(id>>8);
+		return (h==0)?0x80:h;
+	}
+
+	void EepromBuildDirectory(void){
+		eepromFormatted=(EepromBlockId(0)==EEPROM_SIGNATURE);
+		eepromDirectory[0]=EepromDirHash(EEPROM_SIGNATURE);
+		for(unsigned char i=EEPROM_HEADER_SIZE;i<64;i++){
+			eepromDirectory[i]=eepromFormatted?EepromDirHash(EepromBlockId(i)):0;
+		}
+	}
+
+#endif
+
+//returns the address of the block or 0 if not found. EEPROM_FREE_BLOCK finds a free block.
+static unsigned int EepromFindBlock(unsigned int id){
+	#if EEPROM_BLOCK_DIRECTORY == 1
+		unsigned char hash=EepromDirHash(id);
+	#endif
+
+	for(unsigned char i=EEPROM_HEADER_SIZE;i<64;i++){
+		#if EEPROM_BLOCK_DIRECTORY == 1
+			if(eepromDirectory[i]!=hash) continue;
+			if(id!=EEPROM_FREE_BLOCK && EepromBlockId(i)!=id) continue;
+		#else
+			if(EepromBlockId(i)!=id) continue;
+		#endif
+		#if EEPROM_WRITE_QUEUE > 0
+			//free block already claimed by a pending write
+			if(id==EEPROM_FREE_BLOCK && EepromQueueHasAddr(i*EEPROM_BLOCK_SIZE)) continue;
+		#endif
+		return i*EEPROM_BLOCK_SIZE;
+	}
+	return 0;
+}
+
 /*
  * Write a data block in the specified block id. If the block does not exist, it is created.
+ * With EEPROM_WRITE_QUEUE the block is queued and written during the next frames.
+ * When the queue is full nothing is written and EEPROM_ERROR_BUSY is
+ * returned, call again once EepromWritePending() is false or a few
+ * frames later.
  *
  * Returns: 0 on success or error codes
  */
 char EepromWriteBlock(struct EepromBlockStruct *block){
-	unsigned char i,nextFreeBlock=0,c;
-	unsigned int destAddr=0,id;
-	unsigned char *srcPtr=(unsigned char *)block;
+	unsigned int destAddr=0;
 
-	if(!isEepromFormatted()) return EEPROM_ERROR_NOT_FORMATTED;
 	if(block->id==EEPROM_FREE_BLOCK || block->id==EEPROM_SIGNATURE) return EEPROM_ERROR_INVALID_BLOCK;
 
-	//scan all blocks and get the adress of that block or the next free one.
-	for(i=EEPROM_HEADER_SIZE;i<64;i++){
-		id=ReadEeprom(i*EEPROM_BLOCK_SIZE)+(ReadEeprom((i*EEPROM_BLOCK_SIZE)+1)<<8);
-		if(id==block->id){
-			destAddr=i*EEPROM_BLOCK_SIZE;
-			break;
-		}
-		if(id==0xffff && nextFreeBlock==0) nextFreeBlock=i;
+	EepromLock();
+	if(!isEepromFormatted()){
+		EepromUnlock();
+		return EEPROM_ERROR_NOT_FORMATTED;
 	}
 
-	if(destAddr==0 && nextFreeBlock==0) return EEPROM_ERROR_FULL;
-	if(nextFreeBlock!=0) destAddr=nextFreeBlock*EEPROM_BLOCK_SIZE;
+	#if EEPROM_WRITE_QUEUE > 0
+		//already pending: replace the data, else take a free entry
+		struct EepromQueueStruct *q=EepromQueueEntry(block->id);
+		if(q==NULL){
+			EepromUnlock();
+			return EEPROM_ERROR_BUSY;
+		}
+		destAddr=q->addr;
+	#endif
 
-	for(i=0;i<EEPROM_BLOCK_SIZE;i++){
-		c=*srcPtr;
-		WriteEeprom(destAddr++,c);
-		srcPtr++;	
+	//get the adress of that block or the next free one.
+	if(destAddr==0) destAddr=EepromFindBlock(block->id);
+	if(destAddr==0) destAddr=EepromFindBlock(EEPROM_FREE_BLOCK);
+	if(destAddr==0){
+		EepromUnlock();
+		return EEPROM_ERROR_FULL;
 	}
+
+	#if EEPROM_BLOCK_DIRECTORY == 1
+		eepromDirectory[destAddr/EEPROM_BLOCK_SIZE]=EepromDirHash(block->id);
+	#endif
+
+	#if EEPROM_WRITE_QUEUE > 0
+		memcpy(&q->block,block,sizeof(struct EepromBlockStruct));
+		q->pos=0;
+		q->addr=destAddr;
+	#else
+		//only write the bytes that changed
+		unsigned char *srcPtr=(unsigned char *)block;
+		for(unsigned char i=0;i<EEPROM_BLOCK_SIZE;i++){
+			if(ReadEeprom(destAddr)!=*srcPtr) WriteEeprom(destAddr,*srcPtr);
+			destAddr++;
+			srcPtr++;	
+		}
+	#endif
 	
+	EepromUnlock();
 	return 0;
 }
 
@@ -675,28 +879,39 @@ char EepromWriteBlock(struct EepromBlockStruct *block){
  */
 char EepromReadBlock(unsigned int blockId,struct EepromBlockStruct *block){
 	unsigned char i;
-	unsigned int destAddr=0xffff,id;
+	unsigned int destAddr;
 	unsigned char *destPtr=(unsigned char *)block;
 
-	if(!isEepromFormatted()) return EEPROM_ERROR_NOT_FORMATTED;
 	if(blockId==EEPROM_FREE_BLOCK) return EEPROM_ERROR_INVALID_BLOCK;
 
-	//scan all blocks and get the adress of that block
-	for(i=0;i<32;i++){
-		id=ReadEeprom(i*EEPROM_BLOCK_SIZE)+(ReadEeprom((i*EEPROM_BLOCK_SIZE)+1)<<8);
-		if(id==blockId){
-			destAddr=i*EEPROM_BLOCK_SIZE;
-			break;
-		}
+	EepromLock();
+	if(!isEepromFormatted()){
+		EepromUnlock();
+		return EEPROM_ERROR_NOT_FORMATTED;
 	}
 
-	if(destAddr==0xffff) return EEPROM_ERROR_BLOCK_NOT_FOUND;			
+	#if EEPROM_WRITE_QUEUE > 0
+		//pending writes hold the most recent data
+		struct EepromQueueStruct *q=EepromQueueFind(blockId);
+		if(q!=NULL){
+			memcpy(block,&q->block,sizeof(struct EepromBlockStruct));
+			EepromUnlock();
+			return 0;
+		}
+	#endif
+
+	destAddr=EepromFindBlock(blockId);
+	if(destAddr==0){
+		EepromUnlock();
+		return EEPROM_ERROR_BLOCK_NOT_FOUND;
+	}
 
 	for(i=0;i<EEPROM_BLOCK_SIZE;i++){
 		*destPtr=ReadEeprom(destAddr++);
 		destPtr++;	
 	}
 	
+	EepromUnlock();
 	return 0;
 }
 
@@ -734,3 +949,608 @@ char EepromReadBlock(unsigned int blockId,struct EepromBlockStruct *block){
 	}
 
 #endif
+
+
+/*
+ * UART Transmit buffer functions. The hsync code sends the byte at
+ * uart_tx_buf_start when the UART is ready. Both indexes hold the low
+ * byte of the address to save the hsync an addition, which is why the
+ * buffer is aligned on its size.
+ */
+#if UART_TX_BUFFER == 1
+
+	u8 uart_tx_buf[UART_TX_BUFFER_SIZE] __attribute__((aligned(UART_TX_BUFFER_SIZE)));
+	volatile u8 uart_tx_buf_start;
+	volatile u8 uart_tx_buf_end;
+	unsigned int uartTxDropped;
+	unsigned int uartTxOverruns;
+
+	#define UART_TX_BASE ((u8)(unsigned int)uart_tx_buf)
+
+	void UartInitTxBuffer(){
+		uart_tx_buf_start=UART_TX_BASE;
+		uart_tx_buf_end=UART_TX_BASE;
+		uartTxDropped=0;
+		uartTxOverruns=0;
+
+		UCSR0A=(1<<U2X0);
+		UBRR0=30; //115200 bauds (.2% error)
+		UCSR0C=(1<<UCSZ01)+(1<<UCSZ00);
+		UCSR0B|=(1<<TXEN0);
+	}
+
+	unsigned char UartTxFree(){
+		return (uart_tx_buf_start-uart_tx_buf_end-1)&(UART_TX_BUFFER_SIZE-1);
+	}
+
+	unsigned char UartWrite(const void *buf,unsigned char count){
+		const u8 *src=buf;
+		u8 end=uart_tx_buf_end,next,i;
+
+		for(i=0;i<count;i++){
+			next=UART_TX_BASE|((end+1)&(UART_TX_BUFFER_SIZE-1));
+			if(next==uart_tx_buf_start) break;	//full
+			uart_tx_buf[end&(UART_TX_BUFFER_SIZE-1)]=src[i];
+			end=next;
+		}
+		uart_tx_buf_end=end;
+
+		if(i<count){
+			uartTxDropped+=count-i;
+			uartTxOverruns++;
+		}
+		return i;
+	}
+
+	bool UartWriteChar(unsigned char data){
+		return UartWrite(&data,1)!=0;
+	}
+
+#endif
+
+
+/*
+ * Joypad input recorder. ReadButtons() logs the two joypads each frame
+ * while recording, or replaces them with the log while replaying. The
+ * physical buttons stay readable with ReadPhysicalJoypad().
+ *
+ * The log starts with the rand() seed (u16), then:
+ *  0nnnnnnn           the buttons are held n+1 frames
+ *  10p0kkkk           toggle button bit k of joypad p
+ *  10p1hhhh llllllll  toggle the 12 bit mask hhhhllllllll of joypad p
+ *  0xff               end
+ * The toggles apply before the next run. Both joypads start released.
+ * A match where a button changes every few frames takes ~1 byte per
+ * change, 2 bytes per second when they are held.
+ */
+#if INPUT_RECORDER == 1
+
+	#define INPUT_LOG_END		0xff
+	#define INPUT_LOG_TOGGLE	0x80
+	#define INPUT_LOG_MASK		0x90
+	#define INPUT_LOG_PAD2		0x20
+	#define INPUT_LOG_RUN_MAX	0x7f
+
+	volatile u8 inputRecorderState;
+	unsigned int joypadPhysical[2];
+
+	static unsigned int inputLogButtons[2];	//buttons after the last run
+	static const u8 *inputLogPtr;			//replay position
+	static bool inputLogInFlash;
+	static u8 inputLogRunLeft;				//frames left in the replayed run
+
+	#if INPUT_LOG_SIZE > 0
+		u8 inputLog[INPUT_LOG_SIZE];
+		unsigned int inputLogSize;
+		static unsigned int inputLogRunAt;	//index of the run being recorded, 0=none
+		#if INPUT_RECORDER_UART == 1
+			static unsigned int inputLogSent;
+		#endif
+
+		static void InputLogPut(u8 c){
+			inputLog[inputLogSize++]=c;
+		}
+
+		static void InputLogClose(void){
+			inputRecorderState=INPUT_IDLE;
+			InputLogPut(INPUT_LOG_END);
+		}
+
+		static void InputLogToggle(u8 pad,unsigned int diff){
+			u8 k;
+
+			if(diff==0) return;
+			if((diff&(diff-1))==0){
+				for(k=0;!(diff&1);k++) diff>>=1;
+				InputLogPut(INPUT_LOG_TOGGLE|pad|k);
+			}else{
+				InputLogPut(INPUT_LOG_MASK|pad|(diff>>8));
+				InputLogPut(diff&0xff);
+			}
+		}
+
+		static void InputRecordFrame(void){
+			unsigned int b1=joypad1_status_lo&0x0fff,b2=joypad2_status_lo&0x0fff;
+
+			if(inputLogRunAt!=0 && b1==inputLogButtons[0] && b2==inputLogButtons[1] &&
+				inputLog[inputLogRunAt]<INPUT_LOG_RUN_MAX){
+				inputLog[inputLogRunAt]++;
+				return;
+			}
+
+			//room for two masks, the run and the end
+			if(inputLogSize>INPUT_LOG_SIZE-6){
+				InputLogClose();
+				return;
+			}
+
+			InputLogToggle(0,b1^inputLogButtons[0]);
+			InputLogToggle(INPUT_LOG_PAD2,b2^inputLogButtons[1]);
+			inputLogButtons[0]=b1;
+			inputLogButtons[1]=b2;
+			inputLogRunAt=inputLogSize;
+			InputLogPut(0);
+		}
+
+		void InputRecordStart(unsigned int seed){
+			inputRecorderState=INPUT_IDLE;
+			inputLog[0]=seed;
+			inputLog[1]=seed>>8;
+			inputLogSize=2;
+			inputLogRunAt=0;
+			inputLogButtons[0]=0;
+			inputLogButtons[1]=0;
+			#if INPUT_RECORDER_UART == 1
+				inputLogSent=0;
+			#endif
+			srand(seed);
+			inputRecorderState=INPUT_RECORDING;
+		}
+
+		unsigned int InputRecordStop(void){
+			unsigned char sreg=SREG;
+
+			cli();
+			if(inputRecorderState==INPUT_RECORDING) InputLogClose();
+			SREG=sreg;
+			return inputLogSize;
+		}
+
+		/*
+		 * The log in consecutive blocks from firstId, its size in the
+		 * first two bytes. Returns the EepromWriteBlock() error. A log
+		 * longer than the write queue waits for the queue to drain.
+		 */
+		char InputLogSaveEeprom(unsigned int firstId){
+			struct EepromBlockStruct block;
+			unsigned int pos=0,len;
+			unsigned char at=2;
+			char err;
+
+			block.id=firstId;
+			block.data[0]=inputLogSize;
+			block.data[1]=inputLogSize>>8;
+			do{
+				len=inputLogSize-pos;
+				if(len>sizeof(block.data)-at) len=sizeof(block.data)-at;
+				memset(block.data+at,INPUT_LOG_END,sizeof(block.data)-at);
+				memcpy(block.data+at,inputLog+pos,len);
+				pos+=len;
+				err=EepromWriteBlock(&block);
+				#if EEPROM_WRITE_QUEUE > 0
+					if(err==EEPROM_ERROR_BUSY){
+						EepromFlush();
+						err=EepromWriteBlock(&block);
+					}
+				#endif
+				if(err!=0) return err;
+				block.id++;
+				at=0;
+			}while(pos<inputLogSize);
+			return 0;
+		}
+
+		char InputLogLoadEeprom(unsigned int firstId){
+			struct EepromBlockStruct block;
+			unsigned int pos=0,size,len;
+			unsigned char at=2;
+			char err;
+
+			inputRecorderState=INPUT_IDLE;
+			err=EepromReadBlock(firstId,&block);
+			if(err!=0) return err;
+			size=block.data[0]|(block.data[1]<<8);
+			if(size<3 || size>INPUT_LOG_SIZE) return EEPROM_ERROR_INVALID_BLOCK;
+
+			for(;;){
+				len=size-pos;
+				if(len>sizeof(block.data)-at) len=sizeof(block.data)-at;
+				memcpy(inputLog+pos,block.data+at,len);
+				pos+=len;
+				if(pos>=size) break;
+				err=EepromReadBlock(++firstId,&block);
+				if(err!=0) return err;
+				at=0;
+			}
+			inputLogSize=size;
+			#if INPUT_RECORDER_UART == 1
+				inputLogSent=size;
+			#endif
+			return 0;
+		}
+
+		#if INPUT_RECORDER_UART == 1
+			//sends the bytes of the log that will not change, from WaitVsync()
+			void InputLogSend(void){
+				unsigned int end=inputLogSize,len;
+
+				if(inputRecorderState==INPUT_RECORDING && inputLogRunAt!=0) end=inputLogRunAt;
+				if(inputLogSent>=end) return;
+				len=end-inputLogSent;
+				if(len>255) len=255;
+				inputLogSent+=UartWrite(inputLog+inputLogSent,len);
+			}
+		#endif
+	#endif
+
+	static u8 InputLogNext(void){
+		u8 c=inputLogInFlash?pgm_read_byte(inputLogPtr):*inputLogPtr;
+
+		inputLogPtr++;
+		return c;
+	}
+
+	static void InputReplayFrame(void){
+		unsigned int diff;
+		u8 c;
+
+		while(inputLogRunLeft==0){
+			c=InputLogNext();
+			if(c<0x80){
+				inputLogRunLeft=c+1;
+			}else if(c>=0xc0){
+				//end of the log, the joypads are back from the next frame
+				inputRecorderState=INPUT_IDLE;
+				inputLogButtons[0]=0;
+				inputLogButtons[1]=0;
+				break;
+			}else{
+				diff=1<<(c&0x0f);
+				if(c&(INPUT_LOG_MASK&~INPUT_LOG_TOGGLE)) diff=((c&0x0f)<<8)|InputLogNext();
+				inputLogButtons[(c&INPUT_LOG_PAD2)?1:0]^=diff;
+			}
+		}
+		if(inputLogRunLeft!=0) inputLogRunLeft--;
+		joypad1_status_lo=inputLogButtons[0];
+		joypad2_status_lo=inputLogButtons[1];
+	}
+
+	//called by ReadButtons() with the joypads just read
+	void InputRecorderFrame(void){
+		joypadPhysical[0]=joypad1_status_lo;
+		joypadPhysical[1]=joypad2_status_lo;
+
+		#if INPUT_LOG_SIZE > 0
+			if(inputRecorderState==INPUT_RECORDING) InputRecordFrame();
+		#endif
+		if(inputRecorderState==INPUT_REPLAYING) InputReplayFrame();
+	}
+
+	/*
+	 * Replays a log from flash (PROGMEM) or RAM from the next frame, rand()
+	 * is seeded from the log.
+	 */
+	void InputReplayStart(const u8 *log,bool inFlash){
+		unsigned int seed;
+
+		inputRecorderState=INPUT_IDLE;
+		inputLogPtr=log;
+		inputLogInFlash=inFlash;
+		seed=InputLogNext();
+		seed|=InputLogNext()<<8;
+		srand(seed);
+		inputLogRunLeft=0;
+		inputLogButtons[0]=0;
+		inputLogButtons[1]=0;
+		inputRecorderState=INPUT_REPLAYING;
+	}
+
+	void InputReplayStop(void){
+		inputRecorderState=INPUT_IDLE;
+	}
+
+	u8 GetInputRecorderState(void){
+		return inputRecorderState;
+	}
+
+	unsigned int ReadPhysicalJoypad(unsigned char joypadNo){
+		return joypadPhysical[joypadNo&1];
+	}
+
+#endif
+
+
+/*
+ * Cycles since the start of vsync, rebuilt from the sync phase/pulse
+ * counters and TIMER1. Used by the frame stats and the idle jobs.
+ */
+#if KERNEL_FRAME_STATS == 1 || IDLE_JOBS > 0
+
+	unsigned long GetFrameCycles(void){
+		unsigned char sreg=SREG,phase,pulse,halfLines;
+		unsigned int t;
+		unsigned long now;
+
+		cli();
+		t=TCNT1;
+		phase=sync_phase;
+		pulse=sync_pulse;
+		if(TIFR1&(1<<OCF1A)){
+			//sync interrupt pending, counters not updated yet
+			t=TCNT1+OCR1A+1;
+		}
+		SREG=sreg;
+
+		//the first pre-eq period is a full line (set in do_hsync)
+		if(phase==SYNC_PHASE_PRE_EQ){
+			halfLines=SYNC_PRE_EQ_PULSES-pulse;
+			if(halfLines!=0) halfLines++;
+			now=0;
+		}else if(phase==SYNC_PHASE_EQ){
+			halfLines=SYNC_PRE_EQ_PULSES+1+SYNC_EQ_PULSES-pulse;
+			now=0;
+		}else if(phase==SYNC_PHASE_POST_EQ){
+			halfLines=SYNC_PRE_EQ_PULSES+1+SYNC_EQ_PULSES+SYNC_POST_EQ_PULSES-pulse;
+			now=0;
+		}else{
+			halfLines=SYNC_PRE_EQ_PULSES+1+SYNC_EQ_PULSES+SYNC_POST_EQ_PULSES;
+			pulse=SYNC_HSYNC_PULSES-pulse;
+			if(pulse!=0){
+				halfLines++; //first hsync period is still a half line
+				pulse--;
+			}
+			now=(unsigned long)pulse*(HDRIVE_CL+1);
+		}
+		now+=(unsigned long)halfLines*(HDRIVE_CL_TWICE+1)+t;
+
+		return now;
+	}
+
+	//cycles at the start of hsync line (0=first line after post-eq)
+	unsigned long GetLineStartCycles(unsigned char line){
+		unsigned long cycles=(unsigned long)(SYNC_PRE_EQ_PULSES+1+SYNC_EQ_PULSES+SYNC_POST_EQ_PULSES)*(HDRIVE_CL_TWICE+1);
+		if(line!=0){
+			cycles+=(HDRIVE_CL_TWICE+1)+(unsigned long)(line-1)*(HDRIVE_CL+1);
+		}
+		return cycles;
+	}
+
+#endif
+
+
+/*
+ * Frame stats. The stages run in the TIMER1 interrupt with interrupts
+ * enabled, so they include the sync pulses handled meanwhile.
+ */
+#if KERNEL_FRAME_STATS == 1
+
+	struct KernelFrameStats frameStats;
+	unsigned long frameStatsLast;
+	unsigned char frameStatsUart;
+
+	void FrameStatsBegin(void){
+		frameStatsLast=GetFrameCycles();
+	}
+
+	void FrameStatsMark(unsigned char stage){
+		unsigned long now=GetFrameCycles();
+		unsigned long delta=now-frameStatsLast;
+
+		if(now<frameStatsLast) delta=0;
+		if(delta>0xffff) delta=0xffff;
+		frameStats.cycles[stage]=delta;
+		if(delta>frameStats.peak[stage]) frameStats.peak[stage]=delta;
+		frameStatsLast=now;
+	}
+
+	void FrameStatsEnd(void){
+		unsigned long total;
+
+		FrameStatsMark(FS_POST_CALLBACK);
+		total=frameStatsLast;
+		if(total>0xffff) total=0xffff;
+		frameStats.cycles[FS_VSYNC]=total;
+		if(total>frameStats.peak[FS_VSYNC]) frameStats.peak[FS_VSYNC]=total;
+		frameStats.game=(frameStatsLast<FRAME_CYCLES)?FRAME_CYCLES-frameStatsLast:0;
+		frameStats.frames++;
+	}
+
+	/*
+	 * The vsync interrupt writes frames last, so the copy is whole when
+	 * frames did not change while it was made. Retried rather than made
+	 * under cli(), which would delay the sync interrupt.
+	 */
+	void GetFrameStats(struct KernelFrameStats *stats){
+		const volatile unsigned char *src=(const volatile unsigned char *)&frameStats;
+		unsigned char *dest=(unsigned char *)stats;
+		unsigned int frames;
+
+		do{
+			frames=*(volatile unsigned int *)&frameStats.frames;
+			for(unsigned char i=0;i<sizeof(*stats);i++){
+				dest[i]=src[i];
+			}
+		}while(frames!=*(volatile unsigned int *)&frameStats.frames);
+	}
+
+	void ResetFrameStats(void){
+		unsigned char sreg=SREG;
+		cli();
+		for(unsigned char i=0;i<FS_STAGES;i++){
+			frameStats.peak[i]=0;
+		}
+		frameStats.frames=0;
+		SREG=sreg;
+	}
+
+	void FrameStatsPutc(char c){
+		#if UART_TX_BUFFER == 1
+			UartWriteChar(c);	//dropped when the buffer is full
+		#else
+			while(!(UCSR0A&(1<<UDRE0)));
+			UDR0=c;
+		#endif
+	}
+
+	void FrameStatsPutNumber(unsigned long value){
+		char buf[11];
+		ultoa(value,buf,10);
+		for(char *p=buf;*p!=0;p++){
+			FrameStatsPutc(*p);
+		}
+		FrameStatsPutc(' ');
+	}
+
+	/*
+	 * Sends "frames cycles[FS_STAGES] peak[FS_STAGES] game" as a
+	 * line of decimal numbers.
+	 */
+	void DumpFrameStats(void){
+		struct KernelFrameStats stats;
+
+		if(!frameStatsUart){
+			#if MIDI_IN == 1
+				UCSR0B|=(1<<TXEN0); //keep the MIDI in baud rate
+			#else
+				UCSR0A=(1<<U2X0);
+				UBRR0=30; //115200 bauds (.2% error)
+				UCSR0C=(1<<UCSZ01)+(1<<UCSZ00);
+				UCSR0B|=(1<<TXEN0);
+			#endif
+			frameStatsUart=1;
+		}
+
+		GetFrameStats(&stats);
+		FrameStatsPutNumber(stats.frames);
+		for(unsigned char i=0;i<FS_STAGES;i++){
+			FrameStatsPutNumber(stats.cycles[i]);
+		}
+		for(unsigned char i=0;i<FS_STAGES;i++){
+			FrameStatsPutNumber(stats.peak[i]);
+		}
+		FrameStatsPutNumber(stats.game);
+		FrameStatsPutc('\r');
+		FrameStatsPutc('\n');
+	}
+
+#endif
+
+
+/*
+ * Idle jobs, run by WaitVsync() while waiting for the next vsync.
+ * Video modes render in the sync interrupt, so before the first render
+ * line the deadline is the start of rendering, after it the next vsync.
+ */
+#if IDLE_JOBS > 0
+
+	struct IdleJobStruct{
+		IdleJobFunc func;
+		unsigned int cycles;
+	};
+
+	struct IdleJobStruct idleJobs[IDLE_JOBS];
+	unsigned char idleJobsNext;		//round robin start
+	unsigned char idleJobsRan;		//jobs already run this frame
+	unsigned long idleJobsLastCycles;
+
+	char AddIdleJob(IdleJobFunc job,unsigned int cycles){
+		for(unsigned char i=0;i<IDLE_JOBS;i++){
+			if(idleJobs[i].func==job || idleJobs[i].func==NULL){
+				idleJobs[i].cycles=cycles;
+				idleJobs[i].func=job;
+				return 0;
+			}
+		}
+		return IDLE_JOBS_ERROR_FULL;
+	}
+
+	void RemoveIdleJob(IdleJobFunc job){
+		for(unsigned char i=0;i<IDLE_JOBS;i++){
+			if(idleJobs[i].func==job) idleJobs[i].func=NULL;
+		}
+	}
+
+	unsigned long IdleCyclesLeft(unsigned long now){
+		unsigned long end=GetLineStartCycles(first_render_line);
+
+		if(now>=end) end=FRAME_CYCLES;
+		if(end<now+IDLE_JOBS_MARGIN) return 0;
+		return end-now-IDLE_JOBS_MARGIN;
+	}
+
+	void NewIdleJobsFrame(void){
+		idleJobsRan=0;
+	}
+
+	void RunIdleJobs(void){
+		unsigned long now=GetFrameCycles();
+		unsigned char i;
+
+		//time went back: a vsync happened since the last call
+		if(now<idleJobsLastCycles) idleJobsRan=0;
+
+		for(unsigned char j=0;j<IDLE_JOBS;j++){
+			i=idleJobsNext;
+			if(++idleJobsNext==IDLE_JOBS) idleJobsNext=0;
+
+			if(idleJobs[i].func==NULL || (idleJobsRan&(1<<i))) continue;
+			if(GetVsyncFlag()) break;
+
+			now=GetFrameCycles();
+			if(IdleCyclesLeft(now)<idleJobs[i].cycles) continue;
+
+			idleJobsRan|=(1<<i);
+			if(!idleJobs[i].func()) idleJobs[i].func=NULL;
+		}
+
+		idleJobsLastCycles=GetFrameCycles();
+	}
+
+#endif
+
+
+/*
+ * Stack painting. Runs in .init3, after the stack pointer is set and r1
+ * cleared but before main(), nothing is on the stack yet. The painting
+ * starts above both .bss and .noinit since the game may move .noinit
+ * below .data. A canary value pushed by the program reads as unused,
+ * the mark can only be low by the bytes that happen to match.
+ */
+#if STACK_PAINT == 1
+
+	extern unsigned char __bss_end;
+	extern unsigned char __noinit_end;
+
+	#define STACK_PAINT_START ((&__bss_end>&__noinit_end)?&__bss_end:&__noinit_end)
+
+	void StackPaint(void) __attribute__((naked,used,section(".init3")));
+	void StackPaint(void){
+		unsigned char *p=STACK_PAINT_START;
+
+		while(p<=(unsigned char *)RAMEND){
+			*p++=STACK_CANARY;
+		}
+	}
+
+	unsigned int GetStackFree(void){
+		unsigned char *p=STACK_PAINT_START;
+
+		while(p<=(unsigned char *)RAMEND && *p==STACK_CANARY) p++;
+		return p-STACK_PAINT_START;
+	}
+
+	unsigned int GetStackHighWater(void){
+		return (RAMEND+1)-(unsigned int)STACK_PAINT_START-GetStackFree();
+	}
+
+#endif
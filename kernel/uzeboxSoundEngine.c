@@ -36,6 +36,7 @@
 #define DEFAULT_EXPRESSION_VOL 0xff
 
 #define MIDI_NULL 0xfd
+#define MAX_SLIDE_NOTE 126	//last steptable entry
 
 unsigned int ReadVarLen(const char **songPos);
 void SetTriggerCommonValues(struct TrackStruct *track, u8 volume, u8 note);
@@ -52,6 +53,7 @@ void SetTriggerCommonValues(struct TrackStruct *track, u8 volume, u8 note);
 unsigned char ramPatchPtr;
 
 extern unsigned char waves[];
+extern const unsigned int steptable[];
 
 struct TrackStruct tracks[CHANNELS];
 
@@ -162,6 +164,7 @@ const PatchCommand patchCommands[] PROGMEM ={&PatchCommand00,&PatchCommand01,&Pa
 //const char **patchPointers; //data in PROGMEM
 
 const struct PatchStruct *patchPointers;
+const struct FxInfoStruct *fxInfoPointers; //data in PROGMEM, optional
 
 //void InitMusicPlayer(const char *patchPointersParam[]){
 void InitMusicPlayer(const struct PatchStruct *patchPointersParam){
@@ -169,6 +172,7 @@ void InitMusicPlayer(const struct PatchStruct *patchPointersParam){
 
 	//patchPointers=(const char **)patchPointersParam;
 	patchPointers=patchPointersParam;
+	fxInfoPointers=NULL;
 
 	masterVolume=DEFAULT_MASTER_VOL;
 
@@ -590,6 +594,30 @@ void ProcessMusic(void){
 			
 			tracks[track].patchCurrDeltaTime++;
 		}
+
+		//pitch slide
+		if(tracks[track].slideRate!=0){
+			unsigned int pitch=tracks[track].slidePitch;
+			unsigned int target=tracks[track].slideTarget<<8;
+			unsigned int delta=tracks[track].slideRate<<4;
+			unsigned int step;
+
+			if(pitch<target){
+				pitch=(target-pitch>delta)?pitch+delta:target;
+			}else{
+				pitch=(pitch-target>delta)?pitch-delta:target;
+			}
+			if(pitch==target) tracks[track].slideRate=0;
+			tracks[track].slidePitch=pitch;
+			tracks[track].note=pitch>>8;
+
+			//interpolate between the two closest notes
+			step=pgm_read_word(&steptable[pitch>>8]);
+			if(pitch&0xff){
+				step+=((unsigned long)(pgm_read_word(&steptable[(pitch>>8)+1])-step)*(pitch&0xff))>>8;
+			}
+			mixer.channels.type.wave[track].step=step;
+		}
 	
 
 
@@ -660,72 +688,94 @@ unsigned int ReadVarLen(const char **songPos)
     return value;
 }
 
+/* Sets an optional PROGMEM table with one FxInfoStruct per patch, giving
+ * each fx its priority, maximum polyphony and allowed channels.
+ * With no table, all fx have the same priority, unlimited polyphony and
+ * use channels 1-2 (or channel 3 for noise/PCM patches).
+ */
+void SetFxInfoTable(const struct FxInfoStruct *fxInfoParam){
+	fxInfoPointers=fxInfoParam;
+}
+
 /* Trigger a sound effect.
  * Method allocates the channel based on priority.
- * Retrig: if this fx if already playing on a track, reuse same track.
+ * Retrig: if this fx if already playing on a track, reuse same track
+ * and only restart its command stream and envelope.
  */
 void TriggerFx(unsigned char patch,unsigned char volume,bool retrig){
-	unsigned char channel;
+	unsigned char channel,c,priority,voices,channelsMask,playing=0;
+	unsigned char freeChannel=0xff,oldestChannel=0xff,oldestSame=0xff,sameChannel=0xff;
+	struct TrackStruct *track;
 	
 	const char *pos = (const char*)pgm_read_word(&(patchPointers[patch].cmdStream));
-	unsigned char type=(unsigned char)pgm_read_byte(&(patchPointers[patch].type));
-
-	//find the channel to play the fx
-	//try to steal voice 2 then 1
-	//never steal voice 0, reserve it for lead melodies
-	if(type==1 || type==2){
-		//noise or PCM channel fx
-		channel=3;
-	}else if(tracks[1].priority==0 || (tracks[1].fxPatchNo==patch && tracks[1].priority>0 && retrig==true)){ //fx already playing
-		channel=1;
-	}else if(tracks[2].priority==0 || (tracks[2].fxPatchNo==patch && tracks[2].priority>0 && retrig==true)){ //fx already playing				
-		channel=2;
+
+	if(fxInfoPointers!=NULL){
+		priority=pgm_read_byte(&(fxInfoPointers[patch].priority));
+		voices=pgm_read_byte(&(fxInfoPointers[patch].voices));
+		channelsMask=pgm_read_byte(&(fxInfoPointers[patch].channels));
+		if(priority==0) priority=1; //0 is reserved for music
 	}else{
-		//both channels have fx playing, use the oldest one
-		if(tracks[1].patchPlayingTime>tracks[2].patchPlayingTime){
-			channel=1;
+		unsigned char type=(unsigned char)pgm_read_byte(&(patchPointers[patch].type));
+		priority=1;
+		voices=0;
+		//noise or PCM fx on channel 3, never steal voice 0, reserve it for lead melodies
+		channelsMask=(type==1 || type==2)?FX_CHANNEL(3):(FX_CHANNEL(1)|FX_CHANNEL(2));
+	}
+
+	//single pass over the allowed channels
+	for(c=0;c<(CHANNELS);c++){
+		if(!(channelsMask&FX_CHANNEL(c))) continue;
+		track=&tracks[c];
+
+		if(track->priority==0){
+			if(freeChannel==0xff) freeChannel=c;
 		}else{
-			channel=2;
+			if(track->fxPatchNo==patch){
+				playing++;
+				if(sameChannel==0xff) sameChannel=c;
+				if(oldestSame==0xff || track->patchPlayingTime>=tracks[oldestSame].patchPlayingTime) oldestSame=c;
+			}
+			//can only steal fx of same or lower priority, use the oldest one
+			if(track->priority<=priority && (oldestChannel==0xff || track->patchPlayingTime>=tracks[oldestChannel].patchPlayingTime)){
+				oldestChannel=c;
+			}
 		}
-	}				
-	
-	
-/*
-	tracks[channel].patchNextDeltaTime=pgm_read_byte(pos++); //pgm_read_byte(tracks[channel].patchCommandStreamPos++);
-	tracks[channel].patchCommandStreamPos=pos;
-	tracks[channel].patchCurrDeltaTime=0;		
-	tracks[channel].note=80; //default 
-	tracks[channel].noteVol=volume;
-	tracks[channel].envelopeVol=0xff;
-	tracks[channel].envelopeStep=0; 
-	tracks[channel].patchEnvelopeHold=false;
-	tracks[channel].patchPlayingTime=0;
-	tracks[channel].patchPlaying=true;	
-	tracks[channel].patchWave=0;
-	tracks[channel].fxPatchNo=patch;
-	tracks[channel].priority=1;	
-	tracks[channel].tremoloLevel=0;
-	tracks[channel].expressionVol=DEFAULT_EXPRESSION_VOL;
-*/
-/*
-	tracks[channel].patchCurrDeltaTime=0;	
-	tracks[channel].envelopeStep=0; 
-	tracks[channel].envelopeVol=0xff;
-	tracks[channel].noteVol=volume;
-	tracks[channel].patchEnvelopeHold=false;
-	tracks[channel].patchPlayingTime=0;
-	tracks[channel].patchPlaying=true;	
-	tracks[channel].patchWave=0;
-	tracks[channel].tremoloLevel=0;
-	tracks[channel].expressionVol=DEFAULT_EXPRESSION_VOL;
-	tracks[channel].note=80; //default 
-*/
+	}
 
+	if(retrig && sameChannel!=0xff){
+		//fx already playing, cheap retrigger: restart the command stream
+		//and envelope, the patch sets its own wave and pitch
+		track=&tracks[sameChannel];
+		track->patchNextDeltaTime=pgm_read_byte(pos++);
+		track->patchCommandStreamPos=pos;
+		track->patchCurrDeltaTime=0;
+		track->envelopeStep=0;
+		track->envelopeVol=0xff;
+		track->noteVol=volume;
+		track->patchEnvelopeHold=false;
+		track->patchPlayingTime=0;
+		track->patchPlaying=true;
+		track->tremoloLevel=0;
+		track->expressionVol=DEFAULT_EXPRESSION_VOL;
+		track->slideRate=0;
+		track->priority=priority;
+		return;
+	}
+
+	if(voices!=0 && playing>=voices){
+		channel=oldestSame; //polyphony exhausted, restart the oldest instance
+	}else if(freeChannel!=0xff){
+		channel=freeChannel;
+	}else if(oldestChannel!=0xff){
+		channel=oldestChannel;
+	}else{
+		return; //all allowed channels play higher priority fx
+	}
 
 	tracks[channel].patchNextDeltaTime=pgm_read_byte(pos++); //pgm_read_byte(tracks[channel].patchCommandStreamPos++);
 	tracks[channel].patchCommandStreamPos=pos;
 	tracks[channel].fxPatchNo=patch;
-	tracks[channel].priority=1;	
+	tracks[channel].priority=priority;	
 	SetTriggerCommonValues(&tracks[channel],volume,80);
 
 
@@ -843,6 +893,37 @@ void TriggerNote(unsigned char channel,unsigned char patch,unsigned char note,un
 
 
 
+/* Glides the pitch of a playing voice to note without retriggering
+ * its patch. slideRate is in 1/16 semitone per frame, 0=jump to note.
+ */
+void SetVoicePitchTarget(unsigned char channel,unsigned char note,unsigned char slideRate){
+	unsigned char rate,current;
+
+	if(channel>=WAVE_CHANNELS) return;
+	rate=tracks[channel].slideRate;
+	current=tracks[channel].note;
+	if(note>MAX_SLIDE_NOTE) note=MAX_SLIDE_NOTE;
+	if(current>MAX_SLIDE_NOTE) current=MAX_SLIDE_NOTE;
+
+	//slideRate is written last, the update runs in the vsync interrupt
+	tracks[channel].slideRate=0;
+	if(rate==0) tracks[channel].slidePitch=current<<8;
+	tracks[channel].slideTarget=note;
+	if(slideRate==0){
+		tracks[channel].slidePitch=note<<8;
+		slideRate=1;
+	}
+	tracks[channel].slideRate=slideRate;
+}
+
+/* Sets the note volume of a playing voice, as the volume of the
+ * TriggerNote() that started it, without retriggering its patch.
+ */
+void SetVoiceVolume(unsigned char channel,unsigned char volume){
+	if(channel>=CHANNELS) return;
+	tracks[channel].noteVol=volume;
+}
+
 void SetTriggerCommonValues(struct TrackStruct* track, u8 volume, u8 note)  {
 
 	track->patchCurrDeltaTime=0;
@@ -856,6 +937,7 @@ void SetTriggerCommonValues(struct TrackStruct* track, u8 volume, u8 note)  {
 	track->tremoloLevel=0;
 	track->expressionVol=DEFAULT_EXPRESSION_VOL;
 	track->note=note;
+	track->slideRate=0;
 }
 
 
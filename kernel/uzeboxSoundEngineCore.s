@@ -33,6 +33,7 @@
 .global EnableSoundEngine
 .global DisableSoundEngine
 .global waves
+.global steptable
 .global mix_pos
 .global mix_buf
 .global mix_bank
@@ -290,6 +291,11 @@ MixSound:
  	call ProcessMusic
 #endif
 
+#if KERNEL_FRAME_STATS == 1
+	ldi r24,FS_MUSIC
+	call FrameStatsMark
+#endif
+
 
 	;Flip mix bank & set target bank adress for mixing
 	lds r0,mix_bank
@@ -688,6 +694,26 @@ s2:
 	inc r16
 	andi r16,(UART_RX_BUFFER_SIZE-1) ;wrap
 	sts uart_rx_buf_end,r16
+#elif UART_TX_BUFFER == 1
+	;send the next byte of the UART TX buffer (20 cycles)
+	;Z points to it without an addition, the buffer is aligned on its size
+	ldi ZH,hi8(uart_tx_buf)
+	lds ZL,uart_tx_buf_start
+	lds r17,uart_tx_buf_end
+
+	clr r18
+	cpse ZL,r17					;status only if the buffer isn't empty,
+	lds r18,_SFR_MEM_ADDR(UCSR0A) ;3 cycles either way
+
+	ld r17,Z
+	sbrc r18,UDRE0				;3 cycles either way
+	sts _SFR_MEM_ADDR(UDR0),r17
+
+	sbrc r18,UDRE0
+	inc ZL
+	andi ZL,(UART_TX_BUFFER_SIZE-1) ;wrap
+	ori ZL,lo8(uart_tx_buf)
+	sts uart_tx_buf_start,ZL
 #else
 	//alignment cycles
 	;lpm
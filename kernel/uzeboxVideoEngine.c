@@ -253,8 +253,20 @@ void WaitVsync(int count){
 	int i;
 	//ClearVsyncFlag();
 	for(i=0;i<count;i++){
+		#if IDLE_JOBS > 0
+			RunIdleJobs();
+		#endif
+		#if EEPROM_WRITE_QUEUE > 0
+			if(ReadPowerSwitch()) EepromFlush();
+		#endif
 		while(!GetVsyncFlag());
 		ClearVsyncFlag();		
+		#if IDLE_JOBS > 0
+			NewIdleJobsFrame();
+		#endif
+		#if INPUT_RECORDER_UART == 1
+			InputLogSend();
+		#endif
 	}
 }
 
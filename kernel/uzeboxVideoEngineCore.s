@@ -199,6 +199,10 @@ do_hsync_delay:
 	sei ;must enable ints for hsync pulses
 	clr r1
 
+	#if KERNEL_FRAME_STATS == 1
+		call FrameStatsBegin
+	#endif
+
 	;process user pre callback
 	lds ZL,pre_vsync_user_callback+0
 	lds ZH,pre_vsync_user_callback+1
@@ -207,18 +211,42 @@ do_hsync_delay:
 	breq .+2 
 	icall
 
+	#if KERNEL_FRAME_STATS == 1
+		ldi r24,FS_PRE_CALLBACK
+		call FrameStatsMark
+	#endif
+
 	;refresh buttons states
 	#if CONTROLLERS_VSYNC_READ == 1
 		call ReadControllers
 	#endif 
 
+	#if KERNEL_FRAME_STATS == 1
+		ldi r24,FS_CONTROLLERS
+		call FrameStatsMark
+	#endif
+
 	;invoke stuff the video mode may have to do
 	call VideoModeVsync	
+
+	#if KERNEL_FRAME_STATS == 1
+		ldi r24,FS_SPRITES
+		call FrameStatsMark
+	#endif
 	
 	;process music (music, envelopes, etc)
 	call MixSound
 	clr r1
 
+	#if KERNEL_FRAME_STATS == 1
+		ldi r24,FS_MIXER
+		call FrameStatsMark
+	#endif
+
+	#if EEPROM_WRITE_QUEUE > 0
+		call ProcessEepromQueue
+	#endif
+
 	#if SNES_MOUSE == 1
 		call ReadMouseExtendedData
 		call ProcessMouseMovement
@@ -232,6 +260,9 @@ do_hsync_delay:
 	breq .+2 
 	icall
 
+	#if KERNEL_FRAME_STATS == 1
+		call FrameStatsEnd
+	#endif
 
 
 	pop r27
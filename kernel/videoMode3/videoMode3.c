@@ -42,7 +42,8 @@
 	extern void CopyTileToRam(unsigned char romTile,unsigned char ramTile);
 	extern void BlitSprite(unsigned char spriteNo,unsigned char ramTileNo,unsigned int xy,unsigned int dxdy);
 
-	unsigned char free_tile_index;
+	unsigned char free_tile_index;		//RAM tiles used by the sprites this frame
+	unsigned char sprite_tiles_dropped;	//sprite tiles not drawn for lack of RAM tiles
 	bool spritesOn=true;
 
 	void RestoreBackground(){
@@ -67,6 +68,7 @@
 		unsigned int ramPtr,ssx,ssy;
 
 		free_tile_index=0;	
+		sprite_tiles_dropped=0;
 		if(!spritesOn) return;
 	
 		for(i=0;i<MAX_SPRITES;i++){
@@ -126,6 +128,8 @@
 							vram[ramPtr]=free_tile_index;
 							bt=free_tile_index;
 							free_tile_index++;										
+						}else if(bt>=RAM_TILES_COUNT){
+							sprite_tiles_dropped++;
 						}
 				
 						if(bt<RAM_TILES_COUNT){
@@ -213,16 +217,26 @@
 			for(unsigned char dy=0;dy<mapHeight;dy++){
 				for(s8 dx=(mapWidth-1);dx>=0;dx--){
 				 	tile=pgm_read_byte(&(map[(dy*mapWidth)+dx+2]));		
-					sprites[startSprite].tileIndex=tile ;
-					sprites[startSprite++].flags=spriteFlags;
+					#if SPRITE_MAP_FLIP == 1
+						sprites[startSprite].tileIndex=tile&0x7f;
+						sprites[startSprite++].flags=spriteFlags^(tile>>7);
+					#else
+						sprites[startSprite].tileIndex=tile ;
+						sprites[startSprite++].flags=spriteFlags;
+					#endif
 				}			
 			}
 		}else{
 			for(unsigned char dy=0;dy<mapHeight;dy++){
 				for(unsigned char dx=0;dx<mapWidth;dx++){
 				 	tile=pgm_read_byte(&(map[(dy*mapWidth)+dx+2]));		
-					sprites[startSprite].tileIndex=tile;
-					sprites[startSprite++].flags=spriteFlags;
+					#if SPRITE_MAP_FLIP == 1
+						sprites[startSprite].tileIndex=tile&0x7f;
+						sprites[startSprite++].flags=spriteFlags^(tile>>7);
+					#else
+						sprites[startSprite].tileIndex=tile;
+						sprites[startSprite++].flags=spriteFlags;
+					#endif
 				}			
 			}
 		}
@@ -324,6 +338,9 @@
 	void VideoModeVsync(){
 		
 		ProcessFading();
+		#if KERNEL_FRAME_STATS == 1
+			FrameStatsMark(FS_FADING);
+		#endif
 		ProcessSprites();
 
 	}
@@ -97,3 +97,9 @@
 #define SPRITE_BANK2 2<<6
 #define SPRITE_BANK3 3<<6
 
+//Bit 7 of the tile numbers of the maps given to MapSprite2() flips
+//that tile, for the maps made by tools/tileconv -x (128 sprite tiles max)
+#ifndef SPRITE_MAP_FLIP
+	#define SPRITE_MAP_FLIP 0
+#endif
+
@@ -43,6 +43,8 @@
 
 	
 	extern struct SpriteStruct sprites[];
+	extern unsigned char free_tile_index;		//RAM tiles used by the sprites in the last frame
+	extern unsigned char sprite_tiles_dropped;	//sprite tiles not drawn for lack of RAM tiles
 
 	#if SCROLLING == 1
 		typedef struct {
@@ -68,11 +68,33 @@
 #include <stdbool.h>
 #include <avr/io.h>
 #include <stdlib.h>
+#include <string.h>
 #include <avr/pgmspace.h>
+#include <avr/interrupt.h>
+#include <util/crc16.h>
 #include <uzebox.h>
 
+// attract screen assets on the SD card, see assets.c
+#ifndef SD_ASSETS
+	#define SD_ASSETS 0
+#endif
+#if SD_ASSETS != 0
+	#include <fat.h>
+	#include <mmc.h>
+#endif
+
+// send the stage and the input log of each turn on the UART, for
+// data/demos.h
+#ifndef DEMO_RECORD
+	#define DEMO_RECORD 0
+#endif
+#if INPUT_RECORDER != 1
+	#error The attract demo needs INPUT_RECORDER=1
+#endif
+
 #include "data/patches.h"
 #include "data/east.h"
+#include "data/demos.h"
 
 #include "data/sprites.inc" // 3194 bytes
 //#include "data/all-graphics.inc"
@@ -82,6 +104,8 @@
 #include "data/transition-screen-graphics.h"
 
 #include "highscores.c"
+#include "audit.c"
+#include "assets.c"
 
 #define LANE1 22
 #define LANE2 54
@@ -149,6 +173,9 @@ char storeCourseLine = 0;
 #define MIN_SPEED 1
 #define MAX_SPEED 5
 
+// engine pitch glide, in 1/16 semitone per frame
+#define ENGINE_SLIDE_RATE 8
+
 // Minimum speed by stage.
 // MAKE SURE WE HAVE MAX_STAGES ENTRIES!
 const unsigned char minSpeedTable[] PROGMEM = {
@@ -219,7 +246,9 @@ unsigned char banditZ = 0;   // z axis position (for jumping)
 unsigned char numCredits = 0;
 unsigned char creditDebounce = 0;
 unsigned char joystickDebounce = 0;
-unsigned char gameMode = 0; // 0 = logo, 1 = dialog, 2 = demo, 3 = highscore, > 3 gamePlay
+unsigned char gameMode = 0; // 0 = logo, 1 = dialog, 2 = demo, 3 = gamePlay, 4 = service
+unsigned char demoIndex = 0; // next recording of demos[]
+const unsigned char *demoLog;
 
 // variables relating to scrolling and track loading
 unsigned char destX=30;
@@ -251,6 +280,30 @@ char randomNumber;
 unsigned char courseRightBoundary[32];
 unsigned char courseLeftBoundary[32];
 
+// HUD digits of printStats(), least significant first. formatStats()
+// makes them as an idle job, printStats() formats them itself when the
+// job has not run for HUD_MAX_AGE prints. The cycles are an estimate
+// for AddIdleJob(), GetStackHighWater() scans the free RAM.
+#define HUD_SCORE 0
+#define HUD_STAGE 6
+#define HUD_SUBSTAGE 8
+#define HUD_STACK 9
+#define HUD_DIGITS 13
+#define HUD_MAX_AGE 4
+#if STACK_PAINT == 1
+	#define HUD_JOB_CYCLES 8000
+#else
+	#define HUD_JOB_CYCLES 2500
+#endif
+char hudDigits[HUD_DIGITS];
+unsigned char hudAge = HUD_MAX_AGE;
+
+// per frame telemetry, reads the game state above
+#ifndef TELEMETRY
+	#define TELEMETRY 0
+#endif
+#include "telemetry.c"
+
 //
 // forward declarations
 
@@ -265,13 +318,19 @@ void dialogMode();
 void myPrint(int x,int y,const char *string);
 void slowPrint(int x,int y,const char *string);
 void myPrintInt(int x,int y, char len, unsigned int val);
+void formatInt(char *digits, char len, unsigned int val);
+void printDigits(int x,int y, char len, const char *digits);
+bool formatStats();
 void doScrolling(int speed);
 
 void processCredits(int joy1, int joy2);
 void processGameControls();
 void processControlsAndWait(unsigned char waitFor);
 void displayHighScoresScreen();
+void displayAuditScreen();
 void waitCycle();
+void demoMode();
+void syncTurnInput();
 
 void transitionScreen(
         const char * line1,
@@ -279,14 +338,21 @@ void transitionScreen(
         bool showCoors);
 void highScoreScreen(unsigned int);
 void carCrash();
+void setEngineSound(unsigned char note, unsigned char volume);
 void smokeyAndTheBanditLogoScreen();
 
 int main() {
 
 	InitHighScores();
+	InitAudit();
+	InitAssets();
+#if IDLE_JOBS > 0
+	AddIdleJob(&formatStats, HUD_JOB_CYCLES);
+#endif
 
 	Screen.overlayHeight=8;
     InitMusicPlayer(patches);
+    SetFxInfoTable(fxInfo);
     SetSpritesTileTable(spritesTiles);
 
     numCredits = 0;
@@ -294,7 +360,13 @@ int main() {
     gameMode = 0;
 
     while (1) {
-        if (gameMode == 3) playGame();
+        if (gameMode == 3) {
+            playGame();
+#if DEMO_RECORD == 1
+            InputRecordStop();
+#endif
+        }
+        else if (gameMode == 4) displayAuditScreen();
         else waitCycle();
     }
 }
@@ -332,10 +404,13 @@ void initGame(bool twoPlayer) {
     guysLeft[0] = 3;
     if (twoPlayer) guysLeft[1] = 3;
     else guysLeft[1] = 0;
+    AuditGameStart(twoPlayer);
 }
 
 void playGame()  {
 
+    bool demo = (gameMode == 2);
+
     StopSong();
 
     // bandit speed and position
@@ -374,9 +449,13 @@ void playGame()  {
     Screen.scrollX = 0;
     Screen.scrollY = 0;
 
-    if (currentPlayer == 0) transitionScreen(PSTR("READY PLAYER ONE?"), 18, true);
+    if (demo) transitionScreen(PSTR("INSERT COIN"), 11, true);
+    else if (currentPlayer == 0) transitionScreen(PSTR("READY PLAYER ONE?"), 18, true);
     else transitionScreen(PSTR("READY PLAYER TWO?"), 18, true);
 
+    // a coin or a start ended the demo
+    if (demo && gameMode != 2) return;
+
     TriggerNote(0, 3, 20+(2*banditSpeed), 128);
 
     unsigned char frameCounter = 0;
@@ -389,7 +468,8 @@ void playGame()  {
     MapSprite2(MAX_BEERS, map_bandit, 0);
 
 
-    if (currentPlayer == 0) myPrint(0,6, PSTR("P1"));
+    if (demo) myPrint(0,6, PSTR("DEMO"));
+    else if (currentPlayer == 0) myPrint(0,6, PSTR("P1"));
     else myPrint(0,6, PSTR("P2"));
 
     myPrint(3,6, PSTR("STAGE"));
@@ -422,9 +502,18 @@ void playGame()  {
 
     FadeIn(2, true);
 
+    syncTurnInput();
+
     while (true) {
     if (GetVsyncFlag()) {
         ClearVsyncFlag();
+        TelemetryFrame();
+
+        // the demo stops at the end of its recording, a coin or a start
+        if (demo && (gameMode != 2 || GetInputRecorderState() != INPUT_REPLAYING)) {
+            FadeOut(1, true);
+            return;
+        }
 
         randomNumber = rand();
 
@@ -458,7 +547,7 @@ void playGame()  {
                     sprites[i].x = OFF_SCREEN;
                     carCrash();
                     clearCans();
-                    endTurn();
+                    if (!demo) endTurn();
                     return;
                 }
                 else {
@@ -488,16 +577,16 @@ void playGame()  {
 			banditZ++;
 			if (banditZ == 36) {
                 MapSprite2(MAX_BEERS, map_bandit, 0);
-                TriggerNote(0, 3, 20+(2*banditSpeed), 128);
+                setEngineSound(20+(2*banditSpeed), 128);
                 banditZ = 0;
 			}
 			else if (banditZ == 24) {
                 MapSprite2(MAX_BEERS, map_banditDown, 0);
-                TriggerNote(0, 3, 23+(2*banditSpeed), 164);
+                setEngineSound(23+(2*banditSpeed), 164);
 			}
 			else if (banditZ == 12) {
                 MapSprite2(MAX_BEERS, map_banditBig, 0);
-                TriggerNote(0, 3, 28+(2*banditSpeed), 192);
+                setEngineSound(28+(2*banditSpeed), 192);
 		 	}
 		}
 
@@ -528,7 +617,7 @@ void playGame()  {
 
             if (banditY > maxY || banditY < minY) {
                 carCrash();
-                endTurn();
+                if (!demo) endTurn();
                 return;
 
             }
@@ -554,14 +643,65 @@ void playGame()  {
                 return;
             }
         }
+
+#if IDLE_JOBS > 0
+        // the HUD digits, in what is left of the frame
+        RunIdleJobs();
+#endif
     } // if GetVsyncFlag
     } // while(true)
 }
 
+// The first frame of a turn replayed by the demo or recorded with
+// DEMO_RECORD: the recorder starts on the next vsync, with rand() seeded
+// and the course state an earlier turn left set back, so the turn plays
+// the same from its input log.
+void syncTurnInput() {
+    if (gameMode != 2 && DEMO_RECORD == 0) return;
+
+    WaitVsync(1);
+    lastBeerSpawnLane = 2;
+    lastCourseLineGenerated = 0;
+    waterCounter = 0;
+    storeCourseLine = 0;
+    buttonReset = 0;
+
+    if (gameMode == 2) {
+        InputReplayStart(demoLog, true);
+    }
+#if DEMO_RECORD == 1
+    else {
+        UartWriteChar(gameStage[currentPlayer]);
+        InputRecordStart(rand());
+    }
+#endif
+}
+
+// Formats the HUD digits of printStats(). An idle job: the game loop
+// runs it with what is left of the frame, so the divisions by 10 are
+// not in the frame's own work.
+bool formatStats() {
+    formatInt(hudDigits + HUD_SCORE, 6, playerScore[currentPlayer]);
+    formatInt(hudDigits + HUD_STAGE, 2, gameStage[currentPlayer]+1);
+    formatInt(hudDigits + HUD_SUBSTAGE, 1, subStage+1);
+#if STACK_PAINT == 1
+    // debug: deepest stack use in bytes since reset
+    formatInt(hudDigits + HUD_STACK, 4, GetStackHighWater());
+#endif
+    hudAge = 0;
+    return true;
+}
+
 void printStats() {
-    myPrintInt(1,21, 6, playerScore[currentPlayer]);
-    myPrintInt(4,23, 2, gameStage[currentPlayer]+1);
-    myPrintInt(4,21, 1,subStage+1);
+    // the job did not get the time for a while, or there is no job
+    if (IDLE_JOBS == 0 || ++hudAge > HUD_MAX_AGE) formatStats();
+
+    printDigits(1,21, 6, hudDigits + HUD_SCORE);
+    printDigits(4,23, 2, hudDigits + HUD_STAGE);
+    printDigits(4,21, 1, hudDigits + HUD_SUBSTAGE);
+#if STACK_PAINT == 1
+    printDigits(12,21, 4, hudDigits + HUD_STACK);
+#endif
     printCredits();
 }
 
@@ -569,6 +709,14 @@ void printCredits() {
     myPrintInt(27,21,2, numCredits);
 }
 
+// Glide the engine voice started in playGame() to a new pitch and
+// volume without restarting its patch.
+void setEngineSound(unsigned char note, unsigned char volume)
+{
+    SetVoicePitchTarget(0, note, ENGINE_SLIDE_RATE);
+    SetVoiceVolume(0, volume);
+}
+
 void carCrash()
 {
     TriggerNote(0, 7, 0, 0);
@@ -615,6 +763,10 @@ void clearCans()
 
 void endTurn()
 {
+    if (guysLeft[currentPlayer] == 1) {
+        AuditPlayerOver(gameStage[currentPlayer], playerScore[currentPlayer]);
+    }
+
     if ((guysLeft[currentPlayer] == 1) && IsHighScore(playerScore[currentPlayer]) ) {
         highScoreScreen(playerScore[currentPlayer]);
     }
@@ -630,6 +782,7 @@ void endTurn()
         Screen.scrollX =0;
         scrollMark = 0;
         transitionScreen(PSTR("GAME OVER"), 9, false);
+        AuditGameOver();
         gameMode = 0;
         displayHighScoresScreen();
     }
@@ -664,12 +817,19 @@ void processCredits(int joy1, int joy2) {
     //     BTN_R(1)       : Coin 2          : T     : o
     //     BTN_X(*)       : Button 1        : 22    :
 
+    // the demo replays the game buttons, not the coins and starts
+    if (gameMode == 2) {
+        joy1 = ReadPhysicalJoypad(0);
+        joy2 = ReadPhysicalJoypad(1);
+    }
+
     if (creditDebounce > 0) creditDebounce--;
 
 	if(joy2&BTN_SL || joy2&BTN_SR){
         if (creditDebounce == 0) {
             TriggerFx(4,0xff,true);
             numCredits++;
+            AuditCoin();
             creditDebounce = 25;
             if (numCredits == 1 && gameMode < 3) {
                 gameMode = 0;
@@ -694,6 +854,11 @@ void processCredits(int joy1, int joy2) {
                 printCredits();
             }
         }
+	}else if(joy1&BTN_SL){ // service, show the audit counters
+        if (creditDebounce == 0 && gameMode < 3) {
+            creditDebounce = 25;
+            gameMode = 4;
+        }
 	}
 }
 
@@ -733,18 +898,18 @@ void processGameControls() {
                 banditSpeed--;
                 buttonReset = 2;
                 nextXPos = 190 - (4*banditSpeed);
-                TriggerNote(0, 3, 20+(banditSpeed*2), 128);
+                setEngineSound(20+(banditSpeed*2), 128);
             }
             else if (joy1&BTN_UP && banditSpeed < MAX_SPEED) {
                 banditSpeed++;
                 buttonReset = 2;
                 nextXPos = 190 - (4*banditSpeed);
-                TriggerNote(0, 3, 20+(banditSpeed*2), 128);
+                setEngineSound(20+(banditSpeed*2), 128);
             }
             else if(joy1&BTN_X){
                 banditZ = 1;
                 MapSprite2(MAX_BEERS, map_banditUp, 0);
-                TriggerNote(0, 3, 23+(2*banditSpeed), 164);
+                setEngineSound(23+(2*banditSpeed), 164);
 	        }
         }
     }
@@ -758,6 +923,7 @@ void processControlsAndWait(unsigned char waitFor)
 	    int joy2=ReadJoypad(1);
         processCredits(joy1, joy2);
         WaitVsync(1);
+        TelemetryFrame();
     }
 }
 
@@ -805,6 +971,23 @@ void myPrintInt(int x,int y, char len, unsigned int val){
 	}
 }
 
+//Decimal digits of val, least significant first, for printDigits()
+void formatInt(char *digits, char len, unsigned int val){
+    while (len > 0) {
+        *digits++ = (val%10)+48;
+        val = val / 10;
+        len--;
+	}
+}
+
+//Print the digits made by formatInt()
+void printDigits(int x,int y, char len, const char *digits){
+    while (len > 0) {
+        PrintChar(x, y++, *digits++);
+        len--;
+	}
+}
+
 void generateNextStripe(int increment) {
 
     while (increment > 0) {
@@ -931,16 +1114,43 @@ void spawnBeer(char sc)
 }
 
 void waitCycle() {
+    // save the audit counters of the last games, and a high score
+    // record the EEPROM write queue had no room for
+    FlushAudit();
+    FlushHighScores();
+
     spacebarLogoScreen();
     if (gameMode > 2) return;
     smokeyAndTheBanditLogoScreen();
     if (gameMode > 2) return;
     dialogMode();
     if (gameMode > 2) return;
+    demoMode();
+    if (gameMode > 2) return;
     displayHighScoresScreen();
     if (gameMode > 2) return;
 }
 
+// One turn of a recording in demos[], played by playGame() with the
+// joypads replaced by its input log. Each cycle shows the next one.
+void demoMode() {
+    const unsigned char *demo = (const unsigned char *)pgm_read_word(&demos[demoIndex]);
+    if (++demoIndex == DEMO_COUNT) demoIndex = 0;
+
+    gameMode = 2;
+    currentPlayer = 0;
+    gameStage[0] = pgm_read_byte(demo);
+    playerScore[0] = 0;
+    guysLeft[0] = 1;
+    guysLeft[1] = 0;
+    demoLog = demo + 1;
+
+    playGame();
+
+    InputReplayStop();
+    if (gameMode == 2) gameMode = 0;
+}
+
 void spacebarLogoScreen() {
 
     Screen.scrollX =0;
@@ -956,8 +1166,8 @@ void spacebarLogoScreen() {
        if (gameMode > 2) return;
     }
 
-	DrawMap2(2,0,sbl_1);
-	DrawMap2(2,20,sbl_2);
+	DrawAssetMap(2,0,ASSET_SBL_1,sbl_1);
+	DrawAssetMap(2,20,ASSET_SBL_2,sbl_2);
 
     //myPrint(26, 6, PSTR("CREDIT"));
     printCredits();
@@ -996,8 +1206,8 @@ void smokeyAndTheBanditLogoScreen()
        if (gameMode > 2) return;
     }
 
-	DrawMap2(6,0,sabl_1);
-	DrawMap2(6,23,sabl_2);
+	DrawAssetMap(6,0,ASSET_SABL_1,sabl_1);
+	DrawAssetMap(6,23,ASSET_SABL_2,sabl_2);
 
     //myPrint(26, 6, PSTR("CREDIT"));
     printCredits();
@@ -1115,10 +1325,19 @@ void transitionScreen(
         bool showCoors)
 {
 
-	SetTileTable(coorsCan);
-	SetFontTilesIndex(COORSCAN_SIZE);
     initScreen(false);
 
+    // the sprites are off now, with the can in RAM tiles the flash
+    // table only holds the font
+    bool ramCoors = LoadAssetTiles(ASSET_COORS_TILES, 0);
+    if (ramCoors) {
+        SetTileTable(font4_tileset);
+        SetFontTilesIndex(0);
+    } else {
+	    SetTileTable(coorsCan);
+	    SetFontTilesIndex(COORSCAN_SIZE);
+    }
+
     //myPrint(26, 6, PSTR("CREDIT"));
     printCredits();
 
@@ -1128,7 +1347,8 @@ void transitionScreen(
     }
 
     if (showCoors) {
-	    DrawMap2(13,5,coors_can_map);
+        if (ramCoors) LoadAssetMap(13,5,ASSET_COORS_MAP,0);
+        else DrawAssetMap(13,5,ASSET_COORS_MAP,coors_can_map);
         myPrint(10, 25, PSTR("CLEDUS IS DROPPING COORS"));
         myPrint(11, 17, PSTR("GRAB IT!"));
     }
@@ -1168,8 +1388,8 @@ void highScoreScreen(unsigned int score)
        processControlsAndWait(1);
     }
 
-	DrawMap2(2,0,sabl_1);
-	DrawMap2(2,23,sabl_2);
+	DrawAssetMap(2,0,ASSET_SABL_1,sabl_1);
+	DrawAssetMap(2,23,ASSET_SABL_2,sabl_2);
 
     //myPrint(26, 6, PSTR("CREDIT"));
     printCredits();
@@ -1314,3 +1534,61 @@ void displayHighScoresScreen()
     }
 }
 
+
+//
+//
+//          Audit
+//
+//    COINS ............  000012
+//    SCORE < 1000 .....  000003
+
+void displayAuditScreen()
+{
+    Screen.scrollX = 0;
+    scrollMark = 0;
+	SetTileTable(smokeyAndTheBanditLogoTiles);
+    SetFontTilesIndex(SMOKEYANDTHEBANDITLOGOTILES_SIZE);
+    initScreen(false);
+
+    FadeOut(0,true);
+
+    printCredits();
+
+    myPrint(3,26, PSTR("         AUDIT"));
+
+    myPrint(6,26, PSTR("COINS ............ "));
+    myPrintInt(6,22,6,audit->coins);
+    myPrint(7,26, PSTR("1P STARTS ........ "));
+    myPrintInt(7,22,6,audit->starts1P);
+    myPrint(8,26, PSTR("2P STARTS ........ "));
+    myPrintInt(8,22,6,audit->starts2P);
+    myPrint(9,26, PSTR("AVERAGE STAGE .... "));
+    myPrintInt(9,22,6,audit->players ? audit->stageSum / audit->players : 0);
+    myPrint(10,26, PSTR("PLAY TIME HOURS .. "));
+    myPrintInt(10,22,6,(audit->playSeconds + AuditUnsavedSeconds()) / 3600);
+
+    myPrint(12,26, PSTR("SCORE  < 1000 .... "));
+    myPrint(13,26, PSTR("SCORE  < 2000 .... "));
+    myPrint(14,26, PSTR("SCORE  < 5000 .... "));
+    myPrint(15,26, PSTR("SCORE  <10000 .... "));
+    myPrint(16,26, PSTR("SCORE  <20000 .... "));
+    myPrint(17,26, PSTR("SCORE  <50000 .... "));
+    myPrint(18,26, PSTR("SCORE >=50000 .... "));
+    for (unsigned char i = 0; i < AUDIT_HISTOGRAM_BUCKETS; i++) {
+        myPrintInt(12+i,22,6,audit->scores[i]);
+    }
+
+    FadeIn(1, true);
+
+    // stay until a game starts, the service button is pressed again or a timeout
+    for (unsigned int i = 0; i < 60*60; i++) {
+        unsigned int joy1=ReadJoypad(0);
+        if (i > 30 && (joy1&BTN_SL) && creditDebounce == 0) break;
+        processControlsAndWait(1);
+        if (gameMode == 3) return;
+    }
+
+    FadeOut(1,true);
+    gameMode = 0;
+}
+
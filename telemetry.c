@@ -0,0 +1,127 @@
+/*
+        Smokey and the bandit per frame telemetry over the UART.
+
+        This program is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        This program is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// With TELEMETRY=n a record is queued every n frames on the kernel UART
+// TX buffer, so the game never waits for the UART. A record that does
+// not fit is skipped whole and counted in the next one. tools/telemetry
+// turns a capture into CSV and percentiles.
+//
+// Each record is COBS encoded and ends with a 0 byte, the last 2 bytes
+// before encoding are the CRC16 (_crc_ccitt_update, start 0xffff) of the
+// others. All values are little endian.
+//
+// The layout must match tools/telemetry.cc.
+//
+#define TELEMETRY_VERSION       2
+
+struct TelemetryRecord {
+        u8 version;
+        u16 frame;
+        u16 cycles[FS_STAGES];  // frameStats.cycles of the last frame
+        u32 game;               // cycles left for the game and the rendering
+        u8 ramTiles;            // RAM tiles used by the sprites
+        u8 droppedTiles;        // sprite tiles not drawn
+        u8 voices;              // bit n = channel n is audible
+        u16 joy1;
+        u16 joy2;
+        u16 score;
+        u8 stage;
+        u8 mode;                // gameMode, bit 7 = player 2
+        u16 skipped;            // records that did not fit in the UART buffer
+        u16 stack;              // GetStackHighWater(), 0 without STACK_PAINT
+        u16 crc;
+} __attribute__((packed));
+
+#if TELEMETRY > 0
+
+u8 telemetryCount;
+u16 telemetryFrame;
+u16 telemetrySkipped;
+
+//
+// Call once per frame, after the vsync
+//
+
+void TelemetryFrame()
+{
+        struct TelemetryRecord rec;
+        struct KernelFrameStats stats;
+        u8 out[sizeof(rec) + 2];
+        u8 *src = (u8 *)&rec, *code = out, *dest = out + 1;
+        u8 i, n = 1;
+
+        telemetryFrame++;
+        if (++telemetryCount < TELEMETRY) return;
+        telemetryCount = 0;
+
+        rec.version = TELEMETRY_VERSION;
+        rec.frame = telemetryFrame;
+        GetFrameStats(&stats);
+        memcpy(rec.cycles, stats.cycles, sizeof(rec.cycles));
+        rec.game = stats.game;
+        rec.ramTiles = free_tile_index;
+        rec.droppedTiles = sprite_tiles_dropped;
+        rec.voices = 0;
+        for (i = 0; i < CHANNELS; i++) {
+                if (tracks[i].envelopeVol != 0 && tracks[i].noteVol != 0) rec.voices |= 1 << i;
+        }
+        rec.joy1 = ReadJoypad(0);
+        rec.joy2 = ReadJoypad(1);
+        rec.score = playerScore[currentPlayer];
+        rec.stage = gameStage[currentPlayer];
+        rec.mode = gameMode | (currentPlayer << 7);
+        rec.skipped = telemetrySkipped;
+#if STACK_PAINT == 1
+        rec.stack = GetStackHighWater();
+#else
+        rec.stack = 0;
+#endif
+        rec.crc = 0xffff;
+        for (i = 0; i < sizeof(rec) - 2; i++) rec.crc = _crc_ccitt_update(rec.crc, src[i]);
+
+        // COBS: each code byte is the distance to the next 0
+        for (i = 0; i < sizeof(rec); i++) {
+                if (src[i] == 0) {
+                        *code = n;
+                        code = dest++;
+                        n = 1;
+                } else {
+                        *dest++ = src[i];
+                        if (++n == 0xff) {
+                                *code = n;
+                                code = dest++;
+                                n = 1;
+                        }
+                }
+        }
+        *code = n;
+        *dest++ = 0;
+
+        n = dest - out;
+        if (UartTxFree() < n) {
+                telemetrySkipped++;
+                return;
+        }
+        UartWrite(out, n);
+}
+
+#else
+
+#define TelemetryFrame()
+
+#endif
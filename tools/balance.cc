@@ -0,0 +1,696 @@
+/*
+ *  balance - batch runs of the game rules for difficulty tuning. Plays
+ *  thousands of one player games on the host model of playGame()
+ *  (gamerules.cc), each with its own seed, on all the cores, and
+ *  reports how far they get: the stage reached, the score, what ended
+ *  the turns and the course each stage made, next to the minSpeedTable,
+ *  beerVarianceTable, roadVarianceTable and stageLengthTable values of
+ *  the stage.
+ *
+ *  The stage table has the share of turns cleared and ended by each
+ *  crash, and the median time of a cleared turn. The course table has,
+ *  per turn, the beers spawned and the share caught, the dirt road
+ *  segments with their mean length in stripes of 8 pixels and the share
+ *  one lane wide, the causeways and the jumps.
+ *
+ *  The player is a bot or random presses. The bot goes for the nearest
+ *  beer and, on the dirt road, for a lane that stays on the road, with
+ *  a jump when there is none. -k makes it wait after each press and -e
+ *  turns a share of its presses the wrong way, for players of less
+ *  skill than the bot.
+ *
+ *  The tables can be changed on the command line to try a setting
+ *  before it goes in the game:
+ *
+ *    balance -n 10000 -b 100,90,80,70,60,50,40,30,30,30,30,30,30,30,30,30
+ *    balance -n 10000 -e 10 -l 3,20,3,40,5
+ *
+ *  A list of one value (five for -l) is used for every stage.
+ *
+ *  The games are cut in batches of seeds shared by the threads. Each
+ *  thread takes its own batches from the back of its queue and steals
+ *  from the front of the others once it has none left, as a game can
+ *  last one turn or sixteen stages. The reports don't depend on the
+ *  thread count.
+ *
+ *  -d plays one turn with the bot and prints its input log in the
+ *  format of data/demos.h, from the stage and the rand() seed given,
+ *  and the demoEnds[] entry uzesim -m checks the game against.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include "gamerules.h"
+
+typedef uint64_t u64;
+
+#define BATCH_GAMES 16
+#define TURN_FRAME_LIMIT (60 * 60 * 10)	//a turn this long is stuck
+
+enum { PLAYER_BOT, PLAYER_RANDOM };
+
+struct Player
+{
+	int policy;
+	int speed;		//speed the bot keeps
+	int wait;		//frames the bot lets go after a press
+	int slips;		//% of the bot presses that go wrong
+	int presses;	//% of frames with a random press
+};
+
+// xorshift32 of the player, apart from the rand() of the game
+struct Dice
+{
+	explicit Dice(u32 seed) : state(seed * 2654435761u | 1) {}
+
+	u32 Next()
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+
+	bool Chance(int percent) { return (int)(Next() % 100) < percent; }
+
+	u32 state;
+};
+
+// ReadJoypad(0) of one game
+class Pad
+{
+public:
+	Pad(const Player &player, u32 seed) : player(player), dice(seed), idle(0), held(0), holdFor(0) {}
+
+	u16 Read(const GameRules &game)
+	{
+		return player.policy == PLAYER_BOT ? Bot(game) : Random();
+	}
+
+private:
+	u16 Bot(const GameRules &game);
+	u16 Random();
+
+	const Player &player;
+	Dice dice;
+	int idle;
+	u16 held;
+	int holdFor;
+};
+
+// the turn goes on for frames more without a press after first
+static bool survives(const GameRules &game, u16 first, int frames)
+{
+	GameRules g(game);
+	GameEvent e = g.Step(first);
+	for (int n = 0; e == GAME_RUNNING && n < frames; n++) e = g.Step(0);
+	return e == GAME_RUNNING || e == GAME_CLEARED;
+}
+
+//
+// One press at a time, when the car is settled. Beers: the lane of the
+// closest beer not yet past the car. Dirt road: when the lane runs out
+// within the columns the car covers in about 4 frames, the nearest lane
+// on the road for 2 columns, or a jump if it lands on the road.
+//
+u16 Pad::Bot(const GameRules &g)
+{
+	if (idle > 0) {
+		idle--;
+		return 0;
+	}
+	if (g.buttonReset != 0 || g.banditZ != 0 || g.banditY != g.nextYPos) return 0;
+
+	u16 j = 0;
+	if (g.banditSpeed < player.speed) j = GAME_BTN_UP;
+	else if (g.banditSpeed > player.speed && g.banditSpeed > g.minSpeed) j = GAME_BTN_DOWN;
+
+	bool beers = g.subStage == 1;
+	for (int i = 0; i < GAME_MAX_BEERS; i++) beers = beers || g.beerCans[i].enabled;
+
+	int target = g.banditY;
+	if (beers) {
+		int next = -1;
+		for (int i = 0; i < GAME_MAX_BEERS; i++) {
+			const GameBeer &b = g.beerCans[i];
+			if (!b.enabled || b.x >= g.banditX + 14) continue;
+			if (next < 0 || b.x > g.beerCans[next].x) next = i;
+		}
+		if (next >= 0) target = GAME_LANE1 + g.beerCans[next].y - 28;
+	} else if (!g.OnRoad(g.banditY, 4 + g.banditSpeed)) {
+		static const int moves[4] = { -32, 32, -64, 64 };
+		bool found = false;
+		for (int i = 0; i < 4 && !found; i++) {
+			int y = g.banditY + moves[i];
+			if (y >= GAME_LANE1 && y <= GAME_LANE4 && g.OnRoad(y, 2)) {
+				target = y;
+				found = true;
+			}
+		}
+		if (!found && survives(g, GAME_BTN_X, 40)) j = GAME_BTN_X;
+	}
+	if (target < g.banditY) j = GAME_BTN_RIGHT;
+	else if (target > g.banditY) j = GAME_BTN_LEFT;
+
+	if (j != 0) {
+		idle = 1 + player.wait;
+		if (player.slips > 0 && dice.Chance(player.slips)) {
+			if (j == GAME_BTN_RIGHT) j = GAME_BTN_LEFT;
+			else if (j == GAME_BTN_LEFT) j = GAME_BTN_RIGHT;
+			else if (j == GAME_BTN_X) j = 0;
+		}
+	}
+	return j;
+}
+
+// a random direction or jump held for 1 to 8 frames
+u16 Pad::Random()
+{
+	static const u16 buttons[5] = {
+		GAME_BTN_UP, GAME_BTN_DOWN, GAME_BTN_LEFT, GAME_BTN_RIGHT, GAME_BTN_X
+	};
+	if (holdFor > 0) {
+		holdFor--;
+		return held;
+	}
+	if (!dice.Chance(player.presses)) return 0;
+	held = buttons[dice.Next() % 5];
+	holdFor = dice.Next() % 8;
+	return held;
+}
+
+struct StageStats
+{
+	StageStats() : turns(0), frames(0), beersSpawned(0), beersCaught(0), segments(0),
+		segmentStripes(0), singleLane(0), waterCrossings(0), jumps(0) { memset(ends, 0, sizeof(ends)); }
+
+	u64 turns;
+	u64 ends[5];		//by GameEvent, GAME_RUNNING for the stuck turns
+	u64 frames;
+	std::vector<u32> clearFrames;
+	u64 beersSpawned, beersCaught;
+	u64 segments, segmentStripes, singleLane, waterCrossings, jumps;
+};
+
+struct GameResult
+{
+	u32 seed;
+	u8 stage;			//gameStage at the game over, GAME_MAX_STAGES when all cleared
+	u16 score;
+	u32 frames;
+	u32 turns;
+};
+
+// what one thread played
+struct Stats
+{
+	void AddTurn(const GameRules &g, u8 stage, GameEvent end);
+	void Merge(const Stats &s);
+
+	StageStats stages[GAME_MAX_STAGES];
+	std::vector<GameResult> games;
+};
+
+void Stats::AddTurn(const GameRules &g, u8 stage, GameEvent end)
+{
+	StageStats &s = stages[stage];
+	s.turns++;
+	s.ends[end]++;
+	s.frames += g.frames;
+	if (end == GAME_CLEARED) s.clearFrames.push_back(g.frames);
+	s.beersSpawned += g.course.beersSpawned;
+	s.beersCaught += g.course.beersCaught;
+	s.segments += g.course.segments;
+	s.segmentStripes += g.course.segmentStripes;
+	s.singleLane += g.course.singleLane;
+	s.waterCrossings += g.course.waterCrossings;
+	s.jumps += g.course.jumps;
+}
+
+void Stats::Merge(const Stats &o)
+{
+	for (int i = 0; i < GAME_MAX_STAGES; i++) {
+		StageStats &s = stages[i];
+		const StageStats &t = o.stages[i];
+		s.turns += t.turns;
+		for (int e = 0; e < 5; e++) s.ends[e] += t.ends[e];
+		s.frames += t.frames;
+		s.clearFrames.insert(s.clearFrames.end(), t.clearFrames.begin(), t.clearFrames.end());
+		s.beersSpawned += t.beersSpawned;
+		s.beersCaught += t.beersCaught;
+		s.segments += t.segments;
+		s.segmentStripes += t.segmentStripes;
+		s.singleLane += t.singleLane;
+		s.waterCrossings += t.waterCrossings;
+		s.jumps += t.jumps;
+	}
+	games.insert(games.end(), o.games.begin(), o.games.end());
+}
+
+// one game from firstStage with 3 guys, as the game plays it for one player
+static void playGame(const GameTables &tables, const Player &player, u8 firstStage, u32 seed, Stats &stats)
+{
+	GameRules g(tables);
+	Pad pad(player, seed);
+	GameResult r;
+	r.seed = seed;
+	r.frames = 0;
+	r.turns = 0;
+
+	g.NewGame(seed);
+	g.gameStage = firstStage;
+	while (g.guysLeft > 0 && g.gameStage < GAME_MAX_STAGES) {
+		u8 stage = g.gameStage;
+		g.StartTurn();
+		GameEvent e = GAME_RUNNING;
+		while (e == GAME_RUNNING && g.frames < TURN_FRAME_LIMIT) {
+			e = g.Step(pad.Read(g));
+		}
+		stats.AddTurn(g, stage, e);
+		r.frames += g.frames;
+		r.turns++;
+		if (e == GAME_RUNNING) break;
+		if (e != GAME_CLEARED) g.guysLeft--;
+	}
+	r.stage = g.gameStage;
+	r.score = g.playerScore;
+	stats.games.push_back(r);
+}
+
+struct Batch
+{
+	u32 first;
+	u32 count;
+};
+
+//
+// Work stealing pool: a queue of batches per thread, the owner works
+// from the back, thieves from the front. Nothing is queued once Run()
+// starts, so a thread is done when all the queues are empty.
+//
+class BatchPool
+{
+public:
+	BatchPool(const GameTables &tables, const Player &player, u8 firstStage, int threads);
+	~BatchPool();
+
+	void Run(u32 firstSeed, u32 games);
+
+	std::vector<Stats> stats;	//per thread
+	std::vector<u32> steals;
+
+private:
+	struct Queue
+	{
+		std::mutex lock;
+		std::deque<Batch> batches;
+	};
+
+	bool Take(int self, Batch &batch);
+	void Work(int self);
+
+	const GameTables &tables;
+	const Player &player;
+	u8 firstStage;
+	std::vector<Queue *> queues;
+};
+
+BatchPool::BatchPool(const GameTables &tables, const Player &player, u8 firstStage, int threads) :
+	stats(threads), steals(threads), tables(tables), player(player), firstStage(firstStage)
+{
+	for (int i = 0; i < threads; i++) queues.push_back(new Queue());
+}
+
+BatchPool::~BatchPool()
+{
+	for (size_t i = 0; i < queues.size(); i++) delete queues[i];
+}
+
+bool BatchPool::Take(int self, Batch &batch)
+{
+	int n = queues.size();
+	for (int k = 0; k < n; k++) {
+		Queue &q = *queues[(self + k) % n];
+		std::lock_guard<std::mutex> hold(q.lock);
+		if (q.batches.empty()) continue;
+		if (k == 0) {
+			batch = q.batches.back();
+			q.batches.pop_back();
+		} else {
+			batch = q.batches.front();
+			q.batches.pop_front();
+			steals[self]++;
+		}
+		return true;
+	}
+	return false;
+}
+
+void BatchPool::Work(int self)
+{
+	Batch b;
+	while (Take(self, b)) {
+		for (u32 i = 0; i < b.count; i++) playGame(tables, player, firstStage, b.first + i, stats[self]);
+	}
+}
+
+void BatchPool::Run(u32 firstSeed, u32 games)
+{
+	// consecutive batches to each queue, the owner starts from its last
+	int n = queues.size();
+	u32 batches = (games + BATCH_GAMES - 1) / BATCH_GAMES;
+	for (u32 i = 0; i < batches; i++) {
+		Batch b;
+		b.first = firstSeed + i * BATCH_GAMES;
+		b.count = std::min((u32)BATCH_GAMES, games - i * BATCH_GAMES);
+		queues[(u64)i * n / batches]->batches.push_back(b);
+	}
+
+	std::vector<std::thread> threads;
+	for (int i = 1; i < n; i++) threads.push_back(std::thread(&BatchPool::Work, this, i));
+	Work(0);
+	for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+}
+
+static void usage()
+{
+	printf("\n\tUsage: balance [options]\n\n"
+		"\t-n games    games to play, default 1000\n"
+		"\t-j threads  default one per core\n"
+		"\t-S seed     seed of the first game, default 1\n"
+		"\t-s stage    stage the games start at, default 1\n"
+		"\t-p player   bot or random, default bot\n"
+		"\t-v speed    speed the bot keeps, default %d\n"
+		"\t-k frames   frames the bot waits after a press, default 0\n"
+		"\t-e percent  bot presses that go wrong, default 0\n"
+		"\t-q percent  frames with a random press, default 5\n"
+		"\t-m list     minSpeedTable\n"
+		"\t-b list     beerVarianceTable\n"
+		"\t-r list     roadVarianceTable\n"
+		"\t-l list     stageLengthTable\n"
+		"\t-o file     write the games as CSV, - for stdout\n"
+		"\t-d st,seed  print the input log of a bot turn for data/demos.h\n"
+		"\t-f frames   length of the -d turn, default 3600\n\n", GAME_MAX_SPEED);
+}
+
+// comma separated values in [low, high], one value (or period values)
+// repeated up to count
+template <typename T>
+static bool parseTable(const char *s, T *table, int count, int period, int low, int high, const char *name)
+{
+	std::vector<int> v;
+	for (;;) {
+		char *end;
+		long x = strtol(s, &end, 0);
+		if (end == s || x < low || x > high) {
+			printf("%s: values from %d to %d are needed.\n", name, low, high);
+			return false;
+		}
+		v.push_back(x);
+		if (*end == 0) break;
+		if (*end != ',') {
+			printf("%s: a comma separated list is needed.\n", name);
+			return false;
+		}
+		s = end + 1;
+	}
+	if ((int)v.size() != count && (int)v.size() != period) {
+		printf("%s: %d or %d values are needed.\n", name, period, count);
+		return false;
+	}
+	for (int i = 0; i < count; i++) table[i] = v[i % v.size()];
+	return true;
+}
+
+// the input log of InputRecordStart(), see kernel/uzeboxCore.c
+static std::vector<u8> encodeLog(u16 seed, const std::vector<u16> &inputs)
+{
+	std::vector<u8> out;
+	out.push_back(seed & 0xff);
+	out.push_back(seed >> 8);
+	u16 prev = 0;
+	int run = -1;
+	for (size_t i = 0; i < inputs.size(); i++) {
+		u16 j = inputs[i];
+		if (run >= 0 && j == prev && out[run] < 0x7f) {
+			out[run]++;
+			continue;
+		}
+		u16 d = j ^ prev;
+		if (d != 0 && (d & (d - 1)) == 0) {
+			int k = 0;
+			while (!(d & (1 << k))) k++;
+			out.push_back(0x80 | k);
+		} else if (d != 0) {
+			out.push_back(0x90 | (d >> 8));
+			out.push_back(d & 0xff);
+		}
+		prev = j;
+		run = out.size();
+		out.push_back(0);
+	}
+	out.push_back(0xff);
+	return out;
+}
+
+// a turn of demoMode(): playGame() then syncTurnInput() with the seed
+static void printDemo(const GameTables &tables, const Player &player, u8 stage, u16 seed, u32 frames)
+{
+	GameRules g(tables);
+	Pad pad(player, seed);
+	g.NewGame(seed);
+	g.gameStage = stage;
+	g.StartTurn();
+	g.SyncTurn(seed);
+
+	std::vector<u16> inputs;
+	GameEvent e = GAME_RUNNING;
+	while (e == GAME_RUNNING && inputs.size() < frames) {
+		u16 j = pad.Read(g);
+		inputs.push_back(j);
+		e = g.Step(j);
+	}
+	std::vector<u8> log = encodeLog(seed, inputs);
+	log.insert(log.begin(), stage);
+
+	static const char *ends[5] = { "", ", cleared", ", off the road", ", off the causeway", ", missed a beer" };
+	printf("// stage %d, seed %u, %u frames%s, %u bytes\n", stage + 1, seed, (u32)inputs.size(),
+		ends[e], (u32)log.size());
+	printf("const unsigned char demoStage%d[] PROGMEM = {\n", stage + 1);
+	for (size_t i = 0; i < log.size(); i++) {
+		printf("0x%02x%s", log[i], i + 1 == log.size() ? "};\n" : (i % 32 == 31) ? ",\n" : ",");
+	}
+	printf("// demoEnds[]: { %u, %u, %u, %u, %d },\n", (u32)inputs.size(), g.playerScore, g.gameStage,
+		g.subStage, e);
+}
+
+static double percentile(std::vector<double> &v, double p)
+{
+	if (v.empty()) return 0;
+	size_t i = (size_t)(p / 100.0 * (v.size() - 1) + 0.5);
+	return v[i];
+}
+
+static bool bySeed(const GameResult &a, const GameResult &b)
+{
+	return a.seed < b.seed;
+}
+
+static double share(u64 a, u64 b)
+{
+	return b ? (double)a / b : 0.0;
+}
+
+int main(int argc, char *argv[])
+{
+	GameTables tables;
+	Player player = { PLAYER_BOT, GAME_MAX_SPEED, 0, 0, 5 };
+	u32 games = 1000, firstSeed = 1, demoFrames = 3600;
+	int threads = std::thread::hardware_concurrency(), firstStage = 1, demoStage = 0;
+	u16 demoSeed = 0;
+	const char *csvname = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+			games = strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-S") && i + 1 < argc) {
+			firstSeed = strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+			firstStage = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+			i++;
+			if (!strcmp(argv[i], "bot")) player.policy = PLAYER_BOT;
+			else if (!strcmp(argv[i], "random")) player.policy = PLAYER_RANDOM;
+			else {
+				usage();
+				return 1;
+			}
+		} else if (!strcmp(argv[i], "-v") && i + 1 < argc) {
+			player.speed = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-k") && i + 1 < argc) {
+			player.wait = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-e") && i + 1 < argc) {
+			player.slips = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-q") && i + 1 < argc) {
+			player.presses = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+			if (!parseTable(argv[++i], tables.minSpeed, GAME_MAX_STAGES, 1, 1, GAME_MAX_SPEED, "minSpeedTable")) return 1;
+		} else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+			if (!parseTable(argv[++i], tables.beerVariance, GAME_MAX_STAGES, 1, 1, 127, "beerVarianceTable")) return 1;
+		} else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+			if (!parseTable(argv[++i], tables.roadVariance, GAME_MAX_STAGES, 1, 1, 127, "roadVarianceTable")) return 1;
+		} else if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+			//stageStep is a byte, it never gets over 255
+			if (!parseTable(argv[++i], tables.stageLength, GAME_MAX_STAGES * GAME_MAX_SUBSTAGES,
+				GAME_MAX_SUBSTAGES, 0, 254, "stageLengthTable")) return 1;
+		} else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+			csvname = argv[++i];
+		} else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+			unsigned stage, seed;
+			if (sscanf(argv[++i], "%u,%u", &stage, &seed) != 2 || stage < 1 || seed > 0xffff) {
+				usage();
+				return 1;
+			}
+			demoStage = stage;
+			demoSeed = seed;
+		} else if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+			demoFrames = strtoul(argv[++i], NULL, 0);
+		} else {
+			usage();
+			return 1;
+		}
+	}
+	if (threads < 1) threads = 1;
+	if (firstStage < 1 || firstStage > GAME_MAX_STAGES || demoStage > GAME_MAX_STAGES) {
+		printf("Stages go from 1 to %d.\n", GAME_MAX_STAGES);
+		return 1;
+	}
+
+	if (demoStage > 0) {
+		printDemo(tables, player, demoStage - 1, demoSeed, demoFrames);
+		return 0;
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	BatchPool pool(tables, player, firstStage - 1, threads);
+	pool.Run(firstSeed, games);
+	Stats all;
+	u32 steals = 0;
+	for (int i = 0; i < threads; i++) {
+		all.Merge(pool.stats[i]);
+		steals += pool.steals[i];
+	}
+	double host = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::sort(all.games.begin(), all.games.end(), bySeed);
+
+	FILE *csv = NULL;
+	if (csvname != NULL) {
+		csv = strcmp(csvname, "-") ? fopen(csvname, "w") : stdout;
+		if (csv == NULL) {
+			printf("Failed to create file.\n");
+			return 1;
+		}
+		fprintf(csv, "seed,stage,score,turns,frames\n");
+		for (size_t i = 0; i < all.games.size(); i++) {
+			const GameResult &r = all.games[i];
+			fprintf(csv, "%u,%d,%u,%u,%u\n", r.seed, r.stage + 1, r.score, r.turns, r.frames);
+		}
+		if (csv != stdout) fclose(csv);
+	}
+	FILE *out = (csv == stdout) ? stderr : stdout;
+
+	u64 frames = 0;
+	u32 reached[GAME_MAX_STAGES + 1] = { 0 };
+	std::vector<double> scores;
+	for (size_t i = 0; i < all.games.size(); i++) {
+		const GameResult &r = all.games[i];
+		frames += r.frames;
+		reached[r.stage]++;
+		scores.push_back(r.score);
+	}
+	std::sort(scores.begin(), scores.end());
+
+	if (player.policy == PLAYER_BOT) {
+		fprintf(out, "\n\t%u games, bot at speed %d, %d frames wait, %d%% slips\n", games,
+			player.speed, player.wait, player.slips);
+	} else {
+		fprintf(out, "\n\t%u games, random presses on %d%% of the frames\n", games, player.presses);
+	}
+	fprintf(out, "\t%.1f hours of play in %.1fs on %d threads (%u batches stolen)\n\n",
+		frames / 60.0 / 3600.0, host, threads, steals);
+
+	fprintf(out, "\t%-8s %8s %8s\n", "reached", "games", "%");
+	for (int s = 0; s <= GAME_MAX_STAGES; s++) {
+		if (reached[s] == 0) continue;
+		char name[16];
+		if (s == GAME_MAX_STAGES) strcpy(name, "all");
+		else sprintf(name, "stage %d", s + 1);
+		fprintf(out, "\t%-8s %8u %8.1f\n", name, reached[s], 100.0 * reached[s] / games);
+	}
+
+	fprintf(out, "\n\t%-8s %8s %8s %8s %8s %8s\n", "", "p10", "p50", "p90", "p99", "max");
+	fprintf(out, "\t%-8s %8.0f %8.0f %8.0f %8.0f %8.0f\n", "score", percentile(scores, 10),
+		percentile(scores, 50), percentile(scores, 90), percentile(scores, 99),
+		scores.empty() ? 0.0 : scores.back());
+
+	// the settings of each stage played, then how its turns went
+	fprintf(out, "\n\t%-5s %5s %5s %5s %-14s %7s %6s %6s %6s %6s %7s\n", "stage", "speed",
+		"beer", "road", "lengths", "turns", "clear", "wall", "water", "beer", "clear s");
+	for (int s = 0; s < GAME_MAX_STAGES; s++) {
+		StageStats &st = all.stages[s];
+		if (st.turns == 0) continue;
+		const u8 *len = tables.stageLength + s * GAME_MAX_SUBSTAGES;
+		char lengths[32];
+		sprintf(lengths, "%d/%d/%d/%d/%d", len[0], len[1], len[2], len[3], len[4]);
+		std::vector<double> clear(st.clearFrames.begin(), st.clearFrames.end());
+		std::sort(clear.begin(), clear.end());
+		char clearTime[16] = "-";
+		if (!clear.empty()) sprintf(clearTime, "%.1f", percentile(clear, 50) / 60);
+		fprintf(out, "\t%-5d %5d %5d %5d %-14s %7llu %5.1f%% %5.1f%% %5.1f%% %5.1f%% %7s\n", s + 1,
+			tables.minSpeed[s], tables.beerVariance[s], tables.roadVariance[s], lengths,
+			(unsigned long long)st.turns, 100 * share(st.ends[GAME_CLEARED], st.turns),
+			100 * share(st.ends[GAME_WALL], st.turns), 100 * share(st.ends[GAME_WATER], st.turns),
+			100 * share(st.ends[GAME_BEER], st.turns), clearTime);
+	}
+
+	// the course per turn
+	fprintf(out, "\n\t%-5s %7s %7s %7s %7s %7s %7s %7s\n", "stage", "beers", "caught",
+		"roads", "stripes", "single", "water", "jumps");
+	u64 stuck = 0;
+	for (int s = 0; s < GAME_MAX_STAGES; s++) {
+		const StageStats &st = all.stages[s];
+		if (st.turns == 0) continue;
+		fprintf(out, "\t%-5d %7.1f %6.1f%% %7.1f %7.1f %6.1f%% %7.2f %7.2f\n", s + 1,
+			share(st.beersSpawned, st.turns), 100 * share(st.beersCaught, st.beersSpawned),
+			share(st.segments, st.turns), share(st.segmentStripes, st.segments),
+			100 * share(st.singleLane, st.segments), share(st.waterCrossings, st.turns),
+			share(st.jumps, st.turns));
+		stuck += st.ends[GAME_RUNNING];
+	}
+	if (stuck > 0) fprintf(out, "\n\tturns stopped after %d frames: %llu\n", TURN_FRAME_LIMIT, (unsigned long long)stuck);
+	fprintf(out, "\n");
+
+	return 0;
+}
@@ -0,0 +1,442 @@
+/*
+ *  budget - flash and RAM report of the game from the linker map file,
+ *  by group (kernel, video mode, game, C library and each data file)
+ *  and by symbol. Exits with an error when a budget is exceeded, so
+ *  default/Makefile can stop the build.
+ *
+ *  The map gives the object file of each input section. The symbol sizes
+ *  come from an avr-nm -S listing when one is given, else from the
+ *  distance to the next symbol of the same section. The symbols defined
+ *  in the .h and .inc files of the -a directories form one group per file.
+ *
+ *  The stack headroom is the RAM left above the highest static variable,
+ *  the stack grows down to it from RAMEND.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include "uzehost.h"
+
+#define RAM_START 0x800100		//atmega644
+#define RAM_END 0x8010ff
+
+struct Symbol
+{
+	std::string name;
+	u32 addr;
+	u32 size;
+	bool sized;				//size from avr-nm
+};
+
+struct Section
+{
+	std::string output;		//.text, .data, .bss, .noinit
+	std::string name;
+	u32 addr;
+	u32 size;
+	std::string object;
+	std::vector<Symbol> symbols;
+};
+
+struct Usage
+{
+	u32 flash;
+	u32 ram;
+};
+
+struct Budget
+{
+	std::string group;
+	u32 max;
+};
+
+static void usage()
+{
+	printf("\n\tUsage: budget [options] game.map [game.sym]\n\n"
+		"\tgame.sym is the output of avr-nm -S game.elf, for exact symbol sizes.\n\n"
+		"\t-a dir      group the symbols of the .h and .inc files of dir\n"
+		"\t-f bytes    flash budget\n"
+		"\t-r bytes    RAM budget of the static variables\n"
+		"\t-s bytes    minimum stack headroom\n"
+		"\t-g group=bytes  flash budget of a group\n"
+		"\t-t count    biggest symbols to list, default: 20\n\n"
+		"\tEx:  budget -a ../data -f 61440 -s 256 game.map game.sym\n\n");
+}
+
+// the AVR linker script puts all the flash in .text, plus the initial values of .data
+static bool isFlash(const std::string &output)
+{
+	return output == ".text" || output == ".data";
+}
+
+static bool isRam(const std::string &output)
+{
+	return output == ".data" || output == ".bss" || output == ".noinit";
+}
+
+static std::string fileName(const std::string &path)
+{
+	size_t slash = path.find_last_of("/\\");
+	return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+// the group of an object file
+static std::string objectGroup(const std::string &object)
+{
+	std::string name = fileName(object);
+	if (object.find(".a(") != std::string::npos || name.compare(0, 3, "crt") == 0) return "libc";
+	if (name.find("VideoEngine") != std::string::npos) return "video mode";
+	if (name.compare(0, 6, "uzebox") == 0 || name == "fat.o" || name == "mmc.o") return "kernel";
+	if (name.empty()) return "padding";
+	return "game";
+}
+
+static std::vector<std::string> split(const std::string &line)
+{
+	std::vector<std::string> words;
+	size_t pos = 0;
+	while (pos < line.size()) {
+		while (pos < line.size() && isspace(line[pos])) pos++;
+		size_t start = pos;
+		while (pos < line.size() && !isspace(line[pos])) pos++;
+		if (pos > start) words.push_back(line.substr(start, pos - start));
+	}
+	return words;
+}
+
+static bool isHex(const std::string &s)
+{
+	return s.size() > 2 && s[0] == '0' && s[1] == 'x';
+}
+
+static bool readMap(const char *name, std::vector<Section> &sections)
+{
+	FILE *f = fopen(name, "r");
+	if (f == NULL) {
+		printf("Can't open %s.\n", name);
+		return false;
+	}
+
+	char buf[1024];
+	bool started = false;
+	std::string output, pending;
+	bool pendingOutput = false;
+	while (fgets(buf, sizeof(buf), f) != NULL) {
+		std::string line = buf;
+		while (!line.empty() && isspace(line[line.size() - 1])) line.erase(line.size() - 1);
+		if (!started) {
+			started = line.compare(0, 26, "Linker script and memory m") == 0;
+			continue;
+		}
+		if (line.empty()) continue;
+		std::vector<std::string> w = split(line);
+		bool outputLine = !isspace(line[0]);
+
+		// a long section name is alone on its line, its values on the next
+		if (!pending.empty()) {
+			if (isHex(w[0]) && w.size() >= 2 && isHex(w[1])) {
+				w.insert(w.begin(), pending);
+				outputLine = pendingOutput;
+			}
+			pending.clear();
+		}
+
+		if (outputLine) {
+			// output section
+			if (w[0][0] != '.') continue;
+			if (w.size() == 1) {
+				pending = w[0];
+				pendingOutput = true;
+				continue;
+			}
+			output = w[0];
+			continue;
+		}
+		if (output.empty()) continue;
+
+		if (w[0] == "*fill*" || (w[0][0] == '.' || w[0] == "COMMON")) {
+			if (w.size() == 1) {
+				pending = w[0];
+				pendingOutput = false;
+				continue;
+			}
+			if (w.size() < 3 || !isHex(w[1]) || !isHex(w[2])) continue;
+			Section s;
+			s.output = output;
+			s.name = w[0];
+			s.addr = strtoul(w[1].c_str(), NULL, 16);
+			s.size = strtoul(w[2].c_str(), NULL, 16);
+			if (w.size() > 3) {
+				s.object = w[3];
+				for (size_t i = 4; i < w.size(); i++) s.object += " " + w[i];
+			}
+			if (s.size > 0) sections.push_back(s);
+			continue;
+		}
+
+		// symbol of the last input section: address, name
+		if (w.size() == 2 && isHex(w[0]) && !sections.empty() && (isalpha(w[1][0]) || w[1][0] == '_')) {
+			Section &s = sections.back();
+			u32 addr = strtoul(w[0].c_str(), NULL, 16);
+			if (addr < s.addr || addr >= s.addr + s.size || s.output != output) continue;
+			Symbol sym = { w[1], addr, 0, false };
+			s.symbols.push_back(sym);
+		}
+	}
+	fclose(f);
+
+	if (!started) {
+		printf("%s: not a linker map file.\n", name);
+		return false;
+	}
+	return true;
+}
+
+static bool byAddress(const Symbol &a, const Symbol &b)
+{
+	return a.addr < b.addr;
+}
+
+static bool bySize(const std::pair<u32, std::string> &a, const std::pair<u32, std::string> &b)
+{
+	return a.first > b.first;
+}
+
+// symbol sizes, from avr-nm or the next symbol
+static void sizeSymbols(std::vector<Section> &sections, const char *symName)
+{
+	std::map<std::string, std::vector<std::pair<u32, u32> > > nm;
+	FILE *f = symName ? fopen(symName, "r") : NULL;
+	if (symName != NULL && f == NULL) printf("Can't open %s, the sizes are estimated.\n", symName);
+	if (f != NULL) {
+		char buf[1024];
+		while (fgets(buf, sizeof(buf), f) != NULL) {
+			std::vector<std::string> w = split(buf);
+			if (w.size() != 4) continue;
+			nm[w[3]].push_back(std::make_pair((u32)strtoul(w[0].c_str(), NULL, 16),
+				(u32)strtoul(w[1].c_str(), NULL, 16)));
+		}
+		fclose(f);
+	}
+
+	// local symbols are only in the avr-nm listing
+	for (std::map<std::string, std::vector<std::pair<u32, u32> > >::iterator it = nm.begin(); it != nm.end(); ++it) {
+		for (size_t j = 0; j < it->second.size(); j++) {
+			u32 addr = it->second[j].first, size = it->second[j].second;
+			for (size_t i = 0; i < sections.size(); i++) {
+				Section &s = sections[i];
+				if (addr < s.addr || addr >= s.addr + s.size) continue;
+				bool found = false;
+				for (size_t k = 0; k < s.symbols.size(); k++) {
+					if (s.symbols[k].name == it->first && s.symbols[k].addr == addr) {
+						s.symbols[k].size = size;
+						s.symbols[k].sized = true;
+						found = true;
+					}
+				}
+				if (!found) {
+					Symbol sym = { it->first, addr, size, true };
+					s.symbols.push_back(sym);
+				}
+				break;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < sections.size(); i++) {
+		Section &s = sections[i];
+		std::vector<Symbol> &syms = s.symbols;
+		std::sort(syms.begin(), syms.end(), byAddress);
+		for (size_t k = 0; k < syms.size(); k++) {
+			if (syms[k].sized) continue;
+			u32 next = s.addr + s.size;
+			for (size_t n = k + 1; n < syms.size(); n++) {
+				if (syms[n].addr > syms[k].addr) {
+					next = syms[n].addr;
+					break;
+				}
+			}
+			syms[k].size = next - syms[k].addr;
+		}
+	}
+}
+
+// the names defined with PROGMEM in the .h and .inc files of dir
+static void scanAssets(const char *dir, std::map<std::string, std::string> &assets)
+{
+	DIR *d = opendir(dir);
+	if (d == NULL) {
+		printf("Can't open %s.\n", dir);
+		return;
+	}
+	struct dirent *e;
+	while ((e = readdir(d)) != NULL) {
+		std::string file = e->d_name;
+		size_t dot = file.rfind('.');
+		if (dot == std::string::npos || (file.substr(dot) != ".h" && file.substr(dot) != ".inc")) continue;
+
+		FILE *f = fopen((std::string(dir) + "/" + file).c_str(), "r");
+		if (f == NULL) continue;
+		char buf[4096];
+		while (fgets(buf, sizeof(buf), f) != NULL) {
+			std::string line = buf;
+			size_t bracket = line.find('[');
+			if (line.find("PROGMEM") == std::string::npos || bracket == std::string::npos) continue;
+			size_t end = bracket;
+			while (end > 0 && isspace(line[end - 1])) end--;
+			size_t start = end;
+			while (start > 0 && (isalnum(line[start - 1]) || line[start - 1] == '_')) start--;
+			if (end > start) assets[line.substr(start, end - start)] = file;
+		}
+		fclose(f);
+	}
+	closedir(d);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *mapName = NULL, *symName = NULL;
+	std::vector<const char *> assetDirs;
+	std::vector<Budget> budgets;
+	long flashMax = -1, ramMax = -1, stackMin = -1;
+	int top = 20;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-a") && i + 1 < argc) {
+			assetDirs.push_back(argv[++i]);
+		} else if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+			flashMax = atol(argv[++i]);
+		} else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+			ramMax = atol(argv[++i]);
+		} else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+			stackMin = atol(argv[++i]);
+		} else if (!strcmp(argv[i], "-g") && i + 1 < argc) {
+			std::string arg = argv[++i];
+			size_t eq = arg.rfind('=');
+			if (eq == std::string::npos) {
+				usage();
+				return 1;
+			}
+			Budget b = { arg.substr(0, eq), (u32)atol(arg.c_str() + eq + 1) };
+			budgets.push_back(b);
+		} else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+			top = atoi(argv[++i]);
+		} else if (argv[i][0] == '-') {
+			usage();
+			return 1;
+		} else if (mapName == NULL) {
+			mapName = argv[i];
+		} else {
+			symName = argv[i];
+		}
+	}
+	if (mapName == NULL) {
+		usage();
+		return 0;
+	}
+
+	std::vector<Section> sections;
+	if (!readMap(mapName, sections)) return 1;
+	sizeSymbols(sections, symName);
+	std::map<std::string, std::string> assets;
+	for (size_t i = 0; i < assetDirs.size(); i++) scanAssets(assetDirs[i], assets);
+
+	// by group; the game symbols found in a data file go to its group
+	std::map<std::string, Usage> groups;
+	std::vector<std::pair<u32, std::string> > symbols;
+	u32 flash = 0, ram = 0, ramTop = RAM_START;
+	for (size_t i = 0; i < sections.size(); i++) {
+		const Section &s = sections[i];
+		bool inFlash = isFlash(s.output), inRam = isRam(s.output);
+		if (!inFlash && !inRam) continue;
+
+		std::string group = objectGroup(s.object);
+		u32 rest = s.size;
+		for (size_t k = 0; k < s.symbols.size(); k++) {
+			const Symbol &sym = s.symbols[k];
+			std::map<std::string, std::string>::iterator a = assets.find(sym.name);
+			char buf[64];
+			snprintf(buf, sizeof(buf), "%-6s ", inRam ? "ram" : "flash");
+			symbols.push_back(std::make_pair(sym.size, buf + sym.name + " (" +
+				(a != assets.end() ? a->second : group) + ")"));
+			if (group != "game" || a == assets.end() || sym.size > rest) continue;
+			Usage &u = groups[a->second];
+			if (inFlash) u.flash += sym.size;
+			if (inRam) u.ram += sym.size;
+			rest -= sym.size;
+		}
+		Usage &u = groups[group];
+		if (inFlash) u.flash += rest;
+		if (inRam) u.ram += rest;
+		if (inFlash) flash += s.size;
+		if (inRam) {
+			ram += s.size;
+			if (s.addr + s.size > ramTop) ramTop = s.addr + s.size;
+		}
+	}
+	if (flash == 0 && ram == 0) {
+		printf("%s: no sections found.\n", mapName);
+		return 1;
+	}
+
+	printf("\n\t%-32s %8s %8s\n", "", "flash", "ram");
+	for (std::map<std::string, Usage>::iterator it = groups.begin(); it != groups.end(); ++it) {
+		if (it->second.flash == 0 && it->second.ram == 0) continue;
+		printf("\t%-32s %8u %8u\n", it->first.c_str(), it->second.flash, it->second.ram);
+	}
+	printf("\t%-32s %8u %8u\n", "total", flash, ram);
+
+	std::sort(symbols.begin(), symbols.end(), bySize);
+	if (top > 0) printf("\n\tBiggest symbols:\n");
+	for (int i = 0; i < top && i < (int)symbols.size(); i++) {
+		printf("\t%8u  %s\n", symbols[i].first, symbols[i].second.c_str());
+	}
+
+	// .noinit and .data are placed by default/Makefile, there may be a hole
+	long stack = (long)RAM_END + 1 - ramTop;
+	printf("\n\tStatic RAM ends at 0x%04x, %ld bytes left for the stack", ramTop & 0xffff, stack);
+	if (ramTop - RAM_START > ram) printf(" (%u bytes unused between sections)", ramTop - RAM_START - ram);
+	printf("\n\n");
+
+	bool ok = true;
+	if (flashMax >= 0 && flash > (u32)flashMax) {
+		printf("\tFlash over budget: %u of %ld bytes\n", flash, flashMax);
+		ok = false;
+	}
+	if (ramMax >= 0 && ram > (u32)ramMax) {
+		printf("\tRAM over budget: %u of %ld bytes\n", ram, ramMax);
+		ok = false;
+	}
+	if (stackMin >= 0 && stack < stackMin) {
+		printf("\tStack under budget: %ld of %ld bytes\n", stack, stackMin);
+		ok = false;
+	}
+	for (size_t i = 0; i < budgets.size(); i++) {
+		u32 used = groups.count(budgets[i].group) ? groups[budgets[i].group].flash : 0;
+		if (used <= budgets[i].max) continue;
+		printf("\t%s over budget: %u of %u bytes of flash\n", budgets[i].group.c_str(), used, budgets[i].max);
+		ok = false;
+	}
+	if (!ok) printf("\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,364 @@
+/*
+ *  Game rules of a turn on the host
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "gamerules.h"
+
+// must match smokeyAndTheBandit.c
+static const u8 minSpeedTable[GAME_MAX_STAGES] = {
+	2, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 5
+};
+
+static const s8 beerVarianceTable[GAME_MAX_STAGES] = {
+	100, 90, 80, 70, 65, 60, 55, 50, 45, 40, 35, 30, 25, 20, 15, 10
+};
+
+static const s8 roadVarianceTable[GAME_MAX_STAGES] = {
+	5, 4, 4, 4, 3, 3, 3, 2, 2, 2, 2, 1, 1, 1, 1, 1
+};
+
+static const u8 stageLengthTable[GAME_MAX_STAGES * GAME_MAX_SUBSTAGES] = {
+	3, 20, 3, 60, 5,
+	3, 21, 3, 70, 5,
+	3, 22, 3, 80, 5,
+	3, 23, 3, 90, 5,
+	3, 24, 3, 100, 5,
+	3, 25, 3, 100, 5,
+	3, 26, 3, 100, 5,
+	3, 27, 3, 110, 5,
+	3, 28, 3, 110, 5,
+	3, 29, 3, 110, 5,
+	3, 30, 3, 120, 5,
+	3, 31, 3, 130, 5,
+	3, 32, 3, 140, 5,
+	3, 33, 3, 150, 5,
+	3, 34, 3, 160, 5,
+	3, 35, 3, 170, 5,
+};
+
+// right and left boundary of the two stripes of each dirtRoad line
+#define LO GAME_LANEOFFSET
+static const u8 dirtRoad[9][4] = {
+	{ GAME_LANE1 - LO, GAME_LANE1 + LO, GAME_LANE1 - LO, GAME_LANE1 + LO },
+	{ GAME_LANE1 - LO, GAME_LANE2 + LO, GAME_LANE1 - LO, GAME_LANE2 + LO },
+	{ GAME_LANE2 - LO, GAME_LANE2 + LO, GAME_LANE2 - LO, GAME_LANE2 + LO },
+	{ GAME_LANE2 - LO, GAME_LANE3 + LO, GAME_LANE2 - LO, GAME_LANE3 + LO },
+	{ GAME_LANE3 - LO, GAME_LANE3 + LO, GAME_LANE3 - LO, GAME_LANE3 + LO },
+	{ GAME_LANE3 - LO, GAME_LANE4 + LO, GAME_LANE3 - LO, GAME_LANE4 + LO },
+	{ GAME_LANE4 - LO, GAME_LANE4 + LO, GAME_LANE4 - LO, GAME_LANE4 + LO },
+	// causeway
+	{ GAME_LANE1 + 1, GAME_LANE1, GAME_LANE1 + 1, GAME_LANE1 },
+	{ GAME_LANE1 + 1, GAME_LANE1, GAME_LANE1 + 2, GAME_LANE1 }
+};
+
+GameTables::GameTables()
+{
+	memcpy(minSpeed, minSpeedTable, sizeof(minSpeed));
+	memcpy(beerVariance, beerVarianceTable, sizeof(beerVariance));
+	memcpy(roadVariance, roadVarianceTable, sizeof(roadVariance));
+	memcpy(stageLength, stageLengthTable, sizeof(stageLength));
+}
+
+GameRules::GameRules(const GameTables &tables) : tables(tables)
+{
+	memset(courseRight, 0, sizeof(courseRight));
+	memset(courseLeft, 0, sizeof(courseLeft));
+	NewGame(1);
+}
+
+// rand() of avr-libc, an int of 16 bits
+s16 GameRules::Rand()
+{
+	s32 x = randState;
+	if (x == 0) x = 123459876L;
+	s32 hi = x / 127773L, lo = x % 127773L;
+	x = 16807L * lo - 2836L * hi;
+	if (x < 0) x += 0x7fffffffL;
+	randState = x;
+	return x % 32768;
+}
+
+// the globals at power on, then initGame()
+void GameRules::NewGame(u16 seed)
+{
+	randState = seed;
+	gameStage = 0;
+	playerScore = 0;
+	guysLeft = 3;
+	lastBeerSpawnLane = 2;
+	lastCourseLineGenerated = 0;
+	storeCourseLine = 0;
+	waterCounter = 0;
+	buttonReset = 0;
+	randomNumber = 0;
+	frames = 0;
+	memset(&course, 0, sizeof(course));
+}
+
+void GameRules::StartTurn()
+{
+	minSpeed = tables.minSpeed[gameStage];
+	subStage = 0;
+	stageLength = tables.stageLength[gameStage * GAME_MAX_SUBSTAGES];
+	stageStep = 0;
+	banditSpeed = minSpeed;
+	banditX = 190 - (4 * banditSpeed);
+	banditY = GAME_LANE2;
+	banditZ = 0;
+	nextYPos = banditY;
+	nextXPos = banditX;
+
+	beerVariance = tables.beerVariance[gameStage];
+	roadVariance = tables.roadVariance[gameStage];
+
+	destX = 30;
+	scrollMark = 0;
+	stripeToggle = 0;
+	roadStart = 0;
+	roadEnd = 19;
+	roadStart2 = 0;
+	roadEnd2 = 19;
+	courseCount = 0;
+	scrollX = 0;
+
+	for (int i = 0; i < 240; i++) {
+		DoScrolling(1);
+	}
+	for (int i = 0; i < GAME_MAX_BEERS; i++) {
+		beerCans[i].enabled = false;
+		beerCans[i].x = GAME_OFF_SCREEN;
+		beerCans[i].y = 0;
+	}
+	spawnCounter = 0;
+	frames = 0;
+	memset(&course, 0, sizeof(course));
+}
+
+void GameRules::SyncTurn(u16 seed)
+{
+	lastBeerSpawnLane = 2;
+	lastCourseLineGenerated = 0;
+	waterCounter = 0;
+	storeCourseLine = 0;
+	buttonReset = 0;
+	randState = seed;
+}
+
+void GameRules::DoScrolling(int speed)
+{
+	scrollMark += speed;
+	if (scrollMark >= 8) {
+		GenerateNextStripe(scrollMark / 8);
+		scrollMark = scrollMark % 8;
+	}
+	scrollX -= speed;
+}
+
+void GameRules::GenerateNextStripe(int increment)
+{
+	while (increment > 0) {
+		if (courseCount == 0) {
+			if (subStage == 3) {
+				waterCounter++;
+				if (waterCounter == 31) {
+					storeCourseLine = lastCourseLineGenerated;
+					courseCount = 3;
+				} else if (waterCounter == 32) {
+					lastCourseLineGenerated = 7;
+					courseCount = 1;
+					course.waterCrossings++;
+				} else if (waterCounter == 33) {
+					lastCourseLineGenerated = 8;
+					courseCount = 1;
+				} else if (waterCounter == 34) {
+					lastCourseLineGenerated = storeCourseLine;
+					courseCount = 6;
+					waterCounter = 0;
+				} else {
+					u8 r = (u8)randomNumber;
+					playerScore += banditSpeed * (banditSpeed / 2);
+					if (r > 128) lastCourseLineGenerated++;
+					else lastCourseLineGenerated--;
+					if (lastCourseLineGenerated < 0) lastCourseLineGenerated = 1;
+					else if (lastCourseLineGenerated > 6) lastCourseLineGenerated = 5;
+					courseCount = 3 + r % roadVariance;
+
+					course.segments++;
+					course.segmentStripes += courseCount * 2;
+					if ((lastCourseLineGenerated & 1) == 0) course.singleLane++;
+				}
+				const u8 *line = dirtRoad[lastCourseLineGenerated];
+				roadStart = line[0];
+				roadEnd = line[1];
+				roadStart2 = line[2];
+				roadEnd2 = line[3];
+			} else {
+				roadStart = GAME_LANE1 - GAME_LANEOFFSET;
+				roadEnd = GAME_LANE4 + GAME_LANEOFFSET;
+				roadStart2 = GAME_LANE1 - GAME_LANEOFFSET;
+				roadEnd2 = GAME_LANE4 + GAME_LANEOFFSET;
+				courseCount = 10;
+			}
+			stageStep++;
+		}
+
+		if (stripeToggle > 0) {
+			courseRight[destX] = roadStart2;
+			courseLeft[destX] = roadEnd2;
+			courseCount--;
+			stripeToggle = 0;
+		} else {
+			courseRight[destX] = roadStart;
+			courseLeft[destX] = roadEnd;
+			stripeToggle++;
+		}
+
+		destX--;
+		if (destX == 255) destX = 31;
+		increment--;
+	}
+}
+
+void GameRules::SpawnBeer(s8 sc)
+{
+	for (int i = 0; i < GAME_MAX_BEERS; i++) {
+		if (!beerCans[i].enabled) {
+			beerCans[i].enabled = true;
+			beerCans[i].x = 0;
+			s8 c = sc / beerVariance;
+			if (c > 0) {
+				if (lastBeerSpawnLane == 3) lastBeerSpawnLane = 2;
+				else lastBeerSpawnLane++;
+			} else if (c < 0) {
+				if (lastBeerSpawnLane == 0) lastBeerSpawnLane = 1;
+				else lastBeerSpawnLane--;
+			}
+			beerCans[i].y = 28 + (32 * lastBeerSpawnLane);
+			course.beersSpawned++;
+			break;
+		}
+	}
+}
+
+void GameRules::ProcessGameControls(u16 joy1)
+{
+	if (buttonReset == 0) {
+		if (banditZ == 0) {
+			if (joy1 & GAME_BTN_RIGHT) {
+				if (nextYPos > 32) nextYPos -= 32;
+				else nextYPos = 0;
+				buttonReset = 2;
+			} else if (joy1 & GAME_BTN_LEFT) {
+				if (nextYPos == 0) nextYPos = GAME_LANE1;
+				else nextYPos += 32;
+				buttonReset = 2;
+			} else if (joy1 & GAME_BTN_DOWN && banditSpeed > minSpeed) {
+				banditSpeed--;
+				buttonReset = 2;
+				nextXPos = 190 - (4 * banditSpeed);
+			} else if (joy1 & GAME_BTN_UP && banditSpeed < GAME_MAX_SPEED) {
+				banditSpeed++;
+				buttonReset = 2;
+				nextXPos = 190 - (4 * banditSpeed);
+			} else if (joy1 & GAME_BTN_X) {
+				banditZ = 1;
+				course.jumps++;
+			}
+		}
+	} else if (!(joy1 & (GAME_BTN_UP | GAME_BTN_DOWN | GAME_BTN_RIGHT | GAME_BTN_LEFT))) {
+		buttonReset--;
+	}
+}
+
+bool GameRules::OnRoad(int y, int columns) const
+{
+	int i = (scrollX / 8 + banditX / 8) % GAME_COURSE_STRIPES;
+	for (int k = 0; k < columns; k++) {
+		int c = (i - k + GAME_COURSE_STRIPES) % GAME_COURSE_STRIPES;
+		if (y > courseLeft[c] || y < courseRight[c]) return false;
+	}
+	return true;
+}
+
+GameEvent GameRules::Step(u16 buttons)
+{
+	frames++;
+	randomNumber = (s8)Rand();
+
+	DoScrolling(banditSpeed / 2);
+
+	if (subStage == 1) {
+		if (spawnCounter > 0) spawnCounter--;
+		else {
+			SpawnBeer(randomNumber);
+			spawnCounter = 6 + abs(randomNumber / 7);
+		}
+	}
+
+	for (int i = 0; i < GAME_MAX_BEERS; i++) {
+		GameBeer &b = beerCans[i];
+		if (b.enabled) {
+			if (b.x > 220) {
+				b.enabled = false;
+				b.x = GAME_OFF_SCREEN;
+				return GAME_BEER;
+			}
+			b.x = b.x + banditSpeed / 2;
+			if (b.x > banditX - 8 && b.y > banditY - 8 && b.x < banditX + 16 && b.y < banditY + 16) {
+				b.enabled = false;
+				b.x = GAME_OFF_SCREEN;
+				playerScore += banditSpeed * (banditSpeed / 2);
+				course.beersCaught++;
+			}
+		} else {
+			b.x = GAME_OFF_SCREEN;
+			b.y = 0;
+		}
+	}
+
+	if (banditZ > 0) {
+		banditZ++;
+		if (banditZ == 36) banditZ = 0;
+	}
+
+	if (banditY < nextYPos) banditY += 4;
+	else if (banditY > nextYPos) banditY -= 4;
+	else if (banditX < nextXPos) banditX++;
+	else if (banditX > nextXPos) banditX--;
+
+	ProcessGameControls(buttons);
+
+	if (banditZ == 0) {
+		int i = (scrollX / 8 + banditX / 8) % GAME_COURSE_STRIPES;
+		u8 minY = courseRight[i], maxY = courseLeft[i];
+		if (banditY > maxY || banditY < minY) return minY > maxY ? GAME_WATER : GAME_WALL;
+	}
+
+	if (stageStep > stageLength) {
+		subStage++;
+		if (subStage < GAME_MAX_SUBSTAGES) {
+			stageLength = tables.stageLength[gameStage * GAME_MAX_SUBSTAGES + subStage];
+			stageStep = 0;
+		} else {
+			subStage = 0;
+			gameStage++;
+			return GAME_CLEARED;
+		}
+	}
+	return GAME_RUNNING;
+}
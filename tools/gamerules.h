@@ -0,0 +1,154 @@
+/*
+ *  Game rules of a turn on the host
+ *
+ *  The loop of playGame() in smokeyAndTheBandit.c without the picture
+ *  and the sound: rand() as in avr-libc, the course generation of
+ *  doScrolling() and generateNextStripe(), the beers of spawnBeer(),
+ *  the car moves of processGameControls() and the crash and stage
+ *  checks, each with the integer types of the game. One Step() is one
+ *  vsync of the loop, with the buttons ReadJoypad(0) would return.
+ *
+ *  This is kept in sync with the game by hand. The demos of
+ *  data/demos.h are made here and replay through the real loop, "make
+ *  demos" in default/ runs them on the game .elf and finds where the two
+ *  differ.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __GAMERULES_H_
+#define __GAMERULES_H_
+
+#include "uzehost.h"
+
+// must match smokeyAndTheBandit.c
+#define GAME_MAX_BEERS 4
+#define GAME_LANE1 22
+#define GAME_LANE2 54
+#define GAME_LANE3 86
+#define GAME_LANE4 118
+#define GAME_LANEOFFSET 12
+#define GAME_MAX_STAGES 16
+#define GAME_MAX_SUBSTAGES 5
+#define GAME_MAX_SPEED 5
+#define GAME_OFF_SCREEN 240
+#define GAME_COURSE_STRIPES 32
+
+// ReadJoypad() bits, must match kernel/defines.h
+#define GAME_BTN_UP		16
+#define GAME_BTN_DOWN	32
+#define GAME_BTN_LEFT	64
+#define GAME_BTN_RIGHT	128
+#define GAME_BTN_X		512
+
+// the difficulty tables of the game, per stage
+struct GameTables
+{
+	GameTables();	//as in smokeyAndTheBandit.c
+
+	u8 minSpeed[GAME_MAX_STAGES];
+	s8 beerVariance[GAME_MAX_STAGES];
+	s8 roadVariance[GAME_MAX_STAGES];
+	u8 stageLength[GAME_MAX_STAGES * GAME_MAX_SUBSTAGES];
+};
+
+// what Step() saw this frame
+enum GameEvent
+{
+	GAME_RUNNING,
+	GAME_CLEARED,		//the last sub stage is over, gameStage goes up
+	GAME_WALL,			//off the road
+	GAME_WATER,			//off the causeway
+	GAME_BEER			//a beer got by
+};
+
+// course and beer counts of a turn, for the balance reports
+struct GameCourse
+{
+	u32 beersSpawned;
+	u32 beersCaught;
+	u32 segments;		//dodge road segments, the causeway not counted
+	u32 segmentStripes;
+	u32 singleLane;		//segments one lane wide
+	u32 waterCrossings;
+	u32 jumps;
+};
+
+struct GameBeer
+{
+	bool enabled;
+	u8 x, y;			//sprites[i].x and y
+};
+
+class GameRules
+{
+public:
+	explicit GameRules(const GameTables &tables);
+
+	// initGame() for one player, rand() seeded with seed
+	void NewGame(u16 seed);
+
+	// playGame() up to its loop at the stage of the player
+	void StartTurn();
+
+	// syncTurnInput() of a demo or DEMO_RECORD turn: the course state
+	// back to its defaults and rand() seeded as InputReplayStart()
+	void SyncTurn(u16 seed);
+
+	// one frame of the loop. After GAME_CLEARED gameStage is the next
+	// stage, after a crash the turn is over and StartTurn() restarts it.
+	GameEvent Step(u16 buttons);
+
+	// the car at y is between the boundaries of the column under it and
+	// of the columns-1 coming after it
+	bool OnRoad(int y, int columns) const;
+
+	const GameTables &tables;
+
+	// the game's globals of one player
+	u8 gameStage;
+	u16 playerScore;
+	u8 guysLeft;
+
+	u8 minSpeed, subStage, stageLength, stageStep;
+	u8 banditSpeed, banditX, banditY, banditZ, nextXPos, nextYPos;
+	s8 beerVariance, roadVariance;
+	GameBeer beerCans[GAME_MAX_BEERS];
+	s8 buttonReset;
+	u8 scrollX;			//Screen.scrollX
+	u8 courseRight[GAME_COURSE_STRIPES], courseLeft[GAME_COURSE_STRIPES];
+
+	u32 frames;			//loop iterations of the turn
+	GameCourse course;
+
+private:
+	s16 Rand();
+	void DoScrolling(int speed);
+	void GenerateNextStripe(int increment);
+	void SpawnBeer(s8 sc);
+	void ProcessGameControls(u16 joy1);
+
+	u32 randState;		//avr-libc random() state
+	s8 randomNumber;
+	u8 spawnCounter;
+	u16 scrollMark;
+	u8 destX, stripeToggle;
+	u8 roadStart, roadEnd, roadStart2, roadEnd2;
+	u16 courseCount;
+	s8 lastCourseLineGenerated, storeCourseLine;
+	u8 waterCounter;
+	s8 lastBeerSpawnLane;
+};
+
+#endif
@@ -0,0 +1,12 @@
+/*
+ *  Links the game's sound data (patches and songs) into the host tools.
+ *  Compiled as C so the data headers can be used unmodified.
+*/
+
+#include "uzehost.h"
+
+#include "../data/patches.h"
+#include "../data/east.h"
+
+const int patchesCount = sizeof(patches) / sizeof(patches[0]);
+const size_t midisongSize = sizeof(midisong);
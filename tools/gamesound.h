@@ -0,0 +1,18 @@
+/*
+ *  Game sound data compiled for the host (see gamesound.c)
+*/
+
+#ifndef __GAMESOUND_H_
+#define __GAMESOUND_H_
+
+#include "uzehost.h"
+
+extern "C" {
+	extern const struct PatchStruct patches[];
+	extern const int patchesCount;
+	extern const struct FxInfoStruct fxInfo[];
+	extern const char midisong[];
+	extern const size_t midisongSize;
+}
+
+#endif
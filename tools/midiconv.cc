@@ -0,0 +1,395 @@
+/*
+ *  midiconv - converts a type 0 or 1 MIDI file to the song format of
+ *  the Uzebox kernel (ProcessMusic), like data/east.h.
+ *
+ *  The tracks are merged, the times are quantized to frames and only
+ *  the events ProcessMusic() uses are kept:
+ *   - note on (0x80 note off are dropped unless -n is given)
+ *   - program change
+ *   - the volume, expression, tremolo and tremolo rate controllers,
+ *     when their value changes
+ *   - the S and E loop markers, from the file or -l
+ *   - the end of the song
+ *  Running status is used whenever possible.
+ *
+ *  Without -T the tempo changes are followed. data/east.h was made by
+ *  the old Java converter, which used the last tempo of the file for
+ *  the whole song; it is made again with:
+ *     midiconv -T -r 52 data/midi/east.mid east.h
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "uzesound.h"
+
+// must match kernel/uzeboxSoundEngine.c
+#define CONTROLER_VOL 7
+#define CONTROLER_EXPRESSION 11
+#define CONTROLER_TREMOLO 92
+#define CONTROLER_TREMOLO_RATE 100
+
+#define DEFAULT_TEMPO 500000	//us per quarter note
+#define NO_LOOP -1
+
+struct MidiEvent
+{
+	u32 tick;
+	int track;
+	int order;			//position in the file, keeps the merge stable
+	u8 status;			//0xff for meta events
+	u8 data[2];
+	std::string meta;	//meta event data
+	int frame;
+
+	bool operator<(const MidiEvent &e) const
+	{
+		if (tick != e.tick) return tick < e.tick;
+		if (track != e.track) return track < e.track;
+		return order < e.order;
+	}
+};
+
+struct Tempo
+{
+	u32 tick;
+	u32 tempo;
+};
+
+static void usage()
+{
+	printf("\n\tUsage: midiconv [options] input.mid [output.h]\n\n"
+		"\t-v name     variable name, default: midisong\n"
+		"\t-r rate     frames per second of MIDI time, default: 60\n"
+		"\t-T          one tempo for the whole song, the last of the file\n"
+		"\t-l start[,end]  loop, in MIDI ticks, replaces the S and E markers\n"
+		"\t            of the file; end defaults to the end of the song\n"
+		"\t-n          keep the note off events as note on with volume 0\n\n"
+		"\tThe default output file is midisong.h.\n\n"
+		"\tEx:  midiconv -T -r 52 data/midi/east.mid east.h\n\n");
+}
+
+static u32 get32(const u8 *p)
+{
+	return ((u32)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static bool readVarLen(const std::vector<u8> &data, size_t &pos, size_t end, u32 &value)
+{
+	value = 0;
+	for (int i = 0; i < 4; i++) {
+		if (pos >= end) return false;
+		u8 c = data[pos++];
+		value = (value << 7) | (c & 0x7f);
+		if (!(c & 0x80)) return true;
+	}
+	return false;
+}
+
+static void writeVarLen(std::vector<u8> &out, u32 value)
+{
+	u8 buf[5];
+	int n = 0;
+	do {
+		buf[n++] = value & 0x7f;
+		value >>= 7;
+	} while (value != 0);
+	while (n > 1) out.push_back(buf[--n] | 0x80);
+	out.push_back(buf[0]);
+}
+
+static bool readMidi(const char *name, std::vector<MidiEvent> &events, int &division)
+{
+	FILE *f = fopen(name, "rb");
+	if (f == NULL) {
+		printf("Can't open %s.\n", name);
+		return false;
+	}
+	std::vector<u8> data;
+	u8 buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0) data.insert(data.end(), buf, buf + n);
+	fclose(f);
+
+	if (data.size() < 14 || memcmp(&data[0], "MThd", 4)) {
+		printf("%s: not a MIDI file.\n", name);
+		return false;
+	}
+	int format = (data[8] << 8) | data[9];
+	int tracks = (data[10] << 8) | data[11];
+	division = (data[12] << 8) | data[13];
+	if (format > 1 || (division & 0x8000)) {
+		printf("%s: only type 0 and 1 files with ticks per quarter note are supported.\n", name);
+		return false;
+	}
+
+	size_t pos = 8 + get32(&data[4]);
+	int order = 0;
+	for (int t = 0; t < tracks; t++) {
+		if (pos + 8 > data.size() || memcmp(&data[pos], "MTrk", 4)) {
+			printf("%s: track %d is missing.\n", name, t);
+			return false;
+		}
+		size_t end = pos + 8 + get32(&data[pos + 4]);
+		if (end > data.size()) end = data.size();
+		pos += 8;
+
+		u32 tick = 0, delta, len;
+		u8 status = 0;
+		while (pos < end) {
+			if (!readVarLen(data, pos, end, delta) || pos >= end) break;
+			tick += delta;
+
+			MidiEvent e;
+			e.tick = tick;
+			e.track = t;
+			e.order = order++;
+			u8 c = data[pos];
+			if (c == 0xff) {
+				if (pos + 2 > end) break;
+				e.status = 0xff;
+				e.data[0] = data[pos + 1];
+				pos += 2;
+				if (!readVarLen(data, pos, end, len) || pos + len > end) break;
+				e.meta.assign((const char *)&data[pos], len);
+				pos += len;
+				events.push_back(e);
+				continue;
+			}
+			if (c == 0xf0 || c == 0xf7) {	//sysex, ignored
+				pos++;
+				if (!readVarLen(data, pos, end, len)) break;
+				pos += len;
+				continue;
+			}
+			if (c & 0x80) {
+				status = c;
+				pos++;
+			}
+			if (status == 0) break;
+			int count = ((status & 0xe0) == 0xc0) ? 1 : 2;
+			if (pos + count > end) break;
+			e.status = status;
+			e.data[0] = data[pos];
+			e.data[1] = count == 2 ? data[pos + 1] : 0;
+			pos += count;
+			events.push_back(e);
+		}
+		pos = end;
+	}
+	std::sort(events.begin(), events.end());
+	return true;
+}
+
+// frame of each event, from the tempo map or the last tempo with -T
+static void quantize(std::vector<MidiEvent> &events, int division, double rate, bool oneTempo)
+{
+	std::vector<Tempo> tempos;
+	for (size_t i = 0; i < events.size(); i++) {
+		const MidiEvent &e = events[i];
+		if (e.status == 0xff && e.data[0] == 0x51 && e.meta.size() == 3) {
+			const u8 *p = (const u8 *)e.meta.data();
+			Tempo t = { e.tick, (u32)((p[0] << 16) | (p[1] << 8) | p[2]) };
+			tempos.push_back(t);
+		}
+	}
+	if (oneTempo && !tempos.empty()) {
+		Tempo last = { 0, tempos.back().tempo };
+		tempos.clear();
+		tempos.push_back(last);
+	}
+
+	// time in us of the current tempo change
+	double time = 0;
+	u32 tempo = DEFAULT_TEMPO, tempoTick = 0;
+	size_t next = 0;
+	for (size_t i = 0; i < events.size(); i++) {
+		MidiEvent &e = events[i];
+		while (next < tempos.size() && tempos[next].tick <= e.tick) {
+			time += (double)(tempos[next].tick - tempoTick) * tempo / division;
+			tempoTick = tempos[next].tick;
+			tempo = tempos[next++].tempo;
+		}
+		double us = time + (double)(e.tick - tempoTick) * tempo / division;
+		e.frame = (int)floor(us * rate / 1000000 + 1e-6);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	const char *varname = "midisong";
+	const char *inname = NULL, *outname = "midisong.h";
+	double rate = 60;
+	bool oneTempo = false, noteOff = false;
+	long loopStart = NO_LOOP, loopEnd = NO_LOOP;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-v") && i + 1 < argc) {
+			varname = argv[++i];
+		} else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+			rate = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "-T")) {
+			oneTempo = true;
+		} else if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+			if (sscanf(argv[++i], "%ld,%ld", &loopStart, &loopEnd) < 1) loopStart = NO_LOOP;
+		} else if (!strcmp(argv[i], "-n")) {
+			noteOff = true;
+		} else if (argv[i][0] == '-') {
+			usage();
+			return 1;
+		} else if (inname == NULL) {
+			inname = argv[i];
+		} else {
+			outname = argv[i];
+		}
+	}
+	if (inname == NULL || rate <= 0) {
+		usage();
+		return inname == NULL ? 0 : 1;
+	}
+
+	std::vector<MidiEvent> events;
+	int division;
+	if (!readMidi(inname, events, division)) return 1;
+	if (events.empty()) {
+		printf("%s: no events.\n", inname);
+		return 1;
+	}
+
+	// the loop markers given on the command line replace the ones of the file
+	if (loopStart != NO_LOOP) {
+		std::vector<MidiEvent> kept;
+		for (size_t i = 0; i < events.size(); i++) {
+			if (events[i].status != 0xff || events[i].data[0] != 0x06) kept.push_back(events[i]);
+		}
+		MidiEvent e;
+		e.track = -1;
+		e.order = 0;
+		e.status = 0xff;
+		e.data[0] = 0x06;
+		e.tick = loopStart;
+		e.meta = "S";
+		kept.push_back(e);
+		e.tick = loopEnd == NO_LOOP ? events.back().tick : loopEnd;
+		e.meta = "E";
+		kept.push_back(e);
+		events.swap(kept);
+		std::sort(events.begin(), events.end());
+	}
+	quantize(events, division, rate, oneTempo);
+
+	std::vector<u8> out;
+	int lastFrame = 0, endFrame = 0, dropped = 0, notes = 0;
+	u8 lastStatus = 0;
+	int patch[16], controller[16][128];
+	memset(patch, -1, sizeof(patch));
+	memset(controller, -1, sizeof(controller));
+
+	for (size_t i = 0; i < events.size(); i++) {
+		const MidiEvent &e = events[i];
+		u8 type = e.status & 0xf0, channel = e.status & 0x0f;
+		u8 bytes[3];
+		int count = 0;
+		if (e.frame > endFrame) endFrame = e.frame;
+
+		if (e.status == 0xff) {
+			// ProcessMusic() reads one byte of a marker
+			if (e.data[0] != 0x06 || e.meta.size() != 1 || (e.meta[0] != 'S' && e.meta[0] != 'E')) continue;
+			if (e.meta[0] == 'S') {
+				// after the loop the state is not known
+				memset(patch, -1, sizeof(patch));
+				memset(controller, -1, sizeof(controller));
+			}
+			writeVarLen(out, e.frame - lastFrame);
+			lastFrame = e.frame;
+			out.push_back(0xff);
+			out.push_back(0x06);
+			out.push_back(0x01);
+			out.push_back(e.meta[0]);
+			continue;
+		}
+
+		if (type == 0x80 && noteOff) type = 0x90;
+		switch (type) {
+		case 0x90:
+			bytes[count++] = e.data[0];
+			bytes[count++] = type == (e.status & 0xf0) ? e.data[1] : 0;
+			break;
+		case 0xb0:
+			if (e.data[0] != CONTROLER_VOL && e.data[0] != CONTROLER_EXPRESSION &&
+				e.data[0] != CONTROLER_TREMOLO && e.data[0] != CONTROLER_TREMOLO_RATE) break;
+			if (controller[channel][e.data[0]] == e.data[1]) break;
+			controller[channel][e.data[0]] = e.data[1];
+			bytes[count++] = e.data[0];
+			bytes[count++] = e.data[1];
+			break;
+		case 0xc0:
+			if (patch[channel] == e.data[0]) break;
+			patch[channel] = e.data[0];
+			bytes[count++] = e.data[0];
+			break;
+		}
+		if (count == 0) continue;
+		if (channel >= CHANNELS) {
+			dropped++;		//ProcessMusic() has no track for it
+			continue;
+		}
+
+		if (type == 0x90) notes++;
+
+		// StartSong() skips the first delta, it must fit in one byte
+		writeVarLen(out, out.empty() ? 0 : e.frame - lastFrame);
+		lastFrame = e.frame;
+		u8 status = type | channel;
+		if (status != lastStatus) out.push_back(status);
+		lastStatus = status;
+		out.insert(out.end(), bytes, bytes + count);
+	}
+	writeVarLen(out, endFrame - lastFrame);
+	out.push_back(0xff);
+	out.push_back(0x2f);
+	out.push_back(0x00);
+
+	std::string text = "//*********************************//\n// MIDI file: ";
+	const char *base = strrchr(inname, '/');
+	text += base ? base + 1 : inname;
+	text += "\n//*********************************//\nconst char ";
+	text += varname;
+	text += "[] PROGMEM ={\n";
+	for (size_t i = 0; i < out.size(); i++) {
+		char buf[8];
+		snprintf(buf, sizeof(buf), "0x%02x", out[i]);
+		text += buf;
+		text += i + 1 == out.size() ? " };\n" : ((i & 31) == 31 ? ",\n" : ",");
+	}
+
+	FILE *fout = fopen(outname, "w");
+	if (fout == NULL || fwrite(text.data(), 1, text.size(), fout) != text.size()) {
+		printf("Failed to create file.\n");
+		return 1;
+	}
+	fclose(fout);
+
+	if (dropped) printf("\tWarning: %d events on channels above %d dropped.\n", dropped, CHANNELS);
+	printf("\n\t%d events, %d notes, %d frames (%.1f s)\n", (int)events.size(), notes,
+		endFrame, endFrame / 60.0);
+	printf("\tDone. PROGMEM usage: %u bytes\n", (unsigned int)out.size());
+	return 0;
+}
@@ -0,0 +1,137 @@
+/*
+ *  mkassets - writes SMOKEY.PAK, the attract screen maps and tiles the
+ *  game reads from the SD card when built with SD_ASSETS (see assets.c).
+ *  Compiled as C so the data headers can be used unmodified, they need
+ *  the font .inc files made by gconvert in data/.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "uzehost.h"
+
+#include "../data/spacebar-screen-graphics.h"
+#include "../data/smokey-screen-graphics.h"
+#include "../data/transition-screen-graphics.h"
+
+#define MAX_PACK (64 * 1024)
+
+// in the order of the ASSET_* ids in assets.c
+enum { MAP, TILES };
+
+static const struct
+{
+	int type;
+	const char *data;
+	int tiles;
+	const char *name;
+} assets[] = {
+	{ MAP, sbl_1, 0, "sbl_1" },
+	{ MAP, sbl_2, 0, "sbl_2" },
+	{ MAP, sabl_1, 0, "sabl_1" },
+	{ MAP, sabl_2, 0, "sabl_2" },
+	{ MAP, coors_can_map, 0, "coors_can_map" },
+	{ TILES, coorsCan, COORSCAN_SIZE, "coorsCan" },
+};
+
+#define ASSET_COUNT (int)(sizeof(assets) / sizeof(assets[0]))
+
+static u8 pack[MAX_PACK];
+static int packSize;
+
+static void put(u8 c)
+{
+	if (packSize == MAX_PACK) {
+		printf("Pack too large.\n");
+		exit(1);
+	}
+	pack[packSize++] = c;
+}
+
+// c<128: c+1 literal bytes follow, c>=128: the next byte repeated c-125 times
+static void rle(const u8 *data, int len)
+{
+	int i = 0;
+
+	while (i < len) {
+		int run = 1;
+		while (i + run < len && run < 130 && data[i + run] == data[i]) run++;
+		if (run >= 3) {
+			put(run + 125);
+			put(data[i]);
+			i += run;
+			continue;
+		}
+
+		// literals up to the next run of 3
+		int lit = 0;
+		while (i + lit < len && lit < 128) {
+			if (i + lit + 2 < len && data[i + lit] == data[i + lit + 1] &&
+				data[i + lit] == data[i + lit + 2]) break;
+			lit++;
+		}
+		put(lit - 1);
+		for (int j = 0; j < lit; j++) put(data[i + j]);
+		i += lit;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	const char *outname = "SMOKEY.PAK";
+	int i, raw = 0;
+
+	if (argc > 1) {
+		if (argv[1][0] == '-') {
+			printf("\n\tUsage: mkassets [out.pak]\n\n"
+				"\tCopy the file to the root of the SD card, default: SMOKEY.PAK\n\n");
+			return 0;
+		}
+		outname = argv[1];
+	}
+
+	memcpy(pack, "SMKY", 4);
+	pack[4] = ASSET_COUNT;
+	packSize = 5 + ASSET_COUNT * 4;
+
+	for (i = 0; i < ASSET_COUNT; i++) {
+		const u8 *data = (const u8 *)assets[i].data;
+		int start = packSize, len;
+
+		for (int b = 0; b < 32; b += 8) pack[5 + i * 4 + b / 8] = (packSize >> b) & 0xff;
+		if (assets[i].type == MAP) {
+			len = data[0] * data[1];
+			put(data[0]);
+			put(data[1]);
+			rle(data + 2, len);
+		} else {
+			len = assets[i].tiles * 64;
+			put(assets[i].tiles);
+			rle(data, len);
+		}
+		raw += len;
+		printf("\t%-16s %5d -> %5d bytes\n", assets[i].name, len, packSize - start);
+	}
+
+	FILE *f = fopen(outname, "wb");
+	if (f == NULL || fwrite(pack, 1, packSize, f) != (size_t)packSize) {
+		printf("Failed to create file.\n");
+		return 1;
+	}
+	fclose(f);
+	printf("\n\tDone. %d bytes of flash data in %d bytes\n", raw, packSize);
+	return 0;
+}
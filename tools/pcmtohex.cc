@@ -1,93 +1,343 @@
+/*
+ *  PCM2Hex - Lee Weber(D3thAdd3r) 2010
+ *  Released under GPL 3.0 or later.
+ *
+ *  Converts a sound file to the signed 8 bit mono samples the Uzebox
+ *  mixer plays, as a PROGMEM array or a binary blob.
+ *
+ *  Input is a WAV file (8/16/24/32 bit PCM or 32 bit float, any number
+ *  of channels, mixed to mono) or headerless raw PCM. It is resampled to
+ *  the mixer rate, so the sound plays at its original pitch with a step
+ *  of 1.0 (see steptable); -r changes the rate.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <vector>
+#include <string>
+#include "uzesound.h"
+
+#define SINC_ZEROS 16			//zero crossings on each side of the resampling filter
+#define SINC_PHASES 256
+
+enum RawFormat { RAW_U8, RAW_S8, RAW_S16 };
+
+static void usage()
+{
+	printf("\n\tUsage: pcmtohex [options] input [outfile]\n\n"
+		"\t-v name     variable name, default: PCM_Data\n"
+		"\t-b          write a binary blob instead of a PROGMEM array\n"
+		"\t-r rate     output rate, default: the mixer rate (%.2f Hz)\n"
+		"\t-k          keep the input rate\n"
+		"\t-n          normalize to full scale\n"
+		"\t-t [level]  trim the silence at both ends, level in %% of full\n"
+		"\t            scale, default 1\n"
+		"\t-i fmt,rate raw input format: u8 (default), s8 or s16, and rate\n\n"
+		"\tWAV files are detected from their header, other files are raw.\n"
+		"\tThe default output file is PCM_out.inc (PCM_out.bin with -b).\n\n"
+		"\tEx:  pcmtohex voice.wav voice.inc -v voice -n -t\n"
+		"\t     pcmtohex -i u8,15734 input.raw out.inc -v VarName\n\n", MIX_RATE);
+}
+
+static bool readFile(const char *name, std::vector<u8> &data)
+{
+	FILE *f = fopen(name, "rb");
+	if (f == NULL) return false;
+
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	data.resize(size > 0 ? size : 0);
+	bool ok = size <= 0 || fread(&data[0], 1, size, f) == (size_t)size;
+	fclose(f);
+	return ok;
+}
+
+static u16 get16(const u8 *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static u32 get32(const u8 *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24);
+}
+
+// one sample, scaled to -1..1
+static float getSample(const u8 *p, int bits, bool isFloat)
+{
+	if (isFloat) {
+		float f;
+		u32 v = get32(p);
+		memcpy(&f, &v, 4);
+		return f;
+	}
+	switch (bits) {
+	case 8: return (p[0] - 128) / 128.0f;
+	case 16: return (short)get16(p) / 32768.0f;
+	case 24: return (s32)((p[0] << 8) | (p[1] << 16) | ((u32)p[2] << 24)) / 2147483648.0f;
+	default: return (s32)get32(p) / 2147483648.0f;
+	}
+}
+
+// decodes a RIFF WAVE file to mono
+static bool readWav(const std::vector<u8> &data, std::vector<float> &out, double &rate)
+{
+	const u8 *fmt = NULL, *samples = NULL;
+	size_t samplesSize = 0;
+
+	for (size_t pos = 12; pos + 8 <= data.size();) {
+		const u8 *chunk = &data[pos];
+		size_t size = get32(chunk + 4);
+		if (size > data.size() - pos - 8) size = data.size() - pos - 8;	//truncated file
+		if (!memcmp(chunk, "fmt ", 4) && size >= 16) fmt = chunk + 8;
+		if (!memcmp(chunk, "data", 4)) {
+			samples = chunk + 8;
+			samplesSize = size;
+		}
+		pos += 8 + size + (size & 1);
+	}
+	if (fmt == NULL || samples == NULL) {
+		printf("Bad WAV file.\n");
+		return false;
+	}
+
+	u32 format = get16(fmt);
+	u32 channels = get16(fmt + 2);
+	u32 bits = get16(fmt + 14);
+	if (format == 0xfffe) format = get16(fmt + 24);	//WAVE_FORMAT_EXTENSIBLE sub format
+	bool isFloat = format == 3;
+
+	if (!((format == 1 && (bits == 8 || bits == 16 || bits == 24 || bits == 32)) ||
+		(isFloat && bits == 32)) || channels == 0) {
+		printf("Unsupported WAV format %u, %u bits.\n", format, bits);
+		return false;
+	}
 
-//PCM2Hex - Lee Weber(D3thAdd3r) 2010
-//Released under GPL 3.0 or later.
+	rate = get32(fmt + 4);
+	size_t frameSize = channels * bits / 8;
+	size_t frames = samplesSize / frameSize;
+	out.resize(frames);
+	for (size_t i = 0; i < frames; i++) {
+		const u8 *p = samples + i * frameSize;
+		float sum = 0;
+		for (u32 c = 0; c < channels; c++, p += bits / 8) {
+			sum += getSample(p, bits, isFloat);
+		}
+		out[i] = sum / channels;
+	}
+	return true;
+}
+
+static void readRaw(const std::vector<u8> &data, RawFormat format, std::vector<float> &out)
+{
+	size_t n = format == RAW_S16 ? data.size() / 2 : data.size();
+	out.resize(n);
+	for (size_t i = 0; i < n; i++) {
+		if (format == RAW_U8) out[i] = (data[i] - 128) / 128.0f;
+		else if (format == RAW_S8) out[i] = (signed char)data[i] / 128.0f;
+		else out[i] = (short)get16(&data[i * 2]) / 32768.0f;
+	}
+}
+
+// windowed sinc resampler, the filter cutoff follows the lower rate
+static void resample(const std::vector<float> &in, double inRate, double outRate, std::vector<float> &out)
+{
+	double ratio = outRate / inRate;
+	double cutoff = (ratio < 1 ? ratio : 1) * 0.95;
+	int half = (int)ceil(SINC_ZEROS / cutoff);		//taps on each side
+	int taps = half * 2;
+
+	// polyphase table, one row of taps per fraction of an input sample
+	std::vector<float> table((SINC_PHASES + 1) * taps);
+	for (int p = 0; p <= SINC_PHASES; p++) {
+		double frac = (double)p / SINC_PHASES;
+		double sum = 0;
+		float *row = &table[p * taps];
+		for (int t = 0; t < taps; t++) {
+			double x = t - half + 1 - frac;		//distance to the output sample
+			double s = x == 0 ? 1 : sin(M_PI * x * cutoff) / (M_PI * x * cutoff);
+			double w = 0.42 + 0.5 * cos(M_PI * x / half) + 0.08 * cos(2 * M_PI * x / half);	//Blackman
+			if (fabs(x) >= half) w = 0;
+			row[t] = s * w;
+			sum += row[t];
+		}
+		for (int t = 0; t < taps; t++) row[t] /= sum;	//unity gain at DC
+	}
+
+	size_t n = (size_t)(in.size() * ratio);
+	long last = (long)in.size() - 1;
+	out.resize(n);
+	for (size_t i = 0; i < n; i++) {
+		double pos = i / ratio;
+		long base = (long)pos;
+		const float *row = &table[(int)((pos - base) * SINC_PHASES + 0.5) * taps];
+		long first = base - half + 1;
+		float acc = 0;
+		if (first >= 0 && first + taps - 1 <= last) {
+			const float *src = &in[first];
+			for (int t = 0; t < taps; t++) acc += src[t] * row[t];
+		} else {
+			for (int t = 0; t < taps; t++) {
+				long j = first + t;
+				if (j >= 0 && j <= last) acc += in[j] * row[t];
+			}
+		}
+		out[i] = acc;
+	}
+}
+
+static void trim(std::vector<float> &samples, float level)
+{
+	size_t start = 0, end = samples.size();
+	while (start < end && fabsf(samples[start]) < level) start++;
+	while (end > start && fabsf(samples[end - 1]) < level) end--;
+	samples = std::vector<float>(samples.begin() + start, samples.begin() + end);
+}
 
-//Converts a RAW 8 bit mono PCM file (no headers) to  formatted hex nicely in a PROGMEM array.
-//Cool Edit and many other programs allow you to save in this format. The sample rate will depend
-//on the speed you will play it back on the Uzebox via TriggerNote(). See the tutorial if you have
-//questions.
+static void normalize(std::vector<float> &samples)
+{
+	float peak = 0;
+	for (size_t i = 0; i < samples.size(); i++) {
+		if (fabsf(samples[i]) > peak) peak = fabsf(samples[i]);
+	}
+	if (peak == 0) return;
+	for (size_t i = 0; i < samples.size(); i++) samples[i] /= peak;
+}
 
+static s8 toS8(float v)
+{
+	int s = (int)lrintf(v * 128);
+	if (s > 127) s = 127;
+	if (s < -128) s = -128;
+	return s;
+}
 
 int main(int argc, char *argv[])
 {
-   char *varname = "PCM_Data";
-   char *inname = "in.pcm";
-   
-   if(argc < 2){
-      printf( "\n\tUsage: input.raw outfile[optional]\n\n"          \
-                "\t-v  [specify custom variable name]\n\n"          \
-                "\tRAW PCM 8 bit unsigned mono files supported.\n"  \
-                "\tEx:  pcm2hex input.raw out.inc -v VarName\n\n");
-      return 0;
-   }
-   else
-      inname = argv[1];
-   
-   for(int i=0;i<argc;i++){
-
-      if(!strcmp(argv[i],"-v")){//variable name
-         if(argv[i+1]){
-            varname = argv[i+1];
-            i++;
-         }
-         else
-            printf("\n\tBad variable name, using default.\n");     
-      }        
-   }
-   
-   FILE * fin = fopen(inname,"rb");
-   FILE * fout;
-   
-   if(argc > 2)//user has supplied output file name
-      fout = fopen(argv[2],"w");
-   else
-      fout = fopen("PCM_out.inc","w");
-   
-   if(fin == NULL){
-      printf("Failed to open file.\n");
-      fcloseall();
-      return 0;     
-   }
-   
-   if(fout == NULL){
-      printf("Failed to create file.\n");
-      fcloseall();
-      return 0;
-   }
-   
-   int wide = 0;
-   unsigned int numbytes = 0;
-   unsigned char c;
-   int b;
-   
-   fprintf(fout,"const char %s[] PROGMEM = {\n",varname);
-   
-   while(!feof(fin)){
-      fscanf(fin,"%c",&b);
-      fprintf(fout,"0x");
-      
-      b += 128;//convert to unsigned
-      c = b;
-      
-      if(c < 16)//don't know how to handle this gracefully. Width parameter with escape characters? Never needed them before...
-         fprintf(fout,"0");
-         
-      fprintf(fout,"%X",c);//output hex format
-      if(!feof(fin))
-         fprintf(fout,",");//skip last comma
-      else if(wide < 15)
-         fprintf(fout," ");//use space if not too wide, otherwise closing bracket is on next line.
-         
-      if(++wide > 15){//16 values per line
-         wide = 0;
-         fprintf(fout,"\n");
-      }
-      numbytes++;
-   }
-   fprintf(fout,"};\n");
-   fcloseall();
-   
-   printf("\n\tDone. PROGMEM usage: %d bytes\n",numbytes);
+	const char *varname = "PCM_Data";
+	const char *inname = NULL, *outname = NULL;
+	bool binary = false, keepRate = false, norm = false;
+	float trimLevel = -1;
+	double outRate = MIX_RATE, rawRate = MIX_RATE;
+	RawFormat rawFormat = RAW_U8;
+
+	if (argc < 2) {
+		usage();
+		return 0;
+	}
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-v") && i + 1 < argc) {
+			varname = argv[++i];
+		} else if (!strcmp(argv[i], "-b")) {
+			binary = true;
+		} else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+			outRate = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "-k")) {
+			keepRate = true;
+		} else if (!strcmp(argv[i], "-n")) {
+			norm = true;
+		} else if (!strcmp(argv[i], "-t")) {
+			trimLevel = 0.01f;
+			if (i + 1 < argc && atof(argv[i + 1]) > 0) trimLevel = atof(argv[++i]) / 100;
+		} else if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+			char fmt[8] = "";
+			double rate = 0;
+			if (sscanf(argv[++i], "%7[^,],%lf", fmt, &rate) < 1) fmt[0] = 0;
+			if (!strcmp(fmt, "u8")) rawFormat = RAW_U8;
+			else if (!strcmp(fmt, "s8")) rawFormat = RAW_S8;
+			else if (!strcmp(fmt, "s16")) rawFormat = RAW_S16;
+			else {
+				printf("Bad raw format: %s\n", argv[i]);
+				return 1;
+			}
+			if (rate > 0) rawRate = rate;
+		} else if (argv[i][0] == '-') {
+			usage();
+			return 1;
+		} else if (inname == NULL) {
+			inname = argv[i];
+		} else {
+			outname = argv[i];
+		}
+	}
+	if (outRate <= 0 || inname == NULL) {
+		usage();
+		return 1;
+	}
+	if (outname == NULL) outname = binary ? "PCM_out.bin" : "PCM_out.inc";
+
+	std::vector<u8> data;
+	if (!readFile(inname, data)) {
+		printf("Failed to open file.\n");
+		return 1;
+	}
+
+	std::vector<float> samples;
+	double inRate = rawRate;
+	if (data.size() >= 12 && !memcmp(&data[0], "RIFF", 4) && !memcmp(&data[8], "WAVE", 4)) {
+		if (!readWav(data, samples, inRate)) return 1;
+	} else {
+		readRaw(data, rawFormat, samples);
+	}
+	size_t inCount = samples.size();
+
+	if (!keepRate && fabs(inRate - outRate) > 0.01) {
+		std::vector<float> tmp;
+		resample(samples, inRate, outRate, tmp);
+		samples.swap(tmp);
+	} else {
+		outRate = inRate;
+	}
+	if (trimLevel >= 0) trim(samples, trimLevel);
+	if (norm) normalize(samples);
+
+	// build the whole output in memory, one write
+	std::string text;
+	if (binary) {
+		text.resize(samples.size());
+		for (size_t i = 0; i < samples.size(); i++) text[i] = toS8(samples[i]);
+	} else {
+		static const char hex[] = "0123456789ABCDEF";
+		text.reserve(samples.size() * 5 + strlen(varname) + 64);
+		text += "const char ";
+		text += varname;
+		text += "[] PROGMEM = {\n";
+		for (size_t i = 0; i < samples.size(); i++) {
+			u8 c = toS8(samples[i]);
+			text += "0x";
+			text += hex[c >> 4];
+			text += hex[c & 15];
+			if (i + 1 < samples.size()) text += ((i & 15) == 15) ? ",\n" : ",";
+		}
+		text += "\n};\n";
+	}
+
+	FILE *fout = fopen(outname, binary ? "wb" : "w");
+	if (fout == NULL || fwrite(text.data(), 1, text.size(), fout) != text.size()) {
+		printf("Failed to create file.\n");
+		return 1;
+	}
+	fclose(fout);
+
+	printf("\n\t%u samples at %.2f Hz -> %u samples at %.2f Hz\n",
+		(unsigned int)inCount, inRate, (unsigned int)samples.size(), outRate);
+	printf("\tDone. PROGMEM usage: %u bytes\n", (unsigned int)samples.size());
+	return 0;
 }
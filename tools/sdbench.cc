@@ -0,0 +1,313 @@
+/*
+ *  sdbench - SD card read throughput of kernel/mmc.s. Runs the mmc.s
+ *  routines, assembled by uzeasm, on the host AVR core (uzeavr.cc)
+ *  against a model of an SD card in SPI mode, and compares the sector
+ *  by sector path, mmc_readsector(), with the CMD18 stream,
+ *  mmc_stream_open()/mmc_stream_read()/mmc_stream_close().
+ *
+ *  The SPI clock is the one mmc_init() sets up, every byte read is
+ *  checked against the card. The card is a standard capacity card with
+ *  byte addresses. Before the data token of a read it sends the access
+ *  time as 0xff bytes, -l, and between the blocks of a multiple block
+ *  read the gap, -g. Real cards differ a lot there and change from read
+ *  to read, the bench shows how both paths depend on it.
+ *
+ *  The cycles of a sector include the calls, for the stream the open and
+ *  the close are spread over the sectors read. Sectors per frame are for
+ *  the free cycles given with -f.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <vector>
+#include "uzeavr.h"
+
+#define PORTD 0x2b
+#define MMC_CS 6
+#define SECTOR_SIZE 512
+
+// the lines mode 3 does not render, 262 minus SCREEN_TILES_V*8, before
+// the vsync work of the kernel. "make bench" in default/ gives the real
+// game and idle cycles of a frame.
+#define FREE_CYCLES ((262 - 28 * 8) * UZE_LINE_CYCLES)
+
+// a byte of the card, any sector
+static u8 cardByte(u32 sector, u32 i)
+{
+	u32 x = sector * SECTOR_SIZE + i;
+	x ^= x >> 7;
+	x *= 0x2545f491;
+	return x >> 24;
+}
+
+class SdBench : public UzeAvr
+{
+public:
+	SdBench(u32 access, u32 gap) : access(access), gap(gap), cmdLen(0), initLeft(0),
+		reading(false), multi(false), sector(0), pos(0), wait(0) {}
+
+	// calls the function with the 32 bit argument in r25:r22 as avr-gcc
+	// passes it, returns r25:r24. False when it does not return.
+	bool Call(const char *name, u32 arg, u16 &result)
+	{
+		const UzeSymbol *s = FindSymbol(name);
+		if (s == NULL || !s->code) {
+			printf("No %s in the .elf.\n", name);
+			return false;
+		}
+		u16 sp = AVR_RAM_END - 2;
+		data[0x5d] = sp;
+		data[0x5e] = sp >> 8;
+		data[sp + 1] = 0;	//returns to word address 0
+		data[sp + 2] = 0;
+		data[0x5f] = 0;
+		data[1] = 0;
+		for (int i = 0; i < 4; i++) data[22 + i] = arg >> (i * 8);
+		pc = s->addr / 2;
+		u64 timeout = cycles + 20 * UZE_FRAME_CYCLES;
+		while (pc != 0 && cycles < timeout) Step();
+		if (pc != 0) {
+			printf("%s does not return.\n", name);
+			return false;
+		}
+		result = data[24] | (data[25] << 8);
+		return true;
+	}
+
+protected:
+	// the card shifts out a byte for each byte it gets
+	u8 OnSpiTransfer(u8 out)
+	{
+		if (data[PORTD] & (1 << MMC_CS)) {
+			cmdLen = 0;
+			return 0xff;
+		}
+		u8 in = Next();
+		if (cmdLen > 0 || (out & 0xc0) == 0x40) {
+			cmd[cmdLen++] = out;
+			if (cmdLen == 6) {
+				Command();
+				cmdLen = 0;
+			}
+		}
+		return in;
+	}
+
+private:
+	u8 Next()
+	{
+		if (!reply.empty()) {
+			u8 b = reply.front();
+			reply.pop_front();
+			return b;
+		}
+		if (!reading) return 0xff;
+		if (wait > 0) {
+			wait--;
+			return 0xff;
+		}
+		u32 i = pos++;
+		if (i == 0) return 0xfe;
+		if (i <= SECTOR_SIZE) return cardByte(sector, i - 1);
+		if (i < SECTOR_SIZE + 2) return 0;	//CRC, not checked in SPI mode
+		//last CRC byte
+		pos = 0;
+		if (multi) {
+			sector++;
+			wait = gap;
+		} else {
+			reading = false;
+		}
+		return 0;
+	}
+
+	// one byte of Ncr before the R1 response
+	void Command()
+	{
+		u8 c = cmd[0] & 0x3f;
+		u32 arg = (cmd[1] << 24) | (cmd[2] << 16) | (cmd[3] << 8) | cmd[4];
+		reply.clear();
+		reply.push_back(0xff);
+		switch (c) {
+		case 0:
+			reading = false;
+			initLeft = 3;
+			reply.push_back(0x01);
+			break;
+		case 1:
+			reply.push_back(initLeft > 0 ? 0x01 : 0x00);
+			if (initLeft > 0) initLeft--;
+			break;
+		case 12:
+			//the stuff byte, R1 and a short busy
+			reading = false;
+			reply.push_back(0x00);
+			for (int i = 0; i < 4; i++) reply.push_back(0x00);
+			break;
+		case 17:
+		case 18:
+			if (arg % SECTOR_SIZE != 0) {
+				reply.push_back(0x20);	//address error
+				break;
+			}
+			reply.push_back(0x00);
+			reading = true;
+			multi = c == 18;
+			sector = arg / SECTOR_SIZE;
+			pos = 0;
+			wait = access;
+			break;
+		default:
+			reply.push_back(0x04);	//illegal command
+			break;
+		}
+	}
+
+	u32 access;		//0xff bytes before the first data token
+	u32 gap;		//0xff bytes between the blocks of CMD18
+	u8 cmd[6];
+	int cmdLen;
+	int initLeft;	//CMD1 answers idle that many times
+	std::deque<u8> reply;
+	bool reading;
+	bool multi;
+	u32 sector;
+	u32 pos;		//token, data and CRC bytes sent of the block
+	u32 wait;
+};
+
+static void usage()
+{
+	printf("\n\tUsage: sdbench [options] mmc.elf\n\n"
+		"\t-l n,...    card access time in bytes, default 0,64,512,2048\n"
+		"\t-g n        gap between the blocks of a stream in bytes, default 8\n"
+		"\t-n n        sectors read by each path, default 64\n"
+		"\t-f cycles   free cycles of a frame, default %u\n\n", (unsigned)FREE_CYCLES);
+}
+
+// the buffer against the card
+static u32 checkSector(SdBench *avr, u16 buffer, u32 sector)
+{
+	u32 errors = 0;
+	for (u32 i = 0; i < SECTOR_SIZE; i++) {
+		if (avr->Peek(buffer + i) != cardByte(sector, i)) errors++;
+	}
+	return errors;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *elfname = NULL;
+	std::vector<u32> latencies;
+	u32 gap = 8, count = 64, frameCycles = FREE_CYCLES;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+			for (char *s = argv[++i]; *s;) {
+				latencies.push_back(strtoul(s, &s, 0));
+				if (*s == ',') s++;
+				else if (*s) break;
+			}
+		} else if (!strcmp(argv[i], "-g") && i + 1 < argc) {
+			gap = strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+			count = strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+			frameCycles = strtoul(argv[++i], NULL, 0);
+		} else if (argv[i][0] == '-') {
+			usage();
+			return 1;
+		} else {
+			elfname = argv[i];
+		}
+	}
+	if (elfname == NULL) {
+		usage();
+		return 0;
+	}
+	if (latencies.empty()) {
+		latencies.push_back(0);
+		latencies.push_back(64);
+		latencies.push_back(512);
+		latencies.push_back(2048);
+	}
+	if (count == 0) count = 1;
+
+	printf("\n\t%u sectors, %u cycles free per frame, %u bytes between stream blocks\n\n",
+		count, frameCycles, gap);
+	printf("\taccess   mmc_readsector()        stream\n");
+	printf("\tbytes    cycles/sector  /frame   cycles/sector  /frame\n");
+
+	const u32 first = 1000;
+	u32 errors = 0;
+	for (size_t l = 0; l < latencies.size(); l++) {
+		SdBench *avr = new SdBench(latencies[l], gap);
+		if (!avr->Load(elfname)) {
+			printf("Can't load %s.\n", elfname);
+			return 1;
+		}
+		const UzeSymbol *buf = avr->FindSymbol("sector_buffer");
+		if (buf == NULL || buf->code) {
+			printf("%s has no sector_buffer, assemble mmc.s with -d sector_buffer=512.\n", elfname);
+			return 1;
+		}
+		u16 buffer = buf->addr;
+		avr->Reset();
+
+		u16 r;
+		if (!avr->Call("mmc_init", (u32)buffer << 16, r)) return 1;
+		if ((r & 0xff) != 0) {
+			printf("mmc_init() failed.\n");
+			return 1;
+		}
+
+		u64 start = avr->cycles;
+		for (u32 s = 0; s < count; s++) {
+			if (!avr->Call("mmc_readsector", first + s, r)) return 1;
+			if ((r & 0xff) != 0) {
+				printf("mmc_readsector(%u) failed.\n", first + s);
+				return 1;
+			}
+			errors += checkSector(avr, buffer, first + s);
+		}
+		double single = (double)(avr->cycles - start) / count;
+
+		start = avr->cycles;
+		if (!avr->Call("mmc_stream_open", first, r)) return 1;
+		if ((r & 0xff) != 0) {
+			printf("mmc_stream_open(%u) failed.\n", first);
+			return 1;
+		}
+		for (u32 s = 0; s < count; s++) {
+			if (!avr->Call("mmc_stream_read", ((u32)buffer << 16) | SECTOR_SIZE, r)) return 1;
+			if (r != SECTOR_SIZE) {
+				printf("mmc_stream_read() read %u bytes of sector %u.\n", r, first + s);
+				return 1;
+			}
+			errors += checkSector(avr, buffer, first + s);
+		}
+		if (!avr->Call("mmc_stream_close", 0, r)) return 1;
+		double stream = (double)(avr->cycles - start) / count;
+
+		printf("\t%-8u %-14.0f %-8.2f %-14.0f %.2f\n", latencies[l],
+			single, frameCycles / single, stream, frameCycles / stream);
+		delete avr;
+	}
+	printf("\n\t%u bytes read wrong\n\n", errors);
+	return errors != 0 ? 1 : 0;
+}
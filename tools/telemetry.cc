@@ -0,0 +1,255 @@
+/*
+ *  telemetry - decodes the UART telemetry of the game (telemetry.c,
+ *  built with TELEMETRY=n) into CSV and prints percentiles of the frame
+ *  timings, RAM tiles, voices and stack use.
+ *
+ *  The input is the raw byte stream captured from the UART, for example
+ *  with: stty -F /dev/ttyUSB0 115200 raw && cat /dev/ttyUSB0 > run.bin
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "uzehost.h"
+
+// must match struct TelemetryRecord in telemetry.c
+#define TELEMETRY_VERSION 2
+#define FS_STAGES 8
+#define RECORD_SIZE 40
+
+static const char *stageNames[FS_STAGES] = {
+	"pre_callback", "controllers", "fading", "sprites",
+	"music", "mixer", "post_callback", "vsync"
+};
+
+struct Record
+{
+	u32 frame;		//unwrapped
+	u16 cycles[FS_STAGES];
+	u32 game;
+	u8 ramTiles;
+	u8 droppedTiles;
+	u8 voices;
+	u16 joy1;
+	u16 joy2;
+	u16 score;
+	u8 stage;
+	u8 mode;
+	u16 skipped;
+	u16 stack;
+};
+
+// the columns summarized with percentiles
+enum { COL_STAGES = 0, COL_GAME = FS_STAGES, COL_RAM_TILES, COL_DROPPED, COL_VOICES, COL_STACK, COLS };
+
+static void usage()
+{
+	printf("\n\tUsage: telemetry [options] capture.bin\n\n"
+		"\t-o file     write the records as CSV, - for stdout\n"
+		"\t-g          gameplay frames only (gameMode 3)\n\n"
+		"\tPrints the percentiles of the vsync stages, the cycles left for\n"
+		"\tthe game, the RAM tiles used by the sprites, the voices and the\n"
+		"\tstack high water mark (game built with STACK_PAINT=1).\n\n");
+}
+
+// avr-libc _crc_ccitt_update()
+static u16 crcCcitt(u16 crc, u8 data)
+{
+	data ^= crc & 0xff;
+	data ^= data << 4;
+	return ((((u16)data << 8) | (crc >> 8)) ^ (u8)(data >> 4) ^ ((u16)data << 3));
+}
+
+static bool cobsDecode(const u8 *in, size_t len, std::vector<u8> &out)
+{
+	out.clear();
+	size_t i = 0;
+	while (i < len) {
+		u8 code = in[i++];
+		if (code == 0) return false;
+		for (int j = 1; j < code; j++) {
+			if (i >= len) return false;
+			out.push_back(in[i++]);
+		}
+		if (code != 0xff && i < len) out.push_back(0);
+	}
+	return true;
+}
+
+static u16 get16(const u8 *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static bool parseRecord(const std::vector<u8> &data, Record &rec, u16 &frame16)
+{
+	if (data.size() != RECORD_SIZE || data[0] != TELEMETRY_VERSION) return false;
+
+	u16 crc = 0xffff;
+	for (int i = 0; i < RECORD_SIZE - 2; i++) crc = crcCcitt(crc, data[i]);
+	if (crc != get16(&data[RECORD_SIZE - 2])) return false;
+
+	const u8 *p = &data[1];
+	frame16 = get16(p);
+	p += 2;
+	for (int i = 0; i < FS_STAGES; i++, p += 2) rec.cycles[i] = get16(p);
+	rec.game = get16(p) | ((u32)get16(p + 2) << 16);
+	p += 4;
+	rec.ramTiles = *p++;
+	rec.droppedTiles = *p++;
+	rec.voices = *p++;
+	rec.joy1 = get16(p);
+	rec.joy2 = get16(p + 2);
+	rec.score = get16(p + 4);
+	p += 6;
+	rec.stage = *p++;
+	rec.mode = *p++;
+	rec.skipped = get16(p);
+	rec.stack = get16(p + 2);
+	return true;
+}
+
+static int bitCount(u8 v)
+{
+	int n = 0;
+	for (; v != 0; v >>= 1) n += v & 1;
+	return n;
+}
+
+static double percentile(std::vector<double> &v, double p)
+{
+	if (v.empty()) return 0;
+	size_t i = (size_t)(p / 100.0 * (v.size() - 1) + 0.5);
+	return v[i];
+}
+
+int main(int argc, char *argv[])
+{
+	const char *inname = NULL, *csvname = NULL;
+	bool gameplay = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+			csvname = argv[++i];
+		} else if (!strcmp(argv[i], "-g")) {
+			gameplay = true;
+		} else if (argv[i][0] == '-') {
+			usage();
+			return 1;
+		} else {
+			inname = argv[i];
+		}
+	}
+	if (inname == NULL) {
+		usage();
+		return 0;
+	}
+
+	FILE *f = fopen(inname, "rb");
+	if (f == NULL) {
+		printf("Can't open %s.\n", inname);
+		return 1;
+	}
+	std::vector<u8> raw;
+	u8 buf[65536];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0) raw.insert(raw.end(), buf, buf + n);
+	fclose(f);
+
+	// the capture may start in the middle of a record, it is dropped by the CRC
+	std::vector<Record> records;
+	std::vector<u8> data;
+	int bad = 0;
+	u32 frameHigh = 0;
+	u16 lastFrame = 0;
+	size_t start = 0;
+	for (size_t i = 0; i < raw.size(); i++) {
+		if (raw[i] != 0) continue;
+		Record rec;
+		u16 frame16;
+		if (i > start && cobsDecode(&raw[start], i - start, data) && parseRecord(data, rec, frame16)) {
+			if (!records.empty() && frame16 < lastFrame) frameHigh += 0x10000;
+			lastFrame = frame16;
+			rec.frame = frameHigh | frame16;
+			records.push_back(rec);
+		} else if (i > start) {
+			bad++;
+		}
+		start = i + 1;
+	}
+
+	FILE *csv = NULL;
+	if (csvname != NULL) {
+		csv = strcmp(csvname, "-") ? fopen(csvname, "w") : stdout;
+		if (csv == NULL) {
+			printf("Failed to create file.\n");
+			return 1;
+		}
+		fprintf(csv, "frame");
+		for (int i = 0; i < FS_STAGES; i++) fprintf(csv, ",%s", stageNames[i]);
+		fprintf(csv, ",game,ram_tiles,dropped_tiles,voices,joy1,joy2,score,stage,mode,player,skipped,stack\n");
+	}
+
+	std::vector<double> cols[COLS];
+	u32 lost = 0, period = 0;
+	for (size_t r = 0; r < records.size(); r++) {
+		const Record &rec = records[r];
+		if (r > 0) {
+			u32 delta = rec.frame - records[r - 1].frame;
+			if (period == 0 || delta < period) period = delta;
+		}
+		if (gameplay && (rec.mode & 0x7f) != 3) continue;
+
+		for (int i = 0; i < FS_STAGES; i++) cols[COL_STAGES + i].push_back(rec.cycles[i]);
+		cols[COL_GAME].push_back(rec.game);
+		cols[COL_RAM_TILES].push_back(rec.ramTiles);
+		cols[COL_DROPPED].push_back(rec.droppedTiles);
+		cols[COL_VOICES].push_back(bitCount(rec.voices));
+		cols[COL_STACK].push_back(rec.stack);
+
+		if (csv != NULL) {
+			fprintf(csv, "%u", rec.frame);
+			for (int i = 0; i < FS_STAGES; i++) fprintf(csv, ",%u", rec.cycles[i]);
+			fprintf(csv, ",%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u\n", rec.game, rec.ramTiles,
+				rec.droppedTiles, bitCount(rec.voices), rec.joy1, rec.joy2, rec.score,
+				rec.stage, rec.mode & 0x7f, (rec.mode >> 7) + 1, rec.skipped, rec.stack);
+		}
+	}
+	if (csv != NULL && csv != stdout) fclose(csv);
+
+	// records lost on the wire, the ones skipped by the game are counted in skipped
+	for (size_t r = 1; period > 0 && r < records.size(); r++) {
+		lost += (records[r].frame - records[r - 1].frame) / period - 1;
+	}
+
+	FILE *out = (csv == stdout) ? stderr : stdout;
+	fprintf(out, "\n\t%d records, every %u frames, %d bad, %u lost, %u skipped by the game\n\n",
+		(int)records.size(), period, bad, lost, records.empty() ? 0 : records.back().skipped);
+	fprintf(out, "\t%-16s %8s %8s %8s %8s\n", "", "p50", "p90", "p99", "max");
+	for (int c = 0; c < COLS; c++) {
+		const char *name = c < FS_STAGES ? stageNames[c] :
+			c == COL_GAME ? "game" : c == COL_RAM_TILES ? "ram_tiles" :
+			c == COL_DROPPED ? "dropped_tiles" : c == COL_VOICES ? "voices" : "stack";
+		std::vector<double> &v = cols[c];
+		std::sort(v.begin(), v.end());
+		fprintf(out, "\t%-16s %8.0f %8.0f %8.0f %8.0f\n", name, percentile(v, 50),
+			percentile(v, 90), percentile(v, 99), v.empty() ? 0.0 : v.back());
+	}
+	fprintf(out, "\n");
+	return 0;
+}
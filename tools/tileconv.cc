@@ -0,0 +1,488 @@
+/*
+ *  tileconv - converts the gconvert XML files of data/ (PNG image, tile
+ *  table and maps) to .inc files, removing the duplicate tiles.
+ *
+ *  With a single XML file the output matches gconvert: the unique tiles
+ *  of the image in scan order, then the maps.
+ *
+ *  Several XML files given with -o share one tile table:
+ *   - a tile already in the table is reused, whatever file it came from
+ *   - files without maps are fonts, their tiles stay in order since
+ *     PrintChar() indexes them by character, and a font already in the
+ *     table is reused whole. <VAR>_INDEX is the first tile of each file.
+ *   - the tiles variables of the other files are defined to the shared
+ *     table, so SetTileTable() and the maps work unchanged
+ *
+ *  With -x a tile that is the mirror image of one in the table is reused
+ *  with bit 7 of its map entry set, for sprite maps drawn with
+ *  MapSprite2() and SPRITE_MAP_FLIP=1. Mode 3 can't flip background
+ *  tiles, so -x is only for sprite tile sets.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <png.h>
+#include "uzehost.h"
+
+#define FLIP_BIT 0x80
+
+struct MapDef
+{
+	std::string name;
+	int left, top, width, height;
+	std::vector<int> tiles;		//table index, FLIP_BIT for the mirrored ones
+};
+
+struct TileSet
+{
+	std::string xml;
+	std::string image;
+	std::string output;
+	std::string var;
+	int tileWidth, tileHeight;
+	int columns;				//tiles per row of the image
+	std::vector<MapDef> maps;
+
+	std::vector<std::string> tiles;	//all the tiles of the image, in scan order
+	std::vector<int> index;		//their place in the table
+	int first;					//first table index used by this set
+	int added;					//tiles added to the table
+};
+
+static void usage()
+{
+	printf("\n\tUsage: tileconv [options] file.xml [file2.xml ...]\n\n"
+		"\t-o file     write all the files with one shared tile table\n"
+		"\t-n name     name of the shared table, default: the first tiles var-name\n"
+		"\t-x          reuse mirrored tiles, bit 7 of the map entries flips\n"
+		"\t            the tile (sprites with SPRITE_MAP_FLIP=1)\n"
+		"\t-r count    tile numbers are offset by count (RAM_TILES_COUNT of\n"
+		"\t            DrawMap2) and must stay below 256, default: 0\n\n"
+		"\tEx:  tileconv coors-can.xml\n"
+		"\t     tileconv -o game.inc -r 26 background.xml font2.xml\n\n");
+}
+
+static std::string upper(const std::string &s)
+{
+	std::string r = s;
+	for (size_t i = 0; i < r.size(); i++) r[i] = toupper(r[i]);
+	return r;
+}
+
+// attribute of an XML tag, the tag text starts after its name
+static std::string attr(const std::string &tag, const char *name)
+{
+	std::string key = std::string(" ") + name + "=\"";
+	size_t pos = tag.find(key);
+	if (pos == std::string::npos) {
+		key[key.size() - 1] = '\'';
+		pos = tag.find(key);
+		if (pos == std::string::npos) return "";
+	}
+	pos += key.size();
+	size_t end = tag.find(key[key.size() - 1], pos);
+	return tag.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+}
+
+// the tags named name, without the < and >
+static std::vector<std::string> tags(const std::string &xml, const char *name)
+{
+	std::vector<std::string> found;
+	std::string open = std::string("<") + name;
+	for (size_t pos = 0; (pos = xml.find(open, pos)) != std::string::npos; pos++) {
+		size_t end = xml.find('>', pos);
+		char c = xml[pos + open.size()];
+		if (end == std::string::npos) break;
+		if (isspace(c) || c == '/' || c == '>') found.push_back(xml.substr(pos + 1, end - pos - 1) + " ");
+	}
+	return found;
+}
+
+static bool readXml(const char *name, TileSet &set)
+{
+	FILE *f = fopen(name, "rb");
+	if (f == NULL) {
+		printf("Can't open %s.\n", name);
+		return false;
+	}
+	std::string xml;
+	char buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0) xml.append(buf, n);
+	fclose(f);
+
+	// the files in the XML are relative to it
+	std::string dir = name;
+	size_t slash = dir.find_last_of("/\\");
+	dir = slash == std::string::npos ? "" : dir.substr(0, slash + 1);
+
+	std::vector<std::string> input = tags(xml, "input"), output = tags(xml, "output");
+	std::vector<std::string> tiles = tags(xml, "tiles"), maps = tags(xml, "map");
+	if (input.empty() || output.empty() || tiles.empty()) {
+		printf("%s: not a gconvert file.\n", name);
+		return false;
+	}
+
+	set.xml = name;
+	set.image = dir + attr(input[0], "file");
+	set.output = dir + attr(output[0], "file");
+	set.var = attr(tiles[0], "var-name");
+	set.tileWidth = atoi(attr(input[0], "tile-width").c_str());
+	set.tileHeight = atoi(attr(input[0], "tile-height").c_str());
+	if (set.tileWidth <= 0 || set.tileHeight <= 0) set.tileWidth = set.tileHeight = 8;
+
+	for (size_t i = 0; i < maps.size(); i++) {
+		MapDef m;
+		m.name = attr(maps[i], "var-name");
+		m.left = atoi(attr(maps[i], "left").c_str());
+		m.top = atoi(attr(maps[i], "top").c_str());
+		m.width = atoi(attr(maps[i], "width").c_str());
+		m.height = atoi(attr(maps[i], "height").c_str());
+		set.maps.push_back(m);
+	}
+	return true;
+}
+
+// nearest Uzebox color (BBGGGRRR)
+static u8 toColor(const u8 *rgb, std::map<u32, u8> &cache)
+{
+	u32 key = rgb[0] | (rgb[1] << 8) | (rgb[2] << 16);
+	std::map<u32, u8>::iterator it = cache.find(key);
+	if (it != cache.end()) return it->second;
+
+	int best = 0, bestDist = 0x7fffffff;
+	for (int c = 0; c < 256; c++) {
+		int dr = rgb[0] - (c & 7) * 255 / 7;
+		int dg = rgb[1] - ((c >> 3) & 7) * 255 / 7;
+		int db = rgb[2] - (c >> 6) * 255 / 3;
+		int dist = dr * dr + dg * dg + db * db;
+		if (dist < bestDist) {
+			best = c;
+			bestDist = dist;
+		}
+	}
+	cache[key] = best;
+	return best;
+}
+
+// cuts the image in tiles of Uzebox colors. Like gconvert, the index
+// of an 8 bit colormap image is the color: the images are drawn with
+// the Uzebox palette. Other images use the nearest color.
+static void pngWarning(png_structp png, png_const_charp message)
+{
+}
+
+static bool readImage(TileSet &set)
+{
+	FILE *f = fopen(set.image.c_str(), "rb");
+	if (f == NULL) {
+		printf("Can't open %s.\n", set.image.c_str());
+		return false;
+	}
+	png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, pngWarning);
+	png_infop info = png_create_info_struct(png);
+	if (setjmp(png_jmpbuf(png))) {
+		printf("%s: bad PNG file.\n", set.image.c_str());
+		png_destroy_read_struct(&png, &info, NULL);
+		fclose(f);
+		return false;
+	}
+	png_init_io(png, f);
+	png_read_info(png, info);
+
+	u32 width = png_get_image_width(png, info), height = png_get_image_height(png, info);
+	bool indexed = png_get_color_type(png, info) == PNG_COLOR_TYPE_PALETTE &&
+		png_get_bit_depth(png, info) == 8;
+	if (!indexed) {
+		png_set_expand(png);
+		png_set_strip_16(png);
+		png_set_strip_alpha(png);
+		png_set_gray_to_rgb(png);
+	}
+	png_read_update_info(png, info);
+
+	std::vector<u8> pixels(png_get_rowbytes(png, info) * height);
+	std::vector<png_bytep> lines(height);
+	for (u32 y = 0; y < height; y++) lines[y] = &pixels[y * png_get_rowbytes(png, info)];
+	png_read_image(png, &lines[0]);
+	png_destroy_read_struct(&png, &info, NULL);
+	fclose(f);
+
+	std::map<u32, u8> colors;
+	int w = set.tileWidth, h = set.tileHeight;
+	int cols = width / w, rows = height / h;
+	set.columns = cols;
+	for (int ty = 0; ty < rows; ty++) {
+		for (int tx = 0; tx < cols; tx++) {
+			std::string tile;
+			for (int y = 0; y < h; y++) {
+				const u8 *p = lines[ty * h + y] + tx * w * (indexed ? 1 : 3);
+				for (int x = 0; x < w; x++) {
+					tile += (char)(indexed ? p[x] : toColor(p + x * 3, colors));
+				}
+			}
+			set.tiles.push_back(tile);
+		}
+	}
+
+	for (size_t i = 0; i < set.maps.size(); i++) {
+		MapDef &m = set.maps[i];
+		if (m.left < 0 || m.top < 0 || m.width <= 0 || m.height <= 0 ||
+			m.left + m.width > cols || m.top + m.height > rows) {
+			printf("%s: map %s is outside the image.\n", set.xml.c_str(), m.name.c_str());
+			return false;
+		}
+	}
+	return true;
+}
+
+static std::string mirror(const std::string &tile, int width)
+{
+	std::string r = tile;
+	for (size_t y = 0; y < tile.size(); y += width) {
+		for (int x = 0; x < width; x++) r[y + x] = tile[y + width - 1 - x];
+	}
+	return r;
+}
+
+class TileTable
+{
+public:
+	std::vector<std::string> tiles;
+
+	TileTable(bool flip) : flip(flip) {}
+
+	// index of the tile, added if needed
+	int add(const std::string &tile, int width)
+	{
+		std::map<std::string, int>::iterator it = lookup.find(tile);
+		if (it != lookup.end()) return it->second;
+		if (flip) {
+			it = lookup.find(mirror(tile, width));
+			if (it != lookup.end()) return it->second | FLIP_BIT;
+		}
+		return append(tile);
+	}
+
+	// a font, in order; an identical run of tiles is reused
+	int addRun(const std::vector<std::string> &run)
+	{
+		for (size_t start = 0; start + run.size() <= tiles.size(); start++) {
+			size_t i = 0;
+			while (i < run.size() && tiles[start + i] == run[i]) i++;
+			if (i == run.size()) return start;
+		}
+		int first = tiles.size();
+		for (size_t i = 0; i < run.size(); i++) append(run[i]);
+		return first;
+	}
+
+private:
+	bool flip;
+	std::map<std::string, int> lookup;
+
+	int append(const std::string &tile)
+	{
+		int index = tiles.size();
+		if (lookup.find(tile) == lookup.end()) lookup[tile] = index;
+		tiles.push_back(tile);
+		return index;
+	}
+};
+
+static void convert(TileSet &set, TileTable &table)
+{
+	size_t before = table.tiles.size();
+
+	if (set.maps.empty()) {
+		set.first = table.addRun(set.tiles);
+		for (size_t i = 0; i < set.tiles.size(); i++) set.index.push_back(set.first + i);
+	} else {
+		set.first = 0;
+		for (size_t i = 0; i < set.tiles.size(); i++) {
+			set.index.push_back(table.add(set.tiles[i], set.tileWidth));
+		}
+	}
+	set.added = table.tiles.size() - before;
+
+	for (size_t i = 0; i < set.maps.size(); i++) {
+		MapDef &m = set.maps[i];
+		for (int y = 0; y < m.height; y++) {
+			for (int x = 0; x < m.width; x++) {
+				m.tiles.push_back(set.index[(m.top + y) * set.columns + m.left + x]);
+			}
+		}
+	}
+}
+
+// same layout as gconvert
+static void writeTiles(std::string &out, const std::string &var, const std::vector<std::string> &tiles)
+{
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%d", (int)tiles.size());
+	out += "#define " + upper(var) + "_SIZE " + buf + "\n";
+	out += "const char " + var + "[] PROGMEM={\n";
+	for (size_t t = 0; t < tiles.size(); t++) {
+		for (size_t i = 0; i < tiles[t].size(); i++) {
+			snprintf(buf, sizeof(buf), "%s0x%x", (t == 0 && i == 0) ? " " : ", ", (u8)tiles[t][i]);
+			out += buf;
+		}
+		snprintf(buf, sizeof(buf), "\t\t //tile:%d\n", (int)t);
+		out += buf;
+	}
+	out += "};\n\n";
+}
+
+static void writeMaps(std::string &out, const TileSet &set)
+{
+	char buf[64];
+	for (size_t i = 0; i < set.maps.size(); i++) {
+		const MapDef &m = set.maps[i];
+		snprintf(buf, sizeof(buf), " %d\n", m.width);
+		out += "#define " + upper(m.name) + "_WIDTH" + buf;
+		snprintf(buf, sizeof(buf), " %d\n", m.height);
+		out += "#define " + upper(m.name) + "_HEIGHT" + buf;
+		snprintf(buf, sizeof(buf), "%d,%d", m.width, m.height);
+		out += "const char " + m.name + "[] PROGMEM ={\n" + buf;
+		for (size_t t = 0; t < m.tiles.size(); t++) {
+			snprintf(buf, sizeof(buf), "%s,0x%x", (t % 20) == 0 ? "\n" : "", m.tiles[t]);
+			out += buf;
+		}
+		out += "};\n\n";
+	}
+}
+
+static bool writeFile(const std::string &name, const std::string &text)
+{
+	FILE *f = fopen(name.c_str(), "w");
+	if (f == NULL || fwrite(text.data(), 1, text.size(), f) != text.size()) {
+		printf("Failed to create %s.\n", name.c_str());
+		return false;
+	}
+	fclose(f);
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *outname = NULL;
+	std::string shared;
+	bool flip = false;
+	int offset = 0;
+	std::vector<TileSet> sets;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+			outname = argv[++i];
+		} else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+			shared = argv[++i];
+		} else if (!strcmp(argv[i], "-x")) {
+			flip = true;
+		} else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+			offset = atoi(argv[++i]);
+		} else if (argv[i][0] == '-') {
+			usage();
+			return 1;
+		} else {
+			TileSet set;
+			if (!readXml(argv[i], set) || !readImage(set)) return 1;
+			sets.push_back(set);
+		}
+	}
+	if (sets.empty()) {
+		usage();
+		return 0;
+	}
+	if (sets.size() > 1 && outname == NULL) {
+		printf("Several files need -o.\n");
+		return 1;
+	}
+	if (shared.empty()) shared = sets[0].var;
+
+	// one table for all the files with -o, else one per file
+	std::vector<TileTable> tables;
+	for (size_t i = 0; i < sets.size(); i++) {
+		if (i == 0 || outname == NULL) tables.push_back(TileTable(flip));
+		convert(sets[i], tables.back());
+	}
+
+	bool ok = true;
+	int limit = (flip ? FLIP_BIT : 256) - offset;
+	for (size_t i = 0; i < sets.size(); i++) {
+		const TileSet &set = sets[i];
+		for (size_t m = 0; m < set.maps.size(); m++) {
+			for (size_t t = 0; t < set.maps[m].tiles.size(); t++) {
+				if ((set.maps[m].tiles[t] & (flip ? ~FLIP_BIT : ~0)) < limit) continue;
+				printf("%s: map %s uses tile %d, more than %d tiles.\n", set.xml.c_str(),
+					set.maps[m].name.c_str(), set.maps[m].tiles[t], limit);
+				ok = false;
+				break;
+			}
+		}
+	}
+	if (!ok) return 1;
+
+	// flash used by gconvert (every file has its own table) and now
+	int tileSize = sets[0].tileWidth * sets[0].tileHeight;
+	int before = 0, after = 0;
+	printf("\n\t%-28s %6s %6s %8s\n", "", "tiles", "added", "saved");
+	for (size_t i = 0; i < sets.size(); i++) {
+		const TileSet &set = sets[i];
+		std::map<std::string, int> unique;
+		for (size_t t = 0; t < set.tiles.size(); t++) unique[set.tiles[t]] = 0;
+		int own = set.maps.empty() ? set.tiles.size() : unique.size();
+		before += own * tileSize;
+		after += set.added * tileSize;
+		printf("\t%-28s %6d %6d %8d bytes\n", set.var.c_str(), (int)set.tiles.size(),
+			set.added, (own - set.added) * tileSize);
+	}
+
+	if (outname == NULL) {
+		std::string text;
+		writeTiles(text, sets[0].var, tables[0].tiles);
+		writeMaps(text, sets[0]);
+		if (!writeFile(sets[0].output, text)) return 1;
+	} else {
+		std::string text = "// made by tools/tileconv from";
+		for (size_t i = 0; i < sets.size(); i++) text += " " + sets[i].xml;
+		text += ", all the files share " + shared + "\n\n";
+		writeTiles(text, shared, tables[0].tiles);
+		for (size_t i = 0; i < sets.size(); i++) {
+			char buf[16];
+			snprintf(buf, sizeof(buf), " %d\n", sets[i].first);
+			text += "#define " + upper(sets[i].var) + "_INDEX" + buf;
+			if (sets[i].var == shared) continue;
+			if (sets[i].maps.empty()) {
+				snprintf(buf, sizeof(buf), "%d", tileSize);
+				text += "#define " + sets[i].var + " (" + shared + " + " + buf + " * " +
+					upper(sets[i].var) + "_INDEX)\n";
+			} else {
+				text += "#define " + sets[i].var + " " + shared + "\n";
+			}
+		}
+		text += "\n";
+		for (size_t i = 0; i < sets.size(); i++) writeMaps(text, sets[i]);
+		if (!writeFile(outname, text)) return 1;
+	}
+
+	printf("\n\tDone. %d bytes of tiles, %d before, %d saved\n\n", after, before, before - after);
+	return 0;
+}
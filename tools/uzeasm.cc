@@ -0,0 +1,982 @@
+/*
+ *  uzeasm - a small AVR assembler for the host checks. Assembles kernel
+ *  .s files, or some routines of them, into an .elf the host AVR core
+ *  (uzeavr.cc) loads, so the hand written assembly can be run and timed
+ *  by uzeframe -b and sdbench without avr-gcc.
+ *
+ *  It is not a general assembler. It knows the AVR instructions, the
+ *  directives the kernel uses (.section, .global, .align, .space, .byte,
+ *  .word, .rept, .equ), the #define/#if preprocessing of
+ *  assembler-with-cpp without macro arguments, and the ATmega644 I/O
+ *  registers of avr/io.h the kernel uses. #include lines are skipped,
+ *  the defines they would bring are given with -D or -i.
+ *
+ *  The .bss of the file is laid out from 0x100 in its order, then the
+ *  -d variables. The code starts at 0x100, -e names get a ret so the
+ *  host tools find the symbols they look for.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include "uzehost.h"
+
+#define CODE_START 0x100
+#define DATA_START 0x100
+
+// avr/io.h for the ATmega644, data space addresses, and the bits used
+static const struct { const char *name; int value; } ioNames[] = {
+	{"PINA", 0x20}, {"DDRA", 0x21}, {"PORTA", 0x22}, {"PINB", 0x23}, {"DDRB", 0x24}, {"PORTB", 0x25},
+	{"PINC", 0x26}, {"DDRC", 0x27}, {"PORTC", 0x28}, {"PIND", 0x29}, {"DDRD", 0x2a}, {"PORTD", 0x2b},
+	{"TIFR0", 0x35}, {"TIFR1", 0x36}, {"TIFR2", 0x37}, {"GPIOR0", 0x3e}, {"EECR", 0x3f}, {"EEDR", 0x40},
+	{"EEARL", 0x41}, {"EEARH", 0x42}, {"GTCCR", 0x43}, {"TCCR0A", 0x44}, {"TCCR0B", 0x45}, {"TCNT0", 0x46},
+	{"OCR0A", 0x47}, {"OCR0B", 0x48}, {"GPIOR1", 0x4a}, {"GPIOR2", 0x4b}, {"SPCR", 0x4c}, {"SPSR", 0x4d},
+	{"SPDR", 0x4e}, {"SMCR", 0x53}, {"MCUSR", 0x54}, {"MCUCR", 0x55}, {"SPL", 0x5d}, {"SPH", 0x5e},
+	{"SREG", 0x5f}, {"WDTCSR", 0x60}, {"TIMSK0", 0x6e}, {"TIMSK1", 0x6f}, {"TIMSK2", 0x70},
+	{"TCCR1A", 0x80}, {"TCCR1B", 0x81}, {"TCCR1C", 0x82}, {"TCNT1L", 0x84}, {"TCNT1H", 0x85},
+	{"ICR1L", 0x86}, {"ICR1H", 0x87}, {"OCR1AL", 0x88}, {"OCR1AH", 0x89}, {"OCR1BL", 0x8a},
+	{"OCR1BH", 0x8b}, {"TCCR2A", 0xb0}, {"TCCR2B", 0xb1}, {"TCNT2", 0xb2}, {"OCR2A", 0xb3},
+	{"OCR2B", 0xb4}, {"UCSR0A", 0xc0}, {"UCSR0B", 0xc1}, {"UCSR0C", 0xc2}, {"UBRR0L", 0xc4},
+	{"UBRR0H", 0xc5}, {"UDR0", 0xc6},
+	{"SPIE", 7}, {"SPE", 6}, {"DORD", 5}, {"MSTR", 4}, {"CPOL", 3}, {"CPHA", 2}, {"SPR1", 1}, {"SPR0", 0},
+	{"SPIF", 7}, {"WCOL", 6}, {"SPI2X", 0}, {"OCIE1A", 1}, {"OCIE1B", 2}, {"TOIE1", 0}, {"OCF1A", 1},
+	{"OCF1B", 2}, {"TOV1", 0}, {"EERE", 0}, {"EEPE", 1}, {"EEMPE", 2}, {"EERIE", 3},
+	{"RAMEND", 0x10ff},
+};
+
+static std::map<std::string, std::string> macros;
+static std::string fileName;
+static int lineNo;
+static int errors;
+
+static void error(const char *msg, const std::string &what = "")
+{
+	printf("%s:%d: %s%s%s\n", fileName.c_str(), lineNo, msg, what.empty() ? "" : " ", what.c_str());
+	errors++;
+}
+
+static bool isIdent(char c, bool first)
+{
+	return isalpha((unsigned char)c) || c == '_' || (!first && isdigit((unsigned char)c));
+}
+
+static std::string trim(const std::string &s)
+{
+	size_t a = s.find_first_not_of(" \t"), b = s.find_last_not_of(" \t");
+	return a == std::string::npos ? "" : s.substr(a, b - a + 1);
+}
+
+//
+// Expressions of #if and of the operands, C precedence. Identifiers are
+// looked up by the resolver: macros in #if, symbols in the operands.
+//
+
+class Expr
+{
+public:
+	typedef bool (*Resolver)(const std::string &name, s32 &value);
+
+	Expr(const std::string &text, Resolver resolve, s32 dot, bool pp)
+		: unknown(false), s(text), p(0), resolve(resolve), dot(dot), pp(pp) {}
+
+	bool Eval(s32 &value)
+	{
+		value = Ternary();
+		Skip();
+		return p == s.size();
+	}
+
+	bool unknown;	//a symbol was not defined yet
+
+private:
+	void Skip() { while (p < s.size() && isspace((unsigned char)s[p])) p++; }
+
+	bool Op(const char *op)
+	{
+		Skip();
+		size_t n = strlen(op);
+		if (s.compare(p, n, op) != 0) return false;
+		//do not take < for <<, & for && and so on
+		if (n == 1 && p + 1 < s.size() && strchr("<>&|=", op[0]) && s[p + 1] == op[0]) return false;
+		if (n == 1 && (op[0] == '<' || op[0] == '>' || op[0] == '!') && p + 1 < s.size() && s[p + 1] == '=') return false;
+		p += n;
+		return true;
+	}
+
+	s32 Ternary()
+	{
+		s32 c = Binary(0);
+		if (!Op("?")) return c;
+		s32 a = Ternary();
+		Op(":");
+		s32 b = Ternary();
+		return c ? a : b;
+	}
+
+	s32 Binary(int level)
+	{
+		static const char *ops[][5] = {
+			{"||"}, {"&&"}, {"|"}, {"^"}, {"&"}, {"==", "!="}, {"<=", ">=", "<", ">"},
+			{"<<", ">>"}, {"+", "-"}, {"*", "/", "%"},
+		};
+		if (level == 10) return Unary();
+		s32 v = Binary(level + 1);
+		for (;;) {
+			const char *found = NULL;
+			for (int i = 0; i < 5 && ops[level][i] != NULL; i++) {
+				if (Op(ops[level][i])) { found = ops[level][i]; break; }
+			}
+			if (found == NULL) return v;
+			s32 r = Binary(level + 1);
+			std::string o = found;
+			if (o == "||") v = v || r;
+			else if (o == "&&") v = v && r;
+			else if (o == "|") v |= r;
+			else if (o == "^") v ^= r;
+			else if (o == "&") v &= r;
+			else if (o == "==") v = v == r;
+			else if (o == "!=") v = v != r;
+			else if (o == "<=") v = v <= r;
+			else if (o == ">=") v = v >= r;
+			else if (o == "<") v = v < r;
+			else if (o == ">") v = v > r;
+			else if (o == "<<") v <<= r;
+			else if (o == ">>") v >>= r;
+			else if (o == "+") v += r;
+			else if (o == "-") v -= r;
+			else if (o == "*") v *= r;
+			else if (r == 0) v = 0;
+			else if (o == "/") v /= r;
+			else v %= r;
+		}
+	}
+
+	s32 Unary()
+	{
+		if (Op("-")) return -Unary();
+		if (Op("+")) return Unary();
+		if (Op("~")) return ~Unary();
+		if (Op("!")) return !Unary();
+		return Primary();
+	}
+
+	s32 Primary()
+	{
+		Skip();
+		if (p >= s.size()) return 0;
+		if (Op("(")) {
+			s32 v = Ternary();
+			Op(")");
+			return v;
+		}
+		char c = s[p];
+		if (isdigit((unsigned char)c)) {
+			char *end;
+			const char *start = s.c_str() + p;
+			s32 v;
+			if (c == '0' && (start[1] == 'b' || start[1] == 'B')) v = strtol(start + 2, &end, 2);
+			else v = strtol(start, &end, 0);
+			p += end - start;
+			while (p < s.size() && (s[p] == 'u' || s[p] == 'U' || s[p] == 'l' || s[p] == 'L')) p++;
+			return v;
+		}
+		if (c == '\'' && p + 2 < s.size() && s[p + 2] == '\'') {
+			p += 3;
+			return (u8)s[p - 2];
+		}
+		if (c == '.' && (p + 1 >= s.size() || !isIdent(s[p + 1], false))) {
+			p++;
+			return dot;
+		}
+		if (!isIdent(c, true) && c != '.') {
+			p = s.size() + 1;	//fails Eval()
+			return 0;
+		}
+		size_t start = p++;
+		while (p < s.size() && (isIdent(s[p], false) || s[p] == '.')) p++;
+		std::string name = s.substr(start, p - start);
+
+		if (pp && name == "defined") {
+			bool paren = Op("(");
+			Skip();
+			size_t a = p;
+			while (p < s.size() && isIdent(s[p], false)) p++;
+			std::string m = s.substr(a, p - a);
+			if (paren) Op(")");
+			return macros.count(m) != 0;
+		}
+		if (Op("(")) {
+			s32 v = Ternary();
+			Op(")");
+			if (name == "lo8") return v & 0xff;
+			if (name == "hi8") return (v >> 8) & 0xff;
+			if (name == "hh8" || name == "hlo8") return (v >> 16) & 0xff;
+			if (name == "pm" || name == "gs") return v >> 1;
+			if (name == "_SFR_IO_ADDR") return v - 0x20;
+			if (name == "_SFR_MEM_ADDR" || name == "_SFR_IO8" || name == "_SFR_MEM8") return v;
+			if (name == "_BV") return 1 << v;
+			error("unknown function", name);
+			return 0;
+		}
+		s32 v = 0;
+		if (!resolve(name, v)) {
+			if (pp) return 0;
+			unknown = true;
+		}
+		return v;
+	}
+
+	std::string s;
+	size_t p;
+	Resolver resolve;
+	s32 dot;
+	bool pp;
+};
+
+static std::set<std::string> expanding;
+
+static bool macroValue(const std::string &name, s32 &value)
+{
+	std::map<std::string, std::string>::iterator m = macros.find(name);
+	if (m == macros.end() || expanding.count(name)) return false;
+	expanding.insert(name);
+	Expr e(m->second, macroValue, 0, true);
+	bool ok = e.Eval(value);
+	expanding.erase(name);
+	return ok;
+}
+
+// macros replaced in a line, as cpp does
+static std::string expand(const std::string &line, int depth = 0)
+{
+	std::string out;
+	for (size_t i = 0; i < line.size();) {
+		if (isIdent(line[i], true) && (i == 0 || !isIdent(line[i - 1], false))) {
+			size_t a = i;
+			while (i < line.size() && isIdent(line[i], false)) i++;
+			std::string name = line.substr(a, i - a);
+			std::map<std::string, std::string>::iterator m = macros.find(name);
+			if (m != macros.end() && depth < 16) out += expand(m->second, depth + 1);
+			else out += name;
+		} else if (isdigit((unsigned char)line[i])) {
+			while (i < line.size() && isIdent(line[i], false)) out += line[i++];
+		} else {
+			out += line[i++];
+		}
+	}
+	return out;
+}
+
+static void define(const std::string &text)
+{
+	std::string t = trim(text);
+	size_t n = 0;
+	while (n < t.size() && isIdent(t[n], n == 0)) n++;
+	if (n == 0) return error("bad #define", t);
+	if (n < t.size() && t[n] == '(') return error("#define with arguments is not supported", t);
+	macros[t.substr(0, n)] = trim(t.substr(n));
+}
+
+// source lines without comments, with their line number
+struct Line
+{
+	int no;
+	std::string text;
+};
+
+static bool readFile(const char *path, std::string &text)
+{
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) return false;
+	char buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0) text.append(buf, n);
+	fclose(f);
+	return true;
+}
+
+//
+// #define, #if and comments. With directivesOnly the other lines are
+// dropped, as for a header given with -i.
+//
+static bool preprocess(const char *path, std::vector<Line> &out, bool directivesOnly)
+{
+	std::string text;
+	if (!readFile(path, text)) {
+		printf("Can't open %s.\n", path);
+		return false;
+	}
+	fileName = path;
+
+	// block comments, keeping the line count
+	std::string s;
+	for (size_t i = 0; i < text.size(); i++) {
+		if (text[i] == '/' && i + 1 < text.size() && text[i + 1] == '*') {
+			size_t end = text.find("*/", i + 2);
+			if (end == std::string::npos) end = text.size();
+			for (size_t j = i; j < end; j++) if (text[j] == '\n') s += '\n';
+			s += ' ';
+			i = end + 1;
+		} else if (text[i] != '\r') {
+			s += text[i];
+		}
+	}
+
+	// per #if: is this branch on, was a branch taken
+	std::vector<std::pair<bool, bool> > conds;
+	size_t pos = 0;
+	lineNo = 0;
+	while (pos <= s.size()) {
+		size_t end = s.find('\n', pos);
+		if (end == std::string::npos) end = s.size();
+		std::string line = s.substr(pos, end - pos);
+		pos = end + 1;
+		lineNo++;
+
+		size_t cpp = line.find("//");
+		if (cpp != std::string::npos) line.erase(cpp);
+		std::string t = trim(line);
+		bool on = conds.empty() || conds.back().first;
+
+		if (!t.empty() && t[0] == '#') {
+			std::string d = trim(t.substr(1));
+			size_t n = 0;
+			while (n < d.size() && isalpha((unsigned char)d[n])) n++;
+			std::string word = d.substr(0, n), rest = trim(d.substr(n));
+			s32 v = 0;
+			if (word == "if" || word == "ifdef" || word == "ifndef") {
+				bool c = false;
+				if (on) {
+					if (word == "ifdef") c = macros.count(rest) != 0;
+					else if (word == "ifndef") c = macros.count(rest) == 0;
+					else {
+						Expr e(rest, macroValue, 0, true);
+						if (!e.Eval(v)) error("bad #if", rest);
+						c = v != 0;
+					}
+				}
+				conds.push_back(std::make_pair(on && c, !on || c));
+			} else if (word == "elif") {
+				if (conds.empty()) { error("#elif without #if"); continue; }
+				bool parent = conds.size() < 2 || conds[conds.size() - 2].first;
+				if (conds.back().second || !parent) {
+					conds.back().first = false;
+				} else {
+					Expr e(rest, macroValue, 0, true);
+					if (!e.Eval(v)) error("bad #elif", rest);
+					conds.back().first = v != 0;
+					conds.back().second = v != 0;
+				}
+			} else if (word == "else") {
+				if (conds.empty()) { error("#else without #if"); continue; }
+				bool parent = conds.size() < 2 || conds[conds.size() - 2].first;
+				conds.back().first = parent && !conds.back().second;
+				conds.back().second = true;
+			} else if (word == "endif") {
+				if (conds.empty()) error("#endif without #if");
+				else conds.pop_back();
+			} else if (!on) {
+				continue;
+			} else if (word == "define") {
+				define(rest);
+			} else if (word == "undef") {
+				macros.erase(rest);
+			} else if (word == "error") {
+				error("#error", rest);
+			} else if (word != "include" && word != "pragma" && word != "warning") {
+				error("unknown directive", t);
+			}
+			continue;
+		}
+		if (!on || directivesOnly) continue;
+
+		size_t semi = line.find(';');
+		if (semi != std::string::npos) line.erase(semi);
+		line = trim(expand(line));
+		if (line.empty()) continue;
+		Line l = { lineNo, line };
+		out.push_back(l);
+	}
+	if (!conds.empty()) error("missing #endif");
+	return errors == 0;
+}
+
+//
+// The assembler
+//
+
+struct Symbol
+{
+	s32 addr;	//byte address in flash, or in the data space
+	bool code;
+};
+
+static std::map<std::string, Symbol> symbols;
+static std::vector<std::string> symbolOrder;
+static bool finalPass;
+
+static bool symbolValue(const std::string &name, s32 &value)
+{
+	std::map<std::string, Symbol>::iterator s = symbols.find(name);
+	if (s == symbols.end()) return false;
+	value = s->second.addr;
+	return true;
+}
+
+static s32 eval(const std::string &text, s32 dot)
+{
+	Expr e(text, symbolValue, dot, false);
+	s32 v = 0;
+	if (!e.Eval(v)) error("bad expression", text);
+	else if (e.unknown && finalPass) error("undefined symbol in", text);
+	return v;
+}
+
+static int reg(const std::string &text)
+{
+	static const char *pairs[] = {"XL", "XH", "YL", "YH", "ZL", "ZH"};
+	std::string t = trim(text);
+	for (int i = 0; i < 6; i++) {
+		if (t == pairs[i]) return 26 + i;
+	}
+	if (t.size() >= 2 && (t[0] == 'r' || t[0] == 'R') && isdigit((unsigned char)t[1])) {
+		char *end;
+		long r = strtol(t.c_str() + 1, &end, 10);
+		if (*end == 0 && r < 32) return r;
+	}
+	error("bad register", t);
+	return 0;
+}
+
+static void checkRange(s32 v, s32 lo, s32 hi, const std::string &what)
+{
+	if (finalPass && (v < lo || v > hi)) error("out of range:", what);
+}
+
+static std::vector<std::string> splitArgs(const std::string &s)
+{
+	std::vector<std::string> out;
+	int depth = 0;
+	std::string cur;
+	for (size_t i = 0; i < s.size(); i++) {
+		if (s[i] == '(') depth++;
+		if (s[i] == ')') depth--;
+		if (s[i] == ',' && depth == 0) {
+			out.push_back(trim(cur));
+			cur.clear();
+		} else {
+			cur += s[i];
+		}
+	}
+	if (!trim(cur).empty()) out.push_back(trim(cur));
+	return out;
+}
+
+// opcode of an instruction at byte address pc, one or two words
+static void encode(const std::string &mnemonic, const std::vector<std::string> &a, s32 pc, std::vector<u16> &out)
+{
+	static const struct { const char *name; u16 op; } rr[] = {
+		{"add", 0x0c00}, {"adc", 0x1c00}, {"sub", 0x1800}, {"sbc", 0x0800}, {"and", 0x2000},
+		{"or", 0x2800}, {"eor", 0x2400}, {"mov", 0x2c00}, {"cp", 0x1400}, {"cpc", 0x0400},
+		{"cpse", 0x1000}, {"mul", 0x9c00},
+	};
+	static const struct { const char *name; u16 op; } same[] = {
+		{"clr", 0x2400}, {"lsl", 0x0c00}, {"rol", 0x1c00}, {"tst", 0x2000},
+	};
+	static const struct { const char *name; u16 op; } imm[] = {
+		{"ldi", 0xe000}, {"cpi", 0x3000}, {"subi", 0x5000}, {"sbci", 0x4000}, {"andi", 0x7000},
+		{"ori", 0x6000}, {"sbr", 0x6000},
+	};
+	static const struct { const char *name; u16 op; } one[] = {
+		{"com", 0x9400}, {"neg", 0x9401}, {"swap", 0x9402}, {"inc", 0x9403}, {"asr", 0x9405},
+		{"lsr", 0x9406}, {"ror", 0x9407}, {"dec", 0x940a}, {"push", 0x920f}, {"pop", 0x900f},
+	};
+	static const struct { const char *name; u16 op; } none[] = {
+		{"nop", 0x0000}, {"ret", 0x9508}, {"reti", 0x9518}, {"ijmp", 0x9409}, {"icall", 0x9509},
+		{"sleep", 0x9588}, {"wdr", 0x95a8}, {"break", 0x9598}, {"spm", 0x95e8},
+		{"sec", 0x9408}, {"clc", 0x9488}, {"sez", 0x9418}, {"clz", 0x9498}, {"sen", 0x9428},
+		{"cln", 0x94a8}, {"sev", 0x9438}, {"clv", 0x94b8}, {"ses", 0x9448}, {"cls", 0x94c8},
+		{"seh", 0x9458}, {"clh", 0x94d8}, {"set", 0x9468}, {"clt", 0x94e8}, {"sei", 0x9478},
+		{"cli", 0x94f8},
+	};
+	static const struct { const char *name; u16 op; } branch[] = {
+		{"brcs", 0xf000}, {"brlo", 0xf000}, {"breq", 0xf001}, {"brmi", 0xf002}, {"brvs", 0xf003},
+		{"brlt", 0xf004}, {"brhs", 0xf005}, {"brts", 0xf006}, {"brie", 0xf007},
+		{"brcc", 0xf400}, {"brsh", 0xf400}, {"brne", 0xf401}, {"brpl", 0xf402}, {"brvc", 0xf403},
+		{"brge", 0xf404}, {"brhc", 0xf405}, {"brtc", 0xf406}, {"brid", 0xf407},
+	};
+	static const struct { const char *name; u16 op; } ioBit[] = {
+		{"cbi", 0x9800}, {"sbic", 0x9900}, {"sbi", 0x9a00}, {"sbis", 0x9b00},
+	};
+	static const struct { const char *name; u16 op; } regBit[] = {
+		{"bld", 0xf800}, {"bst", 0xfa00}, {"sbrc", 0xfc00}, {"sbrs", 0xfe00},
+	};
+	const std::string &m = mnemonic;
+	size_t n = a.size();
+
+#define FIND(table) for (size_t i = 0; i < sizeof(table) / sizeof(table[0]); i++) if (m == table[i].name)
+	FIND(rr) {
+		if (n != 2) break;
+		int d = reg(a[0]), r = reg(a[1]);
+		out.push_back(rr[i].op | ((r & 0x10) << 5) | (d << 4) | (r & 0xf));
+		return;
+	}
+	FIND(same) {
+		if (n != 1) break;
+		int d = reg(a[0]);
+		out.push_back(same[i].op | ((d & 0x10) << 5) | (d << 4) | (d & 0xf));
+		return;
+	}
+	FIND(imm) {
+		if (n != 2) break;
+		int d = reg(a[0]);
+		s32 k = eval(a[1], pc);
+		if (d < 16) error("register must be r16-r31:", a[0]);
+		checkRange(k, -256, 255, a[1]);	//~mask is fine, as for avr-as
+		out.push_back(imm[i].op | ((k & 0xf0) << 4) | ((d & 0xf) << 4) | (k & 0xf));
+		return;
+	}
+	FIND(one) {
+		if (n != 1) break;
+		out.push_back(one[i].op | (reg(a[0]) << 4));
+		return;
+	}
+	FIND(none) {
+		if (n == 0) {
+			out.push_back(none[i].op);
+			return;
+		}
+	}
+	// as for avr-as, . in a relative jump is the next instruction, .+0
+	FIND(branch) {
+		if (n != 1) break;
+		s32 k = (eval(a[0], pc + 2) - pc - 2) / 2;
+		checkRange(k, -64, 63, a[0]);
+		out.push_back(branch[i].op | ((k & 0x7f) << 3));
+		return;
+	}
+	FIND(ioBit) {
+		if (n != 2) break;
+		s32 io = eval(a[0], pc), b = eval(a[1], pc);
+		checkRange(io, 0, 31, a[0]);
+		checkRange(b, 0, 7, a[1]);
+		out.push_back(ioBit[i].op | ((io & 0x1f) << 3) | (b & 7));
+		return;
+	}
+	FIND(regBit) {
+		if (n != 2) break;
+		s32 b = eval(a[1], pc);
+		checkRange(b, 0, 7, a[1]);
+		out.push_back(regBit[i].op | (reg(a[0]) << 4) | (b & 7));
+		return;
+	}
+#undef FIND
+
+	if (m == "ser" && n == 1) {
+		int d = reg(a[0]);
+		if (d < 16) error("register must be r16-r31:", a[0]);
+		out.push_back(0xef0f | ((d & 0xf) << 4));
+	} else if (m == "cbr" && n == 2) {
+		int d = reg(a[0]);
+		s32 k = ~eval(a[1], pc) & 0xff;
+		out.push_back(0x7000 | ((k & 0xf0) << 4) | ((d & 0xf) << 4) | (k & 0xf));
+	} else if (m == "movw" && n == 2) {
+		out.push_back(0x0100 | ((reg(a[0]) / 2) << 4) | (reg(a[1]) / 2));
+	} else if ((m == "muls" || m == "mulsu" || m == "fmul" || m == "fmuls" || m == "fmulsu") && n == 2) {
+		int d = reg(a[0]), r = reg(a[1]);
+		if (m == "muls") out.push_back(0x0200 | ((d & 0xf) << 4) | (r & 0xf));
+		else {
+			u16 op = m == "mulsu" ? 0x0300 : m == "fmul" ? 0x0308 : m == "fmuls" ? 0x0380 : 0x0388;
+			out.push_back(op | ((d & 7) << 4) | (r & 7));
+		}
+	} else if ((m == "adiw" || m == "sbiw") && n == 2) {
+		int d = reg(a[0]);
+		s32 k = eval(a[1], pc);
+		if (d < 24 || (d & 1)) error("register must be r24, r26, r28 or r30:", a[0]);
+		checkRange(k, 0, 63, a[1]);
+		out.push_back((m == "adiw" ? 0x9600 : 0x9700) | ((k & 0x30) << 2) | (((d - 24) / 2) << 4) | (k & 0xf));
+	} else if ((m == "rjmp" || m == "rcall") && n == 1) {
+		s32 k = (eval(a[0], pc + 2) - pc - 2) / 2;
+		checkRange(k, -2048, 2047, a[0]);
+		out.push_back((m == "rjmp" ? 0xc000 : 0xd000) | (k & 0xfff));
+	} else if ((m == "jmp" || m == "call") && n == 1) {
+		s32 k = eval(a[0], pc) / 2;
+		out.push_back((m == "jmp" ? 0x940c : 0x940e) | ((k >> 16) & 1) | (((k >> 17) & 0x1f) << 4));
+		out.push_back(k);
+	} else if (m == "lds" && n == 2) {
+		out.push_back(0x9000 | (reg(a[0]) << 4));
+		out.push_back(eval(a[1], pc));
+	} else if (m == "sts" && n == 2) {
+		out.push_back(0x9200 | (reg(a[1]) << 4));
+		out.push_back(eval(a[0], pc));
+	} else if (m == "in" && n == 2) {
+		s32 io = eval(a[1], pc);
+		checkRange(io, 0, 63, a[1]);
+		out.push_back(0xb000 | ((io & 0x30) << 5) | (reg(a[0]) << 4) | (io & 0xf));
+	} else if (m == "out" && n == 2) {
+		s32 io = eval(a[0], pc);
+		checkRange(io, 0, 63, a[0]);
+		out.push_back(0xb800 | ((io & 0x30) << 5) | (reg(a[1]) << 4) | (io & 0xf));
+	} else if ((m == "lpm" || m == "elpm") && (n == 0 || n == 2)) {
+		bool e = m == "elpm";
+		if (n == 0) out.push_back(e ? 0x95d8 : 0x95c8);
+		else if (a[1] == "Z") out.push_back((e ? 0x9006 : 0x9004) | (reg(a[0]) << 4));
+		else if (a[1] == "Z+") out.push_back((e ? 0x9007 : 0x9005) | (reg(a[0]) << 4));
+		else error("bad lpm operand", a[1]);
+	} else if ((m == "ld" || m == "st" || m == "ldd" || m == "std") && n == 2) {
+		bool store = m[0] == 's';
+		int r = reg(store ? a[1] : a[0]);
+		std::string ptr = store ? a[0] : a[1];
+		static const struct { const char *ptr; u16 op; } modes[] = {
+			{"X", 0x900c}, {"X+", 0x900d}, {"-X", 0x900e}, {"Y", 0x8008}, {"Y+", 0x9009},
+			{"-Y", 0x900a}, {"Z", 0x8000}, {"Z+", 0x9001}, {"-Z", 0x9002},
+		};
+		for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+			if (ptr == modes[i].ptr) {
+				out.push_back(modes[i].op | (store ? 0x0200 : 0) | (r << 4));
+				return;
+			}
+		}
+		if (ptr.size() > 2 && (ptr[0] == 'Y' || ptr[0] == 'Z') && ptr[1] == '+') {
+			s32 q = eval(ptr.substr(2), pc);
+			checkRange(q, 0, 63, ptr);
+			out.push_back(0x8000 | (store ? 0x0200 : 0) | (ptr[0] == 'Y' ? 8 : 0) |
+				((q & 0x20) << 8) | ((q & 0x18) << 7) | (r << 4) | (q & 7));
+			return;
+		}
+		error("bad pointer operand", ptr);
+	} else {
+		error("unknown instruction", m);
+	}
+}
+
+struct Output
+{
+	std::vector<u8> flash;		//from CODE_START
+	s32 dataEnd;
+};
+
+//
+// One pass over the lines. The first pass places the labels, the second
+// has them all and encodes. With routines, only the code from those
+// labels up to the next .section is kept.
+//
+static void assemble(const std::vector<Line> &lines, const std::set<std::string> &routines, Output &o)
+{
+	enum { NONE, TEXT, DATA } section = TEXT;
+	bool keep = routines.empty();
+	s32 pc = CODE_START, dp = DATA_START;
+	o.flash.clear();
+
+	for (size_t i = 0; i < lines.size(); i++) {
+		lineNo = lines[i].no;
+		std::string t = lines[i].text;
+
+		// labels, maybe followed by a statement
+		for (;;) {
+			size_t n = 0;
+			while (n < t.size() && (isIdent(t[n], n == 0) || t[n] == '.')) n++;
+			if (n == 0 || n >= t.size() || t[n] != ':') break;
+			std::string name = t.substr(0, n);
+			if (section == TEXT && routines.count(name)) keep = true;
+			if (section == DATA || (section == TEXT && keep)) {
+				Symbol s = { section == DATA ? dp : pc, section == TEXT };
+				if (!finalPass) {
+					if (symbols.count(name)) error("label defined twice:", name);
+					else symbolOrder.push_back(name);
+				}
+				symbols[name] = s;
+			}
+			t = trim(t.substr(n + 1));
+		}
+		if (t.empty()) continue;
+
+		size_t sp = 0;
+		while (sp < t.size() && !isspace((unsigned char)t[sp])) sp++;
+		std::string word = t.substr(0, sp);
+		for (size_t j = 0; j < word.size(); j++) word[j] = tolower((unsigned char)word[j]);
+		std::vector<std::string> args = splitArgs(trim(t.substr(sp)));
+
+		if (word == ".section" || word == ".text" || word == ".bss" || word == ".data") {
+			std::string name = word == ".section" && !args.empty() ? args[0] : word;
+			if (name.compare(0, 5, ".text") == 0) section = TEXT;
+			else if (name.compare(0, 4, ".bss") == 0 || name.compare(0, 7, ".noinit") == 0) section = DATA;
+			else section = NONE;
+			if (!routines.empty()) keep = false;
+			continue;
+		}
+		if (word == ".global" || word == ".globl" || word == ".type" || word == ".size" ||
+			word == ".func" || word == ".endfunc" || word == ".extern") continue;
+		if (word == ".equ" || word == ".set") {
+			if (args.size() == 2) {
+				Symbol s = { eval(args[1], pc), false };
+				symbols[args[0]] = s;
+			}
+			continue;
+		}
+		if (section == NONE) continue;
+		if (section == TEXT && !keep) continue;
+		s32 &at = section == DATA ? dp : pc;
+
+		if (word == ".align" || word == ".balign" || word == ".p2align") {
+			s32 v = args.empty() ? 0 : eval(args[0], at);
+			s32 align = word == ".balign" ? v : 1 << v;
+			while (align > 1 && at % align != 0) {
+				if (section == TEXT) o.flash.push_back(0);
+				at++;
+			}
+			continue;
+		}
+		if (word == ".space" || word == ".skip" || word == ".zero") {
+			s32 count = args.empty() ? 0 : eval(args[0], at);
+			s32 fill = args.size() > 1 ? eval(args[1], at) : 0;
+			if (section == TEXT) o.flash.insert(o.flash.end(), count, fill);
+			at += count;
+			continue;
+		}
+		if (word == ".byte" || word == ".word" || word == ".short") {
+			int size = word == ".byte" ? 1 : 2;
+			for (size_t j = 0; j < args.size(); j++) {
+				s32 v = eval(args[j], at);
+				if (section == TEXT) {
+					o.flash.push_back(v);
+					if (size == 2) o.flash.push_back(v >> 8);
+				}
+				at += size;
+			}
+			continue;
+		}
+		if (word[0] == '.') {
+			error("unknown directive", word);
+			continue;
+		}
+		if (section == DATA) {
+			error("instruction in a data section:", t);
+			continue;
+		}
+
+		std::vector<u16> op;
+		encode(word, args, pc, op);
+		for (size_t j = 0; j < op.size(); j++) {
+			o.flash.push_back(op[j]);
+			o.flash.push_back(op[j] >> 8);
+		}
+		pc += op.size() * 2;
+	}
+	o.dataEnd = dp;
+}
+
+// .rept n ... .endr copies
+static bool repeat(std::vector<Line> &lines)
+{
+	std::vector<Line> out;
+	for (size_t i = 0; i < lines.size(); i++) {
+		const std::string &t = lines[i].text;
+		if (t.compare(0, 5, ".rept") != 0) {
+			if (t == ".endr") {
+				lineNo = lines[i].no;
+				error(".endr without .rept");
+			}
+			out.push_back(lines[i]);
+			continue;
+		}
+		lineNo = lines[i].no;
+		s32 count = eval(t.substr(5), 0);
+		size_t end = i + 1;
+		while (end < lines.size() && lines[end].text != ".endr") end++;
+		if (end == lines.size()) {
+			error(".rept without .endr");
+			return false;
+		}
+		for (s32 c = 0; c < count; c++) out.insert(out.end(), lines.begin() + i + 1, lines.begin() + end);
+		i = end;
+	}
+	lines.swap(out);
+	return errors == 0;
+}
+
+static void put16(std::vector<u8> &v, u32 x) { v.push_back(x); v.push_back(x >> 8); }
+static void put32(std::vector<u8> &v, u32 x) { put16(v, x); put16(v, x >> 16); }
+
+// an EM_AVR .elf with one program header and a symbol table, as the
+// host AVR core reads it
+static bool writeElf(const char *path, const std::vector<u8> &flash)
+{
+	std::vector<u8> strtab(1, 0), symtab(16, 0);
+	for (size_t i = 0; i < symbolOrder.size(); i++) {
+		const Symbol &s = symbols[symbolOrder[i]];
+		put32(symtab, strtab.size());
+		put32(symtab, s.code ? s.addr : 0x800000 + s.addr);
+		put32(symtab, 0);
+		symtab.push_back(0x10 | (s.code ? 2 : 1));	//global, function or object
+		symtab.push_back(0);
+		put16(symtab, s.code ? 1 : 2);
+		strtab.insert(strtab.end(), symbolOrder[i].begin(), symbolOrder[i].end());
+		strtab.push_back(0);
+	}
+	static const char shstr[] = "\0.text\0.bss\0.symtab\0.strtab";
+	u32 code = 52 + 32, sym = code + flash.size(), str = sym + symtab.size();
+	u32 names = str + strtab.size(), sh = names + sizeof(shstr);
+
+	std::vector<u8> f;
+	const u8 ident[16] = {0x7f, 'E', 'L', 'F', 1, 1, 1};
+	f.insert(f.end(), ident, ident + 16);
+	put16(f, 2); put16(f, 83); put32(f, 1); put32(f, CODE_START); put32(f, 52); put32(f, sh);
+	put32(f, 0); put16(f, 52); put16(f, 32); put16(f, 1); put16(f, 40); put16(f, 6); put16(f, 5);
+	//PT_LOAD of the code
+	put32(f, 1); put32(f, code); put32(f, CODE_START); put32(f, CODE_START);
+	put32(f, flash.size()); put32(f, flash.size()); put32(f, 5); put32(f, 2);
+	f.insert(f.end(), flash.begin(), flash.end());
+	f.insert(f.end(), symtab.begin(), symtab.end());
+	f.insert(f.end(), strtab.begin(), strtab.end());
+	f.insert(f.end(), shstr, shstr + sizeof(shstr));
+
+	//null, .text, .bss, .symtab, .strtab, section names
+	const u32 sections[6][10] = {
+		{0},
+		{1, 1, 6, CODE_START, code, (u32)flash.size(), 0, 0, 2, 0},
+		{7, 8, 3, 0x800000 + DATA_START, sym, 0, 0, 0, 1, 0},
+		{12, 2, 0, 0, sym, (u32)symtab.size(), 4, 1, 4, 16},
+		{20, 3, 0, 0, str, (u32)strtab.size(), 0, 0, 1, 0},
+		{0, 3, 0, 0, names, sizeof(shstr), 0, 0, 1, 0},
+	};
+	for (int i = 0; i < 6; i++) for (int j = 0; j < 10; j++) put32(f, sections[i][j]);
+
+	FILE *out = fopen(path, "wb");
+	if (out == NULL) return false;
+	bool ok = fwrite(&f[0], 1, f.size(), out) == f.size();
+	return fclose(out) == 0 && ok;
+}
+
+static void usage()
+{
+	printf("\n\tUsage: uzeasm [options] -o out.elf file.s\n\n"
+		"\t-D name[=value]   define a macro, as for avr-gcc\n"
+		"\t-i header         take the #defines of a header, as -imacros\n"
+		"\t-r name,...       only the routines from these labels to the next .section\n"
+		"\t-d name=size,...  variables after the .bss of the file\n"
+		"\t-e name,...       code symbols that only return, for the host tools\n\n");
+}
+
+static std::vector<std::string> splitList(const char *s)
+{
+	std::vector<std::string> out;
+	std::string cur;
+	for (; *s; s++) {
+		if (*s == ',') {
+			if (!cur.empty()) out.push_back(cur);
+			cur.clear();
+		} else {
+			cur += *s;
+		}
+	}
+	if (!cur.empty()) out.push_back(cur);
+	return out;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *source = NULL, *outName = NULL;
+	std::vector<const char *> headers;
+	std::set<std::string> routines;
+	std::vector<std::string> vars, stubs;
+
+	for (size_t i = 0; i < sizeof(ioNames) / sizeof(ioNames[0]); i++) {
+		char v[16];
+		sprintf(v, "%d", ioNames[i].value);
+		macros[ioNames[i].name] = v;
+	}
+	for (int i = 1; i < argc; i++) {
+		if (!strncmp(argv[i], "-D", 2)) {
+			std::string d = argv[i][2] ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : "");
+			size_t eq = d.find('=');
+			macros[d.substr(0, eq)] = eq == std::string::npos ? "1" : d.substr(eq + 1);
+		} else if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+			headers.push_back(argv[++i]);
+		} else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+			std::vector<std::string> r = splitList(argv[++i]);
+			routines.insert(r.begin(), r.end());
+		} else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+			std::vector<std::string> d = splitList(argv[++i]);
+			vars.insert(vars.end(), d.begin(), d.end());
+		} else if (!strcmp(argv[i], "-e") && i + 1 < argc) {
+			std::vector<std::string> e = splitList(argv[++i]);
+			stubs.insert(stubs.end(), e.begin(), e.end());
+		} else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+			outName = argv[++i];
+		} else if (argv[i][0] == '-') {
+			usage();
+			return 1;
+		} else {
+			source = argv[i];
+		}
+	}
+	if (source == NULL || outName == NULL) {
+		usage();
+		return source == NULL && outName == NULL ? 0 : 1;
+	}
+
+	std::vector<Line> lines, none;
+	for (size_t i = 0; i < headers.size(); i++) {
+		if (!preprocess(headers[i], none, true)) return 1;
+	}
+	if (!preprocess(source, lines, false) || !repeat(lines)) return 1;
+
+	// the stubs after the routines, the variables after the .bss
+	Line text = { 0, ".section .text.uzeasm" };
+	lines.push_back(text);
+	for (size_t i = 0; i < stubs.size(); i++) {
+		Line l = { 0, stubs[i] + ": ret" };
+		lines.push_back(l);
+		if (!routines.empty()) routines.insert(stubs[i]);
+	}
+	Line bss = { 0, ".section .bss.uzeasm" };
+	lines.push_back(bss);
+	for (size_t i = 0; i < vars.size(); i++) {
+		size_t eq = vars[i].find('=');
+		Line l = { 0, vars[i].substr(0, eq) + ": .space " + (eq == std::string::npos ? "1" : vars[i].substr(eq + 1)) };
+		lines.push_back(l);
+	}
+
+	Output o;
+	finalPass = false;
+	assemble(lines, routines, o);
+	if (errors == 0) {
+		finalPass = true;
+		assemble(lines, routines, o);
+	}
+	for (std::set<std::string>::iterator r = routines.begin(); r != routines.end(); ++r) {
+		if (!symbols.count(*r)) {
+			printf("%s: no routine %s.\n", source, r->c_str());
+			errors++;
+		}
+	}
+	if (errors != 0) return 1;
+	if (CODE_START + o.flash.size() > 0x10000 || o.dataEnd > 0x1100) {
+		printf("%s: the code or the data does not fit in the ATmega644.\n", source);
+		return 1;
+	}
+	if (!writeElf(outName, o.flash)) {
+		printf("Can't write %s.\n", outName);
+		return 1;
+	}
+	return 0;
+}
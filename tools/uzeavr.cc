@@ -0,0 +1,1412 @@
+/*
+ *  Uzebox AVR core for the host tools
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+#include "uzeavr.h"
+
+// data space addresses of the I/O registers
+#define PINA	0x20
+#define DDRA	0x21
+#define PORTA	0x22
+#define PINB	0x23
+#define PINC	0x26
+#define PIND	0x29
+#define TIFR0	0x35
+#define TIFR1	0x36
+#define TIFR2	0x37
+#define EECR	0x3f
+#define EEDR	0x40
+#define EEARL	0x41
+#define EEARH	0x42
+#define TCCR0A	0x44
+#define TCCR0B	0x45
+#define TCNT0	0x46
+#define OCR0A	0x47
+#define OCR0B	0x48
+#define SPCR	0x4c
+#define SPSR	0x4d
+#define SPDR	0x4e
+#define MCUSR	0x54
+#define SPL		0x5d
+#define SPH		0x5e
+#define SREG	0x5f
+#define WDTCSR	0x60
+#define TIMSK0	0x6e
+#define TIMSK1	0x6f
+#define TIMSK2	0x70
+#define TCCR1A	0x80
+#define TCCR1B	0x81
+#define TCNT1L	0x84
+#define TCNT1H	0x85
+#define ICR1L	0x86
+#define ICR1H	0x87
+#define OCR1AL	0x88
+#define OCR1AH	0x89
+#define OCR1BL	0x8a
+#define OCR1BH	0x8b
+#define TCCR2A	0xb0
+#define TCCR2B	0xb1
+#define TCNT2	0xb2
+#define OCR2A	0xb3
+#define OCR2B	0xb4
+#define UCSR0A	0xc0
+#define UCSR0B	0xc1
+#define UCSR0C	0xc2
+#define UDR0	0xc6
+
+// SREG bits
+#define FC 0x01
+#define FZ 0x02
+#define FN 0x04
+#define FV 0x08
+#define FS 0x10
+#define FH 0x20
+#define FT 0x40
+#define FI 0x80
+
+// 3.4ms erase and write, 1.8ms erase or write only
+#define EEPROM_WRITE_CYCLES ((u64)(UZE_CPU_FREQ * 0.0034))
+#define EEPROM_HALF_CYCLES ((u64)(UZE_CPU_FREQ * 0.0018))
+
+#define WDT_OSC 128000
+
+#define NEVER (~(u64)0)
+
+// prescalers by clock select, 0 = stopped, the external clocks are not wired
+static const u16 div01[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+static const u16 div2[8] = { 0, 1, 8, 32, 64, 128, 256, 1024 };
+
+enum {
+	OP_BAD, OP_NOP, OP_MOVW, OP_MULS, OP_MULSU, OP_FMUL, OP_FMULS, OP_FMULSU,
+	OP_CPC, OP_SBC, OP_ADD, OP_CPSE, OP_CP, OP_SUB, OP_ADC, OP_AND, OP_EOR,
+	OP_OR, OP_MOV, OP_CPI, OP_SBCI, OP_SUBI, OP_ORI, OP_ANDI, OP_LDD, OP_STD,
+	OP_LDS, OP_LD_ZP, OP_LD_MZ, OP_LPM_Z, OP_LPM_ZP, OP_LD_YP, OP_LD_MY,
+	OP_LD_X, OP_LD_XP, OP_LD_MX, OP_POP, OP_STS, OP_ST_ZP, OP_ST_MZ, OP_ST_YP,
+	OP_ST_MY, OP_ST_X, OP_ST_XP, OP_ST_MX, OP_PUSH, OP_COM, OP_NEG, OP_SWAP,
+	OP_INC, OP_ASR, OP_LSR, OP_ROR, OP_DEC, OP_BSET, OP_BCLR, OP_RET, OP_RETI,
+	OP_SLEEP, OP_BREAK, OP_WDR, OP_LPM, OP_SPM, OP_IJMP, OP_ICALL, OP_JMP,
+	OP_CALL, OP_ADIW, OP_SBIW, OP_CBI, OP_SBIC, OP_SBI, OP_SBIS, OP_MUL, OP_IN,
+	OP_OUT, OP_RJMP, OP_RCALL, OP_LDI, OP_BRBS, OP_BRBC, OP_BLD, OP_BST,
+	OP_SBRC, OP_SBRS
+};
+
+static u8 opTable[65536];
+
+static u8 decode(u16 op)
+{
+	switch (op >> 12) {
+	case 0x0:
+		if (op == 0) return OP_NOP;
+		switch ((op >> 8) & 0xf) {
+		case 0x0: return OP_BAD;
+		case 0x1: return OP_MOVW;
+		case 0x2: return OP_MULS;
+		case 0x3: {
+			static const u8 ops[4] = {OP_MULSU, OP_FMUL, OP_FMULS, OP_FMULSU};
+			return ops[((op >> 6) & 2) | ((op >> 3) & 1)];
+		}
+		}
+		switch ((op >> 10) & 3) {
+		case 1: return OP_CPC;
+		case 2: return OP_SBC;
+		default: return OP_ADD;
+		}
+	case 0x1: {
+		static const u8 ops[4] = {OP_CPSE, OP_CP, OP_SUB, OP_ADC};
+		return ops[(op >> 10) & 3];
+	}
+	case 0x2: {
+		static const u8 ops[4] = {OP_AND, OP_EOR, OP_OR, OP_MOV};
+		return ops[(op >> 10) & 3];
+	}
+	case 0x3: return OP_CPI;
+	case 0x4: return OP_SBCI;
+	case 0x5: return OP_SUBI;
+	case 0x6: return OP_ORI;
+	case 0x7: return OP_ANDI;
+	case 0x8: case 0xa:
+		return (op & 0x200) ? OP_STD : OP_LDD;
+	case 0x9:
+		switch ((op >> 9) & 7) {
+		case 0: {
+			static const u8 ops[16] = {
+				OP_LDS, OP_LD_ZP, OP_LD_MZ, OP_BAD, OP_LPM_Z, OP_LPM_ZP, OP_BAD, OP_BAD,
+				OP_BAD, OP_LD_YP, OP_LD_MY, OP_BAD, OP_LD_X, OP_LD_XP, OP_LD_MX, OP_POP
+			};
+			return ops[op & 0xf];
+		}
+		case 1: {
+			static const u8 ops[16] = {
+				OP_STS, OP_ST_ZP, OP_ST_MZ, OP_BAD, OP_BAD, OP_BAD, OP_BAD, OP_BAD,
+				OP_BAD, OP_ST_YP, OP_ST_MY, OP_BAD, OP_ST_X, OP_ST_XP, OP_ST_MX, OP_PUSH
+			};
+			return ops[op & 0xf];
+		}
+		case 2:
+			switch (op & 0xf) {
+			case 0x0: return OP_COM;
+			case 0x1: return OP_NEG;
+			case 0x2: return OP_SWAP;
+			case 0x3: return OP_INC;
+			case 0x5: return OP_ASR;
+			case 0x6: return OP_LSR;
+			case 0x7: return OP_ROR;
+			case 0xa: return OP_DEC;
+			case 0xc: case 0xd: return OP_JMP;
+			case 0xe: case 0xf: return OP_CALL;
+			case 0x8:
+				if ((op & 0xff8f) == 0x9408) return OP_BSET;
+				if ((op & 0xff8f) == 0x9488) return OP_BCLR;
+				switch (op) {
+				case 0x9508: return OP_RET;
+				case 0x9518: return OP_RETI;
+				case 0x9588: return OP_SLEEP;
+				case 0x9598: return OP_BREAK;
+				case 0x95a8: return OP_WDR;
+				case 0x95c8: return OP_LPM;
+				case 0x95e8: return OP_SPM;
+				}
+				return OP_BAD;
+			case 0x9:
+				if (op == 0x9409) return OP_IJMP;
+				if (op == 0x9509) return OP_ICALL;
+				return OP_BAD;
+			}
+			return OP_BAD;
+		case 3: return (op & 0x100) ? OP_SBIW : OP_ADIW;
+		case 4: return (op & 0x100) ? OP_SBIC : OP_CBI;
+		case 5: return (op & 0x100) ? OP_SBIS : OP_SBI;
+		default: return OP_MUL;
+		}
+	case 0xb: return (op & 0x800) ? OP_OUT : OP_IN;
+	case 0xc: return OP_RJMP;
+	case 0xd: return OP_RCALL;
+	case 0xe: return OP_LDI;
+	default:
+		switch ((op >> 9) & 7) {
+		case 0: case 1: return OP_BRBS;
+		case 2: case 3: return OP_BRBC;
+		case 4: return (op & 8) ? OP_BAD : OP_BLD;
+		case 5: return (op & 8) ? OP_BAD : OP_BST;
+		case 6: return (op & 8) ? OP_BAD : OP_SBRC;
+		default: return (op & 8) ? OP_BAD : OP_SBRS;
+		}
+	}
+}
+
+// lds, sts, jmp and call take two words
+static bool isTwoWords(u16 op)
+{
+	return (op & 0xfc0f) == 0x9000 || (op & 0xfe0c) == 0x940c;
+}
+
+static inline u8 signFlags(u8 sreg)
+{
+	if (((sreg >> 2) ^ (sreg >> 3)) & 1) sreg |= FS;
+	return sreg;
+}
+
+static inline u8 flagsAdd(u8 sreg, u8 d, u8 r, u8 res)
+{
+	u8 c = (d & r) | (r & ~res) | (~res & d);
+	u8 v = (d & r & ~res) | (~d & ~r & res);
+	sreg &= ~(FC | FZ | FN | FV | FS | FH);
+	if (c & 0x08) sreg |= FH;
+	if (c & 0x80) sreg |= FC;
+	if (v & 0x80) sreg |= FV;
+	if (res & 0x80) sreg |= FN;
+	if (res == 0) sreg |= FZ;
+	return signFlags(sreg);
+}
+
+// keepZ: Z is only cleared, for the operations with carry
+static inline u8 flagsSub(u8 sreg, u8 d, u8 r, u8 res, bool keepZ)
+{
+	u8 c = (~d & r) | (r & res) | (res & ~d);
+	u8 v = (d & ~r & ~res) | (~d & r & res);
+	u8 z = keepZ ? (sreg & FZ) : FZ;
+	sreg &= ~(FC | FZ | FN | FV | FS | FH);
+	if (c & 0x08) sreg |= FH;
+	if (c & 0x80) sreg |= FC;
+	if (v & 0x80) sreg |= FV;
+	if (res & 0x80) sreg |= FN;
+	if (res == 0) sreg |= z;
+	return signFlags(sreg);
+}
+
+static inline u8 flagsLogic(u8 sreg, u8 res)
+{
+	sreg &= ~(FZ | FN | FV | FS);
+	if (res & 0x80) sreg |= FN | FS;
+	if (res == 0) sreg |= FZ;
+	return sreg;
+}
+
+// C from the bit 0 shifted out
+static inline u8 flagsShift(u8 sreg, u8 res, bool carry)
+{
+	sreg &= ~(FC | FZ | FN | FV | FS);
+	if (carry) sreg |= FC;
+	if (res & 0x80) sreg |= FN;
+	if (res == 0) sreg |= FZ;
+	if (((sreg >> 2) ^ sreg) & 1) sreg |= FV;
+	return signFlags(sreg);
+}
+
+static inline u8 flagsMul(u8 sreg, u16 res, bool carry)
+{
+	sreg &= ~(FC | FZ);
+	if (carry) sreg |= FC;
+	if (res == 0) sreg |= FZ;
+	return sreg;
+}
+
+static u16 get16(const u8 *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static u32 get32(const u8 *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24);
+}
+
+static bool bySymbolAddress(const UzeSymbol &a, const UzeSymbol &b)
+{
+	return a.addr < b.addr;
+}
+
+UzeAvr::UzeAvr()
+{
+	static bool decoded = false;
+	if (!decoded) {
+		for (u32 i = 0; i < 65536; i++) opTable[i] = decode(i);
+		decoded = true;
+	}
+
+	memset(flash, 0xff, sizeof(flash));
+	memset(eeprom, 0xff, sizeof(eeprom));
+	memset(watch, 0, sizeof(watch));
+	keepSound = false;
+	profiling = false;
+	pad2Connected = true;
+	joypad[0] = joypad[1] = 0;
+	Reset();
+}
+
+bool UzeAvr::Load(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) return false;
+	std::vector<u8> file;
+	u8 buf[65536];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0) file.insert(file.end(), buf, buf + n);
+	fclose(f);
+
+	if (file.size() >= 52 && !memcmp(&file[0], "\x7f" "ELF", 4)) return LoadElf(&file[0], file.size());
+	if (!file.empty() && file[0] == ':') return LoadHex(path);
+	return false;
+}
+
+bool UzeAvr::LoadElf(const u8 *file, size_t size)
+{
+	// 32 bit little endian, EM_AVR
+	if (file[4] != 1 || file[5] != 1 || get16(file + 18) != 83) return false;
+
+	u32 phoff = get32(file + 28), shoff = get32(file + 32);
+	u16 phentsize = get16(file + 42), phnum = get16(file + 44);
+	u16 shentsize = get16(file + 46), shnum = get16(file + 48);
+
+	// load by physical address: .data comes from flash, .eeprom is at 0x810000
+	for (u32 i = 0; i < phnum; i++) {
+		const u8 *ph = file + phoff + i * phentsize;
+		if (phoff + (i + 1) * phentsize > size) return false;
+		if (get32(ph) != 1) continue;	//PT_LOAD
+		u32 offset = get32(ph + 4), paddr = get32(ph + 12), filesz = get32(ph + 16);
+		if (offset + filesz > size) return false;
+		if (paddr + filesz <= AVR_FLASH_SIZE) {
+			memcpy(flash + paddr, file + offset, filesz);
+		} else if (paddr >= 0x810000 && paddr - 0x810000 + filesz <= AVR_EEPROM_SIZE) {
+			memcpy(eeprom + paddr - 0x810000, file + offset, filesz);
+		}
+	}
+
+	symbols.clear();
+	for (u32 i = 0; i < shnum; i++) {
+		const u8 *sh = file + shoff + i * shentsize;
+		if (shoff + (i + 1) * shentsize > size) break;
+		if (get32(sh + 4) != 2) continue;	//SHT_SYMTAB
+		u32 offset = get32(sh + 16), symsize = get32(sh + 20), link = get32(sh + 24);
+		const u8 *strsh = file + shoff + link * shentsize;
+		u32 stroff = get32(strsh + 16);
+		for (u32 s = 16; s + 16 <= symsize; s += 16) {
+			const u8 *sym = file + offset + s;
+			u32 value = get32(sym + 4);
+			u8 type = sym[12] & 0xf;
+			if (get16(sym + 14) == 0 || type > 2) continue;	//undefined, section or file
+			UzeSymbol us;
+			us.name = (const char *)file + stroff + get32(sym);
+			us.size = get32(sym + 8);
+			if (us.name.empty()) continue;
+			if (value < 0x800000) {
+				us.addr = value;
+				us.code = true;
+			} else if (value < 0x810000) {
+				us.addr = value - 0x800000;
+				us.code = false;
+			} else {
+				continue;
+			}
+			symbols.push_back(us);
+		}
+	}
+	IndexSymbols();
+	return true;
+}
+
+bool UzeAvr::LoadHex(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	if (f == NULL) return false;
+	char line[600];
+	u32 base = 0;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (line[0] != ':') continue;
+		u8 rec[256];
+		int len = 0;
+		for (char *p = line + 1; p[0] && p[1] && len < 256; p += 2) {
+			unsigned v;
+			if (sscanf(p, "%2x", &v) != 1) break;
+			rec[len++] = v;
+		}
+		if (len < 5 || len < rec[0] + 5) continue;
+		u32 addr = base + ((rec[1] << 8) | rec[2]);
+		if (rec[3] == 0) {
+			for (int i = 0; i < rec[0]; i++) {
+				if (addr + i < AVR_FLASH_SIZE) flash[addr + i] = rec[4 + i];
+			}
+		} else if (rec[3] == 1) {
+			break;
+		} else if (rec[3] == 2) {
+			base = ((rec[4] << 8) | rec[5]) << 4;
+		} else if (rec[3] == 4) {
+			base = ((rec[4] << 8) | rec[5]) << 16;
+		}
+	}
+	fclose(f);
+	symbols.clear();
+	IndexSymbols();
+	return true;
+}
+
+bool UzeAvr::LoadEeprom(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) return false;
+	memset(eeprom, 0xff, sizeof(eeprom));
+	fread(eeprom, 1, sizeof(eeprom), f);
+	fclose(f);
+	return true;
+}
+
+bool UzeAvr::SaveEeprom(const char *path) const
+{
+	FILE *f = fopen(path, "wb");
+	if (f == NULL) return false;
+	bool ok = fwrite(eeprom, 1, sizeof(eeprom), f) == sizeof(eeprom);
+	return fclose(f) == 0 && ok;
+}
+
+//
+// Functions get the words up to their size, the assembler labels without
+// a size the words up to the next symbol.
+//
+void UzeAvr::IndexSymbols()
+{
+	std::stable_sort(symbols.begin(), symbols.end(), bySymbolAddress);
+	symbolAt.assign(AVR_FLASH_SIZE / 2, -1);
+
+	int last = -1;
+	for (size_t i = 0; i < symbols.size(); i++) {
+		const UzeSymbol &s = symbols[i];
+		if (!s.code || s.size != 0) continue;
+		if (last >= 0) {
+			for (u32 w = symbols[last].addr / 2; w < s.addr / 2; w++) symbolAt[w] = last;
+		}
+		last = i;
+	}
+	for (size_t i = 0; i < symbols.size(); i++) {
+		const UzeSymbol &s = symbols[i];
+		if (!s.code || s.size == 0) continue;
+		for (u32 w = s.addr / 2; w < (s.addr + s.size) / 2 && w < symbolAt.size(); w++) symbolAt[w] = i;
+	}
+}
+
+const UzeSymbol *UzeAvr::FindSymbol(const char *name) const
+{
+	for (size_t i = 0; i < symbols.size(); i++) {
+		if (symbols[i].name == name) return &symbols[i];
+	}
+	return NULL;
+}
+
+const UzeSymbol *UzeAvr::SymbolAt(u16 at) const
+{
+	if (at >= symbolAt.size() || symbolAt[at] < 0) return NULL;
+	return &symbols[symbolAt[at]];
+}
+
+void UzeAvr::EnableProfile()
+{
+	profile.assign(AVR_FLASH_SIZE / 2, 0);
+	profiling = true;
+}
+
+void UzeAvr::Reset()
+{
+	memset(data, 0, sizeof(data));
+	cycles = 0;
+	resets = 0;
+	badOpcodes = 0;
+	uartTx.clear();
+	sound.clear();
+	Restart(true);
+}
+
+// the RAM is kept by a watchdog reset
+void UzeAvr::Restart(bool powerOn)
+{
+	memset(data, 0, 0x100);
+	memset(&timer0, 0, sizeof(timer0));
+	memset(&timer1, 0, sizeof(timer1));
+	memset(&timer2, 0, sizeof(timer2));
+	timer0.max = timer2.max = 0xff;
+	timer1.max = 0xffff;
+	timer0.div = timer1.div = div01;
+	timer2.div = div2;
+	timerCycles = cycles;
+	nextEvent = 0;
+	pending = false;
+	temp16 = 0;
+	data[SPL] = AVR_RAM_END & 0xff;
+	data[SPH] = AVR_RAM_END >> 8;
+	data[UCSR0A] = 0x20;
+	data[UCSR0C] = 0x06;
+	data[MCUSR] = powerOn ? 0x01 : 0x08;
+	if (!powerOn) data[WDTCSR] = 0x08;	//WDRF keeps the watchdog on
+	pc = 0;
+	intDepth = 0;
+	intHold = false;
+	stall = 0;
+	eempeEnd = 0;
+	eepromDone = 0;
+	spiEnd = 0;
+	spiBusy = false;
+	spiIn = 0;
+	wdtLast = cycles;
+	wdtOpen = 0;
+	padShift = 0;
+	padLatch = false;
+}
+
+//
+// SNES pads: the latch loads the buttons, each rising clock shifts out
+// the next one. The data line is low for a pressed button and stays low
+// after the 16 bits, which is how the kernel sees a pad is plugged in.
+//
+u8 UzeAvr::PinA()
+{
+	u8 port = data[PORTA], ddr = data[DDRA];
+	u8 in = port;	//pull-ups
+	for (int p = 0; p < 2; p++) {
+		if (p == 1 && !pad2Connected) continue;
+		if (padShift >= 16 || ((joypad[p] >> padShift) & 1)) in &= ~(1 << p);
+		else in |= 1 << p;
+	}
+	return (port & ddr) | (in & ~ddr);
+}
+
+// the timer registers, counted up to now before they are read or written
+static inline bool isTimerIo(u16 a)
+{
+	return (a >= TIFR0 && a <= TIFR2) || (a >= TCCR0A && a <= OCR0B) ||
+		(a >= TIMSK0 && a <= TIMSK2) || (a >= TCCR1A && a <= OCR2B);
+}
+
+u8 UzeAvr::ReadIo(u16 addr)
+{
+	if (isTimerIo(addr)) SyncTimers();
+
+	switch (addr) {
+	case PINA: return PinA();
+	case PINB: case PINC: case PIND: return data[addr + 2];	//pull-ups, nothing drives them
+	case TIFR0: return timer0.tifr;
+	case TIFR1: return timer1.tifr;
+	case TIFR2: return timer2.tifr;
+	case TIMSK0: return timer0.timsk;
+	case TIMSK1: return timer1.timsk;
+	case TIMSK2: return timer2.timsk;
+	case TCCR0A: return timer0.tccra;
+	case TCCR0B: return timer0.tccrb;
+	case TCNT0: return timer0.tcnt;
+	case OCR0A: return timer0.ocra;
+	case OCR0B: return timer0.ocrb;
+	case TCCR1A: return timer1.tccra;
+	case TCCR1B: return timer1.tccrb;
+	case TCNT1L: temp16 = timer1.tcnt >> 8; return timer1.tcnt;
+	case ICR1L: temp16 = timer1.icr >> 8; return timer1.icr;
+	case TCNT1H: case ICR1H: return temp16;
+	case OCR1AL: return timer1.ocra;
+	case OCR1AH: return timer1.ocra >> 8;
+	case OCR1BL: return timer1.ocrb;
+	case OCR1BH: return timer1.ocrb >> 8;
+	case TCCR2A: return timer2.tccra;
+	case TCCR2B: return timer2.tccrb;
+	case TCNT2: return timer2.tcnt;
+	case OCR2A: return timer2.ocra;
+	case OCR2B: return timer2.ocrb;
+	case EECR: {
+		u8 v = data[EECR] & 0x38;
+		if (cycles < eempeEnd) v |= 0x04;
+		if (cycles < eepromDone) v |= 0x02;
+		return v;
+	}
+	case SPSR:
+		SyncSpi();
+		return data[SPSR];
+	case SPDR:
+		SyncSpi();
+		data[SPSR] &= ~0xc0;
+		return data[SPDR];
+	case UCSR0A: return (data[UCSR0A] & 0x03) | 0x60;	//the transmitter is always ready
+	case UDR0: return 0;
+	}
+	return data[addr];
+}
+
+void UzeAvr::WriteIo(u16 addr, u8 v)
+{
+	bool timer = isTimerIo(addr);
+	if (timer) SyncTimers();
+
+	switch (addr) {
+	case PINA: case PINB: case PINC: case PIND:
+		//writing a one toggles the port bit
+		WriteIo(addr + 2, data[addr + 2] ^ v);
+		break;
+	case PORTA: {
+		u8 old = data[PORTA];
+		data[PORTA] = v;
+		if (v & 0x04) padShift = 0;		//latch
+		else if ((v & ~old & 0x08) && padShift < 16) padShift++;	//clock rising edge
+		break;
+	}
+	case TIFR0: timer0.tifr &= ~v; break;
+	case TIFR1: timer1.tifr &= ~v; break;
+	case TIFR2: timer2.tifr &= ~v; break;
+	case TIMSK0: timer0.timsk = v & 7; break;
+	case TIMSK1: timer1.timsk = v & 0x27; break;
+	case TIMSK2: timer2.timsk = v & 7; break;
+	case TCCR0A: timer0.tccra = v; break;
+	case TCCR0B: timer0.tccrb = v & 0x0f; break;
+	case TCNT0: timer0.tcnt = v; break;
+	case OCR0A: timer0.ocra = v; break;
+	case OCR0B: timer0.ocrb = v; break;
+	case TCCR1A: timer1.tccra = v; break;
+	case TCCR1B: timer1.tccrb = v & 0xdf; break;
+	case TCNT1H: case ICR1H: case OCR1AH: case OCR1BH: temp16 = v; break;
+	case TCNT1L: timer1.tcnt = (temp16 << 8) | v; break;
+	case ICR1L: timer1.icr = (temp16 << 8) | v; break;
+	case OCR1AL: timer1.ocra = (temp16 << 8) | v; break;
+	case OCR1BL: timer1.ocrb = (temp16 << 8) | v; break;
+	case TCCR2A: timer2.tccra = v; break;
+	case TCCR2B: timer2.tccrb = v & 0x0f; break;
+	case TCNT2: timer2.tcnt = v; break;
+	case OCR2A:
+		timer2.ocra = v;
+		if (keepSound) sound.push_back(v);
+		break;
+	case OCR2B: timer2.ocrb = v; break;
+	case EECR: {
+		data[EECR] = v & 0x38;
+		if (cycles < eepromDone) {
+			//write in progress
+		} else if ((v & 0x06) == 0x04) {
+			eempeEnd = cycles + 4;
+		} else if ((v & 0x02) && cycles < eempeEnd) {
+			u16 a = (data[EEARL] | (data[EEARH] << 8)) & (AVR_EEPROM_SIZE - 1);
+			switch ((v >> 4) & 3) {
+			case 0: eeprom[a] = data[EEDR]; eepromDone = cycles + EEPROM_WRITE_CYCLES; break;
+			case 1: eeprom[a] = 0xff; eepromDone = cycles + EEPROM_HALF_CYCLES; break;
+			case 2: eeprom[a] &= data[EEDR]; eepromDone = cycles + EEPROM_HALF_CYCLES; break;
+			}
+			eempeEnd = 0;
+			stall += 2;
+		} else if (v & 0x01) {
+			u16 a = (data[EEARL] | (data[EEARH] << 8)) & (AVR_EEPROM_SIZE - 1);
+			data[EEDR] = eeprom[a];
+			stall += 4;
+		}
+		break;
+	}
+	case SPDR:
+		SyncSpi();
+		if (spiBusy) {
+			data[SPSR] |= 0x40;		//WCOL, the byte is lost
+		} else {
+			//8 SCK periods of 2 to 128 cycles, SPDR keeps the last byte
+			//received until the end
+			static const int sck[4] = {4, 16, 64, 128};
+			int period = sck[data[SPCR] & 3] >> (data[SPSR] & 1);
+			spiIn = OnSpiTransfer(v);
+			spiEnd = cycles + 1 + 8 * period;
+			spiBusy = true;
+		}
+		break;
+	case SPSR: data[SPSR] = (data[SPSR] & 0xc0) | (v & 0x01); break;
+	case UDR0: uartTx.push_back(v); break;
+	case UCSR0A: data[UCSR0A] = v & 0x03; break;
+	case WDTCSR:
+		if (cycles < wdtOpen) {
+			data[WDTCSR] = (data[WDTCSR] & 0x80 & ~v) | (v & 0x6f);
+			if (data[MCUSR] & 0x08) data[WDTCSR] |= 0x08;
+			wdtOpen = 0;
+		} else {
+			if ((v & 0x18) == 0x18) wdtOpen = cycles + 4;
+			data[WDTCSR] = (data[WDTCSR] & ~(0x80 & v) & ~0x40) | (v & 0x48);
+		}
+		break;
+	default:
+		data[addr] = v;
+		break;
+	}
+
+	if (timer || addr == EECR || addr == WDTCSR || addr == SPCR || addr == SPSR ||
+		addr == SPDR || addr == UCSR0B)
+		Update();
+}
+
+inline u8 UzeAvr::ReadData(u16 addr)
+{
+	if (addr >= AVR_RAM_START) {
+		if (addr > AVR_RAM_END) return 0;
+		if (watch[addr]) OnWatchRead(addr, data[addr]);
+		return data[addr];
+	}
+	if (addr < 0x20) return data[addr];
+	return ReadIo(addr);
+}
+
+inline void UzeAvr::WriteData(u16 addr, u8 v)
+{
+	if (addr >= AVR_RAM_START) {
+		if (addr > AVR_RAM_END) return;
+		if (watch[addr]) OnWatchWrite(addr, data[addr], v);
+		data[addr] = v;
+	} else if (addr < 0x20) {
+		data[addr] = v;
+	} else {
+		WriteIo(addr, v);
+	}
+}
+
+inline void UzeAvr::Push(u8 v)
+{
+	u16 sp = data[SPL] | (data[SPH] << 8);
+	WriteData(sp, v);
+	sp--;
+	data[SPL] = sp;
+	data[SPH] = sp >> 8;
+}
+
+inline u8 UzeAvr::Pop()
+{
+	u16 sp = data[SPL] | (data[SPH] << 8);
+	sp++;
+	data[SPL] = sp;
+	data[SPH] = sp >> 8;
+	return ReadData(sp);
+}
+
+// the high byte ends at the lower address
+inline void UzeAvr::PushPc(u16 value)
+{
+	Push(value);
+	Push(value >> 8);
+}
+
+inline u16 UzeAvr::PopPc()
+{
+	u16 hi = Pop();
+	return ((hi << 8) | Pop()) & (AVR_FLASH_SIZE / 2 - 1);
+}
+
+u64 UzeAvr::Prescale(UzeTimer &t, u64 n)
+{
+	u32 div = t.div[t.tccrb & 7];
+	if (div <= 1) return div * n;
+	t.prescaler += n;
+	u64 clocks = t.prescaler / div;
+	t.prescaler %= div;
+	return clocks;
+}
+
+static int timerWgm(const UzeTimer &t)
+{
+	if (t.max == 0xff) return (t.tccra & 3) | ((t.tccrb & 8) >> 1);
+	return (t.tccra & 3) | ((t.tccrb & 0x18) >> 1);
+}
+
+// TOP of the counting mode, TOV is set there or else at MAX
+static u16 timerTop(const UzeTimer &t, int wgm, bool &tovAtTop)
+{
+	tovAtTop = true;
+	if (t.max == 0xff) {
+		if (wgm == 2) tovAtTop = false;
+		return (wgm == 2 || wgm == 5 || wgm == 7) ? t.ocra : 0xff;
+	}
+	switch (wgm) {
+	case 4: tovAtTop = false; return t.ocra;
+	case 12: tovAtTop = false; return t.icr;
+	case 1: case 5: return 0xff;
+	case 2: case 6: return 0x1ff;
+	case 3: case 7: return 0x3ff;
+	case 8: case 10: case 14: return t.icr;
+	case 9: case 11: case 15: return t.ocra;
+	}
+	return 0xffff;
+}
+
+static void compareFlags(UzeTimer &t, u32 first, u32 last)
+{
+	if (t.ocra >= first && t.ocra <= last) t.tifr |= 0x02;
+	if (t.ocrb >= first && t.ocrb <= last) t.tifr |= 0x04;
+}
+
+//
+// The compare flags are set on the clock after the counter held OCRnx,
+// the clock that clears it in CTC mode.
+//
+void UzeAvr::RunTimer(UzeTimer &t, u64 clocks)
+{
+	int wgm = timerWgm(t);
+	bool tovAtTop;
+	u16 top = timerTop(t, wgm, tovAtTop);
+
+	while (clocks > 0) {
+		//past TOP after a write of OCRnA, it runs to MAX
+		bool wrap = t.tcnt > top;
+		u32 left = (wrap ? t.max : top) - t.tcnt + 1;
+		if (clocks < left) {
+			compareFlags(t, t.tcnt, t.tcnt + clocks - 1);
+			t.tcnt += clocks;
+			return;
+		}
+		compareFlags(t, t.tcnt, t.tcnt + left - 1);
+		if (!wrap && wgm == 12 && t.max == 0xffff) t.tifr |= 0x20;	//ICF1 at TOP
+		if (wrap || tovAtTop) t.tifr |= 0x01;
+		t.tcnt = 0;
+		clocks -= left;
+
+		//whole periods
+		if (!wrap && clocks > (u32)top + 1) {
+			compareFlags(t, 0, top);
+			if (wgm == 12 && t.max == 0xffff) t.tifr |= 0x20;
+			if (tovAtTop) t.tifr |= 0x01;
+			clocks %= (u32)top + 1;
+		}
+	}
+}
+
+// cycle where the timer sets a flag it can interrupt on
+u64 UzeAvr::TimerEvent(const UzeTimer &t) const
+{
+	u32 div = t.div[t.tccrb & 7];
+	if (div == 0 || t.timsk == 0) return NEVER;
+
+	bool tovAtTop;
+	u16 top = timerTop(t, timerWgm(t), tovAtTop);
+	u32 d = (t.tcnt > top ? t.max : top) - t.tcnt + 1;
+	if ((t.timsk & 0x02) && t.ocra >= t.tcnt && (u32)(t.ocra - t.tcnt + 1) < d) d = t.ocra - t.tcnt + 1;
+	if ((t.timsk & 0x04) && t.ocrb >= t.tcnt && (u32)(t.ocrb - t.tcnt + 1) < d) d = t.ocrb - t.tcnt + 1;
+	return cycles + (div == 1 ? d : (div - t.prescaler) + (u64)(d - 1) * div);
+}
+
+void UzeAvr::SyncTimers()
+{
+	u64 n = cycles - timerCycles, c;
+	if (n == 0) return;
+	timerCycles = cycles;
+	if ((c = Prescale(timer0, n)) != 0) RunTimer(timer0, c);
+	if ((c = Prescale(timer1, n)) != 0) RunTimer(timer1, c);
+	if ((c = Prescale(timer2, n)) != 0) RunTimer(timer2, c);
+}
+
+//
+// Brings the timers up to date and finds the next cycle where something
+// can happen without the program touching the I/O registers: a timer
+// flag, the end of an EEPROM write or SPI transfer or the watchdog reset.
+//
+void UzeAvr::Update()
+{
+	SyncTimers();
+
+	nextEvent = NEVER;
+	u8 wdt = data[WDTCSR];
+	if (wdt & 0x08) {
+		int wdp = (wdt & 7) | ((wdt & 0x20) >> 2);
+		u64 end = wdtLast + ((u64)2048 << (wdp > 9 ? 9 : wdp)) * UZE_CPU_FREQ / WDT_OSC;
+		if (cycles >= end) {
+			resets++;
+			Restart(false);
+			return;
+		}
+		nextEvent = end;
+	}
+	if ((data[EECR] & 0x08) && cycles < eepromDone) nextEvent = std::min(nextEvent, eepromDone);
+	SyncSpi();
+	if (spiBusy) nextEvent = std::min(nextEvent, spiEnd);
+	nextEvent = std::min(nextEvent, TimerEvent(timer0));
+	nextEvent = std::min(nextEvent, TimerEvent(timer1));
+	nextEvent = std::min(nextEvent, TimerEvent(timer2));
+
+	pending = (timer0.tifr & timer0.timsk) || (timer1.tifr & timer1.timsk) ||
+		(timer2.tifr & timer2.timsk) || ((data[SPCR] & 0x80) && (data[SPSR] & 0x80)) ||
+		(data[UCSR0B] & 0x20) || ((data[EECR] & 0x08) && cycles >= eepromDone);
+}
+
+// ends the SPI transfer when its time has come
+inline void UzeAvr::SyncSpi()
+{
+	if (spiBusy && cycles >= spiEnd) {
+		data[SPDR] = spiIn;
+		data[SPSR] |= 0x80;
+		spiBusy = false;
+	}
+}
+
+inline void UzeAvr::Tick(int n)
+{
+	cycles += n;
+	if (cycles >= nextEvent) Update();
+}
+
+//
+// The lowest vector wins. The timer flags are cleared when their vector
+// is taken, the UART and EEPROM ready interrupts last as long as their
+// condition.
+//
+bool UzeAvr::Interrupt()
+{
+	int vector;
+	u8 f;
+
+	if ((f = timer2.tifr & timer2.timsk) != 0) {
+		u8 bit = (f & 0x02) ? 0x02 : (f & 0x04) ? 0x04 : 0x01;
+		vector = bit == 0x02 ? 9 : bit == 0x04 ? 10 : 11;
+		timer2.tifr &= ~bit;
+	} else if ((f = timer1.tifr & timer1.timsk) != 0) {
+		u8 bit = (f & 0x20) ? 0x20 : (f & 0x02) ? 0x02 : (f & 0x04) ? 0x04 : 0x01;
+		vector = bit == 0x20 ? 12 : bit == 0x02 ? 13 : bit == 0x04 ? 14 : 15;
+		timer1.tifr &= ~bit;
+	} else if ((f = timer0.tifr & timer0.timsk) != 0) {
+		u8 bit = (f & 0x02) ? 0x02 : (f & 0x04) ? 0x04 : 0x01;
+		vector = bit == 0x02 ? 16 : bit == 0x04 ? 17 : 18;
+		timer0.tifr &= ~bit;
+	} else if ((data[SPCR] & 0x80) && (data[SPSR] & 0x80)) {
+		vector = 19;
+		data[SPSR] &= ~0x80;
+	} else if (data[UCSR0B] & 0x20) {
+		vector = 21;
+	} else if ((data[EECR] & 0x08) && cycles >= eepromDone) {
+		vector = 25;
+	} else {
+		pending = false;
+		return false;
+	}
+
+	PushPc(pc);
+	data[SREG] &= ~FI;
+	pc = vector * 2;
+	intDepth++;
+	Update();
+	return true;
+}
+
+void UzeAvr::RunUntil(u64 end)
+{
+	while (cycles < end) Step();
+}
+
+#define RD ((op >> 4) & 0x1f)
+#define RR ((op & 0xf) | ((op >> 5) & 0x10))
+#define RD16 (16 + ((op >> 4) & 0xf))
+#define K8 ((op & 0xf) | ((op >> 4) & 0xf0))
+#define IOA (0x20 + ((op >> 3) & 0x1f))
+#define BIT (op & 7)
+#define PTR(r) (data[r] | (data[r + 1] << 8))
+#define SETPTR(r, v) do { u16 v_ = (v); data[r] = v_; data[r + 1] = v_ >> 8; } while (0)
+#define NEXTOP (flash[(pc * 2) & (AVR_FLASH_SIZE - 1)] | (flash[(pc * 2 + 1) & (AVR_FLASH_SIZE - 1)] << 8))
+
+int UzeAvr::Step()
+{
+	u16 at = pc;
+	int n = 1;
+	bool hold = intHold;
+
+	intHold = false;
+	if (!hold && pending && (data[SREG] & FI) && Interrupt()) {
+		n = 4;
+		Tick(n);
+		if (profiling) profile[at] += n;
+		return n;
+	}
+
+	u16 op = NEXTOP;
+	u8 &sreg = data[SREG];
+	pc = (pc + 1) & (AVR_FLASH_SIZE / 2 - 1);
+
+	switch (opTable[op]) {
+	case OP_NOP:
+		break;
+	case OP_MOVW:
+		data[((op >> 4) & 0xf) * 2] = data[(op & 0xf) * 2];
+		data[((op >> 4) & 0xf) * 2 + 1] = data[(op & 0xf) * 2 + 1];
+		break;
+	case OP_MULS: {
+		s16 res = (s8)data[RD16] * (s8)data[16 + (op & 0xf)];
+		data[0] = res;
+		data[1] = res >> 8;
+		sreg = flagsMul(sreg, res, res & 0x8000);
+		n = 2;
+		break;
+	}
+	case OP_MULSU: case OP_FMUL: case OP_FMULS: case OP_FMULSU: {
+		u8 d = 16 + ((op >> 4) & 7), r = 16 + (op & 7);
+		s32 a = data[d], b = data[r];
+		if (opTable[op] != OP_FMUL) a = (s8)a;
+		if (opTable[op] == OP_FMULS) b = (s8)b;
+		u16 res = a * b;
+		bool carry = res & 0x8000;
+		if (opTable[op] != OP_MULSU) res <<= 1;
+		data[0] = res;
+		data[1] = res >> 8;
+		sreg = flagsMul(sreg, res, carry);
+		n = 2;
+		break;
+	}
+	case OP_CPC: {
+		u8 d = data[RD], r = data[RR];
+		sreg = flagsSub(sreg, d, r, d - r - (sreg & FC), true);
+		break;
+	}
+	case OP_SBC: {
+		u8 d = data[RD], r = data[RR], res = d - r - (sreg & FC);
+		sreg = flagsSub(sreg, d, r, res, true);
+		data[RD] = res;
+		break;
+	}
+	case OP_ADD: case OP_ADC: {
+		u8 d = data[RD], r = data[RR], res = d + r;
+		if (opTable[op] == OP_ADC) res += sreg & FC;
+		sreg = flagsAdd(sreg, d, r, res);
+		data[RD] = res;
+		break;
+	}
+	case OP_CPSE:
+		if (data[RD] == data[RR]) {
+			n = isTwoWords(NEXTOP) ? 3 : 2;
+			pc += n - 1;
+		}
+		break;
+	case OP_CP: {
+		u8 d = data[RD], r = data[RR];
+		sreg = flagsSub(sreg, d, r, d - r, false);
+		break;
+	}
+	case OP_SUB: {
+		u8 d = data[RD], r = data[RR], res = d - r;
+		sreg = flagsSub(sreg, d, r, res, false);
+		data[RD] = res;
+		break;
+	}
+	case OP_AND:
+		sreg = flagsLogic(sreg, data[RD] &= data[RR]);
+		break;
+	case OP_EOR:
+		sreg = flagsLogic(sreg, data[RD] ^= data[RR]);
+		break;
+	case OP_OR:
+		sreg = flagsLogic(sreg, data[RD] |= data[RR]);
+		break;
+	case OP_MOV:
+		data[RD] = data[RR];
+		break;
+	case OP_CPI: {
+		u8 d = data[RD16], k = K8;
+		sreg = flagsSub(sreg, d, k, d - k, false);
+		break;
+	}
+	case OP_SBCI: {
+		u8 d = data[RD16], k = K8, res = d - k - (sreg & FC);
+		sreg = flagsSub(sreg, d, k, res, true);
+		data[RD16] = res;
+		break;
+	}
+	case OP_SUBI: {
+		u8 d = data[RD16], k = K8, res = d - k;
+		sreg = flagsSub(sreg, d, k, res, false);
+		data[RD16] = res;
+		break;
+	}
+	case OP_ORI:
+		sreg = flagsLogic(sreg, data[RD16] |= K8);
+		break;
+	case OP_ANDI:
+		sreg = flagsLogic(sreg, data[RD16] &= K8);
+		break;
+	case OP_LDD: case OP_STD: {
+		u16 q = ((op >> 8) & 0x20) | ((op >> 7) & 0x18) | (op & 7);
+		u16 addr = ((op & 8) ? PTR(28) : PTR(30)) + q;
+		if (opTable[op] == OP_LDD) data[RD] = ReadData(addr);
+		else WriteData(addr, data[RD]);
+		n = 2;
+		break;
+	}
+	case OP_LDS:
+		data[RD] = ReadData(NEXTOP);
+		pc++;
+		n = 2;
+		break;
+	case OP_STS:
+		WriteData(NEXTOP, data[RD]);
+		pc++;
+		n = 2;
+		break;
+	case OP_LD_ZP: case OP_LD_YP: case OP_LD_XP: {
+		int r = opTable[op] == OP_LD_ZP ? 30 : opTable[op] == OP_LD_YP ? 28 : 26;
+		u16 addr = PTR(r);
+		SETPTR(r, addr + 1);
+		data[RD] = ReadData(addr);
+		n = 2;
+		break;
+	}
+	case OP_LD_MZ: case OP_LD_MY: case OP_LD_MX: {
+		int r = opTable[op] == OP_LD_MZ ? 30 : opTable[op] == OP_LD_MY ? 28 : 26;
+		u16 addr = PTR(r) - 1;
+		SETPTR(r, addr);
+		data[RD] = ReadData(addr);
+		n = 2;
+		break;
+	}
+	case OP_LD_X:
+		data[RD] = ReadData(PTR(26));
+		n = 2;
+		break;
+	case OP_ST_ZP: case OP_ST_YP: case OP_ST_XP: {
+		int r = opTable[op] == OP_ST_ZP ? 30 : opTable[op] == OP_ST_YP ? 28 : 26;
+		u16 addr = PTR(r);
+		u8 v = data[RD];
+		SETPTR(r, addr + 1);
+		WriteData(addr, v);
+		n = 2;
+		break;
+	}
+	case OP_ST_MZ: case OP_ST_MY: case OP_ST_MX: {
+		int r = opTable[op] == OP_ST_MZ ? 30 : opTable[op] == OP_ST_MY ? 28 : 26;
+		u16 addr = PTR(r) - 1;
+		u8 v = data[RD];
+		SETPTR(r, addr);
+		WriteData(addr, v);
+		n = 2;
+		break;
+	}
+	case OP_ST_X:
+		WriteData(PTR(26), data[RD]);
+		n = 2;
+		break;
+	case OP_LPM_Z: case OP_LPM_ZP: case OP_LPM: {
+		u16 z = PTR(30);
+		data[opTable[op] == OP_LPM ? 0 : RD] = flash[z & (AVR_FLASH_SIZE - 1)];
+		if (opTable[op] == OP_LPM_ZP) SETPTR(30, z + 1);
+		n = 3;
+		break;
+	}
+	case OP_POP:
+		data[RD] = Pop();
+		n = 2;
+		break;
+	case OP_PUSH:
+		Push(data[RD]);
+		n = 2;
+		break;
+	case OP_COM: {
+		u8 res = ~data[RD];
+		data[RD] = res;
+		sreg = flagsLogic(sreg, res) | FC;
+		break;
+	}
+	case OP_NEG: {
+		u8 d = data[RD], res = -d;
+		sreg = flagsSub(sreg, 0, d, res, false);
+		data[RD] = res;
+		break;
+	}
+	case OP_SWAP:
+		data[RD] = (data[RD] << 4) | (data[RD] >> 4);
+		break;
+	case OP_INC: {
+		u8 res = data[RD] + 1;
+		data[RD] = res;
+		sreg = flagsLogic(sreg, res);
+		if (res == 0x80) sreg |= FV;
+		sreg = signFlags(sreg & ~FS);
+		break;
+	}
+	case OP_DEC: {
+		u8 res = data[RD] - 1;
+		data[RD] = res;
+		sreg = flagsLogic(sreg, res);
+		if (res == 0x7f) sreg |= FV;
+		sreg = signFlags(sreg & ~FS);
+		break;
+	}
+	case OP_ASR: {
+		u8 d = data[RD], res = (d >> 1) | (d & 0x80);
+		data[RD] = res;
+		sreg = flagsShift(sreg, res, d & 1);
+		break;
+	}
+	case OP_LSR: {
+		u8 d = data[RD], res = d >> 1;
+		data[RD] = res;
+		sreg = flagsShift(sreg, res, d & 1);
+		break;
+	}
+	case OP_ROR: {
+		u8 d = data[RD], res = (d >> 1) | ((sreg & FC) << 7);
+		data[RD] = res;
+		sreg = flagsShift(sreg, res, d & 1);
+		break;
+	}
+	case OP_BSET:
+		if (((op >> 4) & 7) == 7 && !(sreg & FI)) intHold = true;	//sei
+		sreg |= 1 << ((op >> 4) & 7);
+		break;
+	case OP_BCLR:
+		sreg &= ~(1 << ((op >> 4) & 7));
+		break;
+	case OP_RET:
+		pc = PopPc();
+		n = 4;
+		break;
+	case OP_RETI:
+		pc = PopPc();
+		sreg |= FI;
+		if (intDepth > 0) intDepth--;
+		intHold = true;
+		n = 4;
+		break;
+	case OP_SLEEP: case OP_BREAK:
+		break;
+	case OP_WDR:
+		wdtLast = cycles;
+		Update();
+		break;
+	case OP_SPM:
+		n = 4;
+		break;
+	case OP_IJMP:
+		pc = PTR(30) & (AVR_FLASH_SIZE / 2 - 1);
+		n = 2;
+		break;
+	case OP_ICALL:
+		PushPc(pc);
+		pc = PTR(30) & (AVR_FLASH_SIZE / 2 - 1);
+		n = 3;
+		break;
+	case OP_JMP:
+		pc = NEXTOP & (AVR_FLASH_SIZE / 2 - 1);	//64K: the high bits of k are 0
+		n = 3;
+		break;
+	case OP_CALL:
+		PushPc(pc + 1);
+		pc = NEXTOP & (AVR_FLASH_SIZE / 2 - 1);
+		n = 4;
+		break;
+	case OP_ADIW: case OP_SBIW: {
+		int r = 24 + ((op >> 3) & 6);
+		u16 d = PTR(r), k = (op & 0xf) | ((op >> 2) & 0x30), res;
+		sreg &= ~(FC | FZ | FN | FV | FS);
+		if (opTable[op] == OP_ADIW) {
+			res = d + k;
+			if (~d & res & 0x8000) sreg |= FV;
+			if (~res & d & 0x8000) sreg |= FC;
+		} else {
+			res = d - k;
+			if (d & ~res & 0x8000) sreg |= FV;
+			if (res & ~d & 0x8000) sreg |= FC;
+		}
+		if (res & 0x8000) sreg |= FN;
+		if (res == 0) sreg |= FZ;
+		sreg = signFlags(sreg);
+		SETPTR(r, res);
+		n = 2;
+		break;
+	}
+	case OP_CBI: case OP_SBI: {
+		//the flag and PIN registers only see the written bit
+		u16 a = IOA;
+		u8 bit = 1 << BIT;
+		bool single = (a >= TIFR0 && a <= TIFR2) || a == PINA || a == PINB || a == PINC || a == PIND;
+		if (opTable[op] == OP_SBI) WriteIo(a, single ? bit : ReadIo(a) | bit);
+		else if (!single) WriteIo(a, ReadIo(a) & ~bit);
+		n = 2;
+		break;
+	}
+	case OP_SBIC: case OP_SBIS: {
+		bool set = (ReadIo(IOA) >> BIT) & 1;
+		if (set == (opTable[op] == OP_SBIS)) {
+			n = isTwoWords(NEXTOP) ? 3 : 2;
+			pc += n - 1;
+		}
+		break;
+	}
+	case OP_MUL: {
+		u16 res = data[RD] * data[RR];
+		data[0] = res;
+		data[1] = res >> 8;
+		sreg = flagsMul(sreg, res, res & 0x8000);
+		n = 2;
+		break;
+	}
+	case OP_IN:
+		data[RD] = ReadData(0x20 + ((op & 0xf) | ((op >> 5) & 0x30)));
+		break;
+	case OP_OUT:
+		WriteData(0x20 + ((op & 0xf) | ((op >> 5) & 0x30)), data[RD]);
+		break;
+	case OP_RJMP:
+		pc = (pc + ((s16)(op << 4) >> 4)) & (AVR_FLASH_SIZE / 2 - 1);
+		n = 2;
+		break;
+	case OP_RCALL:
+		PushPc(pc);
+		pc = (pc + ((s16)(op << 4) >> 4)) & (AVR_FLASH_SIZE / 2 - 1);
+		n = 3;
+		break;
+	case OP_LDI:
+		data[RD16] = K8;
+		break;
+	case OP_BRBS: case OP_BRBC: {
+		bool set = (sreg >> BIT) & 1;
+		if (set == (opTable[op] == OP_BRBS)) {
+			pc = (pc + ((s16)(op << 6) >> 9)) & (AVR_FLASH_SIZE / 2 - 1);
+			n = 2;
+		}
+		break;
+	}
+	case OP_BLD:
+		if (sreg & FT) data[RD] |= 1 << BIT;
+		else data[RD] &= ~(1 << BIT);
+		break;
+	case OP_BST:
+		if ((data[RD] >> BIT) & 1) sreg |= FT;
+		else sreg &= ~FT;
+		break;
+	case OP_SBRC: case OP_SBRS: {
+		bool set = (data[RD] >> BIT) & 1;
+		if (set == (opTable[op] == OP_SBRS)) {
+			n = isTwoWords(NEXTOP) ? 3 : 2;
+			pc += n - 1;
+		}
+		break;
+	}
+	default:
+		badOpcodes++;
+		break;
+	}
+
+	n += stall;
+	stall = 0;
+	Tick(n);
+	if (profiling) profile[at] += n;
+	return n;
+}
+
+static const char *buttonNames[12] = {
+	"B", "Y", "SELECT", "START", "UP", "DOWN", "LEFT", "RIGHT", "A", "X", "SL", "SR"
+};
+
+static bool parseButtons(const char *s, u16 &buttons)
+{
+	buttons = 0;
+	if (!strcmp(s, "-")) return true;
+	if (isdigit((unsigned char)s[0])) {
+		char *end;
+		buttons = strtol(s, &end, 0);
+		return *end == 0;
+	}
+	std::string name;
+	for (const char *p = s;; p++) {
+		if (*p != 0 && *p != '+') {
+			name += toupper((unsigned char)*p);
+			continue;
+		}
+		int i;
+		for (i = 0; i < 12 && name != buttonNames[i]; i++);
+		if (i == 12) return false;
+		buttons |= 1 << i;
+		name.clear();
+		if (*p == 0) return true;
+	}
+}
+
+bool UzeReadPadScript(const char *name, std::vector<UzePadEvent> &events)
+{
+	FILE *f = fopen(name, "r");
+	if (f == NULL) {
+		printf("Can't open %s.\n", name);
+		return false;
+	}
+	char line[256];
+	int n = 0;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		n++;
+		char *c = strchr(line, '#');
+		if (c) *c = 0;
+		char frame[64], p1[64], p2[64];
+		int count = sscanf(line, "%63s %63s %63s", frame, p1, p2);
+		if (count <= 0) continue;
+		UzePadEvent e;
+		e.frame = strtoul(frame, NULL, 0);
+		e.buttons[1] = 0;
+		if (count < 2 || !parseButtons(p1, e.buttons[0]) || (count == 3 && !parseButtons(p2, e.buttons[1]))) {
+			printf("%s:%d: bad line.\n", name, n);
+			fclose(f);
+			return false;
+		}
+		events.push_back(e);
+	}
+	fclose(f);
+	return true;
+}
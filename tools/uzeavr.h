@@ -0,0 +1,207 @@
+/*
+ *  Uzebox AVR core for the host tools
+ *
+ *  Cycle counting ATmega644 with what the kernel uses on the Uzebox
+ *  board: the three timers and their interrupts, the EEPROM with its
+ *  write time, the watchdog reset, the UART transmitter, the SPI master
+ *  with its clock and the SNES joypad shift registers on PORTA. The
+ *  video DAC on PORTC is not drawn, the sound samples written to OCR2A
+ *  can be kept.
+ *
+ *  The timers are exact for the normal, CTC and fast PWM modes with any
+ *  prescaler, the phase correct modes count like fast PWM. The interrupt
+ *  entry takes 4 cycles plus the jmp of the vector and one instruction
+ *  always runs after a reti, as on the chip.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __UZEAVR_H_
+#define __UZEAVR_H_
+
+#include <string>
+#include <vector>
+#include "uzehost.h"
+
+typedef uint64_t u64;
+
+// atmega644
+#define AVR_FLASH_SIZE 65536
+#define AVR_RAM_START 0x100
+#define AVR_RAM_END 0x10ff
+#define AVR_EEPROM_SIZE 2048
+
+// NTSC timing, must match kernel/defines.h
+#define UZE_CPU_FREQ 28636360UL
+#define UZE_LINE_CYCLES 1820
+#define UZE_FRAME_CYCLES (262UL * UZE_LINE_CYCLES)
+
+// ReadJoypad() bits, must match kernel/defines.h
+#define BTN_B		1
+#define BTN_Y		2
+#define BTN_SELECT	4
+#define BTN_START	8
+#define BTN_UP		16
+#define BTN_DOWN	32
+#define BTN_LEFT	64
+#define BTN_RIGHT	128
+#define BTN_A		256
+#define BTN_X		512
+#define BTN_SL		1024
+#define BTN_SR		2048
+
+struct UzeSymbol
+{
+	std::string name;
+	u32 addr;		//byte address in flash, or in the data space for variables
+	u32 size;
+	bool code;
+};
+
+// 8 and 16 bit timers share the counting
+struct UzeTimer
+{
+	u16 tcnt;
+	u16 ocra;
+	u16 ocrb;
+	u16 icr;
+	u8 tccra;
+	u8 tccrb;
+	u8 tifr;
+	u8 timsk;
+	u16 max;		//0xff or 0xffff
+	const u16 *div;	//prescaler of each clock select
+	u64 prescaler;	//cycles counted toward the next timer clock
+};
+
+class UzeAvr
+{
+public:
+	UzeAvr();
+	virtual ~UzeAvr() {}
+
+	// .elf (flash, .eeprom section and symbols) or Intel .hex
+	bool Load(const char *path);
+	bool LoadEeprom(const char *path);
+	bool SaveEeprom(const char *path) const;
+
+	// power on reset, the EEPROM is kept
+	void Reset();
+
+	// runs one instruction, or enters an interrupt, and the peripherals
+	// for the cycles it took. Returns the cycles.
+	int Step();
+
+	// runs until cycles reaches the given count
+	void RunUntil(u64 end);
+
+	const UzeSymbol *FindSymbol(const char *name) const;
+	const UzeSymbol *SymbolAt(u16 pc) const;	//function holding the word address pc
+
+	// data space without side effects, for the host
+	u8 Peek(u16 addr) const { return addr <= AVR_RAM_END ? data[addr] : 0; }
+	void Poke(u16 addr, u8 value) { if (addr <= AVR_RAM_END) data[addr] = value; }
+	u16 Peek16(u16 addr) const { return Peek(addr) | (Peek(addr + 1) << 8); }
+
+	// calls OnWatchRead/OnWatchWrite for this RAM address
+	void Watch(u16 addr, bool on = true) { if (addr >= AVR_RAM_START && addr <= AVR_RAM_END) watch[addr] = on; }
+
+	// adds the cycles of each instruction to profile[pc], interrupt
+	// entries are counted on the vector
+	void EnableProfile();
+
+	u64 cycles;
+	u16 pc;				//word address
+	int intDepth;		//interrupt nesting, 0 = main program
+	u16 joypad[2];		//buttons held, ReadJoypad() layout
+	bool pad2Connected;
+
+	u8 flash[AVR_FLASH_SIZE];
+	u8 data[AVR_RAM_END + 1];	//registers, I/O and RAM
+	u8 eeprom[AVR_EEPROM_SIZE];
+	std::vector<UzeSymbol> symbols;
+
+	std::vector<u8> uartTx;		//bytes written to UDR0
+	std::vector<u8> sound;		//bytes written to OCR2A, when keepSound
+	bool keepSound;
+	std::vector<u64> profile;	//cycles per word address
+	u32 badOpcodes;
+	u32 resets;			//watchdog resets
+
+protected:
+	virtual void OnWatchRead(u16 addr, u8 value) {}
+	virtual void OnWatchWrite(u16 addr, u8 oldValue, u8 value) {}
+
+	// the byte shifted in for the byte written to SPDR, no SD card by
+	// default. The card sees PORTD bit 6 for its chip select.
+	virtual u8 OnSpiTransfer(u8 out) { return 0xff; }
+
+private:
+	bool LoadElf(const u8 *file, size_t size);
+	bool LoadHex(const char *path);
+	void IndexSymbols();
+
+	u8 ReadData(u16 addr);
+	void WriteData(u16 addr, u8 value);
+	u8 ReadIo(u16 addr);
+	void WriteIo(u16 addr, u8 value);
+	void Push(u8 value);
+	u8 Pop();
+	void PushPc(u16 value);
+	u16 PopPc();
+	void Restart(bool powerOn);
+	void Tick(int n);
+	void Update();
+	void SyncSpi();
+	void SyncTimers();
+	u64 Prescale(UzeTimer &t, u64 n);
+	void RunTimer(UzeTimer &t, u64 clocks);
+	u64 TimerEvent(const UzeTimer &t) const;
+	bool Interrupt();
+	u8 PinA();
+
+	UzeTimer timer0, timer1, timer2;
+	u64 timerCycles;	//the timers are counted up to there
+	u64 nextEvent;
+	bool pending;		//an interrupt flag is set and enabled
+	u8 temp16;			//TEMP register of the 16 bit timer
+	bool intHold;		//one instruction runs after a reti or sei before the next interrupt
+	int stall;			//cycles the EEPROM halts the CPU
+	u64 eempeEnd;		//EEMPE clears 4 cycles after it is set
+	u64 eepromDone;		//EEPE clears when the write is over
+	u64 spiEnd;			//SPIF sets when the transfer is over
+	bool spiBusy;
+	u8 spiIn;			//the byte SPDR gets at spiEnd
+	u64 wdtLast;
+	u64 wdtOpen;		//WDCE timed sequence
+	u8 padShift;		//bits clocked out since the latch
+	bool padLatch;
+
+	bool watch[AVR_RAM_END + 1];
+	bool profiling;
+	std::vector<int> symbolAt;	//index in symbols by word address, -1 if none
+};
+
+// joypad script line: the buttons held from this frame on
+struct UzePadEvent
+{
+	u32 frame;
+	u16 buttons[2];
+};
+
+// reads a script of "frame p1 [p2]" lines, the buttons joined with '+',
+// '-' for none or a ReadJoypad() number. '#' starts a comment.
+bool UzeReadPadScript(const char *path, std::vector<UzePadEvent> &events);
+
+#endif
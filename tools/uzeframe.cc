@@ -0,0 +1,491 @@
+/*
+ *  uzeframe - golden frame test of the mode 3 picture. Runs the .elf on
+ *  the host AVR core with a joypad script like uzesim, draws selected
+ *  frames with the host mode 3 renderer (uzemode3.cc) to PNG and
+ *  compares them with golden PNGs. The run is deterministic: the same
+ *  .elf, EEPROM and script give the same frames.
+ *
+ *  A frame is taken when VideoModeVsync() returns, after ProcessSprites()
+ *  made the sprite RAM tiles: it is the picture the next field shows
+ *  unless the game changes vram meanwhile. The frames are numbered as in
+ *  uzesim, from the vsync_flag sets.
+ *
+ *  With -c the RAM tiles of every frame are compared with the ones the
+ *  host makes from sprites[], so a change to ProcessSprites(),
+ *  BlitSprite() or CopyTileToRam() must stay pixel identical.
+ *
+ *  With -b the two are called alone on the AVR core with random
+ *  arguments, sprites and pixels, and the whole RAM after each call is
+ *  compared with the host blit. The callee saved registers and r1 must
+ *  come back as avr-gcc expects. "make blitcheck" in tools/ does the
+ *  same on the two routines alone, assembled by uzeasm.
+ *
+ *  Usual use, from default/:
+ *
+ *    make golden    makes the goldens before a renderer change
+ *    make frames    checks the build against them
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <set>
+#include <png.h>
+#include "uzeavr.h"
+#include "uzemode3.h"
+
+class FrameRun : public UzeAvr
+{
+public:
+	FrameRun() : frame(0), taken(false), vsyncFlag(0), vsyncEntry(0), vsyncReturn(-1) {}
+
+	bool Init()
+	{
+		const UzeSymbol *s = FindSymbol("vsync_flag");
+		const UzeSymbol *f = FindSymbol("VideoModeVsync");
+		if (s == NULL || s->code || f == NULL || !f->code) return false;
+		vsyncFlag = s->addr;
+		vsyncEntry = f->addr / 2;
+		Watch(vsyncFlag);
+		return true;
+	}
+
+	// runs up to the start of the next frame, false when it never comes
+	bool RunFrame()
+	{
+		u32 count = frame;
+		u64 timeout = cycles + 4 * UZE_FRAME_CYCLES;
+		taken = false;
+		while (frame == count && cycles < timeout) {
+			Step();
+			if (pc == vsyncEntry) {
+				u16 sp = data[0x5d] | (data[0x5e] << 8);
+				vsyncReturn = (Peek(sp + 1) << 8) | Peek(sp + 2);
+			} else if (pc == vsyncReturn) {
+				memcpy(snapshot, data, sizeof(snapshot));
+				taken = true;
+				vsyncReturn = -1;
+			}
+		}
+		return frame != count;
+	}
+
+	// calls the function at byte address addr with interrupts off, the
+	// arguments in r24, r22, r21:r20 and r19:r18 as avr-gcc passes them.
+	// False when it does not return.
+	bool Call(u32 addr, u8 a, u8 b, u16 c, u16 d)
+	{
+		u16 sp = AVR_RAM_END - 2;
+		data[0x5d] = sp;
+		data[0x5e] = sp >> 8;
+		data[sp + 1] = 0;	//returns to word address 0
+		data[sp + 2] = 0;
+		data[0x5f] = 0;
+		data[24] = a;
+		data[22] = b;
+		data[20] = c;
+		data[21] = c >> 8;
+		data[18] = d;
+		data[19] = d >> 8;
+		pc = addr / 2;
+		u64 timeout = cycles + 100000;
+		while (pc != 0 && cycles < timeout) Step();
+		return pc == 0;
+	}
+
+	u32 frame;			//vsync_flag sets since reset
+	bool taken;			//snapshot is from the frame that just ended
+	u8 snapshot[AVR_RAM_END + 1];
+
+protected:
+	void OnWatchWrite(u16 addr, u8 oldValue, u8 value)
+	{
+		if (value != 0) frame++;
+	}
+
+private:
+	u16 vsyncFlag;
+	u16 vsyncEntry;
+	int vsyncReturn;	//word address after the call, -1 outside
+};
+
+static void usage()
+{
+	printf("\n\tUsage: uzeframe [options] game.elf\n\n"
+		"\t-f frames   frames to run, default 600\n"
+		"\t-i script   joypad script, as for uzesim\n"
+		"\t-e file     EEPROM image to start with, default erased\n"
+		"\t-d frames   frames to draw: all, or a list like 120,300-400,600-1200/60\n"
+		"\t-o dir      where the drawn frames go, default .\n"
+		"\t-g dir      compare the drawn frames with the goldens in dir, only\n"
+		"\t            the ones that differ are written to -o\n"
+		"\t-u          write the drawn frames to the -g dir as the new goldens\n"
+		"\t-c          check the sprites of every frame against the host\n"
+		"\t            ProcessSprites()\n"
+		"\t-b cases    check BlitSprite() and CopyTileToRam() against the host\n"
+		"\t            blit on random cases, and run no frames\n"
+		"\t-t color    TRANSLUCENT_COLOR, default 0xfe\n"
+		"\t-v tiles    SCREEN_TILES_V, default 28\n\n");
+}
+
+static bool parseFrames(const char *s, std::set<u32> &frames, bool &all)
+{
+	if (!strcmp(s, "all")) {
+		all = true;
+		return true;
+	}
+	while (*s) {
+		char *end;
+		u32 first = strtoul(s, &end, 0), last = first, step = 1;
+		if (end == s) return false;
+		if (*end == '-') {
+			s = end + 1;
+			last = strtoul(s, &end, 0);
+			if (end == s || last < first) return false;
+		}
+		if (*end == '/') {
+			s = end + 1;
+			step = strtoul(s, &end, 0);
+			if (end == s || step == 0) return false;
+		}
+		for (u32 f = first; f <= last; f += step) frames.insert(f);
+		if (*end == ',') end++;
+		else if (*end != 0) return false;
+		s = end;
+	}
+	return true;
+}
+
+static bool writePng(const std::string &name, const std::vector<u8> &rgb, int width, int height)
+{
+	FILE *f = fopen(name.c_str(), "wb");
+	if (f == NULL) return false;
+	png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	png_infop info = png_create_info_struct(png);
+	if (setjmp(png_jmpbuf(png))) {
+		png_destroy_write_struct(&png, &info);
+		fclose(f);
+		return false;
+	}
+	png_init_io(png, f);
+	png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+		PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(png, info);
+	for (int y = 0; y < height; y++) png_write_row(png, (png_bytep)&rgb[y * width * 3]);
+	png_write_end(png, NULL);
+	png_destroy_write_struct(&png, &info);
+	return fclose(f) == 0;
+}
+
+static void pngWarning(png_structp png, png_const_charp message)
+{
+}
+
+// RGB pixels, false when missing or not width x height
+static bool readPng(const std::string &name, std::vector<u8> &rgb, int width, int height)
+{
+	FILE *f = fopen(name.c_str(), "rb");
+	if (f == NULL) return false;
+	png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, pngWarning);
+	png_infop info = png_create_info_struct(png);
+	if (setjmp(png_jmpbuf(png))) {
+		png_destroy_read_struct(&png, &info, NULL);
+		fclose(f);
+		return false;
+	}
+	png_init_io(png, f);
+	png_read_info(png, info);
+	if ((int)png_get_image_width(png, info) != width || (int)png_get_image_height(png, info) != height) {
+		png_destroy_read_struct(&png, &info, NULL);
+		fclose(f);
+		return false;
+	}
+	png_set_expand(png);
+	png_set_strip_16(png);
+	png_set_strip_alpha(png);
+	png_set_gray_to_rgb(png);
+	png_read_update_info(png, info);
+
+	rgb.resize(width * height * 3);
+	std::vector<png_bytep> lines(height);
+	for (int y = 0; y < height; y++) lines[y] = &rgb[y * width * 3];
+	png_read_image(png, &lines[0]);
+	png_destroy_read_struct(&png, &info, NULL);
+	fclose(f);
+	return true;
+}
+
+static void toRgb(const std::vector<u8> &screen, std::vector<u8> &rgb)
+{
+	rgb.resize(screen.size() * 3);
+	for (size_t i = 0; i < screen.size(); i++) UzeMode3::ToRgb(screen[i], &rgb[i * 3]);
+}
+
+static std::string frameName(const char *dir, u32 frame)
+{
+	char name[32];
+	sprintf(name, "/%05u.png", frame);
+	return dir + std::string(name);
+}
+
+static int countDiffs(const std::vector<u8> &a, const std::vector<u8> &b, size_t pixelSize)
+{
+	int n = 0;
+	for (size_t i = 0; i < a.size(); i += pixelSize) {
+		if (memcmp(&a[i], &b[i], pixelSize)) n++;
+	}
+	return n;
+}
+
+// flash the random sprite pixels go to, away from the code of the two
+// functions. The program is not run after the check.
+#define BLIT_WINDOW 0x1000
+
+static u32 blitWindow(const u32 *code, int n)
+{
+	for (u32 start = 0; start < AVR_FLASH_SIZE; start += BLIT_WINDOW) {
+		bool clear = true;
+		for (int i = 0; i < n; i++) {
+			if (code[i] + 0x800 > start && code[i] < start + BLIT_WINDOW) clear = false;
+		}
+		if (clear) return start;
+	}
+	return 0;
+}
+
+// -b: the RAM and the saved registers after CopyTileToRam() and
+// BlitSprite() on the AVR core against UzeMode3 on cases random calls
+static u32 checkBlit(FrameRun *avr, const UzeMode3 &mode3, u32 cases)
+{
+	const UzeSymbol *blit = avr->FindSymbol("BlitSprite");
+	const UzeSymbol *copy = avr->FindSymbol("CopyTileToRam");
+	if (blit == NULL || !blit->code || copy == NULL || !copy->code) {
+		printf("No BlitSprite or CopyTileToRam symbol.\n");
+		return 1;
+	}
+	u32 code[2] = { blit->addr, copy->addr };
+	u32 window = blitWindow(code, 2);
+	std::vector<u8> expect(AVR_RAM_END + 1);
+	u32 errors = 0;
+
+	srand(1);
+	avr->Reset();
+	for (u32 n = 0; n < cases; n++) {
+		// new pixels now and then, a quarter of them translucent
+		if (n % 256 == 0) {
+			for (u32 i = 0; i < BLIT_WINDOW; i++) {
+				avr->flash[window + i] = rand() % 4 == 0 ? mode3.translucent : rand();
+			}
+		}
+		for (int i = 0; i < mode3.ramTiles * MODE3_TILE_SIZE * MODE3_TILE_SIZE; i++) avr->data[mode3.ramTileData + i] = rand();
+		for (int r = 0; r < 32; r++) avr->data[r] = rand();
+
+		bool isBlit = n & 1;
+		int ramTile = rand() % mode3.ramTiles;
+		u8 a, b = ramTile;
+		u16 c = 0, d = 0;
+		if (isBlit) {
+			int sprite = rand() % mode3.maxSprites;
+			int dx = rand() % 8, dy = rand() % 8;
+			int x = dx ? rand() % 2 : 0, y = dy ? rand() % 2 : 0;
+			u8 *s = avr->data + mode3.sprites + sprite * MODE3_SPRITE_SIZE;
+			u16 tile = rand() % 16;
+			s[2] = tile;
+			s[3] = tile >> 8;
+			s[4] = rand() & (0xc0 | MODE3_FLIP_X);
+			for (int i = 0; i < 4; i++) {
+				u16 bank = window + rand() % (BLIT_WINDOW - 16 * MODE3_TILE_SIZE * MODE3_TILE_SIZE);
+				avr->data[mode3.banks + i * 2] = bank;
+				avr->data[mode3.banks + i * 2 + 1] = bank >> 8;
+			}
+			memcpy(&expect[0], avr->data, expect.size());
+			mode3.Blit(&expect[0], avr->flash, sprite, ramTile, x, y, dx, dy);
+			a = sprite;
+			c = (y << 8) | x;
+			d = (dy << 8) | dx;
+		} else {
+			u16 tiles = rand();
+			avr->data[mode3.tileTableLo] = tiles;
+			avr->data[mode3.tileTableHi] = tiles >> 8;
+			a = mode3.ramTiles + rand() % (256 - mode3.ramTiles);
+			memcpy(&expect[0], avr->data, expect.size());
+			mode3.CopyTile(&expect[0], avr->flash, a, ramTile);
+		}
+
+		const char *name = isBlit ? "BlitSprite" : "CopyTileToRam";
+		if (!avr->Call(isBlit ? blit->addr : copy->addr, a, b, c, d)) {
+			printf("%s(%u, %u, 0x%04x, 0x%04x) does not return.\n", name, a, b, c, d);
+			return errors + 1;
+		}
+		// the call stack is the top of the RAM, r18-r27, r30 and r31 are
+		// scratch
+		int diffs = 0;
+		for (u32 i = AVR_RAM_START; i < AVR_RAM_END - 8; i++) {
+			if (avr->data[i] != expect[i]) diffs++;
+		}
+		bool saved = avr->data[1] == 0 && !memcmp(avr->data + 2, &expect[2], 16) &&
+			!memcmp(avr->data + 28, &expect[28], 2);
+		if (diffs == 0 && saved) continue;
+		if (errors++ < 20) {
+			printf("%s(%u, %u, 0x%04x, 0x%04x): %d RAM bytes differ%s\n",
+				name, a, b, c, d, diffs, saved ? "" : ", registers not saved");
+		}
+	}
+	printf("\n\t%u blit cases, %u errors\n\n", cases, errors);
+	return errors;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *elfname = NULL, *scriptname = NULL, *eepromIn = NULL;
+	const char *outDir = ".", *goldenDir = NULL;
+	u32 frameCount = 600, blitCases = 0;
+	std::set<u32> selected;
+	bool all = false, update = false, check = false;
+	UzeMode3 mode3;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+			frameCount = strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+			scriptname = argv[++i];
+		} else if (!strcmp(argv[i], "-e") && i + 1 < argc) {
+			eepromIn = argv[++i];
+		} else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+			if (!parseFrames(argv[++i], selected, all)) {
+				printf("Bad frame list %s.\n", argv[i]);
+				return 1;
+			}
+		} else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+			outDir = argv[++i];
+		} else if (!strcmp(argv[i], "-g") && i + 1 < argc) {
+			goldenDir = argv[++i];
+		} else if (!strcmp(argv[i], "-u")) {
+			update = true;
+		} else if (!strcmp(argv[i], "-c")) {
+			check = true;
+		} else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+			blitCases = strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+			mode3.translucent = strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "-v") && i + 1 < argc) {
+			mode3.screenTilesV = atoi(argv[++i]);
+		} else if (argv[i][0] == '-') {
+			usage();
+			return 1;
+		} else {
+			elfname = argv[i];
+		}
+	}
+	if (elfname == NULL || (update && goldenDir == NULL)) {
+		usage();
+		return elfname == NULL ? 0 : 1;
+	}
+
+	std::vector<UzePadEvent> script;
+	if (scriptname != NULL && !UzeReadPadScript(scriptname, script)) return 1;
+
+	FrameRun *avr = new FrameRun();
+	if (!avr->Load(elfname)) {
+		printf("Can't load %s.\n", elfname);
+		return 1;
+	}
+	std::string error;
+	if (!avr->Init()) {
+		printf("%s has no vsync_flag or VideoModeVsync symbol, an .elf with symbols is needed.\n", elfname);
+		return 1;
+	}
+	if (!mode3.Init(*avr, error)) {
+		printf("%s: %s.\n", elfname, error.c_str());
+		return 1;
+	}
+	if (blitCases != 0) return checkBlit(avr, mode3, blitCases) != 0 ? 1 : 0;
+	if (eepromIn != NULL && !avr->LoadEeprom(eepromIn)) {
+		printf("Can't open %s.\n", eepromIn);
+		return 1;
+	}
+	avr->Reset();
+
+	int w = mode3.Width(), h = mode3.Height();
+	std::vector<u8> screen(w * h), composed(w * h), rgb, golden;
+	std::vector<u8> mem(AVR_RAM_END + 1);
+	u32 drawn = 0, checked = 0, spriteErrors = 0, goldenErrors = 0;
+	clock_t start = clock();
+	size_t next = 0;
+
+	while (avr->frame <= frameCount) {
+		u32 frame = avr->frame;
+		for (; next < script.size() && script[next].frame <= frame; next++) {
+			avr->joypad[0] = script[next].buttons[0];
+			avr->joypad[1] = script[next].buttons[1];
+		}
+		if (!avr->RunFrame()) {
+			printf("No vsync after frame %u at pc 0x%04x, the program is stuck.\n",
+				frame, avr->pc * 2);
+			return 1;
+		}
+		if (!avr->taken) continue;
+
+		bool draw = all || selected.count(frame);
+		if (!draw && !check) continue;
+		mode3.Render(avr->snapshot, avr->flash, &screen[0]);
+
+		if (check) {
+			memcpy(&mem[0], avr->snapshot, mem.size());
+			mode3.ComposeSprites(&mem[0], avr->flash);
+			mode3.Render(&mem[0], avr->flash, &composed[0]);
+			int n = countDiffs(screen, composed, 1);
+			if (n != 0) {
+				if (spriteErrors++ < 20) printf("frame %u: %d sprite pixels differ from the host ProcessSprites()\n", frame, n);
+			}
+			checked++;
+		}
+		if (!draw) continue;
+		drawn++;
+
+		toRgb(screen, rgb);
+		std::string name;
+		if (goldenDir != NULL && !update) {
+			if (!readPng(frameName(goldenDir, frame), golden, w, h)) {
+				printf("frame %u: no golden %s\n", frame, frameName(goldenDir, frame).c_str());
+				goldenErrors++;
+				continue;
+			}
+			int n = countDiffs(rgb, golden, 3);
+			if (n == 0) continue;
+			printf("frame %u: %d pixels differ from the golden\n", frame, n);
+			goldenErrors++;
+			name = frameName(outDir, frame);
+		} else {
+			name = frameName(update ? goldenDir : outDir, frame);
+		}
+		if (!writePng(name, rgb, w, h)) {
+			printf("Failed to create %s.\n", name.c_str());
+			return 1;
+		}
+	}
+	double host = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	printf("\n\t%u frames in %.1fs, %u drawn", frameCount, host, drawn);
+	if (check) printf(", %u sprite checks with %u errors", checked, spriteErrors);
+	if (goldenDir != NULL && !update) printf(", %u differ from the goldens", goldenErrors);
+	printf("\n\n");
+
+	return spriteErrors != 0 || goldenErrors != 0 ? 1 : 0;
+}
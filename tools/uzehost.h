@@ -0,0 +1,68 @@
+/*
+ *  Host side definitions needed to compile the game's data headers
+ *  (data/patches.h, data/east.h, ...) with a regular C++ compiler.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __UZEHOST_H_
+#define __UZEHOST_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint8_t u8;
+typedef int8_t s8;
+typedef uint16_t u16;
+typedef int16_t s16;
+typedef uint32_t u32;
+typedef int32_t s32;
+
+// flash is plain memory on the host
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(a) (*(const unsigned char *)(a))
+
+// Patch commands, must match kernel/defines.h
+#define PC_ENV_SPEED	0
+#define PC_NOISE_PARAMS	1
+#define PC_WAVE			2
+#define PC_NOTE_UP		3
+#define PC_NOTE_DOWN	4
+#define PC_NOTE_CUT		5
+#define PC_NOTE_HOLD 	6
+#define PC_ENV_VOL		7
+#define PC_PITCH		8
+#define PC_TREMOLO_LEVEL	9
+#define PC_TREMOLO_RATE	10
+#define PATCH_END		0xff
+
+// must match kernel/kernel.h
+struct PatchStruct{
+	unsigned char type;
+	const char *pcmData;
+	const char *cmdStream;
+	unsigned int loopStart;
+	unsigned int loopEnd;
+};
+
+struct FxInfoStruct{
+	unsigned char priority;
+	unsigned char voices;
+	unsigned char channels;
+};
+
+#define FX_CHANNEL(c)	(1<<(c))
+
+#endif
@@ -0,0 +1,231 @@
+/*
+ *  Uzebox video mode 3 on the host
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "uzemode3.h"
+
+#define DDRC 0x27
+#define TILE_BYTES (MODE3_TILE_SIZE * MODE3_TILE_SIZE)
+
+UzeMode3::UzeMode3() : screenTilesV(28), translucent(0xfe), ramTiles(0), maxSprites(0),
+	vramTilesV(0), overlayLines(0)
+{
+}
+
+bool UzeMode3::Init(const UzeAvr &avr, std::string &error)
+{
+	static const char *names[] = {
+		"vram", "overlay_vram", "sprites", "ram_tiles", "ram_tiles_restore",
+		"sprites_tile_banks", "Screen", "tile_table_lo", "tile_table_hi", "free_tile_index"
+	};
+	u16 *addrs[] = {
+		&vram, &overlayVram, &sprites, &ramTileData, &restore,
+		&banks, &screen, &tileTableLo, &tileTableHi, &freeTileIndex
+	};
+	for (int i = 0; i < 10; i++) {
+		const UzeSymbol *s = avr.FindSymbol(names[i]);
+		if (s == NULL || s->code) {
+			error = std::string("no ") + names[i] + " symbol, mode 3 with SCROLLING=1 is needed";
+			return false;
+		}
+		*addrs[i] = s->addr;
+	}
+	const UzeSymbol *s = avr.FindSymbol("sprite_tiles_dropped");
+	tilesDropped = s != NULL && !s->code ? s->addr : 0;
+	s = avr.FindSymbol("spritesOn");
+	spritesOn = s != NULL && !s->code ? s->addr : 0;
+
+	//the .bss of videoMode3core.s, in order
+	vramTilesV = (overlayVram - vram) / MODE3_VRAM_TILES_H;
+	overlayLines = (sprites - overlayVram) / MODE3_VRAM_TILES_H;
+	maxSprites = (ramTileData - sprites) / MODE3_SPRITE_SIZE;
+	ramTiles = (restore - ramTileData) / TILE_BYTES;
+	if (vramTilesV <= 0 || maxSprites <= 0 || ramTiles <= 0 || ramTiles > 255 ||
+		banks - restore != ramTiles * 3) {
+		error = "the mode 3 variables are not laid out as in videoMode3core.s";
+		return false;
+	}
+	return true;
+}
+
+void UzeMode3::ToRgb(u8 c, u8 *rgb)
+{
+	rgb[0] = (c & 7) * 255 / 7;
+	rgb[1] = ((c >> 3) & 7) * 255 / 7;
+	rgb[2] = (c >> 6) * 255 / 3;
+}
+
+//
+// One scanline of render_tile_line: 29 tiles from row, wrapping in the
+// 32 tiles of the vram line, the first one shifted by the fine scroll.
+// ROM tiles are numbered from RAM_TILES_COUNT.
+//
+void UzeMode3::RenderLine(const u8 *data, const u8 *flash, u16 row, int line, int scrollX, u16 tiles, u8 *out) const
+{
+	u16 romBase = tiles - ramTiles * TILE_BYTES + line * MODE3_TILE_SIZE;
+	u16 ramBase = ramTileData + line * MODE3_TILE_SIZE;
+	u8 mask = data[DDRC];
+	int fine = scrollX & 7;
+
+	for (int x = 0; x < MODE3_SCREEN_WIDTH; x++) {
+		int p = fine + x;
+		u16 at = (row & 0xffe0) | ((row + p / MODE3_TILE_SIZE) & 31);
+		u8 tile = at <= AVR_RAM_END ? data[at] : 0;
+		u16 offset = tile * TILE_BYTES + p % MODE3_TILE_SIZE;
+		u8 c;
+		if (tile < ramTiles) {
+			u16 a = ramBase + offset;
+			c = a <= AVR_RAM_END ? data[a] : 0;
+		} else {
+			c = flash[(u16)(romBase + offset)];
+		}
+		out[x] = c & mask;
+	}
+}
+
+//
+// As sub_video_mode3: the RAM tiles of the sprites go back in vram, the
+// overlay takes the first overlayHeight tile rows, then the main section
+// starts at the scrolled position and wraps after VRAM_TILES_V rows.
+//
+void UzeMode3::Render(const u8 *data, const u8 *flash, u8 *out) const
+{
+	u8 mem[AVR_RAM_END + 1];
+	memcpy(mem, data, sizeof(mem));
+
+	u8 used = mem[freeTileIndex];
+	for (int i = 0; i < ramTiles && i < used; i++) {
+		u16 a = vram + (mem[restore + i * 3] | (mem[restore + i * 3 + 1] << 8));
+		if (a <= AVR_RAM_END) mem[a] = i;
+	}
+
+	u8 overlayHeight = mem[screen], scrollX = mem[screen + 1], scrollY = mem[screen + 2];
+	u16 tiles = mem[tileTableLo] | (mem[tileTableHi] << 8);
+
+	u16 wrapRow = vram + scrollX / MODE3_TILE_SIZE;
+	u16 mainRow = wrapRow + (scrollY / MODE3_TILE_SIZE) * MODE3_VRAM_TILES_H;
+	u8 mainWrap = vramTilesV - scrollY / MODE3_TILE_SIZE;
+	int mainLine = scrollY & 7;
+
+	u16 row = mainRow;
+	u8 wrap = mainWrap, overlayLeft = overlayHeight;
+	int line = mainLine, sx = scrollX;
+	if (overlayHeight != 0) {
+		row = overlayVram;
+		wrap = overlayLines;
+		line = 0;
+		sx = 0;
+	}
+
+	for (int y = 0; y < Height(); y++) {
+		RenderLine(mem, flash, row, line, sx, tiles, out + y * MODE3_SCREEN_WIDTH);
+		if (++line < MODE3_TILE_SIZE) continue;
+		line = 0;
+		row += MODE3_VRAM_TILES_H;
+		if (--wrap == 0) row = wrapRow;
+		if (--overlayLeft == 0) {
+			line = mainLine;
+			row = mainRow;
+			wrap = mainWrap;
+			sx = scrollX;
+		}
+	}
+}
+
+// the 64 pixels of a flash tile of the tile table to ramTile
+void UzeMode3::CopyTile(u8 *data, const u8 *flash, u8 romTile, int ramTile) const
+{
+	u16 tiles = data[tileTableLo] | (data[tileTableHi] << 8);
+	for (int j = 0; j < TILE_BYTES; j++) {
+		data[ramTileData + ramTile * TILE_BYTES + j] = flash[(u16)(tiles + (u8)(romTile - ramTiles) * TILE_BYTES + j)];
+	}
+}
+
+// sprite pixels over the part of ramTile at (x, y) in the tiles it covers
+void UzeMode3::Blit(u8 *data, const u8 *flash, int sprite, int ramTile, int x, int y, int dx, int dy) const
+{
+	const u8 *s = data + sprites + sprite * MODE3_SPRITE_SIZE;
+	u8 flags = s[4];
+	u16 bank = banks + (flags >> 6) * 2;
+	u16 src = (data[bank] | (data[bank + 1] << 8)) + (s[2] | (s[3] << 8)) * TILE_BYTES;
+	u8 *dest = data + ramTileData + ramTile * TILE_BYTES;
+
+	for (int py = 0; py < MODE3_TILE_SIZE; py++) {
+		int sy = y * MODE3_TILE_SIZE + py - dy;
+		if (sy < 0 || sy >= MODE3_TILE_SIZE) continue;
+		for (int px = 0; px < MODE3_TILE_SIZE; px++) {
+			int sx = x * MODE3_TILE_SIZE + px - dx;
+			if (sx < 0 || sx >= MODE3_TILE_SIZE) continue;
+			if (flags & MODE3_FLIP_X) sx = MODE3_TILE_SIZE - 1 - sx;
+			u8 c = flash[(u16)(src + sy * MODE3_TILE_SIZE + sx)];
+			if (c != translucent) dest[py * MODE3_TILE_SIZE + px] = c;
+		}
+	}
+}
+
+//
+// ProcessSprites() of videoMode3.c: each sprite takes a RAM tile copy of
+// the vram tiles it covers, in sprite order, until RAM_TILES_COUNT runs
+// out. Then the background tiles go back in vram.
+//
+void UzeMode3::ComposeSprites(u8 *data, const u8 *flash) const
+{
+	u8 used = 0, dropped = 0;
+	u8 scrollX = data[screen + 1], scrollY = data[screen + 2];
+
+	for (int i = 0; i < maxSprites && (spritesOn == 0 || data[spritesOn]); i++) {
+		const u8 *s = data + sprites + i * MODE3_SPRITE_SIZE;
+		if (s[0] == MODE3_SCREEN_WIDTH) continue;
+
+		int ssx = s[0] + scrollX, ssy = s[1] + scrollY;
+		int dx = ssx & 7, dy = ssy & 7;
+		u8 bx = ssx / MODE3_TILE_SIZE, by = ssy / MODE3_TILE_SIZE;
+
+		for (int y = 0; y < (dy ? 2 : 1); y++) {
+			for (int x = 0; x < (dx ? 2 : 1); x++) {
+				u8 wy = by + y, wx = bx + x;
+				if (wy >= vramTilesV * 2) wy -= vramTilesV * 2;
+				else if (wy >= vramTilesV) wy -= vramTilesV;
+				if (wx >= MODE3_VRAM_TILES_H) wx -= MODE3_VRAM_TILES_H;
+
+				u16 offset = wy * MODE3_VRAM_TILES_H + wx;
+				u16 a = vram + offset;
+				if (a > AVR_RAM_END) continue;
+				u8 bt = data[a];
+				if (bt >= ramTiles && used < ramTiles) {
+					u8 *r = data + restore + used * 3;
+					r[0] = offset;
+					r[1] = offset >> 8;
+					r[2] = bt;
+					CopyTile(data, flash, bt, used);
+					data[a] = bt = used++;
+				} else if (bt >= ramTiles) {
+					dropped++;
+				}
+				if (bt < ramTiles) Blit(data, flash, i, bt, x, y, dx, dy);
+			}
+		}
+	}
+
+	for (int i = 0; i < used; i++) {
+		const u8 *r = data + restore + i * 3;
+		u16 a = vram + (r[0] | (r[1] << 8));
+		if (a <= AVR_RAM_END) data[a] = r[2];
+	}
+	data[freeTileIndex] = used;
+	if (tilesDropped != 0) data[tilesDropped] = dropped;
+}
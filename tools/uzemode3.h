@@ -0,0 +1,84 @@
+/*
+ *  Uzebox video mode 3 on the host
+ *
+ *  Draws the picture of the mode 3 core (SCROLLING=1) from the data
+ *  space and flash of the AVR: vram and overlay_vram with the tile table
+ *  of SetTileTable(), the RAM tiles, Screen.scrollX/scrollY/overlayHeight
+ *  and the DDRC fading mask. The sprites are in the RAM tiles the last
+ *  ProcessSprites() made, as on the TV.
+ *
+ *  ComposeSprites() does ProcessSprites() again on the host from
+ *  sprites[], with the flip, the tile banks and TRANSLUCENT_COLOR, to
+ *  check the kernel blitter against.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __UZEMODE3_H_
+#define __UZEMODE3_H_
+
+#include <string>
+#include "uzeavr.h"
+
+// must match kernel/videoMode3/videoMode3.def.h with SCROLLING=1
+#define MODE3_TILE_SIZE 8
+#define MODE3_VRAM_TILES_H 32
+#define MODE3_SCREEN_TILES_H 28
+#define MODE3_SCREEN_WIDTH (MODE3_SCREEN_TILES_H * MODE3_TILE_SIZE)
+#define MODE3_SPRITE_SIZE 5
+#define MODE3_FLIP_X 1
+
+class UzeMode3
+{
+public:
+	UzeMode3();
+
+	// finds the video mode variables in the symbols of the .elf, the
+	// sizes of the build (RAM_TILES_COUNT, MAX_SPRITES, VRAM_TILES_V,
+	// OVERLAY_LINES) come from their layout
+	bool Init(const UzeAvr &avr, std::string &error);
+
+	// the screen as BBGGGRRR colors, Width() * Height() bytes
+	void Render(const u8 *data, const u8 *flash, u8 *screen) const;
+
+	// redoes the RAM tiles, ram_tiles_restore, free_tile_index and
+	// sprite_tiles_dropped of data from sprites[] and vram
+	void ComposeSprites(u8 *data, const u8 *flash) const;
+
+	// CopyTileToRam() and BlitSprite() of videoMode3core.s, with their
+	// arguments. romTile is numbered from RAM_TILES_COUNT as in vram.
+	void CopyTile(u8 *data, const u8 *flash, u8 romTile, int ramTile) const;
+	void Blit(u8 *data, const u8 *flash, int sprite, int ramTile, int x, int y, int dx, int dy) const;
+
+	int Width() const { return MODE3_SCREEN_WIDTH; }
+	int Height() const { return screenTilesV * MODE3_TILE_SIZE; }
+
+	static void ToRgb(u8 color, u8 *rgb);
+
+	int screenTilesV;	//SCREEN_TILES_V
+	u8 translucent;		//TRANSLUCENT_COLOR
+	int ramTiles;
+	int maxSprites;
+	int vramTilesV;
+	int overlayLines;
+
+	// data space addresses of the video mode variables
+	u16 vram, overlayVram, sprites, ramTileData, restore, banks;
+	u16 screen, tileTableLo, tileTableHi, freeTileIndex, tilesDropped, spritesOn;
+
+private:
+	void RenderLine(const u8 *data, const u8 *flash, u16 row, int line, int scrollX, u16 tiles, u8 *out) const;
+};
+
+#endif
@@ -0,0 +1,462 @@
+/*
+ *  uzesim - headless frame time benchmark of the game. Runs the .elf on
+ *  the host AVR core (uzeavr.cc) for a number of frames with scripted
+ *  joypads and reports the cycles used per frame, the vsync overruns
+ *  and the worst frame.
+ *
+ *  A frame starts when the video mode sets vsync_flag. The game cycles
+ *  of a frame are the cycles of the main program until it finds
+ *  vsync_flag cleared, the kernel cycles are the interrupts (sync,
+ *  rendering and the vsync stages). A frame where the game never waited
+ *  for the vsync is an overrun.
+ *
+ *  The joypad script has one line per change, the buttons are held
+ *  until the next line:
+ *
+ *    # frame  player 1     player 2
+ *    120      -            SL
+ *    180      START
+ *    240      RIGHT+UP
+ *
+ *  Buttons are B Y SELECT START UP DOWN LEFT RIGHT A X SL SR, joined with
+ *  '+', '-' for none, or a ReadJoypad() number.
+ *
+ *  -m checks the attract demo: it runs until each recording of
+ *  data/demos.h has played once in demoMode() and compares where its turn
+ *  ends with demoEnds[], the end in the host model. A turn is counted in
+ *  loop frames, the clears of vsync_flag from InputReplayStart(), and
+ *  ends at the end of the recording, carCrash() or the stage cleared.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include "uzeavr.h"
+#include "uzesound.h"
+#include "../data/demos.h"
+
+#define INPUT_REPLAYING 2	//GetInputRecorderState(), kernel/defines.h
+
+struct Frame
+{
+	u32 cycles;
+	u32 kernel;
+	u32 game;
+	u32 idle;
+	bool overrun;	//the game did not wait for this vsync
+	bool missed;	//vsync_flag was still set
+};
+
+// a demo turn, as struct DemoEnd
+struct DemoTurn
+{
+	u32 frames;
+	u16 score;
+	u8 stage;
+	u8 subStage;
+	u8 event;		//0 end of the recording, 1 cleared, 2 crash
+};
+
+class Bench : public UzeAvr
+{
+public:
+	Bench() : vsyncFlag(0), frameStart(0), started(false), idle(false),
+		mainCycles(0), kernelCycles(0), busy(0), inDemo(false), demoFrames(0), recorderState(0),
+		gameMode(0), gameStage(0), playerScore(0), subStage(0), crashEntry(0) {}
+
+	bool Init()
+	{
+		const UzeSymbol *s = FindSymbol("vsync_flag");
+		if (s == NULL || s->code) return false;
+		vsyncFlag = s->addr;
+		Watch(vsyncFlag);
+		return true;
+	}
+
+	// the game globals the demo check reads
+	bool InitDemos()
+	{
+		const char *names[5] = {"inputRecorderState", "gameMode", "gameStage", "playerScore", "subStage"};
+		u16 *addrs[5] = {&recorderState, &gameMode, &gameStage, &playerScore, &subStage};
+		for (int i = 0; i < 5; i++) {
+			const UzeSymbol *s = FindSymbol(names[i]);
+			if (s == NULL || s->code) return false;
+			*addrs[i] = s->addr;
+		}
+		const UzeSymbol *f = FindSymbol("carCrash");
+		if (f == NULL || !f->code) return false;
+		crashEntry = f->addr / 2;
+		Watch(recorderState);
+		Watch(gameStage);
+		return true;
+	}
+
+	// runs up to the start of the next frame, false when it never comes
+	bool RunFrame()
+	{
+		size_t count = frames.size();
+		u64 timeout = cycles + 4 * UZE_FRAME_CYCLES;
+		while (frames.size() == count && cycles < timeout) {
+			int depth = intDepth;
+			int n = Step();
+			if (depth == 0 && intDepth == 0) mainCycles += n;
+			else kernelCycles += n;
+			if (inDemo && pc == crashEntry) EndDemo(2, Peek(gameStage));
+		}
+		return frames.size() != count;
+	}
+
+	std::vector<Frame> frames;	//frames[0] is the boot up to the first vsync
+	std::vector<DemoTurn> demos;	//the demo turns played
+
+protected:
+	void OnWatchRead(u16 addr, u8 value)
+	{
+		if (value == 0 && intDepth == 0 && !idle) {
+			idle = true;
+			busy = mainCycles;
+		}
+	}
+
+	void OnWatchWrite(u16 addr, u8 oldValue, u8 value)
+	{
+		if (addr == recorderState) {
+			if (value == INPUT_REPLAYING && Peek(gameMode) == 2) {
+				inDemo = true;
+				demoFrames = 0;
+			} else if (inDemo && value != INPUT_REPLAYING) {
+				EndDemo(0, Peek(gameStage));
+			}
+			return;
+		}
+		if (addr == gameStage) {
+			if (inDemo) EndDemo(1, value);
+			return;
+		}
+		if (value == 0) {
+			if (inDemo && intDepth == 0) demoFrames++;
+			return;
+		}
+		Frame f;
+		f.cycles = cycles - frameStart;
+		f.kernel = kernelCycles;
+		f.game = idle ? busy : mainCycles;
+		f.idle = mainCycles - f.game;
+		f.overrun = !idle && started;
+		f.missed = oldValue != 0;
+		frames.push_back(f);
+		frameStart = cycles;
+		started = true;
+		idle = false;
+		mainCycles = kernelCycles = busy = 0;
+	}
+
+private:
+	void EndDemo(u8 event, u8 stage)
+	{
+		DemoTurn t;
+		t.frames = demoFrames;
+		t.score = Peek16(playerScore);
+		t.stage = stage;
+		t.subStage = Peek(subStage);
+		t.event = event;
+		demos.push_back(t);
+		inDemo = false;
+	}
+
+	u16 vsyncFlag;
+	u64 frameStart;
+	bool started;
+	bool idle;
+	u64 mainCycles;
+	u64 kernelCycles;
+	u64 busy;
+
+	bool inDemo;		//a demo turn is replaying
+	u32 demoFrames;
+	u16 recorderState, gameMode, gameStage, playerScore, subStage;
+	u16 crashEntry;
+};
+
+static void usage()
+{
+	printf("\n\tUsage: uzesim [options] game.elf\n\n"
+		"\t-f frames   frames to run, default 600\n"
+		"\t-s frames   frames left out of the statistics (boot, logo)\n"
+		"\t-i script   joypad script\n"
+		"\t-e file     EEPROM image to start with, default erased\n"
+		"\t-E file     save the EEPROM at the end\n"
+		"\t-u file     write the UART output, for tools/telemetry\n"
+		"\t-a file     write the sound as a .wav\n"
+		"\t-o file     write the frames as CSV, - for stdout\n"
+		"\t-p n        list the n functions using the most cycles\n"
+		"\t-m          check the attract demos against data/demos.h, up to\n"
+		"\t            -f frames\n"
+		"\t-x          exit with an error on a vsync overrun\n\n");
+}
+
+// the demo turns against demoEnds[], in the order of demos[]
+static bool checkDemos(const std::vector<DemoTurn> &turns)
+{
+	static const char *events[3] = {"end", "cleared", "crash"};
+	bool ok = turns.size() >= DEMO_COUNT;
+	printf("\n\tdemo  frames  score  stage  sub stage  end\n");
+	for (size_t i = 0; i < turns.size() && i < DEMO_COUNT; i++) {
+		const DemoTurn &t = turns[i];
+		const DemoEnd &e = demoEnds[i];
+		u8 event = e.event > 2 ? 2 : e.event;	//wall, water or beer
+		bool same = t.frames == e.frames && t.score == e.score && t.stage == e.stage &&
+			t.subStage == e.subStage && t.event == event;
+		printf("\t%-5u %-7u %-6u %-6u %-10u %-8s %s\n", (u32)i, t.frames, t.score, t.stage + 1,
+			t.subStage, events[t.event], same ? "ok" : "differs");
+		if (!same) {
+			printf("\t      %-7u %-6u %-6u %-10u %-8s expected\n", e.frames, e.score, e.stage + 1,
+				e.subStage, events[event]);
+			ok = false;
+		}
+	}
+	if (turns.size() < DEMO_COUNT) {
+		printf("\tonly %u of the %d demos played, more frames are needed\n",
+			(u32)turns.size(), DEMO_COUNT);
+	}
+	return ok;
+}
+
+static bool writeFile(const char *name, const std::vector<u8> &data)
+{
+	FILE *f = fopen(name, "wb");
+	if (f == NULL) return false;
+	bool ok = data.empty() || fwrite(&data[0], data.size(), 1, f) == 1;
+	return fclose(f) == 0 && ok;
+}
+
+static void put32(std::vector<u8> &v, u32 x)
+{
+	for (int i = 0; i < 4; i++) v.push_back(x >> (i * 8));
+}
+
+// 8 bit unsigned mono, one sample per hsync
+static bool writeWav(const char *name, const std::vector<u8> &samples)
+{
+	std::vector<u8> wav;
+	u32 rate = (u32)(MIX_RATE + 0.5);
+	wav.insert(wav.end(), (const u8 *)"RIFF", (const u8 *)"RIFF" + 4);
+	put32(wav, 36 + samples.size());
+	wav.insert(wav.end(), (const u8 *)"WAVEfmt ", (const u8 *)"WAVEfmt " + 8);
+	put32(wav, 16);
+	put32(wav, 1 | (1 << 16));	//PCM, mono
+	put32(wav, rate);
+	put32(wav, rate);
+	put32(wav, 1 | (8 << 16));	//block align, bits
+	wav.insert(wav.end(), (const u8 *)"data", (const u8 *)"data" + 4);
+	put32(wav, samples.size());
+	wav.insert(wav.end(), samples.begin(), samples.end());
+	return writeFile(name, wav);
+}
+
+static double percentile(std::vector<double> &v, double p)
+{
+	if (v.empty()) return 0;
+	size_t i = (size_t)(p / 100.0 * (v.size() - 1) + 0.5);
+	return v[i];
+}
+
+static bool byCycles(const std::pair<u64, std::string> &a, const std::pair<u64, std::string> &b)
+{
+	return a.first > b.first;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *elfname = NULL, *scriptname = NULL, *eepromIn = NULL, *eepromOut = NULL;
+	const char *uartname = NULL, *wavname = NULL, *csvname = NULL;
+	u32 frameCount = 600, skip = 0;
+	int top = 0;
+	bool strict = false, demoCheck = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+			frameCount = strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+			skip = strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+			scriptname = argv[++i];
+		} else if (!strcmp(argv[i], "-e") && i + 1 < argc) {
+			eepromIn = argv[++i];
+		} else if (!strcmp(argv[i], "-E") && i + 1 < argc) {
+			eepromOut = argv[++i];
+		} else if (!strcmp(argv[i], "-u") && i + 1 < argc) {
+			uartname = argv[++i];
+		} else if (!strcmp(argv[i], "-a") && i + 1 < argc) {
+			wavname = argv[++i];
+		} else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+			csvname = argv[++i];
+		} else if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+			top = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-m")) {
+			demoCheck = true;
+		} else if (!strcmp(argv[i], "-x")) {
+			strict = true;
+		} else if (argv[i][0] == '-') {
+			usage();
+			return 1;
+		} else {
+			elfname = argv[i];
+		}
+	}
+	if (elfname == NULL) {
+		usage();
+		return 0;
+	}
+
+	std::vector<UzePadEvent> script;
+	if (scriptname != NULL && !UzeReadPadScript(scriptname, script)) return 1;
+
+	Bench *avr = new Bench();
+	if (!avr->Load(elfname)) {
+		printf("Can't load %s.\n", elfname);
+		return 1;
+	}
+	if (!avr->Init()) {
+		printf("%s has no vsync_flag symbol, an .elf with symbols is needed.\n", elfname);
+		return 1;
+	}
+	if (demoCheck && !avr->InitDemos()) {
+		printf("%s has no demo globals, the check needs the game .elf.\n", elfname);
+		return 1;
+	}
+	if (eepromIn != NULL && !avr->LoadEeprom(eepromIn)) {
+		printf("Can't open %s.\n", eepromIn);
+		return 1;
+	}
+	avr->keepSound = wavname != NULL;
+	if (top > 0) avr->EnableProfile();
+	avr->Reset();
+
+	clock_t start = clock();
+	size_t next = 0;
+	while (avr->frames.size() <= frameCount && !(demoCheck && avr->demos.size() >= DEMO_COUNT)) {
+		u32 frame = avr->frames.size();
+		for (; next < script.size() && script[next].frame <= frame; next++) {
+			avr->joypad[0] = script[next].buttons[0];
+			avr->joypad[1] = script[next].buttons[1];
+		}
+		if (!avr->RunFrame()) {
+			printf("No vsync after frame %u at pc 0x%04x, the program is stuck.\n",
+				frame, avr->pc * 2);
+			return 1;
+		}
+	}
+	double host = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	if (uartname != NULL && !writeFile(uartname, avr->uartTx)) {
+		printf("Failed to create %s.\n", uartname);
+		return 1;
+	}
+	if (wavname != NULL && !writeWav(wavname, avr->sound)) {
+		printf("Failed to create %s.\n", wavname);
+		return 1;
+	}
+	if (eepromOut != NULL && !avr->SaveEeprom(eepromOut)) {
+		printf("Failed to create %s.\n", eepromOut);
+		return 1;
+	}
+
+	// frames[0] is the boot, frames[i] ends at the vsync of frame i
+	FILE *csv = NULL;
+	if (csvname != NULL) {
+		csv = strcmp(csvname, "-") ? fopen(csvname, "w") : stdout;
+		if (csv == NULL) {
+			printf("Failed to create file.\n");
+			return 1;
+		}
+		fprintf(csv, "frame,cycles,kernel,game,idle,overrun,missed\n");
+	}
+
+	std::vector<double> kernel, game, idle;
+	std::vector<u32> overruns;
+	u32 worst = 0, missed = 0;
+	for (u32 i = 1; i < avr->frames.size(); i++) {
+		const Frame &f = avr->frames[i];
+		if (csv != NULL) {
+			fprintf(csv, "%u,%u,%u,%u,%u,%d,%d\n", i, f.cycles, f.kernel, f.game, f.idle,
+				f.overrun, f.missed);
+		}
+		if (i <= skip) continue;
+		kernel.push_back(f.kernel);
+		game.push_back(f.game);
+		idle.push_back(f.idle);
+		if (f.overrun) overruns.push_back(i);
+		if (f.missed) missed++;
+		if (worst == 0 || f.game > avr->frames[worst].game) worst = i;
+	}
+	if (csv != NULL && csv != stdout) fclose(csv);
+
+	FILE *out = (csv == stdout) ? stderr : stdout;
+	double emulated = (double)avr->cycles / UZE_CPU_FREQ;
+	fprintf(out, "\n\t%u frames, %.1fs emulated in %.1fs (%.1fx real time)\n\n", (u32)avr->frames.size() - 1,
+		emulated, host, host > 0 ? emulated / host : 0.0);
+	fprintf(out, "\t%-8s %8s %8s %8s %8s\n", "cycles", "p50", "p90", "p99", "max");
+	const char *names[3] = {"game", "kernel", "idle"};
+	std::vector<double> *cols[3] = {&game, &kernel, &idle};
+	for (int c = 0; c < 3; c++) {
+		std::vector<double> &v = *cols[c];
+		std::sort(v.begin(), v.end());
+		fprintf(out, "\t%-8s %8.0f %8.0f %8.0f %8.0f\n", names[c], percentile(v, 50),
+			percentile(v, 90), percentile(v, 99), v.empty() ? 0.0 : v.back());
+	}
+
+	fprintf(out, "\n\tvsync overruns: %u", (u32)overruns.size());
+	for (size_t i = 0; i < overruns.size() && i < 10; i++) fprintf(out, "%s%u", i ? ", " : " (frames ", overruns[i]);
+	fprintf(out, "%s\n", overruns.empty() ? "" : overruns.size() > 10 ? ", ...)" : ")");
+	if (missed > 0) fprintf(out, "\tframes missed by the game: %u\n", missed);
+	if (worst > 0) {
+		const Frame &f = avr->frames[worst];
+		fprintf(out, "\tworst frame: %u, %u game cycles, %u kernel, %.1f%% of the frame\n", worst,
+			f.game, f.kernel, 100.0 * (f.game + f.kernel) / (f.cycles ? f.cycles : 1));
+	}
+	if (avr->resets > 0) fprintf(out, "\twatchdog resets: %u\n", avr->resets);
+	if (avr->badOpcodes > 0) fprintf(out, "\tinvalid opcodes run: %u\n", avr->badOpcodes);
+
+	if (top > 0) {
+		std::map<std::string, u64> byName;
+		for (size_t w = 0; w < avr->profile.size(); w++) {
+			if (avr->profile[w] == 0) continue;
+			const UzeSymbol *s = avr->SymbolAt(w);
+			byName[s ? s->name : "?"] += avr->profile[w];
+		}
+		std::vector<std::pair<u64, std::string> > list;
+		for (std::map<std::string, u64>::iterator it = byName.begin(); it != byName.end(); ++it) {
+			list.push_back(std::make_pair(it->second, it->first));
+		}
+		std::sort(list.begin(), list.end(), byCycles);
+		fprintf(out, "\n\t%-32s %12s %10s %6s\n", "function", "cycles", "per frame", "%");
+		for (int i = 0; i < top && i < (int)list.size(); i++) {
+			fprintf(out, "\t%-32s %12llu %10.0f %6.2f\n", list[i].second.c_str(),
+				(unsigned long long)list[i].first, (double)list[i].first / avr->frames.size(),
+				100.0 * list[i].first / avr->cycles);
+		}
+	}
+	fprintf(out, "\n");
+
+	if (demoCheck && !checkDemos(avr->demos)) return 1;
+	return (strict && !overruns.empty()) ? 1 : 0;
+}
@@ -0,0 +1,703 @@
+/*
+ *  Uzebox sound engine host reference
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "uzesound.h"
+
+#define CONTROLER_VOL 7
+#define CONTROLER_EXPRESSION 11
+#define CONTROLER_TREMOLO 92
+#define CONTROLER_TREMOLO_RATE 100
+
+#define DEFAULT_PATCH		0
+#define DEFAULT_TRACK_VOL	0xff
+#define DEFAULT_EXPRESSION_VOL 0xff
+
+//
+// Reads the numbers following .byte/.word directives of an assembler
+// include file (kernel/data/*.inc). Returns the count of values read.
+//
+static int ReadAsmTable(const char *path, const char *directive, u16 *dest, int max)
+{
+	FILE *f = fopen(path, "r");
+	if (f == NULL) return -1;
+
+	char line[1024];
+	int count = 0;
+	size_t dlen = strlen(directive);
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		char *p = line;
+		while (isspace((unsigned char)*p)) p++;
+		if (strncmp(p, directive, dlen) != 0) continue;
+		p += dlen;
+
+		// strip trailing comments
+		char *c = strchr(p, ';');
+		if (c) *c = 0;
+		c = strstr(p, "//");
+		if (c) *c = 0;
+
+		while (*p) {
+			while (*p && (isspace((unsigned char)*p) || *p == ',')) p++;
+			if (!*p) break;
+			char *end;
+			long v = strtol(p, &end, 0);
+			if (end == p) break;
+			if (count < max) dest[count] = (u16)v;
+			count++;
+			p = end;
+		}
+	}
+
+	fclose(f);
+	return count;
+}
+
+UzeSound::UzeSound()
+{
+	memset(waves, 0, sizeof(waves));
+	memset(steptable, 0, sizeof(steptable));
+	config.channel2 = true;
+	config.channel3 = true;
+	config.channel4 = false;
+	Initialize(config);
+}
+
+bool UzeSound::LoadTables(const char *kernelDir)
+{
+	char path[1024];
+	static u16 tmp[256 * 256];
+
+	snprintf(path, sizeof(path), "%s/data/sounds.inc", kernelDir);
+	int n = ReadAsmTable(path, ".byte", tmp, 256 * 256);
+	if (n <= 0) {
+		fprintf(stderr, "Failed to read %s\n", path);
+		return false;
+	}
+	// waves past the end of the table read whatever follows in flash,
+	// the host has no way to know, so they are left silent.
+	for (int i = 0; i < n && i < 256 * 256; i++) waves[i] = (u8)tmp[i];
+
+	snprintf(path, sizeof(path), "%s/data/steptable.inc", kernelDir);
+	n = ReadAsmTable(path, ".word", steptable, 256);
+	if (n <= 0) {
+		fprintf(stderr, "Failed to read %s\n", path);
+		return false;
+	}
+	return true;
+}
+
+// uzeboxCore.c: Initialize()
+void UzeSound::Initialize(const UzeSoundConfig &cfg)
+{
+	config = cfg;
+	memset(tracks, 0, sizeof(tracks));
+	memset(mixer, 0, sizeof(mixer));
+
+	// initialize LFSR, 15 bits no divider
+	mixer[3].barrel = 0x0101;
+	mixer[3].params = 1;
+
+	patchPointers = NULL;
+	fxInfoPointers = NULL;
+	songEnd = NULL;
+	playSong = false;
+	absoluteTime = 0;
+	nextDeltaTime = 0;
+	currDeltaTime = 0;
+	lastStatus = 0;
+	songPos = songStart = loopStart = NULL;
+	masterVolume = DEFAULT_MASTER_VOL;
+}
+
+void UzeSound::InitMusicPlayer(const struct PatchStruct *patches)
+{
+	patchPointers = patches;
+	fxInfoPointers = NULL;
+	masterVolume = DEFAULT_MASTER_VOL;
+	playSong = false;
+
+	for (u8 t = 0; t < CHANNELS; t++) {
+		tracks[t].allocated = true;
+		tracks[t].noteVol = 0;
+		tracks[t].expressionVol = DEFAULT_EXPRESSION_VOL;
+		tracks[t].trackVol = DEFAULT_TRACK_VOL;
+		tracks[t].patchNo = DEFAULT_PATCH;
+		tracks[t].priority = 0;
+		tracks[t].tremoloRate = 24;
+	}
+}
+
+void UzeSound::StartSong(const char *song, size_t size)
+{
+	songEnd = size ? song + size : NULL;
+	for (u8 t = 0; t < CHANNELS; t++) tracks[t].priority = 0;
+
+	songPos = song + 1;		//skip first delta-time
+	songStart = song + 1;
+	loopStart = song + 1;
+	nextDeltaTime = 0;
+	currDeltaTime = 0;
+	lastStatus = 0;
+	playSong = true;
+	absoluteTime = 0;
+}
+
+void UzeSound::StopSong()
+{
+	for (u8 i = 0; i < CHANNELS; i++) {
+		if (tracks[i].envelopeStep >= 0) tracks[i].envelopeStep = -6;
+	}
+	playSong = false;
+}
+
+void UzeSound::ResumeSong()
+{
+	playSong = true;
+}
+
+void UzeSound::SetMasterVolume(u8 vol)
+{
+	masterVolume = vol;
+}
+
+//
+// SetMixerNote (assembler). The noise channel ignores notes.
+//
+void UzeSound::SetMixerNote(u8 channel, u8 note)
+{
+	if (channel >= WAVE_CHANNELS) return;
+	mixer[channel].step = steptable[note];
+}
+
+//
+// SetMixerWave (assembler). The 0xfe/0xff tests are done for every
+// channel and 0xff really does 'ori 0xfe' on the noise params, both
+// are reproduced as is.
+//
+void UzeSound::SetMixerWave(u8 channel, u8 patch)
+{
+	if (patch == 0xfe) {
+		mixer[3].params &= 0xfe;
+		return;
+	}
+	if (patch == 0xff) {
+		mixer[3].params |= 0xfe;
+		return;
+	}
+	if (channel < WAVE_CHANNELS) mixer[channel].posHi = patch;
+}
+
+void UzeSound::PatchCommand(u8 track, u8 cmd, s8 param)
+{
+	UzeTrack *t = &tracks[track];
+
+	switch (cmd) {
+		case PC_ENV_SPEED:
+			t->envelopeStep = param;
+			break;
+		case PC_NOISE_PARAMS:
+			mixer[3].params = (u8)param;
+			break;
+		case PC_WAVE:
+			SetMixerWave(track, (u8)param);
+			break;
+		case PC_NOTE_UP:
+			t->note += param;
+			SetMixerNote(track, t->note);
+			break;
+		case PC_NOTE_DOWN:
+			t->note -= param;
+			SetMixerNote(track, t->note);
+			break;
+		case PC_NOTE_CUT:
+			t->patchPlaying = false;
+			t->priority = 0;
+			break;
+		case PC_NOTE_HOLD:
+			t->patchEnvelopeHold = true;
+			break;
+		case PC_ENV_VOL:
+			t->envelopeVol = (u8)param;
+			break;
+		case PC_PITCH:
+			SetMixerNote(track, (u8)param);
+			t->note = (u8)param;
+			break;
+		case PC_TREMOLO_LEVEL:
+			t->tremoloLevel = (u8)param;
+			break;
+		case PC_TREMOLO_RATE:
+			t->tremoloRate = (u8)param;
+			break;
+		default:
+			// the kernel would jump through a random pointer here
+			fprintf(stderr, "Invalid patch command %d on track %d\n", cmd, track);
+			break;
+	}
+}
+
+u16 UzeSound::ReadVarLen(const char **pos)
+{
+	u16 value;
+	u8 c;
+
+	if ((value = pgm_read_byte((*pos)++)) & 0x80) {
+		value &= 0x7f;
+		do {
+			value = (value << 7) + ((c = pgm_read_byte((*pos)++)) & 0x7f);
+		} while (c & 0x80);
+	}
+	return value;
+}
+
+void UzeSound::ProcessController(u8 channel, u8 controller, u8 value)
+{
+	if (controller == CONTROLER_VOL) {
+		tracks[channel].trackVol = value << 1;
+	} else if (controller == CONTROLER_EXPRESSION) {
+		tracks[channel].expressionVol = value << 1;
+	} else if (controller == CONTROLER_TREMOLO) {
+		tracks[channel].tremoloLevel = value << 1;
+	} else if (controller == CONTROLER_TREMOLO_RATE) {
+		tracks[channel].tremoloRate = value << 1;
+	}
+}
+
+void UzeSound::ProcessMusic()
+{
+	u8 c1, c2, channel, tmp;
+	s16 vol;
+	u16 uVol, tVol;
+
+	//process patches envelopes
+	for (u8 track = 0; track < CHANNELS; track++) {
+		vol = tracks[track].envelopeVol + tracks[track].envelopeStep;
+		if (vol < 0) {
+			vol = 0;
+		} else if (vol > 0xff) {
+			vol = 0xff;
+		}
+		tracks[track].envelopeVol = (u8)vol;
+	}
+
+	//Process song MIDI notes
+	if (playSong) {
+		while (currDeltaTime == nextDeltaTime) {
+			if (songEnd != NULL && songPos >= songEnd) {
+				//song without end marker, the AVR would play whatever follows in flash
+				playSong = false;
+				break;
+			}
+			c1 = pgm_read_byte(songPos++);
+
+			if (c1 == 0xff) {
+				//META data type event
+				c1 = pgm_read_byte(songPos++);
+				if (c1 == 0x2f) {	//end of song
+					playSong = false;
+					break;
+				} else if (c1 == 0x6) {	//marker
+					c1 = pgm_read_byte(songPos++);	//read len
+					c2 = pgm_read_byte(songPos++);	//read data
+					if (c2 == 'S') {
+						loopStart = songPos;
+					} else if (c2 == 'E') {
+						songPos = loopStart;
+					}
+				}
+			} else {
+				if (c1 & 0x80) lastStatus = c1;
+				channel = c1 & 0x0f;
+
+				switch (c1 & 0xf0) {
+					case 0x90:
+						c1 = pgm_read_byte(songPos++);
+						c2 = pgm_read_byte(songPos++) << 1;
+						if (tracks[channel].allocated) {
+							TriggerNote(channel, tracks[channel].patchNo, c1, c2);
+						}
+						break;
+
+					case 0xb0:
+						c1 = pgm_read_byte(songPos++);
+						c2 = pgm_read_byte(songPos++);
+						ProcessController(channel, c1, c2);
+						break;
+
+					case 0xc0:
+						c1 = pgm_read_byte(songPos++);
+						tracks[channel].patchNo = c1;
+						break;
+
+					//running status
+					default:
+						channel = lastStatus & 0x0f;
+
+						switch (lastStatus & 0xf0) {
+							case 0x90:
+								c2 = pgm_read_byte(songPos++) << 1;
+								if (tracks[channel].allocated) {
+									TriggerNote(channel, tracks[channel].patchNo, c1, c2);
+								}
+								break;
+
+							case 0xb0:
+								c2 = pgm_read_byte(songPos++);
+								ProcessController(channel, c1, c2);
+								break;
+
+							case 0xc0:
+								tracks[channel].patchNo = c1;
+								break;
+						}
+				}
+			}
+
+			if (songEnd != NULL && songPos >= songEnd) {
+				playSong = false;
+				break;
+			}
+			nextDeltaTime = (s16)ReadVarLen(&songPos);
+			currDeltaTime = 0;
+		}
+
+		currDeltaTime++;
+		absoluteTime++;
+	}
+
+	//
+	// Process patches command streams & final volume
+	//
+	for (u8 track = 0; track < CHANNELS; track++) {
+		UzeTrack *t = &tracks[track];
+
+		if (t->patchEnvelopeHold == false) {
+			if (t->patchCommandStreamPos != NULL &&
+				t->patchCurrDeltaTime >= t->patchNextDeltaTime) {
+
+				while (t->patchCurrDeltaTime == t->patchNextDeltaTime) {
+					c1 = pgm_read_byte(t->patchCommandStreamPos++);
+					if (c1 == 0xff) {
+						//end of stream!
+						t->priority = 0;
+						t->patchCommandStreamPos = NULL;
+						break;
+					} else {
+						c2 = pgm_read_byte(t->patchCommandStreamPos++);
+						PatchCommand(track, c1, (s8)c2);
+					}
+
+					t->patchNextDeltaTime = pgm_read_byte(t->patchCommandStreamPos++);
+					t->patchCurrDeltaTime = 0;
+				}
+			}
+			t->patchCurrDeltaTime++;
+		}
+
+		//pitch slide
+		if (t->slideRate != 0) {
+			u16 pitch = t->slidePitch;
+			u16 target = t->slideTarget << 8;
+			u16 delta = t->slideRate << 4;
+
+			if (pitch < target) {
+				pitch = (target - pitch > delta) ? pitch + delta : target;
+			} else {
+				pitch = (pitch - target > delta) ? pitch - delta : target;
+			}
+			if (pitch == target) t->slideRate = 0;
+			t->slidePitch = pitch;
+			t->note = pitch >> 8;
+
+			u16 step = steptable[pitch >> 8];
+			if (pitch & 0xff) {
+				step += ((u32)(u16)(steptable[(pitch >> 8) + 1] - step) * (pitch & 0xff)) >> 8;
+			}
+			mixer[track].step = step;
+		}
+
+		if (t->patchPlaying) {
+			if (t->patchPlayingTime < 0xff) t->patchPlayingTime++;
+
+			if (t->noteVol != 0 && t->envelopeVol != 0 && t->trackVol != 0 && masterVolume != 0) {
+				uVol = (u16)(t->noteVol * t->trackVol) + 0x100;
+				uVol >>= 8;
+				uVol = (u16)(uVol * t->envelopeVol) + 0x100;
+				uVol >>= 8;
+				uVol = (u16)(uVol * t->expressionVol) + 0x100;
+				uVol >>= 8;
+				uVol = (u16)(uVol * masterVolume) + 0x100;
+				uVol >>= 8;
+
+				if (t->tremoloLevel > 0) {
+					tmp = waves[t->tremoloPos];
+					tmp -= 128;
+
+					tVol = (u16)(t->tremoloLevel * tmp) + 0x100;
+					tVol >>= 8;
+
+					uVol = (u16)(uVol * (0xff - tVol)) + 0x100;
+					uVol >>= 8;
+				}
+			} else {
+				uVol = 0;
+			}
+
+			t->tremoloPos += t->tremoloRate;
+		} else {
+			uVol = 0;
+		}
+
+		mixer[track].volume = (u8)(uVol & 0xff);
+	}
+}
+
+void UzeSound::SetFxInfoTable(const struct FxInfoStruct *fxInfo)
+{
+	fxInfoPointers = fxInfo;
+}
+
+void UzeSound::TriggerFx(u8 patch, u8 volume, bool retrig)
+{
+	u8 channel, priority, voices, channelsMask, playing = 0;
+	u8 freeChannel = 0xff, oldestChannel = 0xff, oldestSame = 0xff, sameChannel = 0xff;
+	const char *pos = patchPointers[patch].cmdStream;
+
+	if (fxInfoPointers != NULL) {
+		priority = fxInfoPointers[patch].priority;
+		voices = fxInfoPointers[patch].voices;
+		channelsMask = fxInfoPointers[patch].channels;
+		if (priority == 0) priority = 1;
+	} else {
+		u8 type = patchPointers[patch].type;
+		priority = 1;
+		voices = 0;
+		channelsMask = (type == 1 || type == 2) ? FX_CHANNEL(3) : (FX_CHANNEL(1) | FX_CHANNEL(2));
+	}
+
+	for (u8 c = 0; c < CHANNELS; c++) {
+		if (!(channelsMask & FX_CHANNEL(c))) continue;
+		UzeTrack *track = &tracks[c];
+
+		if (track->priority == 0) {
+			if (freeChannel == 0xff) freeChannel = c;
+		} else {
+			if (track->fxPatchNo == patch) {
+				playing++;
+				if (sameChannel == 0xff) sameChannel = c;
+				if (oldestSame == 0xff || track->patchPlayingTime >= tracks[oldestSame].patchPlayingTime) oldestSame = c;
+			}
+			if (track->priority <= priority && (oldestChannel == 0xff || track->patchPlayingTime >= tracks[oldestChannel].patchPlayingTime)) {
+				oldestChannel = c;
+			}
+		}
+	}
+
+	if (retrig && sameChannel != 0xff) {
+		//cheap retrigger: restart the command stream and envelope only
+		UzeTrack *track = &tracks[sameChannel];
+		track->patchNextDeltaTime = pgm_read_byte(pos++);
+		track->patchCommandStreamPos = pos;
+		track->patchCurrDeltaTime = 0;
+		track->envelopeStep = 0;
+		track->envelopeVol = 0xff;
+		track->noteVol = volume;
+		track->patchEnvelopeHold = false;
+		track->patchPlayingTime = 0;
+		track->patchPlaying = true;
+		track->tremoloLevel = 0;
+		track->expressionVol = DEFAULT_EXPRESSION_VOL;
+		track->slideRate = 0;
+		track->priority = priority;
+		return;
+	}
+
+	if (voices != 0 && playing >= voices) {
+		channel = oldestSame;
+	} else if (freeChannel != 0xff) {
+		channel = freeChannel;
+	} else if (oldestChannel != 0xff) {
+		channel = oldestChannel;
+	} else {
+		return;
+	}
+
+	tracks[channel].patchNextDeltaTime = pgm_read_byte(pos++);
+	tracks[channel].patchCommandStreamPos = pos;
+	tracks[channel].fxPatchNo = patch;
+	tracks[channel].priority = priority;
+	SetTriggerCommonValues(&tracks[channel], volume, 80);
+
+	if (channel == 3) {
+		mixer[3].barrel = 0x0101;
+		mixer[3].params = 1;
+	} else {
+		SetMixerNote(channel, tracks[channel].note);
+		SetMixerWave(channel, tracks[channel].patchWave);
+	}
+}
+
+void UzeSound::TriggerNote(u8 channel, u8 patch, u8 note, u8 volume)
+{
+	if (!tracks[channel].patchPlaying || tracks[channel].priority == 0) {
+
+		if (volume == 0) {	//note-off received
+			tracks[channel].patchEnvelopeHold = false;
+			if (tracks[channel].envelopeStep == 0) {
+				tracks[channel].noteVol = 0;
+			}
+		} else {
+			if (channel == 3) {
+				patch = note;
+				mixer[3].barrel = 0x0101;
+				mixer[3].params = 1;
+			} else {
+				SetMixerWave(channel, 0);
+				SetMixerNote(channel, note);
+			}
+
+			const char *pos = patchPointers[patch].cmdStream;
+			if (pos == NULL) {
+				tracks[channel].patchCommandStreamPos = NULL;
+			} else {
+				tracks[channel].patchNextDeltaTime = pgm_read_byte(pos++);
+				tracks[channel].patchCommandStreamPos = pos;
+			}
+
+			tracks[channel].patchNo = patch;
+			tracks[channel].priority = 0;
+			SetTriggerCommonValues(&tracks[channel], volume, note);
+		}
+	}
+}
+
+void UzeSound::SetTriggerCommonValues(UzeTrack *track, u8 volume, u8 note)
+{
+	track->patchCurrDeltaTime = 0;
+	track->envelopeStep = 0;
+	track->envelopeVol = 0xff;
+	track->noteVol = volume;
+	track->patchEnvelopeHold = false;
+	track->patchPlayingTime = 0;
+	track->patchPlaying = true;
+	track->patchWave = 0;
+	track->tremoloLevel = 0;
+	track->expressionVol = DEFAULT_EXPRESSION_VOL;
+	track->note = note;
+	track->slideRate = 0;
+}
+
+void UzeSound::SetVoicePitchTarget(u8 channel, u8 note, u8 slideRate)
+{
+	if (channel >= WAVE_CHANNELS) return;
+	u8 current = tracks[channel].note;
+
+	if (note > MAX_SLIDE_NOTE) note = MAX_SLIDE_NOTE;
+	if (current > MAX_SLIDE_NOTE) current = MAX_SLIDE_NOTE;
+
+	if (tracks[channel].slideRate == 0) tracks[channel].slidePitch = current << 8;
+	tracks[channel].slideTarget = note;
+	if (slideRate == 0) {
+		tracks[channel].slidePitch = note << 8;
+		slideRate = 1;
+	}
+	tracks[channel].slideRate = slideRate;
+}
+
+void UzeSound::SetVoiceVolume(u8 channel, u8 volume)
+{
+	if (channel >= CHANNELS) return;
+	tracks[channel].noteVol = volume;
+}
+
+//
+// MixSound (assembler) minus the ProcessMusic() call.
+//
+// Wave channels: the 8:8 step is added to frac:lo of the sample position,
+// the high byte selects the wave. Each sample is multiplied signed by
+// unsigned volume (mulsu) and only the high byte of the product is kept.
+//
+static inline s16 MulsuHi(s8 sample, u8 vol)
+{
+	s16 product = (s16)sample * (s16)vol;
+	return (s16)(s8)(u8)((u16)product >> 8);
+}
+
+void UzeSound::MixSound(u8 *out)
+{
+	UzeMixerChannel *ch1 = &mixer[0], *ch2 = &mixer[1], *ch3 = &mixer[2], *ch4 = &mixer[3];
+
+	for (int i = 0; i < MIX_BANK_SIZE; i++) {
+		s16 mix;
+		u16 acc;
+
+		//channel 1
+		acc = ch1->posFrac + (ch1->step & 0xff);
+		ch1->posFrac = (u8)acc;
+		ch1->posLo = (u8)(ch1->posLo + (ch1->step >> 8) + (acc >> 8));
+		mix = MulsuHi((s8)waves[(ch1->posHi << 8) | ch1->posLo], ch1->volume);
+
+		if (config.channel2) {
+			acc = ch2->posFrac + (ch2->step & 0xff);
+			ch2->posFrac = (u8)acc;
+			ch2->posLo = (u8)(ch2->posLo + (ch2->step >> 8) + (acc >> 8));
+			mix += MulsuHi((s8)waves[(ch2->posHi << 8) | ch2->posLo], ch2->volume);
+		}
+
+		if (config.channel3) {
+			acc = ch3->posFrac + (ch3->step & 0xff);
+			ch3->posFrac = (u8)acc;
+			ch3->posLo = (u8)(ch3->posLo + (ch3->step >> 8) + (acc >> 8));
+			mix += MulsuHi((s8)waves[(ch3->posHi << 8) | ch3->posLo], ch3->volume);
+		}
+
+		if (config.channel4) {
+			//7/15 bit LFSR
+			ch4->divider--;
+			if (ch4->divider & 0x80) {
+				ch4->divider = ch4->params >> 1;
+
+				u8 lo = (u8)ch4->barrel;
+				u8 bit = (lo ^ (lo >> 1)) & 1;
+				ch4->barrel >>= 1;
+				ch4->barrel = (ch4->barrel & ~(1 << 14)) | (bit << 14);
+				if (!(ch4->params & 1)) {
+					ch4->barrel = (ch4->barrel & ~(1 << 6)) | (bit << 6);
+				}
+			}
+			s8 sample = (ch4->barrel & 1) ? 0x7f : -128;
+			mix += MulsuHi(sample, ch4->volume);
+		}
+
+		//clip
+		if (mix > 127) mix = 127;
+		if (mix < -128) mix = -128;
+
+		*out++ = (u8)(mix + 128);
+	}
+}
+
+void UzeSound::Frame(u8 *out)
+{
+	ProcessMusic();
+	MixSound(out);
+}
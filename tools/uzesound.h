@@ -0,0 +1,151 @@
+/*
+ *  Uzebox sound engine host reference
+ *
+ *  Bit-exact C++ model of the kernel music player (uzeboxSoundEngine.c)
+ *  and of the assembler mixer (uzeboxSoundEngineCore.s). One call to
+ *  Frame() does what the kernel does in one vsync: run ProcessMusic()
+ *  and mix MIX_BANK_SIZE samples, exactly as they would be written to
+ *  OCR2A.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __UZESOUND_H_
+#define __UZESOUND_H_
+
+#include "uzehost.h"
+
+// kernel constants, must match kernel/defines.h
+#define CHANNELS 4
+#define WAVE_CHANNELS 3
+#define MIX_BANK_SIZE 262
+#define MIX_RATE 15734.263736
+#define DEFAULT_MASTER_VOL 0x6f
+#define MAX_SLIDE_NOTE 126
+
+// build options, defaults match default/Makefile
+struct UzeSoundConfig
+{
+	bool channel2;		//SOUND_CHANNEL_2_ENABLE
+	bool channel3;		//SOUND_CHANNEL_3_ENABLE
+	bool channel4;		//SOUND_CHANNEL_4_ENABLE (LFSR noise, MIXER_CHAN4_TYPE=0)
+};
+
+// mirror of struct TrackStruct in kernel/kernel.h
+struct UzeTrack
+{
+	bool allocated;
+	u8 priority;
+	u8 note;
+
+	u8 tremoloPos;
+	u8 tremoloLevel;
+	u8 tremoloRate;
+
+	u8 expressionVol;
+	u8 trackVol;
+	u8 noteVol;
+	u8 envelopeVol;
+	s8 envelopeStep;
+	bool patchPlaying;
+	u8 patchNo;
+	u8 fxPatchNo;
+	u8 patchLastStatus;
+	u8 patchNextDeltaTime;
+	u8 patchCurrDeltaTime;
+	u8 patchPlayingTime;
+	u8 patchWave;
+	bool patchEnvelopeHold;
+	const char *patchCommandStreamPos;
+
+	u16 slidePitch;
+	u8 slideTarget;
+	u8 slideRate;
+};
+
+// mirror of the tr1..tr4 mixer variables in uzeboxSoundEngineCore.s
+struct UzeMixerChannel
+{
+	u8 volume;
+	u16 step;		//8:8 fixed point
+	u8 posFrac;
+	u8 posLo;
+	u8 posHi;		//wave number (hi8(waves) is 0 on the host)
+
+	//noise channel only
+	u8 params;
+	u16 barrel;
+	u8 divider;
+};
+
+class UzeSound
+{
+public:
+	UzeSound();
+
+	// tables are read from the kernel sources so there is only one copy
+	bool LoadTables(const char *kernelDir);
+
+	void Initialize(const UzeSoundConfig &config);
+
+	// kernel API
+	void InitMusicPlayer(const struct PatchStruct *patches);
+	void StartSong(const char *song, size_t size = 0);	//size=0: song ends with its end marker
+	void StopSong();
+	void ResumeSong();
+	void SetMasterVolume(u8 vol);
+	void SetFxInfoTable(const struct FxInfoStruct *fxInfo);
+	void TriggerFx(u8 patch, u8 volume, bool retrig);
+	void TriggerNote(u8 channel, u8 patch, u8 note, u8 volume);
+	void SetVoicePitchTarget(u8 channel, u8 note, u8 slideRate);
+	void SetVoiceVolume(u8 channel, u8 volume);
+	bool IsSongPlaying() const { return playSong; }
+
+	// runs one vsync worth of sound: ProcessMusic() then the mixer.
+	// out receives MIX_BANK_SIZE unsigned 8 bit samples.
+	void Frame(u8 *out);
+
+	void ProcessMusic();
+	void MixSound(u8 *out);
+
+	UzeTrack tracks[CHANNELS];
+	UzeMixerChannel mixer[CHANNELS];
+
+private:
+	void PatchCommand(u8 track, u8 cmd, s8 param);
+	void SetTriggerCommonValues(UzeTrack *track, u8 volume, u8 note);
+	void SetMixerNote(u8 channel, u8 note);
+	void SetMixerWave(u8 channel, u8 patch);
+	u16 ReadVarLen(const char **pos);
+	void ProcessController(u8 channel, u8 controller, u8 value);
+
+	UzeSoundConfig config;
+	u8 waves[256 * 256];	//indexed by the full 16 bit sample position
+	u16 steptable[256];
+
+	const struct PatchStruct *patchPointers;
+	const struct FxInfoStruct *fxInfoPointers;
+	bool playSong;
+	u16 absoluteTime;
+	s16 nextDeltaTime;
+	s16 currDeltaTime;
+	u8 lastStatus;
+	const char *songPos;
+	const char *songStart;
+	const char *songEnd;
+	const char *loopStart;
+	u8 masterVolume;
+};
+
+#endif
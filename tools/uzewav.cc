@@ -0,0 +1,266 @@
+/*
+ *  uzewav - renders the game's music and sound effects to a WAV file
+ *  using the host reference of the Uzebox sound engine (uzesound.cc).
+ *
+ *  The output is the exact byte stream the kernel writes to OCR2A, so
+ *  two renders can be compared with cmp, and a raw dump (-r) can be
+ *  compared against an emulator capture.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "uzesound.h"
+#include "gamesound.h"
+
+#define MAX_FRAMES (60 * 60 * 10)
+
+struct Event
+{
+	int frame;
+	int type;		//0=fx, 1=note, 2=pitch slide
+	int channel;
+	int patch;
+	int note;
+	int volume;
+};
+
+static void usage()
+{
+	printf("\n\tUsage: uzewav [options] out.wav\n\n"
+		"\t-s                    play the song (midisong from data/east.h)\n"
+		"\t-f patch[:vol][@frame] trigger a sound effect (TriggerFx)\n"
+		"\t-t chan,patch,note,vol[@frame] trigger a note (TriggerNote)\n"
+		"\t-g chan,note,rate[@frame] glide a voice (SetVoicePitchTarget)\n"
+		"\t-l frames             length in frames, default: end of song or 300\n"
+		"\t-d                    ignore fxInfo, use the default fx allocation\n"
+		"\t-4                    enable mixing of the noise channel\n"
+		"\t-k dir                kernel directory, default ../kernel\n"
+		"\t-r                    write raw 8 bit unsigned samples instead of WAV\n"
+		"\t-c                    print a CRC32 of the rendered samples\n"
+		"\t-b count              render count times and report the speed\n\n"
+		"\tEx:  uzewav -s -l 1800 east.wav\n"
+		"\t     uzewav -f 6 -f 6@10 -f 7@20 fx.wav\n"
+		"\t     uzewav -t 0,3,22,128 -g 0,30,8@60 -l 180 engine.wav\n\n");
+}
+
+static u32 crc32(const u8 *data, size_t len)
+{
+	u32 crc = 0xffffffff;
+	for (size_t i = 0; i < len; i++) {
+		crc ^= data[i];
+		for (int b = 0; b < 8; b++) {
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+		}
+	}
+	return ~crc;
+}
+
+static void put32(FILE *f, u32 v)
+{
+	fputc(v & 0xff, f);
+	fputc((v >> 8) & 0xff, f);
+	fputc((v >> 16) & 0xff, f);
+	fputc((v >> 24) & 0xff, f);
+}
+
+static void put16(FILE *f, u16 v)
+{
+	fputc(v & 0xff, f);
+	fputc((v >> 8) & 0xff, f);
+}
+
+static bool writeWav(const char *name, const std::vector<u8> &samples, bool raw)
+{
+	FILE *f = fopen(name, "wb");
+	if (f == NULL) return false;
+
+	if (!raw) {
+		u32 rate = (u32)(MIX_RATE + 0.5);
+		fwrite("RIFF", 1, 4, f);
+		put32(f, 36 + samples.size());
+		fwrite("WAVEfmt ", 1, 8, f);
+		put32(f, 16);
+		put16(f, 1);		//PCM
+		put16(f, 1);		//mono
+		put32(f, rate);
+		put32(f, rate);		//bytes per second
+		put16(f, 1);		//block align
+		put16(f, 8);		//bits per sample
+		fwrite("data", 1, 4, f);
+		put32(f, samples.size());
+	}
+	fwrite(&samples[0], 1, samples.size(), f);
+	fclose(f);
+	return true;
+}
+
+static bool parseEvent(int type, const char *arg, Event &ev)
+{
+	memset(&ev, 0, sizeof(ev));
+	ev.type = type;
+	ev.volume = 0xff;
+
+	const char *at = strchr(arg, '@');
+	if (at) ev.frame = atoi(at + 1);
+
+	if (type == 0) {
+		ev.patch = atoi(arg);
+		const char *colon = strchr(arg, ':');
+		if (colon && (!at || colon < at)) ev.volume = atoi(colon + 1);
+	} else if (type == 1) {
+		if (sscanf(arg, "%d,%d,%d,%d", &ev.channel, &ev.patch, &ev.note, &ev.volume) != 4) return false;
+		if (ev.channel < 0 || ev.channel >= CHANNELS) return false;
+	} else {
+		//volume holds the slide rate
+		if (sscanf(arg, "%d,%d,%d", &ev.channel, &ev.note, &ev.volume) != 3) return false;
+		if (ev.channel < 0 || ev.channel >= CHANNELS) return false;
+	}
+	return ev.patch >= 0 && ev.patch < patchesCount;
+}
+
+static void render(UzeSound &snd, const UzeSoundConfig &config, bool song, bool fxTable,
+	int frames, std::vector<Event> &events, std::vector<u8> &out)
+{
+	u8 buf[MIX_BANK_SIZE];
+
+	snd.Initialize(config);
+	snd.InitMusicPlayer(patches);
+	if (fxTable) snd.SetFxInfoTable(fxInfo);
+	if (song) snd.StartSong(midisong, midisongSize);
+
+	out.clear();
+	for (int frame = 0; frame < frames; frame++) {
+		for (size_t i = 0; i < events.size(); i++) {
+			Event &ev = events[i];
+			if (ev.frame != frame) continue;
+			if (ev.type == 0) snd.TriggerFx(ev.patch, ev.volume, true);
+			else if (ev.type == 1) snd.TriggerNote(ev.channel, ev.patch, ev.note, ev.volume);
+			else snd.SetVoicePitchTarget(ev.channel, ev.note, ev.volume);
+		}
+		snd.Frame(buf);
+		out.insert(out.end(), buf, buf + MIX_BANK_SIZE);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	const char *kernelDir = "../kernel";
+	const char *outname = NULL;
+	bool song = false, raw = false, crc = false, fxTable = true;
+	int frames = -1, bench = 0;
+	std::vector<Event> events;
+	UzeSoundConfig config;
+
+	config.channel2 = true;
+	config.channel3 = true;
+	config.channel4 = false;
+
+	if (argc < 2) {
+		usage();
+		return 0;
+	}
+
+	for (int i = 1; i < argc; i++) {
+		Event ev;
+		if (!strcmp(argv[i], "-s")) {
+			song = true;
+		} else if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+			if (!parseEvent(0, argv[++i], ev)) {
+				printf("Bad fx: %s\n", argv[i]);
+				return 1;
+			}
+			events.push_back(ev);
+		} else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+			if (!parseEvent(1, argv[++i], ev)) {
+				printf("Bad note: %s\n", argv[i]);
+				return 1;
+			}
+			events.push_back(ev);
+		} else if (!strcmp(argv[i], "-g") && i + 1 < argc) {
+			if (!parseEvent(2, argv[++i], ev)) {
+				printf("Bad slide: %s\n", argv[i]);
+				return 1;
+			}
+			events.push_back(ev);
+		} else if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+			frames = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-k") && i + 1 < argc) {
+			kernelDir = argv[++i];
+		} else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+			bench = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-d")) {
+			fxTable = false;
+		} else if (!strcmp(argv[i], "-4")) {
+			config.channel4 = true;
+		} else if (!strcmp(argv[i], "-r")) {
+			raw = true;
+		} else if (!strcmp(argv[i], "-c")) {
+			crc = true;
+		} else if (argv[i][0] == '-') {
+			usage();
+			return 1;
+		} else {
+			outname = argv[i];
+		}
+	}
+
+	static UzeSound snd;
+	if (!snd.LoadTables(kernelDir)) return 1;
+
+	if (frames < 0) {
+		// find the end of the song, songs that loop are cut at MAX_FRAMES
+		frames = 300;
+		if (song) {
+			snd.Initialize(config);
+			snd.InitMusicPlayer(patches);
+			snd.StartSong(midisong, midisongSize);
+			for (frames = 0; frames < MAX_FRAMES && snd.IsSongPlaying(); frames++) {
+				snd.ProcessMusic();
+			}
+			frames += 60;	//let the last notes decay
+		}
+	}
+	if (frames > MAX_FRAMES) frames = MAX_FRAMES;
+
+	std::vector<u8> out;
+	render(snd, config, song, fxTable, frames, events, out);
+
+	if (bench > 0) {
+		clock_t start = clock();
+		for (int i = 0; i < bench; i++) {
+			std::vector<u8> tmp;
+			render(snd, config, song, fxTable, frames, events, tmp);
+		}
+		double secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+		double played = (double)frames * bench * MIX_BANK_SIZE / MIX_RATE;
+		printf("\tRendered %d frames x %d in %.3fs, %.0fx real time\n",
+			frames, bench, secs, secs > 0 ? played / secs : 0.0);
+	}
+
+	if (crc) printf("%08x\n", crc32(&out[0], out.size()));
+
+	if (outname != NULL) {
+		if (!writeWav(outname, out, raw)) {
+			printf("Failed to create file.\n");
+			return 1;
+		}
+		printf("\n\tDone. %d frames, %d samples\n", frames, (int)out.size());
+	}
+	return 0;
+}